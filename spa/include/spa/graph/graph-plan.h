@@ -0,0 +1,508 @@
+/* Simple Plugin API
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __SPA_GRAPH_PLAN_H__
+#define __SPA_GRAPH_PLAN_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Scheduler that works on a precompiled plan of the graph.
+ *
+ * When the graph changes, spa_graph_update() compiles the nodes into an
+ * array sorted in topological order with the ports of each node in a flat
+ * array of edges. need_input and have_output then sweep over this array:
+ * pulls walk backwards from the node, the produced data is pushed forwards.
+ * The ready and required counters of the nodes are used like in
+ * graph-scheduler6.h, only the recursion is replaced with marks on the
+ * plan nodes.
+ *
+ * The plan is compiled in the thread that changes the graph, into a second
+ * plan that is swapped with the active one when it is complete. The plan
+ * index of a node is kept in its scheduler_data. The sweeps share their
+ * state, so only one thread can run the graph at a time. */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include <spa/graph/graph.h>
+
+#define SPA_GRAPH_PLAN_MARK_PULL	(1 << 0)
+#define SPA_GRAPH_PLAN_MARK_PUSH	(1 << 1)
+
+/* a node that keeps asking for more data would make the sweeps go on
+ * forever, give up after this many passes */
+#define SPA_GRAPH_PLAN_MAX_PASSES	16
+
+struct spa_graph_plan_edge {
+	struct spa_graph_port *port;	/**< port of the node */
+	uint32_t peer;			/**< plan index of the peer node */
+};
+
+struct spa_graph_plan_node {
+	struct spa_graph_node *node;
+	uint32_t in_offset;		/**< first input edge */
+	uint32_t n_in;			/**< number of input edges */
+	uint32_t out_offset;		/**< first output edge */
+	uint32_t n_out;			/**< number of output edges */
+};
+
+struct spa_graph_plan_data {
+	uint32_t max_nodes;
+	uint32_t max_edges;
+	uint32_t n_nodes;
+	uint32_t n_edges;
+	struct spa_graph_plan_node *nodes;	/**< nodes in topological order */
+	struct spa_graph_plan_edge *edges;	/**< ports, grouped per node */
+	struct spa_graph_node **collect;	/**< nodes before sorting */
+	uint32_t *degree;			/**< pending inputs while sorting */
+	uint32_t *stack;			/**< nodes ready to be sorted */
+	uint8_t *marks;				/**< work for the current sweep */
+};
+
+struct spa_graph_plan {
+	struct spa_graph *graph;
+	struct spa_graph_plan_data *active;	/**< plan used for scheduling */
+	struct spa_graph_plan_data *spare;	/**< plan compiled on the next update */
+	struct spa_graph_plan_data data[2];
+	uint32_t lo, hi;			/**< range of marked nodes */
+	uint32_t n_marks;			/**< number of marks set */
+	bool running;				/**< a sweep is in progress */
+};
+
+static inline void spa_graph_plan_init(struct spa_graph_plan *plan, struct spa_graph *graph)
+{
+	memset(plan, 0, sizeof(*plan));
+	plan->graph = graph;
+	plan->spare = &plan->data[0];
+}
+
+static inline void spa_graph_plan_data_clear(struct spa_graph_plan_data *d)
+{
+	free(d->nodes);
+	free(d->edges);
+	free(d->collect);
+	free(d->degree);
+	free(d->stack);
+	free(d->marks);
+	memset(d, 0, sizeof(*d));
+}
+
+static inline void spa_graph_plan_clear(struct spa_graph_plan *plan)
+{
+	plan->active = NULL;
+	spa_graph_plan_data_clear(&plan->data[0]);
+	spa_graph_plan_data_clear(&plan->data[1]);
+}
+
+static inline int spa_graph_plan_data_ensure_nodes(struct spa_graph_plan_data *d, uint32_t n)
+{
+	void *p;
+
+	if (n <= d->max_nodes)
+		return 0;
+	n = SPA_MAX(n, SPA_MAX(d->max_nodes * 2, 64u));
+
+	if ((p = realloc(d->nodes, n * sizeof(struct spa_graph_plan_node))) == NULL)
+		return -ENOMEM;
+	d->nodes = p;
+	if ((p = realloc(d->collect, n * sizeof(struct spa_graph_node *))) == NULL)
+		return -ENOMEM;
+	d->collect = p;
+	if ((p = realloc(d->degree, n * sizeof(uint32_t))) == NULL)
+		return -ENOMEM;
+	d->degree = p;
+	if ((p = realloc(d->stack, n * sizeof(uint32_t))) == NULL)
+		return -ENOMEM;
+	d->stack = p;
+	if ((p = realloc(d->marks, n * sizeof(uint8_t))) == NULL)
+		return -ENOMEM;
+	d->marks = p;
+
+	d->max_nodes = n;
+	return 0;
+}
+
+static inline int spa_graph_plan_data_ensure_edges(struct spa_graph_plan_data *d, uint32_t n)
+{
+	void *p;
+
+	if (n <= d->max_edges)
+		return 0;
+	n = SPA_MAX(n, SPA_MAX(d->max_edges * 2, 256u));
+
+	if ((p = realloc(d->edges, n * sizeof(struct spa_graph_plan_edge))) == NULL)
+		return -ENOMEM;
+	d->edges = p;
+
+	d->max_edges = n;
+	return 0;
+}
+
+static inline uint32_t spa_graph_plan_data_index(struct spa_graph_plan_data *d,
+						  struct spa_graph_node *node)
+{
+	uint32_t idx = SPA_PTR_TO_UINT32(node->scheduler_data);
+
+	if (idx < d->n_nodes && d->nodes[idx].node == node)
+		return idx;
+	return SPA_ID_INVALID;
+}
+
+static inline int spa_graph_plan_collect(struct spa_graph_plan_data *d,
+					 struct spa_graph_node *node)
+{
+	uint32_t idx = SPA_PTR_TO_UINT32(node->scheduler_data);
+	int res;
+
+	if (idx < d->n_nodes && d->collect[idx] == node)
+		return 0;
+
+	if ((res = spa_graph_plan_data_ensure_nodes(d, d->n_nodes + 1)) < 0)
+		return res;
+
+	node->scheduler_data = SPA_UINT32_TO_PTR(d->n_nodes);
+	d->collect[d->n_nodes++] = node;
+	return 0;
+}
+
+/* the node of the peer of a port. A link connects its two ports before they
+ * are added to their nodes, so the peer can still be without a node. */
+static inline struct spa_graph_node *spa_graph_plan_peer_node(struct spa_graph_port *port)
+{
+	return port->peer ? port->peer->node : NULL;
+}
+
+/* compile the graph into d */
+static inline int spa_graph_plan_compile(struct spa_graph_plan *plan,
+					 struct spa_graph_plan_data *d)
+{
+	struct spa_graph_node *n, *peer;
+	struct spa_graph_port *p;
+	uint32_t i, j, top, tail;
+	int res;
+
+	d->n_nodes = d->n_edges = 0;
+
+	/* collect the nodes of the graph and the nodes they are linked to */
+	spa_list_for_each(n, &plan->graph->nodes, link) {
+		if ((res = spa_graph_plan_collect(d, n)) < 0)
+			return res;
+	}
+	for (i = 0; i < d->n_nodes; i++) {
+		n = d->collect[i];
+		for (j = 0; j < 2; j++) {
+			spa_list_for_each(p, &n->ports[j], link) {
+				if ((peer = spa_graph_plan_peer_node(p)) == NULL)
+					continue;
+				if ((res = spa_graph_plan_collect(d, peer)) < 0)
+					return res;
+			}
+		}
+	}
+
+	/* sort, every node comes after the nodes that feed it. The ready nodes
+	 * are kept on a stack so that the nodes of a chain end up next to
+	 * each other. */
+	for (i = 0; i < d->n_nodes; i++) {
+		d->degree[i] = 0;
+		spa_list_for_each(p, &d->collect[i]->ports[SPA_DIRECTION_INPUT], link)
+			if (spa_graph_plan_peer_node(p) != NULL)
+				d->degree[i]++;
+	}
+	top = tail = 0;
+	for (i = d->n_nodes; i-- > 0;) {
+		if (d->degree[i] == 0)
+			d->stack[top++] = i;
+	}
+	while (top > 0) {
+		i = d->stack[--top];
+		n = d->collect[i];
+		d->nodes[tail++].node = n;
+		d->degree[i] = SPA_ID_INVALID;
+
+		spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link) {
+			if ((peer = spa_graph_plan_peer_node(p)) == NULL)
+				continue;
+			j = SPA_PTR_TO_UINT32(peer->scheduler_data);
+			if (d->degree[j] != SPA_ID_INVALID && d->degree[j] > 0 &&
+			    --d->degree[j] == 0)
+				d->stack[top++] = j;
+		}
+	}
+	/* nodes in a loop keep the order of the graph */
+	for (i = 0; i < d->n_nodes; i++) {
+		if (d->degree[i] != SPA_ID_INVALID)
+			d->nodes[tail++].node = d->collect[i];
+	}
+	for (i = 0; i < d->n_nodes; i++)
+		d->nodes[i].node->scheduler_data = SPA_UINT32_TO_PTR(i);
+
+	/* flatten the ports */
+	for (i = 0; i < d->n_nodes; i++) {
+		struct spa_graph_plan_node *pn = &d->nodes[i];
+
+		for (j = 0; j < 2; j++) {
+			uint32_t offset = d->n_edges;
+
+			spa_list_for_each(p, &pn->node->ports[j], link) {
+				struct spa_graph_plan_edge *e;
+
+				if ((res = spa_graph_plan_data_ensure_edges(d, d->n_edges + 1)) < 0)
+					return res;
+
+				e = &d->edges[d->n_edges++];
+				e->port = p;
+				peer = spa_graph_plan_peer_node(p);
+				e->peer = peer ?
+					SPA_PTR_TO_UINT32(peer->scheduler_data) :
+					SPA_ID_INVALID;
+			}
+			if (j == SPA_DIRECTION_INPUT) {
+				pn->in_offset = offset;
+				pn->n_in = d->n_edges - offset;
+			} else {
+				pn->out_offset = offset;
+				pn->n_out = d->n_edges - offset;
+			}
+		}
+		d->marks[i] = 0;
+	}
+	return 0;
+}
+
+/** Compile a new plan and make it the active one. Call this in the thread
+ * that runs the graph after nodes, ports or links were added or removed. */
+static inline int spa_graph_plan_update(void *data)
+{
+	struct spa_graph_plan *plan = data;
+	struct spa_graph_plan_data *d = plan->spare, *old = plan->active;
+	int res;
+
+	if ((res = spa_graph_plan_compile(plan, d)) < 0) {
+		/* the old plan can point to removed nodes */
+		__atomic_store_n(&plan->active, NULL, __ATOMIC_RELEASE);
+		return res;
+	}
+
+	__atomic_store_n(&plan->active, d, __ATOMIC_RELEASE);
+	plan->spare = old ? old : &plan->data[1];
+
+	return 0;
+}
+
+static inline void spa_graph_plan_mark(struct spa_graph_plan *plan,
+				       struct spa_graph_plan_data *d,
+				       uint32_t idx, uint8_t mark)
+{
+	if (!(d->marks[idx] & mark)) {
+		d->marks[idx] |= mark;
+		plan->n_marks++;
+	}
+	plan->lo = SPA_MIN(plan->lo, idx);
+	plan->hi = SPA_MAX(plan->hi, idx);
+}
+
+static inline void spa_graph_plan_pull(struct spa_graph_plan *plan,
+				       struct spa_graph_plan_data *d, uint32_t idx)
+{
+	struct spa_graph_plan_node *pn = &d->nodes[idx];
+	struct spa_graph_node *node = pn->node;
+	struct spa_graph_plan_edge *e, *end = &d->edges[pn->in_offset + pn->n_in];
+
+	spa_debug("node %p start pull", node);
+
+	node->required[SPA_DIRECTION_INPUT] = 0;
+	for (e = &d->edges[pn->in_offset]; e < end; e++) {
+		if (e->port->io->status == SPA_STATUS_NEED_BUFFER)
+			node->required[SPA_DIRECTION_INPUT]++;
+	}
+	node->ready[SPA_DIRECTION_INPUT] = 0;
+	for (e = &d->edges[pn->in_offset]; e < end; e++) {
+		struct spa_graph_port *pport;
+		struct spa_graph_node *pnode;
+
+		if (e->peer == SPA_ID_INVALID)
+			continue;
+		pport = e->port->peer;
+		if (pport->flags & SPA_GRAPH_PORT_FLAG_DISABLED)
+			continue;
+		pnode = d->nodes[e->peer].node;
+
+		if (pport->io->status == SPA_STATUS_NEED_BUFFER)
+			pnode->ready[SPA_DIRECTION_OUTPUT]++;
+
+		if (pnode->required[SPA_DIRECTION_OUTPUT] > 0 &&
+		    pnode->ready[SPA_DIRECTION_OUTPUT] >= pnode->required[SPA_DIRECTION_OUTPUT]) {
+			pnode->state = spa_node_process_output(pnode->implementation);
+
+			spa_debug("peer %p processed out %d", pnode, pnode->state);
+			if (pnode->state == SPA_STATUS_HAVE_BUFFER)
+				spa_graph_plan_mark(plan, d, e->peer, SPA_GRAPH_PLAN_MARK_PUSH);
+			else if (pnode->state == SPA_STATUS_NEED_BUFFER)
+				spa_graph_plan_mark(plan, d, e->peer, SPA_GRAPH_PLAN_MARK_PULL);
+		}
+	}
+}
+
+static inline void spa_graph_plan_push(struct spa_graph_plan *plan,
+				       struct spa_graph_plan_data *d, uint32_t idx)
+{
+	struct spa_graph_plan_node *pn = &d->nodes[idx];
+	struct spa_graph_node *node = pn->node;
+	struct spa_graph_plan_edge *e, *end = &d->edges[pn->out_offset + pn->n_out];
+
+	spa_debug("node %p start push", node);
+
+	node->required[SPA_DIRECTION_OUTPUT] = 0;
+	for (e = &d->edges[pn->out_offset]; e < end; e++) {
+		if (e->port->io->status == SPA_STATUS_HAVE_BUFFER &&
+		    !(e->port->flags & SPA_PORT_INFO_FLAG_OPTIONAL))
+			node->required[SPA_DIRECTION_OUTPUT]++;
+	}
+	node->ready[SPA_DIRECTION_OUTPUT] = 0;
+	for (e = &d->edges[pn->out_offset]; e < end; e++) {
+		struct spa_graph_port *pport;
+		struct spa_graph_node *pnode;
+
+		if (e->peer == SPA_ID_INVALID)
+			continue;
+		pport = e->port->peer;
+		if (pport->flags & SPA_GRAPH_PORT_FLAG_DISABLED)
+			continue;
+		pnode = d->nodes[e->peer].node;
+
+		if (pport->io->status == SPA_STATUS_HAVE_BUFFER)
+			pnode->ready[SPA_DIRECTION_INPUT]++;
+
+		if (pnode->required[SPA_DIRECTION_INPUT] > 0 &&
+		    pnode->ready[SPA_DIRECTION_INPUT] >= pnode->required[SPA_DIRECTION_INPUT]) {
+			pnode->state = spa_node_process_input(pnode->implementation);
+
+			spa_debug("peer %p processed in %d", pnode, pnode->state);
+			if (pnode->state == SPA_STATUS_HAVE_BUFFER)
+				spa_graph_plan_mark(plan, d, e->peer, SPA_GRAPH_PLAN_MARK_PUSH);
+			else if (pnode->state == SPA_STATUS_NEED_BUFFER)
+				spa_graph_plan_mark(plan, d, e->peer, SPA_GRAPH_PLAN_MARK_PULL);
+		}
+	}
+}
+
+/* sweep backwards over the pulls and forwards over the pushes until no
+ * node is marked anymore */
+static inline int spa_graph_plan_run(struct spa_graph_plan *plan, struct spa_graph_node *node,
+				     uint8_t mark)
+{
+	struct spa_graph_plan_data *d;
+	uint32_t i, idx, passes;
+
+	d = __atomic_load_n(&plan->active, __ATOMIC_ACQUIRE);
+	idx = d ? spa_graph_plan_data_index(d, node) : SPA_ID_INVALID;
+
+	/* called from one of the nodes, the running sweep will handle it */
+	if (plan->running) {
+		if (idx == SPA_ID_INVALID)
+			return -ENOENT;
+		spa_graph_plan_mark(plan, d, idx, mark);
+		return 0;
+	}
+	if (idx == SPA_ID_INVALID) {
+		/* a node that was not seen yet, the graph must have changed */
+		if (spa_graph_plan_update(plan) < 0)
+			return -ENOMEM;
+		d = plan->active;
+		if ((idx = spa_graph_plan_data_index(d, node)) == SPA_ID_INVALID)
+			return -ENOENT;
+	}
+	plan->running = true;
+
+	plan->lo = plan->hi = idx;
+	plan->n_marks = 0;
+	spa_graph_plan_mark(plan, d, idx, mark);
+
+	for (passes = 0; passes < SPA_GRAPH_PLAN_MAX_PASSES; passes++) {
+		for (i = plan->hi + 1; i-- > plan->lo;) {
+			if (d->marks[i] & SPA_GRAPH_PLAN_MARK_PULL) {
+				d->marks[i] &= ~SPA_GRAPH_PLAN_MARK_PULL;
+				plan->n_marks--;
+				spa_graph_plan_pull(plan, d, i);
+			}
+		}
+		for (i = plan->lo; i <= plan->hi; i++) {
+			if (d->marks[i] & SPA_GRAPH_PLAN_MARK_PUSH) {
+				d->marks[i] &= ~SPA_GRAPH_PLAN_MARK_PUSH;
+				plan->n_marks--;
+				spa_graph_plan_push(plan, d, i);
+			}
+		}
+		if (plan->n_marks == 0) {
+			plan->running = false;
+			return 0;
+		}
+	}
+
+	spa_debug("node %p still busy after %d passes", node, passes);
+	for (i = plan->lo; i <= plan->hi; i++)
+		d->marks[i] = 0;
+	plan->running = false;
+
+	return -EBUSY;
+}
+
+static inline int spa_graph_plan_need_input(void *data, struct spa_graph_node *node)
+{
+	return spa_graph_plan_run(data, node, SPA_GRAPH_PLAN_MARK_PULL);
+}
+
+static inline int spa_graph_plan_have_output(void *data, struct spa_graph_node *node)
+{
+	return spa_graph_plan_run(data, node, SPA_GRAPH_PLAN_MARK_PUSH);
+}
+
+static const struct spa_graph_callbacks spa_graph_plan_impl = {
+	SPA_VERSION_GRAPH_CALLBACKS,
+	.need_input = spa_graph_plan_need_input,
+	.have_output = spa_graph_plan_have_output,
+	.update = spa_graph_plan_update,
+};
+
+static inline void spa_graph_plan_scheduler_init(void *data, struct spa_graph *graph)
+{
+	spa_graph_plan_init((struct spa_graph_plan *) data, graph);
+}
+
+static inline void spa_graph_plan_scheduler_clear(void *data)
+{
+	spa_graph_plan_clear((struct spa_graph_plan *) data);
+}
+
+static const struct spa_graph_scheduler spa_graph_scheduler_plan = {
+	"plan",
+	&spa_graph_plan_impl,
+	sizeof(struct spa_graph_plan),
+	spa_graph_plan_scheduler_init,
+	spa_graph_plan_scheduler_clear,
+};
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif /* __SPA_GRAPH_PLAN_H__ */
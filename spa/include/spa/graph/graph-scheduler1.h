@@ -17,8 +17,8 @@
  * Boston, MA 02110-1301, USA.
  */
 
-#ifndef __SPA_GRAPH_SCHEDULER_H__
-#define __SPA_GRAPH_SCHEDULER_H__
+#ifndef __SPA_GRAPH_SCHEDULER1_H__
+#define __SPA_GRAPH_SCHEDULER1_H__
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,13 +31,13 @@ extern "C" {
 #define SPA_GRAPH_STATE_CHECK_IN	2
 #define SPA_GRAPH_STATE_CHECK_OUT	3
 
-struct spa_graph_data {
+struct spa_graph_scheduler1_data {
 	struct spa_graph *graph;
         struct spa_list ready;
         struct spa_graph_node *node;
 };
 
-static inline void spa_graph_data_init(struct spa_graph_data *data,
+static inline void spa_graph_scheduler1_data_init(struct spa_graph_scheduler1_data *data,
 				       struct spa_graph *graph)
 {
 	data->graph = graph;
@@ -45,7 +45,7 @@ static inline void spa_graph_data_init(struct spa_graph_data *data,
 	data->node = NULL;
 }
 
-static inline void spa_graph_data_port_check(struct spa_graph_data *data, struct spa_graph_port *port)
+static inline void spa_graph_scheduler1_port_check(struct spa_graph_scheduler1_data *data, struct spa_graph_port *port)
 {
 	struct spa_graph_node *node = port->node;
 	uint32_t required = node->required[SPA_DIRECTION_INPUT];
@@ -66,7 +66,7 @@ static inline void spa_graph_data_port_check(struct spa_graph_data *data, struct
 	}
 }
 
-static inline bool spa_graph_data_iterate(struct spa_graph_data *data)
+static inline bool spa_graph_scheduler1_iterate(struct spa_graph_scheduler1_data *data)
 {
 	bool res;
 	int state;
@@ -121,7 +121,7 @@ static inline bool spa_graph_data_iterate(struct spa_graph_data *data)
 			}
 		case SPA_GRAPH_STATE_CHECK_OUT:
 			spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link)
-				spa_graph_data_port_check(data, p->peer);
+				spa_graph_scheduler1_port_check(data, p->peer);
 			break;
 
 		default:
@@ -132,38 +132,50 @@ static inline bool spa_graph_data_iterate(struct spa_graph_data *data)
 	return res;
 }
 
-static inline int spa_graph_impl_need_input(void *data, struct spa_graph_node *node)
+static inline int spa_graph_scheduler1_need_input(void *data, struct spa_graph_node *node)
 {
-	struct spa_graph_data *d = (struct spa_graph_data *) data;
+	struct spa_graph_scheduler1_data *d = (struct spa_graph_scheduler1_data *) data;
 	spa_debug("node %p start pull", node);
 	node->state = SPA_GRAPH_STATE_CHECK_IN;
 	d->node = node;
 	if (node->ready_link.next == NULL)
 		spa_list_append(&d->ready, &node->ready_link);
 
-	while(spa_graph_data_iterate(d));
+	while(spa_graph_scheduler1_iterate(d));
 
 	return 0;
 }
 
-static inline int spa_graph_impl_have_output(void *data, struct spa_graph_node *node)
+static inline int spa_graph_scheduler1_have_output(void *data, struct spa_graph_node *node)
 {
-	struct spa_graph_data *d = (struct spa_graph_data *) data;
+	struct spa_graph_scheduler1_data *d = (struct spa_graph_scheduler1_data *) data;
 	spa_debug("node %p start push", node);
 	node->state = SPA_GRAPH_STATE_OUT;
 	d->node = node;
 	if (node->ready_link.next == NULL)
 		spa_list_append(&d->ready, &node->ready_link);
 
-	while(spa_graph_data_iterate(d));
+	while(spa_graph_scheduler1_iterate(d));
 
 	return 0;
 }
 
-static const struct spa_graph_callbacks spa_graph_impl_default = {
+static const struct spa_graph_callbacks spa_graph_scheduler1_callbacks = {
 	SPA_VERSION_GRAPH_CALLBACKS,
-	.need_input = spa_graph_impl_need_input,
-	.have_output = spa_graph_impl_have_output,
+	.need_input = spa_graph_scheduler1_need_input,
+	.have_output = spa_graph_scheduler1_have_output,
+};
+
+static inline void spa_graph_scheduler1_init(void *data, struct spa_graph *graph)
+{
+	spa_graph_scheduler1_data_init((struct spa_graph_scheduler1_data *) data, graph);
+}
+
+static const struct spa_graph_scheduler spa_graph_scheduler1 = {
+	"scheduler1",
+	&spa_graph_scheduler1_callbacks,
+	sizeof(struct spa_graph_scheduler1_data),
+	.init = spa_graph_scheduler1_init,
 };
 
 
@@ -171,4 +183,4 @@ static const struct spa_graph_callbacks spa_graph_impl_default = {
 }  /* extern "C" */
 #endif
 
-#endif /* __SPA_GRAPH_SCHEDULER_H__ */
+#endif /* __SPA_GRAPH_SCHEDULER1_H__ */
@@ -17,8 +17,8 @@
  * Boston, MA 02110-1301, USA.
  */
 
-#ifndef __SPA_GRAPH_SCHEDULER_H__
-#define __SPA_GRAPH_SCHEDULER_H__
+#ifndef __SPA_GRAPH_SCHEDULER3_H__
+#define __SPA_GRAPH_SCHEDULER3_H__
 
 #ifdef __cplusplus
 extern "C" {
@@ -26,7 +26,7 @@ extern "C" {
 
 #include <spa/graph/graph.h>
 
-static inline int spa_graph_impl_need_input(void *data, struct spa_graph_node *node)
+static inline int spa_graph_scheduler3_need_input(void *data, struct spa_graph_node *node)
 {
 	struct spa_graph_port *p;
 	struct spa_graph_node *n, *t;
@@ -85,7 +85,7 @@ static inline int spa_graph_impl_need_input(void *data, struct spa_graph_node *n
 	return 0;
 }
 
-static inline int spa_graph_impl_have_output(void *data, struct spa_graph_node *node)
+static inline int spa_graph_scheduler3_have_output(void *data, struct spa_graph_node *node)
 {
 	struct spa_graph_port *p;
 	struct spa_list ready;
@@ -149,10 +149,15 @@ static inline int spa_graph_impl_have_output(void *data, struct spa_graph_node *
 	return 0;
 }
 
-static const struct spa_graph_callbacks spa_graph_impl_default = {
+static const struct spa_graph_callbacks spa_graph_scheduler3_callbacks = {
 	SPA_VERSION_GRAPH_CALLBACKS,
-	.need_input = spa_graph_impl_need_input,
-	.have_output = spa_graph_impl_have_output,
+	.need_input = spa_graph_scheduler3_need_input,
+	.have_output = spa_graph_scheduler3_have_output,
+};
+
+static const struct spa_graph_scheduler spa_graph_scheduler3 = {
+	"scheduler3",
+	&spa_graph_scheduler3_callbacks,
 };
 
 
@@ -160,4 +165,4 @@ static const struct spa_graph_callbacks spa_graph_impl_default = {
 }  /* extern "C" */
 #endif
 
-#endif /* __SPA_GRAPH_SCHEDULER_H__ */
+#endif /* __SPA_GRAPH_SCHEDULER3_H__ */
@@ -17,8 +17,8 @@
  * Boston, MA 02110-1301, USA.
  */
 
-#ifndef __SPA_GRAPH_SCHEDULER_H__
-#define __SPA_GRAPH_SCHEDULER_H__
+#ifndef __SPA_GRAPH_SCHEDULER5_H__
+#define __SPA_GRAPH_SCHEDULER5_H__
 
 #ifdef __cplusplus
 extern "C" {
@@ -26,49 +26,42 @@ extern "C" {
 
 #include <spa/graph/graph.h>
 
-struct spa_graph_data {
-	struct spa_graph *graph;
-};
-
-static inline void spa_graph_data_init(struct spa_graph_data *data,
-                                       struct spa_graph *graph)
-{
-	data->graph = graph;
-}
+static inline int spa_graph_scheduler5_need_input(void *data, struct spa_graph_node *node);
+static inline int spa_graph_scheduler5_have_output(void *data, struct spa_graph_node *node);
 
-static inline int spa_graph_impl_need_input(void *data, struct spa_graph_node *node);
-static inline int spa_graph_impl_have_output(void *data, struct spa_graph_node *node);
-
-static inline void spa_graph_impl_activate(void *data, struct spa_graph_node *node, bool recurse)
+static inline void spa_graph_scheduler5_activate(void *data, struct spa_graph_node *node, bool recurse)
 {
 	int res = node->state;
 
-	debug("node %p activate %d\n", node, node->state);
+	spa_debug("node %p activate %d", node, node->state);
 	if (node->state == SPA_STATUS_NEED_BUFFER) {
                 res = spa_node_process_input(node->implementation);
-		debug("node %p process in %d\n", node, res);
+		spa_debug("node %p process in %d", node, res);
 	}
 	else if (node->state == SPA_STATUS_HAVE_BUFFER) {
                 res = spa_node_process_output(node->implementation);
-		debug("node %p process out %d\n", node, res);
+		spa_debug("node %p process out %d", node, res);
 	}
 
-	if (recurse && (res == SPA_STATUS_NEED_BUFFER || res == SPA_STATUS_OK))
-		spa_graph_impl_need_input(data, node);
+	/* only pull again when the node could not produce output, a node that
+	 * consumed its input waits for the next cycle */
+	if (recurse && node->state == SPA_STATUS_HAVE_BUFFER &&
+	    (res == SPA_STATUS_NEED_BUFFER || res == SPA_STATUS_OK))
+		spa_graph_scheduler5_need_input(data, node);
 	else if (recurse && (res == SPA_STATUS_HAVE_BUFFER))
-		spa_graph_impl_have_output(data, node);
+		spa_graph_scheduler5_have_output(data, node);
 	else
 		node->state = res;
 
-	debug("node %p activate end %d\n", node, node->state);
+	spa_debug("node %p activate end %d", node, node->state);
 }
 
-static inline int spa_graph_impl_need_input(void *data, struct spa_graph_node *node)
+static inline int spa_graph_scheduler5_need_input(void *data, struct spa_graph_node *node)
 {
 	struct spa_graph_port *p;
 	uint32_t required;
 
-	debug("node %p start pull\n", node);
+	spa_debug("node %p start pull", node);
 
 	node->state = SPA_STATUS_NEED_BUFFER;
 	node->ready[SPA_DIRECTION_INPUT] = 0;
@@ -83,33 +76,34 @@ static inline int spa_graph_impl_need_input(void *data, struct spa_graph_node *n
 			continue;
 		pnode = pport->node;
 		prequired = pnode->required[SPA_DIRECTION_OUTPUT];
-		debug("node %p pull peer %p io %d %d\n", node, pnode, pport->io->status, pport->io->buffer_id);
+		spa_debug("node %p pull peer %p io %d %d", node, pnode, pport->io->status, pport->io->buffer_id);
 
 		if (pport->io->status == SPA_STATUS_NEED_BUFFER)
 			pnode->ready[SPA_DIRECTION_OUTPUT]++;
 		else if (pport->io->status == SPA_STATUS_OK)
 			node->ready[SPA_DIRECTION_INPUT]++;
 
-		debug("node %p pull peer %p out %d %d\n", node, pnode, prequired, pnode->ready[SPA_DIRECTION_OUTPUT]);
+		spa_debug("node %p pull peer %p out %d %d", node, pnode, prequired, pnode->ready[SPA_DIRECTION_OUTPUT]);
 		if (prequired > 0 && pnode->ready[SPA_DIRECTION_OUTPUT] >= prequired) {
 			if (pnode->state == SPA_STATUS_NEED_BUFFER)
 				pnode->state = SPA_STATUS_HAVE_BUFFER;
-			spa_graph_impl_activate(data, pnode, true);
+			spa_graph_scheduler5_activate(data, pnode, true);
 		}
 	}
 	if (required > 0 && node->ready[SPA_DIRECTION_INPUT] >= required)
-		spa_graph_impl_activate(data, node, false);
+		spa_graph_scheduler5_activate(data, node, false);
 
-	debug("node %p end pull\n", node);
+	spa_debug("node %p end pull", node);
 
 	return 0;
 }
 
-static inline int spa_graph_impl_have_output(void *data, struct spa_graph_node *node)
+static inline int spa_graph_scheduler5_have_output(void *data, struct spa_graph_node *node)
 {
 	struct spa_graph_port *p;
+	uint32_t required;
 
-	debug("node %p start push\n", node);
+	spa_debug("node %p start push", node);
 
 	node->state = SPA_STATUS_HAVE_BUFFER;
 	node->ready[SPA_DIRECTION_OUTPUT] = 0;
@@ -125,29 +119,34 @@ static inline int spa_graph_impl_have_output(void *data, struct spa_graph_node *
 
 		pnode = pport->node;
 		prequired = pnode->required[SPA_DIRECTION_INPUT];
-		debug("node %p push peer %p io %d %d\n", node, pnode, pport->io->status, pport->io->buffer_id);
+		spa_debug("node %p push peer %p io %d %d", node, pnode, pport->io->status, pport->io->buffer_id);
 
 		if (pport->io->status == SPA_STATUS_HAVE_BUFFER) {
 			pnode->ready[SPA_DIRECTION_INPUT]++;
 			node->required[SPA_DIRECTION_OUTPUT]++;
 		}
-		debug("node %p push peer %p in %d %d\n", node, pnode, prequired, pnode->ready[SPA_DIRECTION_INPUT]);
+		spa_debug("node %p push peer %p in %d %d", node, pnode, prequired, pnode->ready[SPA_DIRECTION_INPUT]);
 		if (prequired > 0 && pnode->ready[SPA_DIRECTION_INPUT] >= prequired)
-			spa_graph_impl_activate(data, pnode, true);
+			spa_graph_scheduler5_activate(data, pnode, true);
 	}
 	required = node->required[SPA_DIRECTION_OUTPUT];
 	if (required > 0 && node->ready[SPA_DIRECTION_OUTPUT] >= required)
-		spa_graph_impl_activate(data, node, false);
+		spa_graph_scheduler5_activate(data, node, false);
 
-	debug("node %p end push\n", node);
+	spa_debug("node %p end push", node);
 
 	return 0;
 }
 
-static const struct spa_graph_callbacks spa_graph_impl_default = {
+static const struct spa_graph_callbacks spa_graph_scheduler5_callbacks = {
 	SPA_VERSION_GRAPH_CALLBACKS,
-	.need_input = spa_graph_impl_need_input,
-	.have_output = spa_graph_impl_have_output,
+	.need_input = spa_graph_scheduler5_need_input,
+	.have_output = spa_graph_scheduler5_have_output,
+};
+
+static const struct spa_graph_scheduler spa_graph_scheduler5 = {
+	"scheduler5",
+	&spa_graph_scheduler5_callbacks,
 };
 
 
@@ -155,4 +154,4 @@ static const struct spa_graph_callbacks spa_graph_impl_default = {
 }  /* extern "C" */
 #endif
 
-#endif /* __SPA_GRAPH_SCHEDULER_H__ */
+#endif /* __SPA_GRAPH_SCHEDULER5_H__ */
@@ -17,8 +17,8 @@
  * Boston, MA 02110-1301, USA.
  */
 
-#ifndef __SPA_GRAPH_SCHEDULER_H__
-#define __SPA_GRAPH_SCHEDULER_H__
+#ifndef __SPA_GRAPH_SCHEDULER6_H__
+#define __SPA_GRAPH_SCHEDULER6_H__
 
 #ifdef __cplusplus
 extern "C" {
@@ -26,17 +26,7 @@ extern "C" {
 
 #include <spa/graph/graph.h>
 
-struct spa_graph_data {
-	struct spa_graph *graph;
-};
-
-static inline void spa_graph_data_init(struct spa_graph_data *data,
-				       struct spa_graph *graph)
-{
-	data->graph = graph;
-}
-
-static inline int spa_graph_impl_need_input(void *data, struct spa_graph_node *node)
+static inline int spa_graph_scheduler6_need_input(void *data, struct spa_graph_node *node)
 {
 	struct spa_graph_port *p;
 
@@ -82,7 +72,7 @@ static inline int spa_graph_impl_need_input(void *data, struct spa_graph_node *n
 	return 0;
 }
 
-static inline int spa_graph_impl_have_output(void *data, struct spa_graph_node *node)
+static inline int spa_graph_scheduler6_have_output(void *data, struct spa_graph_node *node)
 {
 	struct spa_graph_port *p;
 
@@ -130,10 +120,15 @@ static inline int spa_graph_impl_have_output(void *data, struct spa_graph_node *
 	return 0;
 }
 
-static const struct spa_graph_callbacks spa_graph_impl_default = {
+static const struct spa_graph_callbacks spa_graph_scheduler6_callbacks = {
 	SPA_VERSION_GRAPH_CALLBACKS,
-	.need_input = spa_graph_impl_need_input,
-	.have_output = spa_graph_impl_have_output,
+	.need_input = spa_graph_scheduler6_need_input,
+	.have_output = spa_graph_scheduler6_have_output,
+};
+
+static const struct spa_graph_scheduler spa_graph_scheduler6 = {
+	"scheduler6",
+	&spa_graph_scheduler6_callbacks,
 };
 
 
@@ -141,4 +136,4 @@ static const struct spa_graph_callbacks spa_graph_impl_default = {
 }  /* extern "C" */
 #endif
 
-#endif /* __SPA_GRAPH_SCHEDULER_H__ */
+#endif /* __SPA_GRAPH_SCHEDULER6_H__ */
@@ -0,0 +1,64 @@
+/* Simple Plugin API
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __SPA_GRAPH_SCHEDULERS_H__
+#define __SPA_GRAPH_SCHEDULERS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include <spa/graph/graph.h>
+#include <spa/graph/graph-scheduler6.h>
+#include <spa/graph/graph-plan.h>
+
+#define SPA_GRAPH_SCHEDULER_DEFAULT	"scheduler6"
+
+/** the schedulers that can be selected by name. Only the schedulers that
+ * complete every cycle of the graphs in benchmark-scheduler are listed,
+ * scheduler1 crashes on fan-out and diamond graphs and scheduler3,
+ * scheduler4 and scheduler5 lose buffers. Their headers can still be
+ * included directly. */
+static const struct spa_graph_scheduler * const spa_graph_schedulers[] = {
+	&spa_graph_scheduler6,
+	&spa_graph_scheduler_plan,
+};
+
+/** find a scheduler by name, NULL gives the default scheduler */
+static inline const struct spa_graph_scheduler *spa_graph_scheduler_find(const char *name)
+{
+	uint32_t i;
+
+	if (name == NULL)
+		name = SPA_GRAPH_SCHEDULER_DEFAULT;
+
+	for (i = 0; i < SPA_N_ELEMENTS(spa_graph_schedulers); i++) {
+		if (strcmp(spa_graph_schedulers[i]->name, name) == 0)
+			return spa_graph_schedulers[i];
+	}
+	return NULL;
+}
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif /* __SPA_GRAPH_SCHEDULERS_H__ */
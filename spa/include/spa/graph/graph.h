@@ -43,6 +43,19 @@ struct spa_graph_callbacks {
 
 	int (*need_input) (void *data, struct spa_graph_node *node);
 	int (*have_output) (void *data, struct spa_graph_node *node);
+
+	/** optional, nodes, ports or links were added or removed */
+	int (*update) (void *data);
+};
+
+/** A scheduler implementation, the callbacks are called with \a size bytes
+ * of scheduler data allocated by the user of the graph */
+struct spa_graph_scheduler {
+	const char *name;
+	const struct spa_graph_callbacks *callbacks;
+	size_t size;					/**< size of the scheduler data */
+	void (*init) (void *data, struct spa_graph *graph);	/**< optional */
+	void (*clear) (void *data);			/**< optional */
 };
 
 struct spa_graph {
@@ -53,6 +66,7 @@ struct spa_graph {
 
 #define spa_graph_need_input(g,n)	((g)->callbacks->need_input((g)->callbacks_data, (n)))
 #define spa_graph_have_output(g,n)	((g)->callbacks->have_output((g)->callbacks_data, (n)))
+#define spa_graph_update(g)		((g)->callbacks->update ? (g)->callbacks->update((g)->callbacks_data) : 0)
 #define spa_graph_reuse_buffer(g,n,p,i)	((g)->callbacks->reuse_buffer((g)->callbacks_data, (n),(p),(i)))
 
 struct spa_graph_node {
@@ -95,6 +109,23 @@ spa_graph_set_callbacks(struct spa_graph *graph,
 	graph->callbacks_data = data;
 }
 
+static inline void
+spa_graph_set_scheduler(struct spa_graph *graph,
+			const struct spa_graph_scheduler *scheduler,
+			void *data)
+{
+	if (scheduler->init)
+		scheduler->init(data, graph);
+	spa_graph_set_callbacks(graph, scheduler->callbacks, data);
+}
+
+static inline void
+spa_graph_scheduler_clear(const struct spa_graph_scheduler *scheduler, void *data)
+{
+	if (scheduler->clear)
+		scheduler->clear(data);
+}
+
 static inline void
 spa_graph_node_init(struct spa_graph_node *node)
 {
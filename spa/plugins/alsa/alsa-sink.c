@@ -130,7 +130,7 @@ static int impl_node_enum_params(struct spa_node *node,
 				":", t->prop_device,      "S",   p->device, sizeof(p->device),
 				":", t->prop_device_name, "S-r", p->device_name, sizeof(p->device_name),
 				":", t->prop_card_name,   "S-r", p->card_name, sizeof(p->card_name),
-				":", t->prop_min_latency, "i",   p->min_latency,
+				":", t->prop_min_latency, "i",   spa_alsa_get_min_latency(this),
 				":", t->prop_max_latency, "i",   p->max_latency);
 			break;
 		default:
@@ -170,6 +170,7 @@ static int impl_node_set_param(struct spa_node *node, uint32_t id, uint32_t flag
 			":", t->prop_device,      "?S", p->device, sizeof(p->device),
 			":", t->prop_min_latency, "?i", &p->min_latency,
 			":", t->prop_max_latency, "?i", &p->max_latency, NULL);
+		spa_alsa_update_threshold(this);
 	}
 	else
 		return -ENOENT;
@@ -120,7 +120,7 @@ static int impl_node_enum_params(struct spa_node *node,
 				":", t->prop_device,      "S",   p->device, sizeof(p->device),
 				":", t->prop_device_name, "S-r", p->device_name, sizeof(p->device_name),
 				":", t->prop_card_name,   "S-r", p->card_name, sizeof(p->card_name),
-				":", t->prop_min_latency, "i",   p->min_latency);
+				":", t->prop_min_latency, "i",   spa_alsa_get_min_latency(this));
 			break;
 		default:
 			return 0;
@@ -158,6 +158,7 @@ static int impl_node_set_param(struct spa_node *node, uint32_t id, uint32_t flag
 		spa_pod_object_parse(param,
 			":", t->prop_device,      "?S", p->device, sizeof(p->device),
 			":", t->prop_min_latency, "?i", &p->min_latency, NULL);
+		spa_alsa_update_threshold(this);
 	}
 	else
 		return -ENOENT;
@@ -658,6 +658,20 @@ static void alsa_on_capture_timeout_event(struct spa_source *source)
 	timerfd_settime(state->timerfd, TFD_TIMER_ABSTIME, &ts, NULL);
 }
 
+/* the threshold is min_latency, limited by max_latency and half of the
+ * hardware buffer. Used when starting and when min_latency changes. */
+static int calc_threshold(struct state *state)
+{
+	uint32_t threshold = state->props.min_latency;
+
+	if (state->props.max_latency > 0)
+		threshold = SPA_MIN(threshold, state->props.max_latency);
+	if (state->buffer_frames > 0)
+		threshold = SPA_MIN(threshold, (uint32_t) state->buffer_frames / 2);
+
+	return SPA_MAX(threshold, 1u);
+}
+
 int spa_alsa_start(struct state *state, bool xrun_recover)
 {
 	int err;
@@ -688,7 +702,7 @@ int spa_alsa_start(struct state *state, bool xrun_recover)
 	state->source.rmask = 0;
 	spa_loop_add_source(state->data_loop, &state->source);
 
-	state->threshold = state->props.min_latency;
+	state->threshold = calc_threshold(state);
 
 	if (state->stream == SND_PCM_STREAM_PLAYBACK) {
 		state->alsa_started = false;
@@ -731,6 +745,49 @@ static int do_remove_source(struct spa_loop *loop,
 	return 0;
 }
 
+static int do_set_threshold(struct spa_loop *loop,
+			    bool async,
+			    uint32_t seq,
+			    const void *data,
+			    size_t size,
+			    void *user_data)
+{
+	struct state *state = user_data;
+
+	state->threshold = *(const int *) data;
+
+	return 0;
+}
+
+/* the min_latency that is in use, it is limited like the threshold once
+ * the hardware buffer is known */
+uint32_t spa_alsa_get_min_latency(struct state *state)
+{
+	return calc_threshold(state);
+}
+
+/* apply a new min_latency to a running device. The threshold is only used
+ * from the data thread, it is changed there between two timeouts. */
+int spa_alsa_update_threshold(struct state *state)
+{
+	int threshold;
+
+	if (!state->started)
+		return 0;
+
+	threshold = calc_threshold(state);
+	if (threshold == state->threshold)
+		return 0;
+
+	spa_log_debug(state->log, "alsa %p: threshold %d -> %d", state,
+			state->threshold, threshold);
+
+	spa_loop_invoke(state->data_loop, do_set_threshold, 0, &threshold, sizeof(threshold),
+			true, state);
+
+	return 0;
+}
+
 int spa_alsa_pause(struct state *state, bool xrun_recover)
 {
 	int err;
@@ -180,6 +180,8 @@ spa_alsa_enum_format(struct state *state,
 int spa_alsa_set_format(struct state *state, struct spa_audio_info *info, uint32_t flags);
 
 int spa_alsa_start(struct state *state, bool xrun_recover);
+int spa_alsa_update_threshold(struct state *state);
+uint32_t spa_alsa_get_min_latency(struct state *state);
 int spa_alsa_pause(struct state *state, bool xrun_recover);
 int spa_alsa_close(struct state *state);
 
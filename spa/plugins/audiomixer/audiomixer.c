@@ -149,6 +149,7 @@ struct impl {
 	int n_formats;
 	struct spa_audio_info format;
 	uint32_t bpf;
+	int fmt;
 
 	mix_clear_func_t clear;
 	mix_func_t copy;
@@ -156,6 +157,9 @@ struct impl {
 	mix_scale_func_t copy_scale;
 	mix_scale_func_t add_scale;
 
+	/* the only input port shares its buffers with the output */
+	bool in_place;
+
 	bool started;
 };
 
@@ -294,6 +298,7 @@ static int impl_node_add_port(struct spa_node *node, enum spa_direction directio
 			   SPA_PORT_INFO_FLAG_IN_PLACE;
 
 	this->port_count++;
+	this->in_place = false;
 	if (this->last_port <= port_id)
 		this->last_port = port_id + 1;
 
@@ -317,6 +322,7 @@ impl_node_remove_port(struct spa_node *node, enum spa_direction direction, uint3
 	port = GET_IN_PORT (this, port_id);
 
 	this->port_count--;
+	this->in_place = false;
 	if (port->have_format && this->have_format) {
 		if (--this->n_formats == 0)
 			this->have_format = false;
@@ -576,10 +582,27 @@ static int clear_buffers(struct impl *this, struct port *port)
 		spa_log_info(this->log, NAME " %p: clear buffers %p", this, port);
 		port->n_buffers = 0;
 		spa_list_init(&port->queue);
+		this->in_place = false;
 	}
 	return 0;
 }
 
+static void check_in_place(struct impl *this)
+{
+	struct port *inport = GET_IN_PORT(this, 0);
+	struct port *outport = GET_OUT_PORT(this, 0);
+	uint32_t i;
+
+	this->in_place = this->port_count == 1 && inport->valid &&
+	    inport->n_buffers > 0 && inport->n_buffers == outport->n_buffers;
+
+	for (i = 0; i < inport->n_buffers && this->in_place; i++) {
+		if (inport->buffers[i].outbuf != outport->buffers[i].outbuf)
+			this->in_place = false;
+	}
+	spa_log_info(this->log, NAME " %p: in-place %d", this, this->in_place);
+}
+
 static int port_set_format(struct spa_node *node,
 			   enum spa_direction direction,
 			   uint32_t port_id,
@@ -623,6 +646,7 @@ static int port_set_format(struct spa_node *node,
 				this->add = this->ops.add[FMT_S16];
 				this->copy_scale = this->ops.copy_scale[FMT_S16];
 				this->add_scale = this->ops.add_scale[FMT_S16];
+				this->fmt = FMT_S16;
 				this->bpf = sizeof(int16_t) * info.info.raw.channels;
 			}
 			else if (info.info.raw.format == t->audio_format.F32) {
@@ -631,6 +655,7 @@ static int port_set_format(struct spa_node *node,
 				this->add = this->ops.add[FMT_F32];
 				this->copy_scale = this->ops.copy_scale[FMT_F32];
 				this->add_scale = this->ops.add_scale[FMT_F32];
+				this->fmt = FMT_F32;
 				this->bpf = sizeof(float) * info.info.raw.channels;
 			}
 			else
@@ -725,6 +750,8 @@ impl_node_port_use_buffers(struct spa_node *node,
 	}
 	port->n_buffers = n_buffers;
 
+	check_in_place(this);
+
 	return 0;
 }
 
@@ -817,6 +844,53 @@ impl_node_port_send_command(struct spa_node *node,
 	return -ENOTSUP;
 }
 
+/* get the read pointer of the queued data on port and the number of bytes
+ * that can be read from it without wrapping around */
+static inline void *
+get_port_data(struct impl *this, struct port *port, uint32_t *avail)
+{
+	struct buffer *b;
+	struct spa_data *d;
+	uint32_t index, offset, maxsize, insize;
+
+	b = spa_list_first(&port->queue, struct buffer, link);
+	d = b->outbuf->datas;
+
+	maxsize = d[0].maxsize;
+	insize = SPA_MIN(d[0].chunk->size, maxsize);
+
+	index = d[0].chunk->offset + (insize - port->queued_bytes);
+	offset = index % maxsize;
+
+	*avail = SPA_MIN(port->queued_bytes, maxsize - offset);
+
+	return SPA_MEMBER(d[0].data, offset, void);
+}
+
+static inline void
+consume_port_data(struct impl *this, struct port *port, size_t size)
+{
+	struct buffer *b = spa_list_first(&port->queue, struct buffer, link);
+
+	port->queued_bytes -= size;
+
+	if (port->queued_bytes == 0) {
+		spa_log_trace(this->log, NAME " %p: return buffer %d on port %p %zd",
+			      this, b->outbuf->id, port, size);
+		port->io->buffer_id = b->outbuf->id;
+		spa_list_remove(&b->link);
+		b->outstanding = true;
+	} else {
+		spa_log_trace(this->log, NAME " %p: keeping buffer %d on port %p %zd %zd",
+			      this, b->outbuf->id, port, port->queued_bytes, size);
+	}
+}
+
+static inline bool port_is_silent(struct port *port)
+{
+	return *port->io_volume < 0.001 || *port->io_mute;
+}
+
 static inline void
 add_port_data(struct impl *this, void *out, size_t outsize, struct port *port, int layer)
 {
@@ -826,7 +900,6 @@ add_port_data(struct impl *this, void *out, size_t outsize, struct port *port, i
 	struct spa_data *d;
 	void *data;
 	double volume = *port->io_volume;
-	bool mute = *port->io_mute;
 
 	b = spa_list_first(&port->queue, struct buffer, link);
 
@@ -844,7 +917,7 @@ add_port_data(struct impl *this, void *out, size_t outsize, struct port *port, i
 	len1 = SPA_MIN(outsize, maxsize - offset);
 	len2 = outsize - len1;
 
-	if (volume < 0.001 || mute) {
+	if (port_is_silent(port)) {
 		/* silence, for the first layer clear, otherwise do nothing */
 		if (layer == 0) {
 			this->clear(out, len1);
@@ -867,25 +940,95 @@ add_port_data(struct impl *this, void *out, size_t outsize, struct port *port, i
 			mix(out + len1, data, len2);
 	}
 
-	port->queued_bytes -= outsize;
+	consume_port_data(this, port, outsize);
+}
 
-	if (port->queued_bytes == 0) {
-		spa_log_trace(this->log, NAME " %p: return buffer %d on port %p %zd",
-			      this, b->outbuf->id, port, outsize);
-		port->io->buffer_id = b->outbuf->id;
-		spa_list_remove(&b->link);
-		b->outstanding = true;
-	} else {
-		spa_log_trace(this->log, NAME " %p: keeping buffer %d on port %p %zd %zd",
-			      this, b->outbuf->id, port, port->queued_bytes, outsize);
+/* mix all ports in one pass over the output, split in parts where one of
+ * the input ringbuffers wraps around */
+static void
+mix_ports(struct impl *this, void *out, size_t outsize, struct port **ports, uint32_t n_ports)
+{
+	const void *src[MAX_PORTS];
+	double volume[MAX_PORTS];
+	uint32_t i, n_src, avail;
+	size_t size;
+
+	while (outsize > 0) {
+		size = outsize;
+
+		for (i = 0, n_src = 0; i < n_ports; i++) {
+			void *data = get_port_data(this, ports[i], &avail);
+
+			size = SPA_MIN(size, avail);
+
+			if (port_is_silent(ports[i]))
+				continue;
+
+			src[n_src] = data;
+			volume[n_src++] = *ports[i]->io_volume;
+		}
+
+		spa_audiomixer_mix_n(&this->ops, this->fmt, out, src, volume, n_src, size);
+
+		for (i = 0; i < n_ports; i++)
+			consume_port_data(this, ports[i], size);
+
+		out = SPA_MEMBER(out, size, void);
+		outsize -= size;
 	}
 }
 
+static void scale_in_place(struct impl *this, struct port *port, void *data, uint32_t size)
+{
+	double volume = *port->io_volume;
+
+	if (port_is_silent(port))
+		this->clear(data, size);
+	else if (volume < 0.999 || volume > 1.001)
+		this->copy_scale(data, data, volume, size);
+}
+
+/* apply the port volume to the input buffer and pass it on to the output,
+ * the buffer is given back to the input when the output recycles it */
+static int forward_in_place(struct impl *this, struct port *inport)
+{
+	struct port *outport = GET_OUT_PORT(this, 0);
+	struct spa_io_buffers *inio = inport->io, *outio = outport->io;
+	struct buffer *b;
+	struct spa_data *d;
+	uint32_t maxsize, size, offset, len1;
+
+	if (inio->status != SPA_STATUS_HAVE_BUFFER || inio->buffer_id >= inport->n_buffers)
+		return SPA_STATUS_NEED_BUFFER;
+
+	b = &inport->buffers[inio->buffer_id];
+	d = b->outbuf->datas;
+
+	maxsize = d[0].maxsize;
+	size = SPA_MIN(d[0].chunk->size, maxsize);
+	offset = d[0].chunk->offset % maxsize;
+	len1 = SPA_MIN(size, maxsize - offset);
+
+	scale_in_place(this, inport, SPA_MEMBER(d[0].data, offset, void), len1);
+	if (size > len1)
+		scale_in_place(this, inport, d[0].data, size - len1);
+
+	spa_log_trace(this->log, NAME " %p: forward buffer %d in place", this, b->outbuf->id);
+
+	inio->buffer_id = SPA_ID_INVALID;
+	inio->status = SPA_STATUS_OK;
+
+	outio->buffer_id = b->outbuf->id;
+	outio->status = SPA_STATUS_HAVE_BUFFER;
+
+	return SPA_STATUS_HAVE_BUFFER;
+}
+
 static int mix_output(struct impl *this, size_t n_bytes)
 {
 	struct buffer *outbuf;
-	int i, layer;
-	struct port *outport;
+	int i, layer, n_ports;
+	struct port *outport, *ports[MAX_PORTS];
 	struct spa_io_buffers *outio;
 	struct spa_data *od;
 	uint32_t avail, index, maxsize, len1, len2, offset;
@@ -916,7 +1059,7 @@ static int mix_output(struct impl *this, size_t n_bytes)
 	spa_log_trace(this->log, NAME " %p: dequeue output buffer %d %zd %d %d %d",
 		      this, outbuf->outbuf->id, n_bytes, offset, len1, len2);
 
-	for (layer = 0, i = 0; i < this->last_port; i++) {
+	for (n_ports = 0, i = 0; i < this->last_port; i++) {
 		struct port *in_port = GET_IN_PORT(this, i);
 
 		if (in_port->io == NULL || in_port->n_buffers == 0)
@@ -926,11 +1069,20 @@ static int mix_output(struct impl *this, size_t n_bytes)
 			spa_log_warn(this->log, NAME " %p: underrun stream %d", this, i);
 			continue;
 		}
+		ports[n_ports++] = in_port;
+	}
 
-		add_port_data(this, SPA_MEMBER(od[0].data, offset, void), len1, in_port, layer);
+	if (n_ports > 2) {
+		mix_ports(this, SPA_MEMBER(od[0].data, offset, void), len1, ports, n_ports);
 		if (len2 > 0)
-			add_port_data(this, od[0].data, len2, in_port, layer);
-		layer++;
+			mix_ports(this, od[0].data, len2, ports, n_ports);
+	} else {
+		for (layer = 0; layer < n_ports; layer++) {
+			add_port_data(this, SPA_MEMBER(od[0].data, offset, void), len1,
+				      ports[layer], layer);
+			if (len2 > 0)
+				add_port_data(this, od[0].data, len2, ports[layer], layer);
+		}
 	}
 
 	od[0].chunk->offset = index;
@@ -962,6 +1114,9 @@ static int impl_node_process_input(struct spa_node *node)
 	if (outio->status == SPA_STATUS_HAVE_BUFFER)
 		return SPA_STATUS_HAVE_BUFFER;
 
+	if (this->in_place && GET_IN_PORT(this, 0)->io != NULL)
+		return outio->status = forward_in_place(this, GET_IN_PORT(this, 0));
+
 	for (i = 0; i < this->last_port; i++) {
 		struct port *inport = GET_IN_PORT(this, i);
 		struct spa_io_buffers *inio;
@@ -1023,9 +1178,12 @@ static int impl_node_process_output(struct spa_node *node)
 	if (outio->status == SPA_STATUS_HAVE_BUFFER)
 		return SPA_STATUS_HAVE_BUFFER;
 
-	/* recycle */
+	/* recycle, in-place buffers go back to the input */
 	if (outio->buffer_id < outport->n_buffers) {
-		recycle_buffer(this, outio->buffer_id);
+		if (this->in_place && GET_IN_PORT(this, 0)->io != NULL)
+			GET_IN_PORT(this, 0)->io->buffer_id = outio->buffer_id;
+		else
+			recycle_buffer(this, outio->buffer_id);
 		outio->buffer_id = SPA_ID_INVALID;
 	}
 	/* produce more output if possible */
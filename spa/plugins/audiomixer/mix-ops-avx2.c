@@ -0,0 +1,159 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include <immintrin.h>
+
+#include "mix-ops.h"
+
+void
+add_s16_avx2(void *dst, const void *src, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = n_bytes / sizeof(int16_t);
+	int32_t t;
+
+	for (n = 0; n + 16 <= n_samples; n += 16) {
+		__m256i in = _mm256_loadu_si256((const __m256i *) &s[n]);
+		__m256i out = _mm256_loadu_si256((const __m256i *) &d[n]);
+		_mm256_storeu_si256((__m256i *) &d[n], _mm256_adds_epi16(out, in));
+	}
+	for (; n < n_samples; n++) {
+		t = d[n] + s[n];
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+void
+add_f32_avx2(void *dst, const void *src, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+
+	for (n = 0; n + 16 <= n_samples; n += 16) {
+		__m256 in0 = _mm256_loadu_ps(&s[n]);
+		__m256 in1 = _mm256_loadu_ps(&s[n + 8]);
+		__m256 out0 = _mm256_loadu_ps(&d[n]);
+		__m256 out1 = _mm256_loadu_ps(&d[n + 8]);
+		_mm256_storeu_ps(&d[n], _mm256_add_ps(out0, in0));
+		_mm256_storeu_ps(&d[n + 8], _mm256_add_ps(out1, in1));
+	}
+	for (; n < n_samples; n++)
+		d[n] += s[n];
+}
+
+/* packs_epi32 works per 128 bit lane, reorder the 64 bit quads afterwards
+ * so that the samples end up in their original order */
+static inline __m256i
+pack_s32x16(__m256i lo, __m256i hi)
+{
+	return _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xd8);
+}
+
+void
+copy_scale_s16_avx2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = n_bytes / sizeof(int16_t);
+	int32_t v = scale * (1 << 11), t;
+	__m256i vol = _mm256_set1_epi32(v);
+
+	for (n = 0; n + 16 <= n_samples; n += 16) {
+		__m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) &s[n]));
+		__m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) &s[n + 8]));
+
+		lo = _mm256_srai_epi32(_mm256_mullo_epi32(lo, vol), 11);
+		hi = _mm256_srai_epi32(_mm256_mullo_epi32(hi, vol), 11);
+		_mm256_storeu_si256((__m256i *) &d[n], pack_s32x16(lo, hi));
+	}
+	for (; n < n_samples; n++) {
+		t = (s[n] * v) >> 11;
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+void
+copy_scale_f32_avx2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+	float v = scale;
+	__m256 vol = _mm256_set1_ps(v);
+
+	for (n = 0; n + 16 <= n_samples; n += 16) {
+		__m256 in0 = _mm256_loadu_ps(&s[n]);
+		__m256 in1 = _mm256_loadu_ps(&s[n + 8]);
+		_mm256_storeu_ps(&d[n], _mm256_mul_ps(in0, vol));
+		_mm256_storeu_ps(&d[n + 8], _mm256_mul_ps(in1, vol));
+	}
+	for (; n < n_samples; n++)
+		d[n] = s[n] * v;
+}
+
+void
+add_scale_s16_avx2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = n_bytes / sizeof(int16_t);
+	int32_t v = scale * (1 << 11), t;
+	__m256i vol = _mm256_set1_epi32(v);
+
+	for (n = 0; n + 16 <= n_samples; n += 16) {
+		__m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) &s[n]));
+		__m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) &s[n + 8]));
+		__m256i olo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) &d[n]));
+		__m256i ohi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) &d[n + 8]));
+
+		lo = _mm256_srai_epi32(_mm256_mullo_epi32(lo, vol), 11);
+		hi = _mm256_srai_epi32(_mm256_mullo_epi32(hi, vol), 11);
+		lo = _mm256_add_epi32(lo, olo);
+		hi = _mm256_add_epi32(hi, ohi);
+		_mm256_storeu_si256((__m256i *) &d[n], pack_s32x16(lo, hi));
+	}
+	for (; n < n_samples; n++) {
+		t = d[n] + ((s[n] * v) >> 11);
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+void
+add_scale_f32_avx2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+	float v = scale;
+	__m256 vol = _mm256_set1_ps(v);
+
+	for (n = 0; n + 16 <= n_samples; n += 16) {
+		__m256 in0 = _mm256_loadu_ps(&s[n]);
+		__m256 in1 = _mm256_loadu_ps(&s[n + 8]);
+		__m256 out0 = _mm256_loadu_ps(&d[n]);
+		__m256 out1 = _mm256_loadu_ps(&d[n + 8]);
+		_mm256_storeu_ps(&d[n], _mm256_add_ps(out0, _mm256_mul_ps(in0, vol)));
+		_mm256_storeu_ps(&d[n + 8], _mm256_add_ps(out1, _mm256_mul_ps(in1, vol)));
+	}
+	for (; n < n_samples; n++)
+		d[n] += s[n] * v;
+}
@@ -0,0 +1,134 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include <arm_neon.h>
+
+#include "mix-ops.h"
+
+void
+add_s16_neon(void *dst, const void *src, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = n_bytes / sizeof(int16_t);
+	int32_t t;
+
+	for (n = 0; n + 8 <= n_samples; n += 8)
+		vst1q_s16(&d[n], vqaddq_s16(vld1q_s16(&d[n]), vld1q_s16(&s[n])));
+
+	for (; n < n_samples; n++) {
+		t = d[n] + s[n];
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+void
+add_f32_neon(void *dst, const void *src, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+
+	for (n = 0; n + 4 <= n_samples; n += 4)
+		vst1q_f32(&d[n], vaddq_f32(vld1q_f32(&d[n]), vld1q_f32(&s[n])));
+
+	for (; n < n_samples; n++)
+		d[n] += s[n];
+}
+
+void
+copy_scale_s16_neon(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = n_bytes / sizeof(int16_t);
+	int32_t v = scale * (1 << 11), t;
+	int32x4_t vol = vdupq_n_s32(v);
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		int16x8_t in = vld1q_s16(&s[n]);
+		int32x4_t lo = vmulq_s32(vmovl_s16(vget_low_s16(in)), vol);
+		int32x4_t hi = vmulq_s32(vmovl_s16(vget_high_s16(in)), vol);
+
+		lo = vshrq_n_s32(lo, 11);
+		hi = vshrq_n_s32(hi, 11);
+		vst1q_s16(&d[n], vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+	}
+	for (; n < n_samples; n++) {
+		t = (s[n] * v) >> 11;
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+void
+copy_scale_f32_neon(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+	float v = scale;
+
+	for (n = 0; n + 4 <= n_samples; n += 4)
+		vst1q_f32(&d[n], vmulq_n_f32(vld1q_f32(&s[n]), v));
+
+	for (; n < n_samples; n++)
+		d[n] = s[n] * v;
+}
+
+void
+add_scale_s16_neon(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = n_bytes / sizeof(int16_t);
+	int32_t v = scale * (1 << 11), t;
+	int32x4_t vol = vdupq_n_s32(v);
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		int16x8_t in = vld1q_s16(&s[n]);
+		int16x8_t out = vld1q_s16(&d[n]);
+		int32x4_t lo = vmulq_s32(vmovl_s16(vget_low_s16(in)), vol);
+		int32x4_t hi = vmulq_s32(vmovl_s16(vget_high_s16(in)), vol);
+
+		lo = vaddq_s32(vshrq_n_s32(lo, 11), vmovl_s16(vget_low_s16(out)));
+		hi = vaddq_s32(vshrq_n_s32(hi, 11), vmovl_s16(vget_high_s16(out)));
+		vst1q_s16(&d[n], vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+	}
+	for (; n < n_samples; n++) {
+		t = d[n] + ((s[n] * v) >> 11);
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+void
+add_scale_f32_neon(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+	float v = scale;
+
+	/* no fused multiply-add, keep the same rounding as the C version */
+	for (n = 0; n + 4 <= n_samples; n += 4)
+		vst1q_f32(&d[n], vaddq_f32(vld1q_f32(&d[n]), vmulq_n_f32(vld1q_f32(&s[n]), v)));
+
+	for (; n < n_samples; n++)
+		d[n] += s[n] * v;
+}
@@ -0,0 +1,335 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include <emmintrin.h>
+
+#include "mix-ops.h"
+
+void
+add_s16_sse2(void *dst, const void *src, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = n_bytes / sizeof(int16_t);
+	int32_t t;
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		__m128i in = _mm_loadu_si128((const __m128i *) &s[n]);
+		__m128i out = _mm_loadu_si128((const __m128i *) &d[n]);
+		_mm_storeu_si128((__m128i *) &d[n], _mm_adds_epi16(out, in));
+	}
+	for (; n < n_samples; n++) {
+		t = d[n] + s[n];
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+void
+add_f32_sse2(void *dst, const void *src, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		__m128 in0 = _mm_loadu_ps(&s[n]);
+		__m128 in1 = _mm_loadu_ps(&s[n + 4]);
+		__m128 out0 = _mm_loadu_ps(&d[n]);
+		__m128 out1 = _mm_loadu_ps(&d[n + 4]);
+		_mm_storeu_ps(&d[n], _mm_add_ps(out0, in0));
+		_mm_storeu_ps(&d[n + 4], _mm_add_ps(out1, in1));
+	}
+	for (; n < n_samples; n++)
+		d[n] += s[n];
+}
+
+/* multiply 8 samples with the 16 bit fixed point volume, the 32 bit
+ * products are shifted back and returned in two vectors */
+static inline void
+scale_s16x8(__m128i in, __m128i vol, __m128i *lo, __m128i *hi)
+{
+	__m128i pl = _mm_mullo_epi16(in, vol);
+	__m128i ph = _mm_mulhi_epi16(in, vol);
+
+	*lo = _mm_srai_epi32(_mm_unpacklo_epi16(pl, ph), 11);
+	*hi = _mm_srai_epi32(_mm_unpackhi_epi16(pl, ph), 11);
+}
+
+void
+copy_scale_s16_sse2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n = 0, n_samples = n_bytes / sizeof(int16_t);
+	int32_t v = scale * (1 << 11), t;
+
+	/* the volume needs to fit in 16 bits for the vector multiply */
+	if (v >= INT16_MIN && v <= INT16_MAX) {
+		__m128i vol = _mm_set1_epi16(v), lo, hi;
+
+		for (; n + 8 <= n_samples; n += 8) {
+			__m128i in = _mm_loadu_si128((const __m128i *) &s[n]);
+			scale_s16x8(in, vol, &lo, &hi);
+			_mm_storeu_si128((__m128i *) &d[n], _mm_packs_epi32(lo, hi));
+		}
+	}
+	for (; n < n_samples; n++) {
+		t = (s[n] * v) >> 11;
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+void
+copy_scale_f32_sse2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+	float v = scale;
+	__m128 vol = _mm_set1_ps(v);
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		__m128 in0 = _mm_loadu_ps(&s[n]);
+		__m128 in1 = _mm_loadu_ps(&s[n + 4]);
+		_mm_storeu_ps(&d[n], _mm_mul_ps(in0, vol));
+		_mm_storeu_ps(&d[n + 4], _mm_mul_ps(in1, vol));
+	}
+	for (; n < n_samples; n++)
+		d[n] = s[n] * v;
+}
+
+void
+add_scale_s16_sse2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n = 0, n_samples = n_bytes / sizeof(int16_t);
+	int32_t v = scale * (1 << 11), t;
+
+	if (v >= INT16_MIN && v <= INT16_MAX) {
+		__m128i vol = _mm_set1_epi16(v), lo, hi;
+
+		for (; n + 8 <= n_samples; n += 8) {
+			__m128i in = _mm_loadu_si128((const __m128i *) &s[n]);
+			__m128i out = _mm_loadu_si128((const __m128i *) &d[n]);
+
+			scale_s16x8(in, vol, &lo, &hi);
+			/* sign extend the destination to 32 bits */
+			lo = _mm_add_epi32(lo, _mm_srai_epi32(_mm_unpacklo_epi16(out, out), 16));
+			hi = _mm_add_epi32(hi, _mm_srai_epi32(_mm_unpackhi_epi16(out, out), 16));
+			_mm_storeu_si128((__m128i *) &d[n], _mm_packs_epi32(lo, hi));
+		}
+	}
+	for (; n < n_samples; n++) {
+		t = d[n] + ((s[n] * v) >> 11);
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+void
+add_scale_f32_sse2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+	float v = scale;
+	__m128 vol = _mm_set1_ps(v);
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		__m128 in0 = _mm_loadu_ps(&s[n]);
+		__m128 in1 = _mm_loadu_ps(&s[n + 4]);
+		__m128 out0 = _mm_loadu_ps(&d[n]);
+		__m128 out1 = _mm_loadu_ps(&d[n + 4]);
+		_mm_storeu_ps(&d[n], _mm_add_ps(out0, _mm_mul_ps(in0, vol)));
+		_mm_storeu_ps(&d[n + 4], _mm_add_ps(out1, _mm_mul_ps(in1, vol)));
+	}
+	for (; n < n_samples; n++)
+		d[n] += s[n] * v;
+}
+
+void
+copy_volume_f32_sse2(void *dst, const void *src, const float *volumes, int n_channels, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n = 0, n_samples = n_bytes / sizeof(float);
+
+	/* with 1, 2 or 4 channels the volumes repeat in every vector */
+	if (n_channels == 1 || n_channels == 2 || n_channels == 4) {
+		__m128 vol = _mm_setr_ps(volumes[0],
+					 volumes[1 % n_channels],
+					 volumes[2 % n_channels],
+					 volumes[3 % n_channels]);
+
+		for (; n + 4 <= n_samples; n += 4)
+			_mm_storeu_ps(&d[n], _mm_mul_ps(_mm_loadu_ps(&s[n]), vol));
+	}
+	for (; n < n_samples; n++)
+		d[n] = s[n] * volumes[n % n_channels];
+}
+
+void
+copy_volume_s16_sse2(void *dst, const void *src, const float *volumes, int n_channels, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int i, n = 0, n_samples = n_bytes / sizeof(int16_t), n_v = SPA_MAX(n_channels, 8);
+	int32_t v[n_v], t;
+	bool fits = true;
+
+	for (i = 0; i < n_v; i++) {
+		v[i] = volumes[i % n_channels] * (1 << 11);
+		if (v[i] < INT16_MIN || v[i] > INT16_MAX)
+			fits = false;
+	}
+
+	/* with 1, 2, 4 or 8 channels the volumes repeat in every vector */
+	if (fits && 8 % n_channels == 0) {
+		__m128i vol = _mm_setr_epi16(v[0], v[1], v[2], v[3],
+					     v[4], v[5], v[6], v[7]), lo, hi;
+
+		for (; n + 8 <= n_samples; n += 8) {
+			__m128i in = _mm_loadu_si128((const __m128i *) &s[n]);
+			scale_s16x8(in, vol, &lo, &hi);
+			_mm_storeu_si128((__m128i *) &d[n], _mm_packs_epi32(lo, hi));
+		}
+	}
+	for (; n < n_samples; n++) {
+		t = (s[n] * v[n % n_channels]) >> 11;
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+/* round down and saturate 2 doubles to the 2 low int32 of the result */
+static inline __m128i
+floor_s32x2(__m128d in)
+{
+	__m128i t, lt;
+
+	in = _mm_min_pd(_mm_max_pd(in, _mm_set1_pd(INT32_MIN)), _mm_set1_pd(INT32_MAX));
+	t = _mm_cvttpd_epi32(in);
+	/* truncation rounds negative values up, subtract 1 for those */
+	lt = _mm_castpd_si128(_mm_cmplt_pd(in, _mm_cvtepi32_pd(t)));
+	return _mm_add_epi32(t, _mm_shuffle_epi32(lt, _MM_SHUFFLE(3, 3, 2, 0)));
+}
+
+/* multiply 4 samples with the 16 bit fixed point volumes in vol_lo and
+ * vol_hi, already divided by 1 << 16. The products are exact in a double when
+ * the volume is below 1 << 21, rounding them down gives the same result as
+ * the shift of the plain C functions. */
+static inline __m128i
+scale_s32x4(__m128i in, __m128d vol_lo, __m128d vol_hi)
+{
+	__m128d lo = _mm_mul_pd(_mm_cvtepi32_pd(in), vol_lo);
+	__m128d hi = _mm_mul_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(in, _MM_SHUFFLE(1, 0, 3, 2))),
+				vol_hi);
+	return _mm_unpacklo_epi64(floor_s32x2(lo), floor_s32x2(hi));
+}
+
+#define S32_VOLUME_MAX	(1 << 21)
+
+void
+copy_scale_s32_sse2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int n = 0, n_samples = n_bytes / sizeof(int32_t);
+	int64_t v = scale * (1 << 16), t;
+
+	if (v > -S32_VOLUME_MAX && v < S32_VOLUME_MAX) {
+		__m128d vol = _mm_set1_pd(v / 65536.0);
+
+		for (; n + 4 <= n_samples; n += 4) {
+			__m128i in = _mm_loadu_si128((const __m128i *) &s[n]);
+			_mm_storeu_si128((__m128i *) &d[n], scale_s32x4(in, vol, vol));
+		}
+	}
+	for (; n < n_samples; n++) {
+		t = (s[n] * v) >> 16;
+		d[n] = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+	}
+}
+
+void
+copy_volume_s32_sse2(void *dst, const void *src, const float *volumes, int n_channels, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int i, n = 0, n_samples = n_bytes / sizeof(int32_t), n_v = SPA_MAX(n_channels, 4);
+	int64_t v[n_v], t;
+	bool fits = true;
+
+	for (i = 0; i < n_v; i++) {
+		v[i] = volumes[i % n_channels] * (1 << 16);
+		if (v[i] <= -S32_VOLUME_MAX || v[i] >= S32_VOLUME_MAX)
+			fits = false;
+	}
+
+	/* with 1, 2 or 4 channels the volumes repeat in every vector */
+	if (fits && 4 % n_channels == 0) {
+		__m128d vol_lo = _mm_setr_pd(v[0] / 65536.0, v[1] / 65536.0);
+		__m128d vol_hi = _mm_setr_pd(v[2] / 65536.0, v[3] / 65536.0);
+
+		for (; n + 4 <= n_samples; n += 4) {
+			__m128i in = _mm_loadu_si128((const __m128i *) &s[n]);
+			_mm_storeu_si128((__m128i *) &d[n], scale_s32x4(in, vol_lo, vol_hi));
+		}
+	}
+	for (; n < n_samples; n++) {
+		t = (s[n] * v[n % n_channels]) >> 16;
+		d[n] = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+	}
+}
+
+void
+copy_scale_f64_sse2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+	int n, n_samples = n_bytes / sizeof(double);
+	__m128d vol = _mm_set1_pd(scale);
+
+	for (n = 0; n + 4 <= n_samples; n += 4) {
+		__m128d in0 = _mm_loadu_pd(&s[n]);
+		__m128d in1 = _mm_loadu_pd(&s[n + 2]);
+		_mm_storeu_pd(&d[n], _mm_mul_pd(in0, vol));
+		_mm_storeu_pd(&d[n + 2], _mm_mul_pd(in1, vol));
+	}
+	for (; n < n_samples; n++)
+		d[n] = s[n] * scale;
+}
+
+void
+copy_volume_f64_sse2(void *dst, const void *src, const float *volumes, int n_channels, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+	int n = 0, n_samples = n_bytes / sizeof(double);
+
+	/* with 1 or 2 channels the volumes repeat in every vector */
+	if (n_channels == 1 || n_channels == 2) {
+		__m128d vol = _mm_setr_pd(volumes[0], volumes[1 % n_channels]);
+
+		for (; n + 2 <= n_samples; n += 2)
+			_mm_storeu_pd(&d[n], _mm_mul_pd(_mm_loadu_pd(&s[n]), vol));
+	}
+	for (; n < n_samples; n++)
+		d[n] = s[n] * volumes[n % n_channels];
+}
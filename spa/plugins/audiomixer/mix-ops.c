@@ -17,6 +17,11 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#if defined (__arm__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
 #include "mix-ops.h"
 
 static void
@@ -135,6 +140,194 @@ add_scale_f32(void *dst, const void *src, const double scale, int n_bytes)
 	}
 }
 
+static void
+clear_s32(void *dst, int n_bytes)
+{
+	memset(dst, 0, n_bytes);
+}
+
+static void
+clear_f64(void *dst, int n_bytes)
+{
+	memset(dst, 0, n_bytes);
+}
+
+static void
+copy_s32(void *dst, const void *src, int n_bytes)
+{
+	memcpy(dst, src, n_bytes);
+}
+
+static void
+copy_f64(void *dst, const void *src, int n_bytes)
+{
+	memcpy(dst, src, n_bytes);
+}
+
+static void
+add_s32(void *dst, const void *src, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = (int64_t) *d + *s;
+		*d = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+		d++;
+		s++;
+	}
+}
+
+static void
+add_f64(void *dst, const void *src, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+
+	n_bytes /= sizeof(double);
+	while (n_bytes--) {
+		*d += *s;
+		d++;
+		s++;
+	}
+}
+
+static void
+copy_scale_s32(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = (*s * v) >> 16;
+		*d = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+		d++;
+		s++;
+	}
+}
+
+static void
+copy_scale_f64(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+
+	n_bytes /= sizeof(double);
+	while (n_bytes--) {
+		*d = *s * scale;
+		d++;
+		s++;
+	}
+}
+
+static void
+add_scale_s32(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = *d + ((*s * v) >> 16);
+		*d = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+		d++;
+		s++;
+	}
+}
+
+static void
+add_scale_f64(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+
+	n_bytes /= sizeof(double);
+	while (n_bytes--) {
+		*d += *s * scale;
+		d++;
+		s++;
+	}
+}
+
+static void
+copy_volume_s16(void *dst, const void *src, const float *volumes, int n_channels, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int32_t v[n_channels], t;
+	int i, n_frames = n_bytes / (sizeof(int16_t) * n_channels);
+
+	for (i = 0; i < n_channels; i++)
+		v[i] = volumes[i] * (1 << 11);
+
+	while (n_frames--) {
+		for (i = 0; i < n_channels; i++) {
+			t = (*s * v[i]) >> 11;
+			*d = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+			d++;
+			s++;
+		}
+	}
+}
+
+static void
+copy_volume_f32(void *dst, const void *src, const float *volumes, int n_channels, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int i, n_frames = n_bytes / (sizeof(float) * n_channels);
+
+	while (n_frames--) {
+		for (i = 0; i < n_channels; i++) {
+			*d = *s * volumes[i];
+			d++;
+			s++;
+		}
+	}
+}
+
+static void
+copy_volume_s32(void *dst, const void *src, const float *volumes, int n_channels, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t v[n_channels], t;
+	int i, n_frames = n_bytes / (sizeof(int32_t) * n_channels);
+
+	for (i = 0; i < n_channels; i++)
+		v[i] = volumes[i] * (1 << 16);
+
+	while (n_frames--) {
+		for (i = 0; i < n_channels; i++) {
+			t = (*s * v[i]) >> 16;
+			*d = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+			d++;
+			s++;
+		}
+	}
+}
+
+static void
+copy_volume_f64(void *dst, const void *src, const float *volumes, int n_channels, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+	int i, n_frames = n_bytes / (sizeof(double) * n_channels);
+
+	while (n_frames--) {
+		for (i = 0; i < n_channels; i++) {
+			*d = *s * volumes[i];
+			d++;
+			s++;
+		}
+	}
+}
+
 static void
 copy_s16_i(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
 {
@@ -255,24 +448,139 @@ add_scale_f32_i(void *dst, int dst_stride, const void *src, int src_stride, cons
 	}
 }
 
-void spa_audiomixer_get_ops(struct spa_audiomixer_ops *ops)
+void spa_audiomixer_mix_n(const struct spa_audiomixer_ops *ops, int fmt,
+			  void *dst, const void *src[], const double volume[],
+			  uint32_t n_src, int n_bytes)
 {
+	int offset, size;
+	uint32_t i;
+
+	if (n_src == 0) {
+		ops->clear[fmt](dst, n_bytes);
+		return;
+	}
+
+	for (offset = 0; offset < n_bytes; offset += size) {
+		void *d = SPA_MEMBER(dst, offset, void);
+
+		size = SPA_MIN(n_bytes - offset, MIX_TILE_BYTES);
+
+		for (i = 0; i < n_src; i++) {
+			const void *s = SPA_MEMBER(src[i], offset, void);
+			double v = volume[i];
+
+			if (v < 0.999 || v > 1.001) {
+				if (i == 0)
+					ops->copy_scale[fmt](d, s, v, size);
+				else
+					ops->add_scale[fmt](d, s, v, size);
+			} else {
+				if (i == 0)
+					ops->copy[fmt](d, s, size);
+				else
+					ops->add[fmt](d, s, size);
+			}
+		}
+	}
+}
+
+uint32_t spa_audiomixer_get_cpu_flags(void)
+{
+	uint32_t flags = 0;
+
+#if defined (__i386__) || defined (__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		flags |= MIX_CPU_FLAG_SSE2;
+	if (__builtin_cpu_supports("avx2"))
+		flags |= MIX_CPU_FLAG_AVX2;
+#elif defined (__aarch64__)
+	flags |= MIX_CPU_FLAG_NEON;
+#elif defined (__arm__)
+	if (getauxval(AT_HWCAP) & HWCAP_NEON)
+		flags |= MIX_CPU_FLAG_NEON;
+#endif
+	return flags;
+}
+
+void spa_audiomixer_get_ops_for_cpu(struct spa_audiomixer_ops *ops, uint32_t cpu_flags)
+{
+	memset(ops, 0, sizeof(*ops));
+
 	ops->clear[FMT_S16] = clear_s16;
 	ops->clear[FMT_F32] = clear_f32;
 	ops->copy[FMT_S16] = copy_s16;
 	ops->copy[FMT_F32] = copy_f32;
-        ops->add[FMT_S16] = add_s16;
-        ops->add[FMT_F32] = add_f32;
-        ops->copy_scale[FMT_S16] = copy_scale_s16;
-        ops->copy_scale[FMT_F32] = copy_scale_f32;
-        ops->add_scale[FMT_S16] = add_scale_s16;
-        ops->add_scale[FMT_F32] = add_scale_f32;
-        ops->copy_i[FMT_S16] = copy_s16_i;
-        ops->copy_i[FMT_F32] = copy_f32_i;
-        ops->add_i[FMT_S16] = add_s16_i;
-        ops->add_i[FMT_F32] = add_f32_i;
-        ops->copy_scale_i[FMT_S16] = copy_scale_s16_i;
-        ops->copy_scale_i[FMT_F32] = copy_scale_f32_i;
-        ops->add_scale_i[FMT_S16] = add_scale_s16_i;
-        ops->add_scale_i[FMT_F32] = add_scale_f32_i;
+	ops->add[FMT_S16] = add_s16;
+	ops->add[FMT_F32] = add_f32;
+	ops->copy_scale[FMT_S16] = copy_scale_s16;
+	ops->copy_scale[FMT_F32] = copy_scale_f32;
+	ops->add_scale[FMT_S16] = add_scale_s16;
+	ops->add_scale[FMT_F32] = add_scale_f32;
+	ops->clear[FMT_S32] = clear_s32;
+	ops->clear[FMT_F64] = clear_f64;
+	ops->copy[FMT_S32] = copy_s32;
+	ops->copy[FMT_F64] = copy_f64;
+	ops->add[FMT_S32] = add_s32;
+	ops->add[FMT_F64] = add_f64;
+	ops->copy_scale[FMT_S32] = copy_scale_s32;
+	ops->copy_scale[FMT_F64] = copy_scale_f64;
+	ops->add_scale[FMT_S32] = add_scale_s32;
+	ops->add_scale[FMT_F64] = add_scale_f64;
+	ops->copy_volume[FMT_S16] = copy_volume_s16;
+	ops->copy_volume[FMT_F32] = copy_volume_f32;
+	ops->copy_volume[FMT_S32] = copy_volume_s32;
+	ops->copy_volume[FMT_F64] = copy_volume_f64;
+	ops->copy_i[FMT_S16] = copy_s16_i;
+	ops->copy_i[FMT_F32] = copy_f32_i;
+	ops->add_i[FMT_S16] = add_s16_i;
+	ops->add_i[FMT_F32] = add_f32_i;
+	ops->copy_scale_i[FMT_S16] = copy_scale_s16_i;
+	ops->copy_scale_i[FMT_F32] = copy_scale_f32_i;
+	ops->add_scale_i[FMT_S16] = add_scale_s16_i;
+	ops->add_scale_i[FMT_F32] = add_scale_f32_i;
+
+	/* the strided _i variants stay scalar, gathering with arbitrary
+	 * strides does not vectorize well */
+#if defined (HAVE_SSE2)
+	if (cpu_flags & MIX_CPU_FLAG_SSE2) {
+		ops->add[FMT_S16] = add_s16_sse2;
+		ops->add[FMT_F32] = add_f32_sse2;
+		ops->copy_scale[FMT_S16] = copy_scale_s16_sse2;
+		ops->copy_scale[FMT_F32] = copy_scale_f32_sse2;
+		ops->add_scale[FMT_S16] = add_scale_s16_sse2;
+		ops->add_scale[FMT_F32] = add_scale_f32_sse2;
+		ops->copy_volume[FMT_S16] = copy_volume_s16_sse2;
+		ops->copy_volume[FMT_F32] = copy_volume_f32_sse2;
+		ops->copy_scale[FMT_S32] = copy_scale_s32_sse2;
+		ops->copy_volume[FMT_S32] = copy_volume_s32_sse2;
+		ops->copy_scale[FMT_F64] = copy_scale_f64_sse2;
+		ops->copy_volume[FMT_F64] = copy_volume_f64_sse2;
+	}
+#endif
+#if defined (HAVE_AVX2)
+	if (cpu_flags & MIX_CPU_FLAG_AVX2) {
+		ops->add[FMT_S16] = add_s16_avx2;
+		ops->add[FMT_F32] = add_f32_avx2;
+		ops->copy_scale[FMT_S16] = copy_scale_s16_avx2;
+		ops->copy_scale[FMT_F32] = copy_scale_f32_avx2;
+		ops->add_scale[FMT_S16] = add_scale_s16_avx2;
+		ops->add_scale[FMT_F32] = add_scale_f32_avx2;
+	}
+#endif
+#if defined (HAVE_NEON)
+	if (cpu_flags & MIX_CPU_FLAG_NEON) {
+		ops->add[FMT_S16] = add_s16_neon;
+		ops->add[FMT_F32] = add_f32_neon;
+		ops->copy_scale[FMT_S16] = copy_scale_s16_neon;
+		ops->copy_scale[FMT_F32] = copy_scale_f32_neon;
+		ops->add_scale[FMT_S16] = add_scale_s16_neon;
+		ops->add_scale[FMT_F32] = add_scale_f32_neon;
+	}
+#endif
+}
+
+void spa_audiomixer_get_ops(struct spa_audiomixer_ops *ops)
+{
+	spa_audiomixer_get_ops_for_cpu(ops, spa_audiomixer_get_cpu_flags());
 }
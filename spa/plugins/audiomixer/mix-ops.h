@@ -25,6 +25,8 @@
 typedef void (*mix_clear_func_t) (void *dst, int n_bytes);
 typedef void (*mix_func_t) (void *dst, const void *src, int n_bytes);
 typedef void (*mix_scale_func_t) (void *dst, const void *src, const double scale, int n_bytes);
+typedef void (*mix_volume_func_t) (void *dst, const void *src, const float *volumes,
+				   int n_channels, int n_bytes);
 typedef void (*mix_i_func_t) (void *dst, int dst_stride,
 			      const void *src, int src_stride, int n_bytes);
 typedef void (*mix_scale_i_func_t) (void *dst, int dst_stride,
@@ -33,19 +35,78 @@ typedef void (*mix_scale_i_func_t) (void *dst, int dst_stride,
 enum {
 	FMT_S16,
 	FMT_F32,
+	FMT_S32,
+	FMT_F64,
 	FMT_MAX,
 };
 
+#define MIX_CPU_FLAG_SSE2	(1 << 0)
+#define MIX_CPU_FLAG_AVX2	(1 << 1)
+#define MIX_CPU_FLAG_NEON	(1 << 2)
+
 struct spa_audiomixer_ops {
 	mix_clear_func_t clear[FMT_MAX];
 	mix_func_t copy[FMT_MAX];
 	mix_func_t add[FMT_MAX];
 	mix_scale_func_t copy_scale[FMT_MAX];
 	mix_scale_func_t add_scale[FMT_MAX];
+	/* interleaved copy with a volume per channel */
+	mix_volume_func_t copy_volume[FMT_MAX];
+	/* the strided functions are only available for S16 and F32 */
 	mix_i_func_t copy_i[FMT_MAX];
 	mix_i_func_t add_i[FMT_MAX];
 	mix_scale_i_func_t copy_scale_i[FMT_MAX];
 	mix_scale_i_func_t add_scale_i[FMT_MAX];
 };
 
+/** size in bytes of the blocks that spa_audiomixer_mix_n() works on, small
+ * enough to keep the destination in the L1 cache while all sources are added */
+#define MIX_TILE_BYTES		4096
+
+/** get the cpu features that the mixer can use on this machine */
+uint32_t spa_audiomixer_get_cpu_flags(void);
+
+/** fill \a ops with the best functions available for \a cpu_flags,
+ * with 0 as \a cpu_flags, the plain C reference functions are used */
+void spa_audiomixer_get_ops_for_cpu(struct spa_audiomixer_ops *ops, uint32_t cpu_flags);
+
+/** fill \a ops with the best functions for the running cpu */
 void spa_audiomixer_get_ops(struct spa_audiomixer_ops *ops);
+
+/** mix \a n_src sources with \a volume into \a dst in one pass over the
+ * destination. The result is the same as a copy of the first source followed
+ * by an add of all the others but the destination is only streamed once. */
+void spa_audiomixer_mix_n(const struct spa_audiomixer_ops *ops, int fmt,
+			  void *dst, const void *src[], const double volume[],
+			  uint32_t n_src, int n_bytes);
+
+#if defined (HAVE_SSE2)
+void add_s16_sse2(void *dst, const void *src, int n_bytes);
+void add_f32_sse2(void *dst, const void *src, int n_bytes);
+void copy_scale_s16_sse2(void *dst, const void *src, const double scale, int n_bytes);
+void copy_scale_f32_sse2(void *dst, const void *src, const double scale, int n_bytes);
+void add_scale_s16_sse2(void *dst, const void *src, const double scale, int n_bytes);
+void add_scale_f32_sse2(void *dst, const void *src, const double scale, int n_bytes);
+void copy_volume_f32_sse2(void *dst, const void *src, const float *volumes, int n_channels, int n_bytes);
+void copy_volume_s16_sse2(void *dst, const void *src, const float *volumes, int n_channels, int n_bytes);
+void copy_scale_s32_sse2(void *dst, const void *src, const double scale, int n_bytes);
+void copy_volume_s32_sse2(void *dst, const void *src, const float *volumes, int n_channels, int n_bytes);
+void copy_scale_f64_sse2(void *dst, const void *src, const double scale, int n_bytes);
+void copy_volume_f64_sse2(void *dst, const void *src, const float *volumes, int n_channels, int n_bytes);
+#endif
+#if defined (HAVE_AVX2)
+void add_s16_avx2(void *dst, const void *src, int n_bytes);
+void add_f32_avx2(void *dst, const void *src, int n_bytes);
+void copy_scale_s16_avx2(void *dst, const void *src, const double scale, int n_bytes);
+void copy_scale_f32_avx2(void *dst, const void *src, const double scale, int n_bytes);
+void add_scale_s16_avx2(void *dst, const void *src, const double scale, int n_bytes);
+void add_scale_f32_avx2(void *dst, const void *src, const double scale, int n_bytes);
+#endif
+#if defined (HAVE_NEON)
+void add_s16_neon(void *dst, const void *src, int n_bytes);
+void add_f32_neon(void *dst, const void *src, int n_bytes);
+void copy_scale_s16_neon(void *dst, const void *src, const double scale, int n_bytes);
+void copy_scale_f32_neon(void *dst, const void *src, const double scale, int n_bytes);
+void add_scale_s16_neon(void *dst, const void *src, const double scale, int n_bytes);
+void add_scale_f32_neon(void *dst, const void *src, const double scale, int n_bytes);
+#endif
@@ -27,6 +27,8 @@
 #include <sys/timerfd.h>
 #include <sys/eventfd.h>
 #include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <pthread.h>
 
 #include <spa/support/loop.h>
@@ -36,21 +38,35 @@
 #include <spa/utils/list.h>
 #include <spa/utils/ringbuffer.h>
 
+#ifdef HAVE_IO_URING
+#include "uring.h"
+#endif
+
 #define NAME "loop"
 
 #define DATAS_SIZE (4096 * 8)
+#define ITEM_ALIGN 64
 
 /** \cond */
 
+/* completion of a blocking invoke, lives on the stack of the caller */
+struct invoke_sync {
+	int res;
+	int done;
+};
+
+/* items start on an ITEM_ALIGN boundary in the queue, the header always fits
+ * in the space up to the end of the queue memory, the data wraps around to the
+ * start when it does not fit after the header. */
 struct invoke_item {
-	size_t item_size;
-	spa_invoke_func_t func;
+	uint32_t item_size;
 	uint32_t seq;
+	spa_invoke_func_t func;
 	void *data;
 	size_t size;
-	bool block;
 	void *user_data;
-	int res;
+	struct invoke_sync *sync;
+	int committed;
 };
 
 struct type {
@@ -85,11 +101,33 @@ struct impl {
 	int epoll_fd;
 	pthread_t thread;
 
+#ifdef HAVE_IO_URING
+	/* io_uring backend, used instead of epoll when enabled */
+	bool use_uring;
+	struct spa_uring ring;
+	pthread_mutex_t ring_lock;
+	struct uring_poll *polls;
+	uint32_t n_polls;
+	bool fixed_files;
+	struct __kernel_timespec timeout_ts;
+	uint32_t timeout_gen;
+#endif
+
 	struct spa_source *wakeup;
-	int ack_fd;
+	int wakeup_pending;
+
+	/* all timer sources are kept in a min-heap ordered on their expiration
+	 * time, the loop timerfd is armed for the first one */
+	struct spa_source timer;
+	uint64_t timer_armed;
+	struct source_impl **timers;
+	uint32_t n_timers;
+	uint32_t max_timers;
+	/* number of timer sources, the heap has room for all of them */
+	uint32_t n_timer_sources;
 
 	struct spa_ringbuffer buffer;
-	uint8_t buffer_data[DATAS_SIZE];
+	uint8_t buffer_data[DATAS_SIZE] SPA_ALIGNED(ITEM_ALIGN);
 };
 
 struct source_impl {
@@ -108,7 +146,38 @@ struct source_impl {
 	} func;
 	int signal_number;
 	bool enabled;
+
+	uint64_t next;
+	uint64_t interval;
+	int32_t heap_index;
+};
+
+#ifdef HAVE_IO_URING
+#define URING_ENTRIES		256
+#define URING_MAX_FILES		1024
+
+/* user_data of the sqes: tag in the top 2 bits, then a generation and
+ * the fd */
+#define URING_TAG_POLL		0ULL
+#define URING_TAG_TIMEOUT	1ULL
+#define URING_TAG_OTHER		2ULL
+
+#define URING_DATA(tag,gen,fd)	(((tag) << 62) | ((uint64_t)((gen) & 0x3fffffff) << 32) | (uint32_t)(fd))
+#define URING_DATA_TAG(d)	((d) >> 62)
+#define URING_DATA_GEN(d)	((uint32_t)(((d) >> 32) & 0x3fffffff))
+#define URING_DATA_FD(d)	((uint32_t)(d))
+
+/* the poll registered for a fd, the generation changes whenever the poll
+ * is removed or updated so that stale completions are ignored */
+struct uring_poll {
+	struct spa_source *source;
+	uint32_t gen;
+	bool fixed;
+	bool multishot;
 };
+
+static const uint64_t uring_signal_count = 1;
+#endif
 /** \endcond */
 
 static inline uint32_t spa_io_to_epoll(enum spa_io mask)
@@ -143,12 +212,144 @@ static inline enum spa_io spa_epoll_to_io(uint32_t events)
 	return mask;
 }
 
+#ifdef HAVE_IO_URING
+static void source_event_func(struct spa_source *source);
+
+static int uring_queue_poll(struct impl *impl, int fd)
+{
+	struct uring_poll *p = &impl->polls[fd];
+	struct io_uring_sqe *sqe;
+
+	if ((sqe = spa_uring_get_sqe(&impl->ring)) == NULL)
+		return -EBUSY;
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	if (p->fixed)
+		sqe->flags |= IOSQE_FIXED_FILE;
+	sqe->poll32_events = spa_io_to_epoll(p->source->mask);
+	if (p->multishot)
+		sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = URING_DATA(URING_TAG_POLL, p->gen, fd);
+
+	return 0;
+}
+
+static int uring_queue_remove(struct impl *impl, int fd)
+{
+	struct uring_poll *p = &impl->polls[fd];
+	struct io_uring_sqe *sqe;
+
+	if ((sqe = spa_uring_get_sqe(&impl->ring)) == NULL)
+		return -EBUSY;
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = URING_DATA(URING_TAG_POLL, p->gen, fd);
+	sqe->user_data = URING_DATA(URING_TAG_OTHER, 0, fd);
+	p->gen++;
+
+	return 0;
+}
+
+/* sqes queued from another thread are submitted right away, the loop thread
+ * submits them with its next wait */
+static void uring_unlock(struct impl *impl)
+{
+	if (!pthread_equal(impl->thread, pthread_self()))
+		spa_uring_submit(&impl->ring);
+	pthread_mutex_unlock(&impl->ring_lock);
+}
+
+static int uring_add_source(struct impl *impl, struct spa_source *source)
+{
+	int res, fd = source->fd;
+	struct uring_poll *p;
+
+	pthread_mutex_lock(&impl->ring_lock);
+	if ((uint32_t)fd >= impl->n_polls) {
+		uint32_t n_polls = SPA_MAX(impl->n_polls * 2, 64u);
+		struct uring_poll *polls;
+
+		while (n_polls <= (uint32_t)fd)
+			n_polls *= 2;
+
+		if ((polls = realloc(impl->polls, n_polls * sizeof(struct uring_poll))) == NULL) {
+			res = -errno;
+			goto exit;
+		}
+		memset(&polls[impl->n_polls], 0,
+				(n_polls - impl->n_polls) * sizeof(struct uring_poll));
+		impl->polls = polls;
+		impl->n_polls = n_polls;
+	}
+	p = &impl->polls[fd];
+	if (p->source != NULL) {
+		res = -EEXIST;
+		goto exit;
+	}
+	p->source = source;
+	p->gen++;
+	/* the loop reads the complete eventfd counter, we can use a multishot
+	 * poll for those. Other fds are polled with one-shot polls that are
+	 * rearmed after the callback, this keeps the level triggered behaviour
+	 * of the epoll loop. */
+	p->multishot = source->func == source_event_func;
+	p->fixed = false;
+	if (impl->fixed_files && fd < URING_MAX_FILES) {
+		struct io_uring_files_update up = { .offset = fd, .fds = (uint64_t)(uintptr_t)&fd };
+		p->fixed = spa_uring_register(&impl->ring,
+				IORING_REGISTER_FILES_UPDATE, &up, 1) == 1;
+	}
+	res = uring_queue_poll(impl, fd);
+
+      exit:
+	uring_unlock(impl);
+	return res;
+}
+
+static int uring_update_source(struct impl *impl, struct spa_source *source)
+{
+	int res;
+
+	pthread_mutex_lock(&impl->ring_lock);
+	if ((res = uring_queue_remove(impl, source->fd)) == 0)
+		res = uring_queue_poll(impl, source->fd);
+	uring_unlock(impl);
+
+	return res;
+}
+
+static void uring_remove_source(struct impl *impl, struct spa_source *source)
+{
+	int fd = source->fd;
+	struct uring_poll *p;
+
+	pthread_mutex_lock(&impl->ring_lock);
+	if ((uint32_t)fd < impl->n_polls && (p = &impl->polls[fd])->source == source) {
+		uring_queue_remove(impl, fd);
+		if (p->fixed) {
+			int none = -1;
+			struct io_uring_files_update up = { .offset = fd,
+				.fds = (uint64_t)(uintptr_t)&none };
+			spa_uring_register(&impl->ring, IORING_REGISTER_FILES_UPDATE, &up, 1);
+		}
+		p->source = NULL;
+	}
+	uring_unlock(impl);
+}
+#endif
+
 static int loop_add_source(struct spa_loop *loop, struct spa_source *source)
 {
 	struct impl *impl = SPA_CONTAINER_OF(loop, struct impl, loop);
 
 	source->loop = loop;
 
+#ifdef HAVE_IO_URING
+	if (impl->use_uring)
+		return source->fd != -1 ? uring_add_source(impl, source) : 0;
+#endif
 	if (source->fd != -1) {
 		struct epoll_event ep;
 
@@ -167,6 +368,10 @@ static int loop_update_source(struct spa_source *source)
 	struct spa_loop *loop = source->loop;
 	struct impl *impl = SPA_CONTAINER_OF(loop, struct impl, loop);
 
+#ifdef HAVE_IO_URING
+	if (impl->use_uring)
+		return source->fd != -1 ? uring_update_source(impl, source) : 0;
+#endif
 	if (source->fd != -1) {
 		struct epoll_event ep;
 
@@ -185,12 +390,106 @@ static void loop_remove_source(struct spa_source *source)
 	struct spa_loop *loop = source->loop;
 	struct impl *impl = SPA_CONTAINER_OF(loop, struct impl, loop);
 
+#ifdef HAVE_IO_URING
+	if (impl->use_uring) {
+		if (source->fd != -1)
+			uring_remove_source(impl, source);
+	} else
+#endif
 	if (source->fd != -1)
 		epoll_ctl(impl->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
 
 	source->loop = NULL;
 }
 
+static inline void sync_wait(struct invoke_sync *sync)
+{
+	while (__atomic_load_n(&sync->done, __ATOMIC_ACQUIRE) == 0)
+		syscall(SYS_futex, &sync->done, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0);
+}
+
+static inline void sync_complete(struct invoke_sync *sync, int res)
+{
+	sync->res = res;
+	__atomic_store_n(&sync->done, 1, __ATOMIC_RELEASE);
+	syscall(SYS_futex, &sync->done, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/* reserve space for an item with size bytes of data. Producers race for
+ * the write index with a CAS, the consumer only looks at an item after it
+ * was committed. */
+static struct invoke_item *queue_reserve(struct impl *impl, size_t size)
+{
+	int32_t filled;
+	uint32_t idx, offset, l0, item_size;
+	struct invoke_item *item;
+
+	if (size > DATAS_SIZE - ITEM_ALIGN)
+		return NULL;
+
+	filled = spa_ringbuffer_get_write_index(&impl->buffer, &idx);
+	do {
+		if (filled < 0 || filled > DATAS_SIZE) {
+			spa_log_warn(impl->log, NAME " %p: queue xrun %d", impl, filled);
+			return NULL;
+		}
+		offset = idx & (DATAS_SIZE - 1);
+		l0 = DATAS_SIZE - offset;
+
+		if (l0 >= sizeof(struct invoke_item) + size)
+			item_size = sizeof(struct invoke_item) + size;
+		else
+			item_size = l0 + size;
+		item_size = SPA_ROUND_UP_N(item_size, ITEM_ALIGN);
+
+		if (filled + item_size > DATAS_SIZE) {
+			spa_log_warn(impl->log, NAME " %p: queue full %d", impl,
+					DATAS_SIZE - filled);
+			return NULL;
+		}
+		/* on failure idx is updated with the new write index */
+		if (__atomic_compare_exchange_n(&impl->buffer.writeindex, &idx, idx + item_size,
+						false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			break;
+
+		filled = idx - __atomic_load_n(&impl->buffer.readindex, __ATOMIC_ACQUIRE);
+	} while (true);
+
+	item = SPA_MEMBER(impl->buffer_data, offset, struct invoke_item);
+	item->item_size = item_size;
+	if (l0 >= sizeof(struct invoke_item) + size)
+		item->data = SPA_MEMBER(item, sizeof(struct invoke_item), void);
+	else
+		item->data = impl->buffer_data;
+
+	return item;
+}
+
+/* make the item visible to the consumer and wake up the loop when it is
+ * not already going to look at the queue */
+static void queue_commit(struct impl *impl, struct invoke_item *item)
+{
+	__atomic_store_n(&item->committed, 1, __ATOMIC_RELEASE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (__atomic_exchange_n(&impl->wakeup_pending, 1, __ATOMIC_SEQ_CST) == 0)
+		spa_loop_utils_signal_event(&impl->utils, impl->wakeup);
+}
+
+/* clear the committed flag of all item positions in the consumed region so
+ * that stale data is never seen as a committed item */
+static void queue_release(struct impl *impl, uint32_t index, uint32_t item_size)
+{
+	uint32_t i;
+
+	for (i = 0; i < item_size; i += ITEM_ALIGN) {
+		struct invoke_item *item = SPA_MEMBER(impl->buffer_data,
+				(index + i) & (DATAS_SIZE - 1), struct invoke_item);
+		item->committed = 0;
+	}
+	spa_ringbuffer_read_update(&impl->buffer, index + item_size);
+}
+
 static int
 loop_invoke(struct spa_loop *loop,
 	    spa_invoke_func_t func,
@@ -203,57 +502,27 @@ loop_invoke(struct spa_loop *loop,
 	struct impl *impl = SPA_CONTAINER_OF(loop, struct impl, loop);
 	bool in_thread = pthread_equal(impl->thread, pthread_self());
 	struct invoke_item *item;
+	struct invoke_sync sync = { 0, 0 };
 	int res;
 
 	if (in_thread) {
 		res = func(loop, false, seq, data, size, user_data);
 	} else {
-		int32_t filled, avail;
-		uint32_t idx, offset, l0;
-
-		filled = spa_ringbuffer_get_write_index(&impl->buffer, &idx);
-		if (filled < 0 || filled > DATAS_SIZE) {
-			spa_log_warn(impl->log, NAME " %p: queue xrun %d", impl, filled);
+		if ((item = queue_reserve(impl, size)) == NULL)
 			return -EPIPE;
-		}
-		avail = DATAS_SIZE - filled;
-		if (avail < sizeof(struct invoke_item)) {
-			spa_log_warn(impl->log, NAME " %p: queue full %d", impl, avail);
-			return -EPIPE;
-		}
-		offset = idx & (DATAS_SIZE - 1);
 
-		l0 = DATAS_SIZE - offset;
-
-		item = SPA_MEMBER(impl->buffer_data, offset, struct invoke_item);
 		item->func = func;
 		item->seq = seq;
 		item->size = size;
-		item->block = block;
 		item->user_data = user_data;
-
-		if (l0 > sizeof(struct invoke_item) + size) {
-			item->data = SPA_MEMBER(item, sizeof(struct invoke_item), void);
-			item->item_size = sizeof(struct invoke_item) + size;
-			if (l0 < sizeof(struct invoke_item) + item->item_size)
-				item->item_size = l0;
-		} else {
-			item->data = impl->buffer_data;
-			item->item_size = l0 + size;
-		}
+		item->sync = block ? &sync : NULL;
 		memcpy(item->data, data, size);
 
-		spa_ringbuffer_write_update(&impl->buffer, idx + item->item_size);
-
-		spa_loop_utils_signal_event(&impl->utils, impl->wakeup);
+		queue_commit(impl, item);
 
 		if (block) {
-			uint64_t count = 1;
-			if (read(impl->ack_fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
-				spa_log_warn(impl->log, NAME " %p: failed to read event fd: %s",
-						impl, strerror(errno));
-
-			res = item->res;
+			sync_wait(&sync);
+			res = sync.res;
 		}
 		else {
 			if (seq != SPA_ID_INVALID)
@@ -270,19 +539,28 @@ static void wakeup_func(void *data, uint64_t count)
 	struct impl *impl = data;
 	uint32_t index;
 
+	/* producers that commit after this will signal us again */
+	__atomic_store_n(&impl->wakeup_pending, 0, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
 	while (spa_ringbuffer_get_read_index(&impl->buffer, &index) > 0) {
 		struct invoke_item *item =
 		    SPA_MEMBER(impl->buffer_data, index & (DATAS_SIZE - 1), struct invoke_item);
-		item->res = item->func(&impl->loop, true, item->seq, item->data, item->size,
+		uint32_t item_size;
+		int res;
+
+		/* reserved but not filled yet, the producer will wake us up */
+		if (__atomic_load_n(&item->committed, __ATOMIC_ACQUIRE) == 0)
+			break;
+
+		item_size = item->item_size;
+		res = item->func(&impl->loop, true, item->seq, item->data, item->size,
 			   item->user_data);
-		spa_ringbuffer_read_update(&impl->buffer, index + item->item_size);
 
-		if (item->block) {
-			uint64_t count = 1;
-			if (write(impl->ack_fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
-				spa_log_warn(impl->log, NAME " %p: failed to write event fd: %s",
-						impl, strerror(errno));
-		}
+		if (item->sync)
+			sync_complete(item->sync, res);
+
+		queue_release(impl, index, item_size);
 	}
 }
 
@@ -290,6 +568,10 @@ static int loop_get_fd(struct spa_loop_control *ctrl)
 {
 	struct impl *impl = SPA_CONTAINER_OF(ctrl, struct impl, control);
 
+#ifdef HAVE_IO_URING
+	if (impl->use_uring)
+		return impl->ring.fd;
+#endif
 	return impl->epoll_fd;
 }
 
@@ -316,6 +598,102 @@ static void loop_leave(struct spa_loop_control *ctrl)
 	impl->thread = 0;
 }
 
+static void dispatch_timers(struct impl *impl);
+
+#ifdef HAVE_IO_URING
+#define URING_MAX_EVENTS	64
+
+static int uring_iterate(struct impl *impl, int timeout)
+{
+	struct spa_uring *ring = &impl->ring;
+	struct io_uring_cqe *cqe;
+	struct {
+		struct spa_source *source;
+		uint32_t fd;
+		uint32_t gen;
+	} ev[URING_MAX_EVENTS];
+	int i, n_ev = 0, res;
+	uint32_t to_submit;
+	bool timers = false;
+
+	/* the sqes are only flushed with the lock, the enter submits the ones
+	 * we flushed here */
+	pthread_mutex_lock(&impl->ring_lock);
+	to_submit = spa_uring_flush(ring);
+	pthread_mutex_unlock(&impl->ring_lock);
+
+	spa_hook_list_call(&impl->hooks_list, struct spa_loop_control_hooks, before);
+
+	res = spa_uring_submit_and_wait(ring, to_submit, timeout);
+
+	spa_hook_list_call(&impl->hooks_list, struct spa_loop_control_hooks, after);
+
+	if (SPA_UNLIKELY(res < 0 && res != -ETIME && res != -EINTR && res != -EBUSY))
+		return -res;
+
+	/* like the epoll loop, first set all the rmasks, then call the callbacks */
+	pthread_mutex_lock(&impl->ring_lock);
+	while (n_ev < URING_MAX_EVENTS && (cqe = spa_uring_peek_cqe(ring)) != NULL) {
+		uint64_t data = cqe->user_data;
+		uint32_t fd = URING_DATA_FD(data), gen = URING_DATA_GEN(data);
+		struct uring_poll *p;
+
+		switch (URING_DATA_TAG(data)) {
+		case URING_TAG_POLL:
+			if (fd >= impl->n_polls || (p = &impl->polls[fd])->source == NULL ||
+			    (p->gen & 0x3fffffff) != gen)
+				break;
+			if (cqe->res < 0) {
+				spa_log_warn(impl->log, NAME " %p: poll fd %d error: %s",
+						impl, fd, strerror(-cqe->res));
+			} else {
+				p->source->rmask = spa_epoll_to_io(cqe->res);
+				ev[n_ev].source = p->source;
+				ev[n_ev].fd = fd;
+				ev[n_ev].gen = p->gen;
+				n_ev++;
+			}
+			/* one-shot or terminated multishot, queue it again, it is
+			 * submitted after the callbacks */
+			if (!(cqe->flags & IORING_CQE_F_MORE) && cqe->res != -ECANCELED)
+				uring_queue_poll(impl, fd);
+			break;
+		case URING_TAG_TIMEOUT:
+			if (gen == (impl->timeout_gen & 0x3fffffff))
+				impl->timer_armed = 0;
+			timers = true;
+			break;
+		default:
+			if (cqe->res < 0 && cqe->res != -ENOENT && cqe->res != -EALREADY)
+				spa_log_warn(impl->log, NAME " %p: operation on fd %d failed: %s",
+						impl, fd, strerror(-cqe->res));
+			break;
+		}
+		spa_uring_cqe_seen(ring);
+	}
+	pthread_mutex_unlock(&impl->ring_lock);
+
+	for (i = 0; i < n_ev; i++) {
+		struct spa_source *s = ev[i].source;
+		struct uring_poll *p;
+		bool valid;
+
+		/* skip sources removed or updated by an earlier callback */
+		pthread_mutex_lock(&impl->ring_lock);
+		p = &impl->polls[ev[i].fd];
+		valid = p->source == s && p->gen == ev[i].gen;
+		pthread_mutex_unlock(&impl->ring_lock);
+
+		if (valid && s->rmask && s->fd != -1)
+			s->func(s);
+	}
+	if (timers)
+		dispatch_timers(impl);
+
+	return 0;
+}
+#endif
+
 static int loop_iterate(struct spa_loop_control *ctrl, int timeout)
 {
 	struct impl *impl = SPA_CONTAINER_OF(ctrl, struct impl, control);
@@ -323,6 +701,18 @@ static int loop_iterate(struct spa_loop_control *ctrl, int timeout)
 	int i, nfds, save_errno = 0;
 	struct source_impl *source, *tmp;
 
+#ifdef HAVE_IO_URING
+	if (impl->use_uring) {
+		int res = uring_iterate(impl, timeout);
+
+		spa_list_for_each_safe(source, tmp, &impl->destroy_list, link)
+			free(source);
+		spa_list_init(&impl->destroy_list);
+
+		return res;
+	}
+#endif
+
 	spa_hook_list_call(&impl->hooks_list, struct spa_loop_control_hooks, before);
 
 	if (SPA_UNLIKELY((nfds = epoll_wait(impl->epoll_fd, ep, SPA_N_ELEMENTS(ep), timeout)) < 0))
@@ -491,21 +881,182 @@ static void loop_signal_event(struct spa_source *source)
 	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
 	uint64_t count = 1;
 
+#ifdef HAVE_IO_URING
+	/* from the loop thread, batch the write with the next submission */
+	if (impl->impl->use_uring && pthread_equal(impl->impl->thread, pthread_self())) {
+		struct io_uring_sqe *sqe;
+
+		pthread_mutex_lock(&impl->impl->ring_lock);
+		if ((sqe = spa_uring_get_sqe(&impl->impl->ring)) != NULL) {
+			sqe->opcode = IORING_OP_WRITE;
+			sqe->fd = source->fd;
+			sqe->addr = (uint64_t)(uintptr_t)&uring_signal_count;
+			sqe->len = sizeof(uint64_t);
+			sqe->off = -1;
+			sqe->user_data = URING_DATA(URING_TAG_OTHER, 0, source->fd);
+		}
+		pthread_mutex_unlock(&impl->impl->ring_lock);
+		if (sqe != NULL)
+			return;
+	}
+#endif
+
 	if (write(source->fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
 		spa_log_warn(impl->impl->log, NAME " %p: failed to write event fd %d: %s",
 				source, source->fd, strerror(errno));
 }
 
-static void source_timer_func(struct spa_source *source)
+static inline uint64_t get_time_ns(void)
 {
-	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_TIME(&now);
+}
+
+static inline void heap_set(struct impl *impl, uint32_t index, struct source_impl *s)
+{
+	impl->timers[index] = s;
+	s->heap_index = index;
+}
+
+static void heap_up(struct impl *impl, uint32_t index)
+{
+	struct source_impl *s = impl->timers[index];
+
+	while (index > 0) {
+		uint32_t parent = (index - 1) / 2;
+		if (impl->timers[parent]->next <= s->next)
+			break;
+		heap_set(impl, index, impl->timers[parent]);
+		index = parent;
+	}
+	heap_set(impl, index, s);
+}
+
+static void heap_down(struct impl *impl, uint32_t index)
+{
+	struct source_impl *s = impl->timers[index];
+
+	while (true) {
+		uint32_t child = 2 * index + 1;
+		if (child >= impl->n_timers)
+			break;
+		if (child + 1 < impl->n_timers &&
+		    impl->timers[child + 1]->next < impl->timers[child]->next)
+			child++;
+		if (s->next <= impl->timers[child]->next)
+			break;
+		heap_set(impl, index, impl->timers[child]);
+		index = child;
+	}
+	heap_set(impl, index, s);
+}
+
+static void heap_remove(struct impl *impl, struct source_impl *s)
+{
+	uint32_t index = s->heap_index;
+	struct source_impl *last;
+
+	s->heap_index = -1;
+	last = impl->timers[--impl->n_timers];
+	if (last == s)
+		return;
+
+	heap_set(impl, index, last);
+	if (index > 0 && impl->timers[(index - 1) / 2]->next > last->next)
+		heap_up(impl, index);
+	else
+		heap_down(impl, index);
+}
+
+/* only program the timerfd when the first timer expires before the time it
+ * is currently armed for. When it fires too early we simply rearm it. */
+static void arm_timer(struct impl *impl)
+{
+	struct itimerspec its;
+	uint64_t next;
+
+	if (impl->n_timers == 0)
+		return;
+
+	next = impl->timers[0]->next;
+	if (impl->timer_armed != 0 && impl->timer_armed <= next)
+		return;
+
+#ifdef HAVE_IO_URING
+	/* an absolute timeout request, a timeout armed earlier for a later time
+	 * will still complete and is ignored */
+	if (impl->use_uring) {
+		struct io_uring_sqe *sqe;
+
+		pthread_mutex_lock(&impl->ring_lock);
+		if ((sqe = spa_uring_get_sqe(&impl->ring)) != NULL) {
+			impl->timeout_ts.tv_sec = next / SPA_NSEC_PER_SEC;
+			impl->timeout_ts.tv_nsec = next % SPA_NSEC_PER_SEC;
+			sqe->opcode = IORING_OP_TIMEOUT;
+			sqe->fd = -1;
+			sqe->addr = (uint64_t)(uintptr_t)&impl->timeout_ts;
+			sqe->len = 1;
+			sqe->timeout_flags = IORING_TIMEOUT_ABS;
+			sqe->user_data = URING_DATA(URING_TAG_TIMEOUT, ++impl->timeout_gen, 0);
+			/* the timespec is read when submitting, do that now */
+			spa_uring_submit(&impl->ring);
+			impl->timer_armed = next;
+		}
+		pthread_mutex_unlock(&impl->ring_lock);
+		return;
+	}
+#endif
+
+	spa_zero(its);
+	/* 0 would disarm the timer, expire as soon as possible instead */
+	next = SPA_MAX(next, 1ULL);
+	its.it_value.tv_sec = next / SPA_NSEC_PER_SEC;
+	its.it_value.tv_nsec = next % SPA_NSEC_PER_SEC;
+
+	if (timerfd_settime(impl->timer.fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		spa_log_warn(impl->log, NAME " %p: failed to arm timer fd %d: %s",
+				impl, impl->timer.fd, strerror(errno));
+		return;
+	}
+	impl->timer_armed = next;
+}
+
+static void dispatch_timers(struct impl *impl)
+{
+	uint64_t expirations, now;
+
+	now = get_time_ns();
+
+	while (impl->n_timers > 0 && impl->timers[0]->next <= now) {
+		struct source_impl *s = impl->timers[0];
+
+		if (s->interval > 0) {
+			expirations = 1 + (now - s->next) / s->interval;
+			s->next += expirations * s->interval;
+			heap_down(impl, 0);
+		} else {
+			expirations = 1;
+			heap_remove(impl, s);
+		}
+		/* the callback can update or destroy any timer */
+		s->func.timer(s->source.data, expirations);
+	}
+	arm_timer(impl);
+}
+
+static void timer_dispatch(struct spa_source *source)
+{
+	struct impl *impl = source->data;
 	uint64_t expirations;
 
-	if (read(source->fd, &expirations, sizeof(uint64_t)) != sizeof(uint64_t))
-		spa_log_warn(impl->impl->log, NAME " %p: failed to read timer fd %d: %s",
-				source, source->fd, strerror(errno));
+	if (read(source->fd, &expirations, sizeof(uint64_t)) != sizeof(uint64_t) &&
+	    errno != EAGAIN)
+		spa_log_warn(impl->log, NAME " %p: failed to read timer fd %d: %s",
+				impl, source->fd, strerror(errno));
 
-	impl->func.timer(source->data, expirations);
+	impl->timer_armed = 0;
+	dispatch_timers(impl);
 }
 
 static struct spa_source *loop_add_timer(struct spa_loop_utils *utils,
@@ -514,20 +1065,32 @@ static struct spa_source *loop_add_timer(struct spa_loop_utils *utils,
 	struct impl *impl = SPA_CONTAINER_OF(utils, struct impl, utils);
 	struct source_impl *source;
 
+	/* make room in the heap now so that updating a timer never allocates */
+	if (impl->n_timer_sources + 1 > impl->max_timers) {
+		uint32_t max_timers = SPA_MAX(impl->max_timers * 2, 16u);
+		struct source_impl **timers;
+
+		timers = realloc(impl->timers, max_timers * sizeof(struct source_impl *));
+		if (timers == NULL)
+			return NULL;
+		impl->timers = timers;
+		impl->max_timers = max_timers;
+	}
+
 	source = calloc(1, sizeof(struct source_impl));
 	if (source == NULL)
 		return NULL;
 
 	source->source.loop = &impl->loop;
-	source->source.func = source_timer_func;
+	source->source.func = NULL;
 	source->source.data = data;
-	source->source.fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
-	source->source.mask = SPA_IO_IN;
+	source->source.fd = -1;
+	source->source.mask = 0;
 	source->impl = impl;
-	source->close = true;
+	source->close = false;
 	source->func.timer = func;
-
-	spa_loop_add_source(&impl->loop, &source->source);
+	source->heap_index = -1;
+	impl->n_timer_sources++;
 
 	spa_list_insert(&impl->source_list, &source->link);
 
@@ -538,23 +1101,39 @@ static int
 loop_update_timer(struct spa_source *source,
 		  struct timespec *value, struct timespec *interval, bool absolute)
 {
-	struct itimerspec its;
-	int flags = 0;
+	struct source_impl *s = SPA_CONTAINER_OF(source, struct source_impl, source);
+	struct impl *impl = s->impl;
+	uint64_t next = 0;
 
-	spa_zero(its);
 	if (value) {
-		its.it_value = *value;
+		next = SPA_TIMESPEC_TO_TIME(value);
 	} else if (interval) {
-		its.it_value = *interval;
+		/* start right away */
+		next = get_time_ns();
 		absolute = true;
 	}
-	if (interval)
-		its.it_interval = *interval;
-	if (absolute)
-		flags |= TFD_TIMER_ABSTIME;
+	s->interval = interval ? SPA_TIMESPEC_TO_TIME(interval) : 0;
 
-	if (timerfd_settime(source->fd, flags, &its, NULL) < 0)
-		return errno;
+	/* like timerfd, a 0 value disarms the timer */
+	if (next == 0) {
+		if (s->heap_index >= 0)
+			heap_remove(impl, s);
+		return 0;
+	}
+	if (!absolute)
+		next += get_time_ns();
+
+	s->next = next;
+
+	if (s->heap_index < 0) {
+		s->heap_index = impl->n_timers++;
+		impl->timers[s->heap_index] = s;
+		heap_up(impl, s->heap_index);
+	} else {
+		heap_up(impl, s->heap_index);
+		heap_down(impl, s->heap_index);
+	}
+	arm_timer(impl);
 
 	return 0;
 }
@@ -614,6 +1193,12 @@ static void loop_destroy_source(struct spa_source *source)
 
 	spa_list_remove(&impl->link);
 
+	if (source->func == NULL) {
+		if (impl->heap_index >= 0)
+			heap_remove(loop_impl, impl);
+		loop_impl->n_timer_sources--;
+	}
+
 	spa_loop_remove_source(source->loop, source);
 
 	if (source->fd != -1 && impl->close) {
@@ -690,18 +1275,62 @@ static int impl_clear(struct spa_handle *handle)
 	spa_list_for_each_safe(source, tmp, &impl->destroy_list, link)
 		free(source);
 
-	close(impl->ack_fd);
+	free(impl->timers);
+
+#ifdef HAVE_IO_URING
+	if (impl->use_uring) {
+		spa_uring_clear(&impl->ring);
+		pthread_mutex_destroy(&impl->ring_lock);
+		free(impl->polls);
+		return 0;
+	}
+#endif
+	spa_loop_remove_source(&impl->loop, &impl->timer);
+	close(impl->timer.fd);
+
 	close(impl->epoll_fd);
 
 	return 0;
 }
 
+#ifdef HAVE_IO_URING
+static int init_uring(struct impl *impl)
+{
+	int res, *fds;
+	uint32_t i;
+
+	if ((res = spa_uring_init(&impl->ring, URING_ENTRIES)) < 0) {
+		spa_log_error(impl->log, NAME " %p: can't set up io_uring: %s",
+				impl, strerror(-res));
+		return res;
+	}
+	pthread_mutex_init(&impl->ring_lock, NULL);
+
+	/* register a sparse table of fixed files, the fd of a source is used
+	 * as the index in the table */
+	if ((fds = malloc(URING_MAX_FILES * sizeof(int))) != NULL) {
+		for (i = 0; i < URING_MAX_FILES; i++)
+			fds[i] = -1;
+		impl->fixed_files = spa_uring_register(&impl->ring,
+				IORING_REGISTER_FILES, fds, URING_MAX_FILES) == 0;
+		free(fds);
+	}
+	spa_log_info(impl->log, NAME " %p: io_uring features %08x, fixed files %d",
+			impl, impl->ring.features, impl->fixed_files);
+
+	impl->use_uring = true;
+	impl->epoll_fd = -1;
+
+	return 0;
+}
+#endif
+
 static int
-impl_init(const struct spa_handle_factory *factory,
+init_loop(const struct spa_handle_factory *factory,
 	  struct spa_handle *handle,
-	  const struct spa_dict *info,
 	  const struct spa_support *support,
-	  uint32_t n_support)
+	  uint32_t n_support,
+	  bool uring)
 {
 	struct impl *impl;
 	uint32_t i;
@@ -729,8 +1358,14 @@ impl_init(const struct spa_handle_factory *factory,
 	}
 	init_type(&impl->type, impl->map);
 
-	impl->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
-	if (impl->epoll_fd == -1)
+#ifdef HAVE_IO_URING
+	if (uring) {
+		int res;
+		if ((res = init_uring(impl)) < 0)
+			return res;
+	} else
+#endif
+	if ((impl->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1)
 		return errno;
 
 	spa_list_init(&impl->source_list);
@@ -738,15 +1373,51 @@ impl_init(const struct spa_handle_factory *factory,
 	spa_hook_list_init(&impl->hooks_list);
 
 	spa_ringbuffer_init(&impl->buffer);
+	memset(impl->buffer_data, 0, sizeof(impl->buffer_data));
+	impl->wakeup_pending = 0;
 
 	impl->wakeup = spa_loop_utils_add_event(&impl->utils, wakeup_func, impl);
-	impl->ack_fd = eventfd(0, EFD_CLOEXEC);
+
+	impl->timer_armed = 0;
+	impl->timers = NULL;
+	impl->n_timers = impl->max_timers = impl->n_timer_sources = 0;
+
+	/* the io_uring loop uses timeout requests instead of a timerfd */
+	if (!uring) {
+		impl->timer.func = timer_dispatch;
+		impl->timer.data = impl;
+		impl->timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+		impl->timer.mask = SPA_IO_IN;
+		spa_loop_add_source(&impl->loop, &impl->timer);
+	}
 
 	spa_log_info(impl->log, NAME " %p: initialized", impl);
 
 	return 0;
 }
 
+static int
+impl_init(const struct spa_handle_factory *factory,
+	  struct spa_handle *handle,
+	  const struct spa_dict *info,
+	  const struct spa_support *support,
+	  uint32_t n_support)
+{
+	return init_loop(factory, handle, support, n_support, false);
+}
+
+#ifdef HAVE_IO_URING
+static int
+impl_init_uring(const struct spa_handle_factory *factory,
+		struct spa_handle *handle,
+		const struct spa_dict *info,
+		const struct spa_support *support,
+		uint32_t n_support)
+{
+	return init_loop(factory, handle, support, n_support, true);
+}
+#endif
+
 static const struct spa_interface_info impl_interfaces[] = {
 	{SPA_TYPE__Loop,},
 	{SPA_TYPE__LoopControl,},
@@ -778,10 +1449,24 @@ static const struct spa_handle_factory loop_factory = {
 	impl_enum_interface_info
 };
 
+#ifdef HAVE_IO_URING
+static const struct spa_handle_factory loop_uring_factory = {
+	SPA_VERSION_HANDLE_FACTORY,
+	NAME "-uring",
+	NULL,
+	sizeof(struct impl),
+	impl_init_uring,
+	impl_enum_interface_info
+};
+#endif
+
 int spa_handle_factory_register(const struct spa_handle_factory *factory);
 
 static void reg(void) __attribute__ ((constructor));
 static void reg(void)
 {
 	spa_handle_factory_register(&loop_factory);
+#ifdef HAVE_IO_URING
+	spa_handle_factory_register(&loop_uring_factory);
+#endif
 }
@@ -0,0 +1,251 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __SPA_URING_H__
+#define __SPA_URING_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* minimal io_uring helpers on top of the raw syscalls */
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include <spa/utils/defs.h>
+
+struct spa_uring {
+	int fd;
+	uint32_t features;
+
+	uint32_t *sq_head;
+	uint32_t *sq_tail;
+	uint32_t *sq_mask;
+	uint32_t *sq_array;
+	struct io_uring_sqe *sqes;
+	uint32_t sqe_head;	/* first sqe not yet submitted */
+	uint32_t sqe_tail;	/* next free sqe */
+	uint32_t sq_entries;
+
+	uint32_t *cq_head;
+	uint32_t *cq_tail;
+	uint32_t *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+};
+
+static inline int spa_uring_enter(struct spa_uring *ring, uint32_t to_submit,
+				  uint32_t min_complete, uint32_t flags,
+				  void *arg, size_t argsz)
+{
+	int res = syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete,
+			  flags, arg, argsz);
+	return res < 0 ? -errno : res;
+}
+
+static inline int spa_uring_register(struct spa_uring *ring, uint32_t opcode,
+				     void *arg, uint32_t nr_args)
+{
+	int res = syscall(__NR_io_uring_register, ring->fd, opcode, arg, nr_args);
+	return res < 0 ? -errno : res;
+}
+
+static inline void spa_uring_clear(struct spa_uring *ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring)
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	if (ring->fd != -1)
+		close(ring->fd);
+	ring->fd = -1;
+}
+
+/* set up a ring, we need to be able to pass a timeout to the wait */
+static inline int spa_uring_init(struct spa_uring *ring, uint32_t entries)
+{
+	struct io_uring_params p;
+	int res;
+
+	spa_zero(*ring);
+	spa_zero(p);
+
+	ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0)
+		return -errno;
+
+	ring->features = p.features;
+	if (!(p.features & IORING_FEAT_EXT_ARG)) {
+		res = -ENOTSUP;
+		goto error;
+	}
+
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring->sq_ring_size = ring->cq_ring_size =
+			SPA_MAX(ring->sq_ring_size, ring->cq_ring_size);
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		ring->sq_ring = NULL;
+		res = -errno;
+		goto error;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ring = ring->sq_ring;
+	} else {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED) {
+			ring->cq_ring = NULL;
+			res = -errno;
+			goto error;
+		}
+	}
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		res = -errno;
+		goto error;
+	}
+
+	ring->sq_head = SPA_MEMBER(ring->sq_ring, p.sq_off.head, uint32_t);
+	ring->sq_tail = SPA_MEMBER(ring->sq_ring, p.sq_off.tail, uint32_t);
+	ring->sq_mask = SPA_MEMBER(ring->sq_ring, p.sq_off.ring_mask, uint32_t);
+	ring->sq_array = SPA_MEMBER(ring->sq_ring, p.sq_off.array, uint32_t);
+	ring->sq_entries = p.sq_entries;
+
+	ring->cq_head = SPA_MEMBER(ring->cq_ring, p.cq_off.head, uint32_t);
+	ring->cq_tail = SPA_MEMBER(ring->cq_ring, p.cq_off.tail, uint32_t);
+	ring->cq_mask = SPA_MEMBER(ring->cq_ring, p.cq_off.ring_mask, uint32_t);
+	ring->cqes = SPA_MEMBER(ring->cq_ring, p.cq_off.cqes, struct io_uring_cqe);
+
+	return 0;
+
+      error:
+	spa_uring_clear(ring);
+	return res;
+}
+
+/* make the queued sqes visible to the kernel, returns the number of sqes to
+ * submit with the next enter. This includes the sqes that were flushed before
+ * but not consumed, for example because an enter was interrupted. */
+static inline uint32_t spa_uring_flush(struct spa_uring *ring)
+{
+	uint32_t tail = *ring->sq_tail;
+
+	if (ring->sqe_tail != ring->sqe_head) {
+		uint32_t mask = *ring->sq_mask;
+
+		for (; ring->sqe_head != ring->sqe_tail; ring->sqe_head++, tail++)
+			ring->sq_array[tail & mask] = ring->sqe_head & mask;
+
+		__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+	}
+	return tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+}
+
+static inline int spa_uring_submit(struct spa_uring *ring)
+{
+	uint32_t to_submit = spa_uring_flush(ring);
+
+	if (to_submit == 0)
+		return 0;
+
+	return spa_uring_enter(ring, to_submit, 0, 0, NULL, 0);
+}
+
+/* submit to_submit sqes, as returned by spa_uring_flush(), and wait at most
+ * timeout milliseconds for a completion, -1 waits forever */
+static inline int spa_uring_submit_and_wait(struct spa_uring *ring, uint32_t to_submit,
+					    int timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+
+	if (timeout == 0)
+		return spa_uring_enter(ring, to_submit, 0, 0, NULL, 0);
+
+	spa_zero(arg);
+	arg.sigmask_sz = _NSIG / 8;
+	if (timeout > 0) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000LL;
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+	}
+	return spa_uring_enter(ring, to_submit, 1,
+			IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+/* get a free sqe, submits the pending ones when the queue is full */
+static inline struct io_uring_sqe *spa_uring_get_sqe(struct spa_uring *ring)
+{
+	struct io_uring_sqe *sqe;
+	uint32_t head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+	if (ring->sqe_tail - head >= ring->sq_entries) {
+		if (spa_uring_submit(ring) < 0)
+			return NULL;
+		head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+		if (ring->sqe_tail - head >= ring->sq_entries)
+			return NULL;
+	}
+	sqe = &ring->sqes[ring->sqe_tail & *ring->sq_mask];
+	ring->sqe_tail++;
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+static inline struct io_uring_cqe *spa_uring_peek_cqe(struct spa_uring *ring)
+{
+	uint32_t head = *ring->cq_head;
+
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	return &ring->cqes[head & *ring->cq_mask];
+}
+
+static inline void spa_uring_cqe_seen(struct spa_uring *ring)
+{
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif /* __SPA_URING_H__ */
@@ -20,10 +20,12 @@
 #include <errno.h>
 #include <string.h>
 #include <stddef.h>
+#include <math.h>
 
 #include <spa/support/log.h>
 #include <spa/support/type-map.h>
 #include <spa/utils/list.h>
+#include <spa/utils/ringbuffer.h>
 #include <spa/node/node.h>
 #include <spa/node/io.h>
 #include <spa/param/audio/format-utils.h>
@@ -33,20 +35,45 @@
 
 #include <lib/pod.h>
 
+#include "../audiomixer/mix-ops.h"
+
 #define NAME "volume"
 
-#define DEFAULT_VOLUME 1.0
-#define DEFAULT_MUTE false
+#define MAX_CHANNELS	64
+
+enum ramp_type {
+	RAMP_LINEAR,
+	RAMP_LOG,
+};
+
+#define DEFAULT_VOLUME		1.0
+#define DEFAULT_MUTE		false
+#define DEFAULT_RAMP_TYPE	RAMP_LOG
+#define DEFAULT_RAMP_DURATION	10
+
+/* lowest gain used for logarithmic ramps, about -100dB */
+#define RAMP_LOG_FLOOR		0.00001
 
 struct props {
 	double volume;
 	bool mute;
+	float channel_volumes[MAX_CHANNELS];
+	uint32_t n_channel_volumes;
+	uint32_t ramp_type;
+	int32_t ramp_duration;		/* in milliseconds */
 };
 
 static void reset_props(struct props *props)
 {
+	int i;
+
 	props->volume = DEFAULT_VOLUME;
 	props->mute = DEFAULT_MUTE;
+	for (i = 0; i < MAX_CHANNELS; i++)
+		props->channel_volumes[i] = 1.0;
+	props->n_channel_volumes = 0;
+	props->ramp_type = DEFAULT_RAMP_TYPE;
+	props->ramp_duration = DEFAULT_RAMP_DURATION;
 }
 
 #define MAX_BUFFERS     16
@@ -79,6 +106,9 @@ struct type {
 	uint32_t props;
 	uint32_t prop_volume;
 	uint32_t prop_mute;
+	uint32_t prop_channel_volumes;
+	uint32_t prop_ramp_type;
+	uint32_t prop_ramp_duration;
 	struct spa_type_io io;
 	struct spa_type_param param;
 	struct spa_type_meta meta;
@@ -101,6 +131,9 @@ static inline void init_type(struct type *type, struct spa_type_map *map)
 	type->props = spa_type_map_get_id(map, SPA_TYPE__Props);
 	type->prop_volume = spa_type_map_get_id(map, SPA_TYPE_PROPS__volume);
 	type->prop_mute = spa_type_map_get_id(map, SPA_TYPE_PROPS__mute);
+	type->prop_channel_volumes = spa_type_map_get_id(map, SPA_TYPE_PROPS__channelVolumes);
+	type->prop_ramp_type = spa_type_map_get_id(map, SPA_TYPE_PROPS__rampType);
+	type->prop_ramp_duration = spa_type_map_get_id(map, SPA_TYPE_PROPS__rampDuration);
 	spa_type_io_map(map, &type->io);
 	spa_type_param_map(map, &type->param);
 	spa_type_meta_map(map, &type->meta);
@@ -129,12 +162,39 @@ struct impl {
 	const struct spa_node_callbacks *callbacks;
 	void *callbacks_data;
 
+	struct spa_audiomixer_ops ops;
+
 	struct spa_audio_info current_format;
 	int bpf;
+	int fmt;
+	uint32_t channels;
+
+	/* the last volume change of the main thread. pending_seq is odd while
+	 * it is written, process picks it up when the seq is even and new */
+	struct volume_update {
+		float target[MAX_CHANNELS];
+		uint32_t ramp_type;
+		uint32_t ramp_frames;
+	} pending;
+	uint32_t pending_seq;
+	uint32_t applied_seq;
+
+	/* only used from process: the gains that are applied now and the ones
+	 * we ramp to */
+	float gain[MAX_CHANNELS];
+	float target[MAX_CHANNELS];
+	/* shape, start gain and per frame step of the ramp */
+	uint32_t ramp_type;
+	double ramp_gain[MAX_CHANNELS];
+	double ramp_step[MAX_CHANNELS];
+	uint32_t ramp_frames;
 
 	struct port in_ports[1];
 	struct port out_ports[1];
 
+	/* output buffers are the input buffers, process in place */
+	bool in_place;
+
 	bool started;
 };
 
@@ -145,6 +205,82 @@ struct impl {
 #define GET_OUT_PORT(this,p)	 (&this->out_ports[p])
 #define GET_PORT(this,d,p)	 (d == SPA_DIRECTION_INPUT ? GET_IN_PORT(this,p) : GET_OUT_PORT(this,p))
 
+static void get_targets(struct props *p, float *target)
+{
+	uint32_t i;
+
+	for (i = 0; i < MAX_CHANNELS; i++)
+		target[i] = p->mute ? 0.0 : p->volume * p->channel_volumes[i];
+}
+
+/* publish the volume of the props for process, with a ramp when ramp is
+ * true. Called from the main thread. */
+static void update_volume(struct impl *this, bool ramp)
+{
+	struct props *p = &this->props;
+	struct volume_update *u = &this->pending;
+	float target[MAX_CHANNELS];
+	uint32_t seq;
+
+	get_targets(p, target);
+	if (memcmp(u->target, target, sizeof(target)) == 0)
+		return;
+
+	seq = this->pending_seq;
+	__atomic_store_n(&this->pending_seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	memcpy(u->target, target, sizeof(target));
+	u->ramp_type = p->ramp_type;
+	u->ramp_frames = ramp ?
+		(uint64_t) p->ramp_duration * this->current_format.info.raw.rate / 1000 : 0;
+
+	__atomic_store_n(&this->pending_seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* take the last published volume and start a ramp to it from the current
+ * gains. A volume that is being written is taken in the next cycle. */
+static void apply_volume_update(struct impl *this)
+{
+	struct volume_update u;
+	uint32_t i, n_frames, seq;
+
+	seq = __atomic_load_n(&this->pending_seq, __ATOMIC_ACQUIRE);
+	if (seq == this->applied_seq || (seq & 1))
+		return;
+
+	u = this->pending;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&this->pending_seq, __ATOMIC_RELAXED) != seq)
+		return;
+
+	this->applied_seq = seq;
+	memcpy(this->target, u.target, sizeof(this->target));
+	this->ramp_type = u.ramp_type;
+	n_frames = u.ramp_frames;
+
+	if (n_frames == 0 || this->channels == 0) {
+		memcpy(this->gain, this->target, sizeof(this->gain));
+		this->ramp_frames = 0;
+		return;
+	}
+
+	for (i = 0; i < this->channels; i++) {
+		if (this->ramp_type == RAMP_LOG) {
+			double start = SPA_MAX(this->gain[i], RAMP_LOG_FLOOR);
+			double end = SPA_MAX(this->target[i], RAMP_LOG_FLOOR);
+			this->ramp_gain[i] = start;
+			this->ramp_step[i] = pow(end / start, 1.0 / n_frames);
+		} else {
+			this->ramp_gain[i] = this->gain[i];
+			this->ramp_step[i] = (this->target[i] - this->gain[i]) / n_frames;
+		}
+	}
+	this->ramp_frames = n_frames;
+
+	spa_log_trace(this->log, NAME " %p: start ramp of %d frames", this, n_frames);
+}
+
 static int impl_node_enum_params(struct spa_node *node,
 				 uint32_t id, uint32_t *index,
 				 const struct spa_pod *filter,
@@ -196,6 +332,32 @@ static int impl_node_enum_params(struct spa_node *node,
 				":", t->param.propName, "s", "Mute",
 				":", t->param.propType, "b", p->mute);
 			break;
+		case 2:
+			param = spa_pod_builder_object(&b,
+				id, t->param.PropInfo,
+				":", t->param.propId,   "I", t->prop_channel_volumes,
+				":", t->param.propName, "s", "The volume of each channel",
+				":", t->param.propType, "a", sizeof(float), SPA_POD_TYPE_FLOAT,
+					p->n_channel_volumes, p->channel_volumes);
+			break;
+		case 3:
+			param = spa_pod_builder_object(&b,
+				id, t->param.PropInfo,
+				":", t->param.propId,   "I", t->prop_ramp_type,
+				":", t->param.propName, "s", "The shape of volume changes",
+				":", t->param.propType, "i", p->ramp_type,
+				":", t->param.propLabels, "[-i",
+					"i", RAMP_LINEAR, "s", "Linear ramp",
+					"i", RAMP_LOG, "s", "Logarithmic ramp", "]");
+			break;
+		case 4:
+			param = spa_pod_builder_object(&b,
+				id, t->param.PropInfo,
+				":", t->param.propId,   "I", t->prop_ramp_duration,
+				":", t->param.propName, "s", "Duration of volume changes in milliseconds",
+				":", t->param.propType, "ir", p->ramp_duration,
+					SPA_POD_PROP_MIN_MAX(0, 10000));
+			break;
 		default:
 			return 0;
 		}
@@ -206,7 +368,11 @@ static int impl_node_enum_params(struct spa_node *node,
 			param = spa_pod_builder_object(&b,
 				id, t->props,
 				":", t->prop_volume, "d", p->volume,
-				":", t->prop_mute,   "b", p->mute);
+				":", t->prop_mute,   "b", p->mute,
+				":", t->prop_channel_volumes, "a", sizeof(float), SPA_POD_TYPE_FLOAT,
+					p->n_channel_volumes, p->channel_volumes,
+				":", t->prop_ramp_type, "i", p->ramp_type,
+				":", t->prop_ramp_duration, "i", p->ramp_duration);
 			break;
 		default:
 			return 0;
@@ -235,15 +401,45 @@ static int impl_node_set_param(struct spa_node *node, uint32_t id, uint32_t flag
 	t = &this->type;
 
 	if (id == t->param.idProps) {
-		struct props *p = &this->props;
+		struct props props = this->props, *p = &props;
+		struct spa_pod *volumes = NULL;
 
 		if (param == NULL) {
-			reset_props(p);
+			reset_props(&this->props);
+			update_volume(this, this->started);
 			return 0;
 		}
 		spa_pod_object_parse(param,
 			":", t->prop_volume, "?d", &p->volume,
-			":", t->prop_mute,   "?b", &p->mute, NULL);
+			":", t->prop_mute,   "?b", &p->mute,
+			":", t->prop_channel_volumes, "?P", &volumes,
+			":", t->prop_ramp_type, "?i", &p->ramp_type,
+			":", t->prop_ramp_duration, "?i", &p->ramp_duration, NULL);
+
+		if (p->ramp_type != RAMP_LINEAR && p->ramp_type != RAMP_LOG)
+			return -EINVAL;
+
+		if (volumes && SPA_POD_TYPE(volumes) == SPA_POD_TYPE_ARRAY) {
+			struct spa_pod_array *arr = (struct spa_pod_array *) volumes;
+			float *v;
+			uint32_t i = 0;
+
+			if (arr->body.child.type != SPA_POD_TYPE_FLOAT)
+				return -EINVAL;
+
+			SPA_POD_ARRAY_BODY_FOREACH(&arr->body, SPA_POD_BODY_SIZE(arr), v) {
+				if (i >= MAX_CHANNELS)
+					break;
+				p->channel_volumes[i++] = *v;
+			}
+			p->n_channel_volumes = i;
+			for (; i < MAX_CHANNELS; i++)
+				p->channel_volumes[i] = 1.0;
+		}
+		p->ramp_duration = SPA_CLAMP(p->ramp_duration, 0, 10000);
+
+		this->props = props;
+		update_volume(this, this->started);
 	}
 	else
 		return -ENOENT;
@@ -376,8 +572,10 @@ static int port_enum_formats(struct spa_node *node,
 			"I", t->media_type.audio,
 			"I", t->media_subtype.raw,
 			":", t->format_audio.format,  "Ieu", t->audio_format.S16,
-				SPA_POD_PROP_ENUM(2, t->audio_format.S16,
-						     t->audio_format.S32),
+				SPA_POD_PROP_ENUM(4, t->audio_format.S16,
+						     t->audio_format.S32,
+						     t->audio_format.F32,
+						     t->audio_format.F64),
 			":", t->format_audio.rate,    "iru", 44100,
 				SPA_POD_PROP_MIN_MAX(1, INT32_MAX),
 			":", t->format_audio.channels,"iru", 2,
@@ -532,12 +730,28 @@ impl_node_port_enum_params(struct spa_node *node,
 	return 1;
 }
 
+static void check_in_place(struct impl *this)
+{
+	struct port *in_port = GET_IN_PORT(this, 0);
+	struct port *out_port = GET_OUT_PORT(this, 0);
+	uint32_t i;
+
+	this->in_place = in_port->n_buffers > 0 && in_port->n_buffers == out_port->n_buffers;
+
+	for (i = 0; i < in_port->n_buffers && this->in_place; i++) {
+		if (in_port->buffers[i].outbuf != out_port->buffers[i].outbuf)
+			this->in_place = false;
+	}
+	spa_log_info(this->log, NAME " %p: in-place %d", this, this->in_place);
+}
+
 static int clear_buffers(struct impl *this, struct port *port)
 {
 	if (port->n_buffers > 0) {
 		spa_log_info(this->log, NAME " %p: clear buffers", this);
 		port->n_buffers = 0;
 		spa_list_init(&port->empty);
+		this->in_place = false;
 	}
 	return 0;
 }
@@ -569,9 +783,38 @@ static int port_set_format(struct spa_node *node,
 		if (spa_format_audio_raw_parse(format, &info.info.raw, &this->type.format_audio) < 0)
 			return -EINVAL;
 
-		this->bpf = 2 * info.info.raw.channels;
+		if (info.info.raw.channels == 0 || info.info.raw.channels > MAX_CHANNELS)
+			return -EINVAL;
+
+		if (info.info.raw.format == this->type.audio_format.S16) {
+			this->fmt = FMT_S16;
+			this->bpf = sizeof(int16_t);
+		}
+		else if (info.info.raw.format == this->type.audio_format.S32) {
+			this->fmt = FMT_S32;
+			this->bpf = sizeof(int32_t);
+		}
+		else if (info.info.raw.format == this->type.audio_format.F32) {
+			this->fmt = FMT_F32;
+			this->bpf = sizeof(float);
+		}
+		else if (info.info.raw.format == this->type.audio_format.F64) {
+			this->fmt = FMT_F64;
+			this->bpf = sizeof(double);
+		}
+		else
+			return -EINVAL;
+
+		this->bpf *= info.info.raw.channels;
+		this->channels = info.info.raw.channels;
 		this->current_format = info;
 		port->have_format = true;
+
+		/* not processing now, jump to the last volume */
+		memcpy(this->target, this->pending.target, sizeof(this->target));
+		memcpy(this->gain, this->target, sizeof(this->gain));
+		this->ramp_frames = 0;
+		this->applied_seq = this->pending_seq;
 	}
 
 	return 0;
@@ -648,6 +891,8 @@ impl_node_port_use_buffers(struct spa_node *node,
 	}
 	port->n_buffers = n_buffers;
 
+	check_in_place(this);
+
 	return 0;
 }
 
@@ -725,7 +970,13 @@ static int impl_node_port_reuse_buffer(struct spa_node *node, uint32_t port_id,
 	if (buffer_id >= port->n_buffers)
 		return -EINVAL;
 
-	recycle_buffer(this, buffer_id);
+	if (this->in_place) {
+		struct port *in_port = GET_IN_PORT(this, 0);
+		if (in_port->io)
+			in_port->io->buffer_id = buffer_id;
+	}
+	else
+		recycle_buffer(this, buffer_id);
 
 	return 0;
 }
@@ -753,16 +1004,167 @@ static struct spa_buffer *find_free_buffer(struct impl *this, struct port *port)
 	return b->outbuf;
 }
 
+static inline double read_sample(int fmt, const void *src, uint32_t i)
+{
+	switch (fmt) {
+	case FMT_S16:
+		return ((const int16_t *) src)[i];
+	case FMT_S32:
+		return ((const int32_t *) src)[i];
+	case FMT_F32:
+		return ((const float *) src)[i];
+	default:
+		return ((const double *) src)[i];
+	}
+}
+
+static inline void write_sample(int fmt, void *dst, uint32_t i, double v)
+{
+	switch (fmt) {
+	case FMT_S16:
+		((int16_t *) dst)[i] = SPA_CLAMP(v, INT16_MIN, INT16_MAX);
+		break;
+	case FMT_S32:
+		((int32_t *) dst)[i] = SPA_CLAMP(v, INT32_MIN, INT32_MAX);
+		break;
+	case FMT_F32:
+		((float *) dst)[i] = v;
+		break;
+	default:
+		((double *) dst)[i] = v;
+		break;
+	}
+}
+
+/* apply the ramp on n_frames, returns the number of frames that were ramped.
+ * Ramps are short so this does not need to be fast. */
+static uint32_t do_ramp(struct impl *this, void *dst, const void *src, uint32_t n_frames)
+{
+	uint32_t i, c, n, channels = this->channels;
+	bool log = this->ramp_type == RAMP_LOG;
+
+	n_frames = SPA_MIN(n_frames, this->ramp_frames);
+
+	for (n = 0, i = 0; i < n_frames; i++) {
+		for (c = 0; c < channels; c++, n++) {
+			write_sample(this->fmt, dst, n,
+				     read_sample(this->fmt, src, n) * this->ramp_gain[c]);
+
+			if (log)
+				this->ramp_gain[c] *= this->ramp_step[c];
+			else
+				this->ramp_gain[c] += this->ramp_step[c];
+		}
+	}
+	this->ramp_frames -= n_frames;
+
+	for (c = 0; c < channels; c++)
+		this->gain[c] = this->ramp_frames == 0 ? this->target[c] : this->ramp_gain[c];
+
+	return n_frames;
+}
+
+static void apply_volume(struct impl *this, void *dst, const void *src, uint32_t n_bytes)
+{
+	uint32_t c, channels = this->channels;
+	bool unity = true, equal = true;
+	float v = this->gain[0];
+
+	if (this->ramp_frames > 0) {
+		uint32_t done = do_ramp(this, dst, src, n_bytes / this->bpf) * this->bpf;
+
+		dst = SPA_MEMBER(dst, done, void);
+		src = SPA_MEMBER(src, done, void);
+		n_bytes -= done;
+		if (n_bytes == 0)
+			return;
+	}
+
+	for (c = 0; c < channels; c++) {
+		if (this->gain[c] != 1.0f)
+			unity = false;
+		if (this->gain[c] != v)
+			equal = false;
+	}
+
+	if (unity) {
+		if (dst != src)
+			this->ops.copy[this->fmt](dst, src, n_bytes);
+	}
+	else if (equal && v == 0.0f)
+		this->ops.clear[this->fmt](dst, n_bytes);
+	else if (equal)
+		this->ops.copy_scale[this->fmt](dst, src, v, n_bytes);
+	else
+		this->ops.copy_volume[this->fmt](dst, src, this->gain, channels, n_bytes);
+}
+
+/* a frame that is split by the end of the memory is copied out, processed
+ * and copied back */
+static void apply_volume_frame(struct impl *this, struct spa_data *dd, uint32_t doffset,
+			       const struct spa_data *sd, uint32_t soffset)
+{
+	double frame[MAX_CHANNELS];
+
+	spa_ringbuffer_read_data(NULL, sd->data, sd->maxsize, soffset, frame, this->bpf);
+	apply_volume(this, frame, frame, this->bpf);
+	spa_ringbuffer_write_data(NULL, dd->data, dd->maxsize, doffset, frame, this->bpf);
+}
+
+static bool is_unity(struct impl *this)
+{
+	uint32_t c;
+
+	if (this->ramp_frames > 0)
+		return false;
+	for (c = 0; c < this->channels; c++) {
+		if (this->gain[c] != 1.0f)
+			return false;
+	}
+	return true;
+}
+
+/* process the valid region of the buffer where it is, the chunk stays as is */
+static void do_volume_in_place(struct impl *this, struct spa_buffer *buf)
+{
+	struct spa_data *d = buf->datas;
+	uint32_t n_bytes, done, avail, index;
+
+	if (is_unity(this))
+		return;
+
+	avail = SPA_MIN(d[0].chunk->size, d[0].maxsize);
+	avail -= avail % this->bpf;
+	index = d[0].chunk->offset;
+
+	for (done = 0; done < avail; done += n_bytes) {
+		uint32_t offset = (index + done) % d[0].maxsize;
+		void *p = SPA_MEMBER(d[0].data, offset, void);
+
+		n_bytes = SPA_MIN(avail - done, d[0].maxsize - offset);
+		n_bytes -= n_bytes % this->bpf;
+
+		if (n_bytes > 0)
+			apply_volume(this, p, p, n_bytes);
+		else {
+			n_bytes = this->bpf;
+			apply_volume_frame(this, &d[0], offset, &d[0], offset);
+		}
+	}
+}
+
 static void do_volume(struct impl *this, struct spa_buffer *dbuf, struct spa_buffer *sbuf)
 {
-	uint32_t i, n_samples, n_bytes;
+	uint32_t n_bytes;
 	struct spa_data *sd, *dd;
-	int16_t *src, *dst;
-	double volume;
+	void *src, *dst;
 	uint32_t written, towrite, savail, davail;
 	uint32_t sindex, dindex;
 
-	volume = this->props.volume;
+	if (dbuf == sbuf) {
+		do_volume_in_place(this, sbuf);
+		return;
+	}
 
 	sd = sbuf->datas;
 	dd = dbuf->datas;
@@ -774,21 +1176,26 @@ static void do_volume(struct impl *this, struct spa_buffer *dbuf, struct spa_buf
 	davail = dd[0].maxsize - davail;
 
 	towrite = SPA_MIN(savail, davail);
+	towrite -= towrite % this->bpf;
 	written = 0;
 
 	while (written < towrite) {
 		uint32_t soffset = sindex % sd[0].maxsize;
 		uint32_t doffset = dindex % dd[0].maxsize;
 
-		src = SPA_MEMBER(sd[0].data, soffset, int16_t);
-		dst = SPA_MEMBER(dd[0].data, doffset, int16_t);
+		src = SPA_MEMBER(sd[0].data, soffset, void);
+		dst = SPA_MEMBER(dd[0].data, doffset, void);
 
-		n_bytes = SPA_MIN(towrite, sd[0].maxsize - soffset);
+		n_bytes = SPA_MIN(towrite - written, sd[0].maxsize - soffset);
 		n_bytes = SPA_MIN(n_bytes, dd[0].maxsize - doffset);
+		n_bytes -= n_bytes % this->bpf;
 
-		n_samples = n_bytes / sizeof(int16_t);
-		for (i = 0; i < n_samples; i++)
-			dst[i] = src[i] * volume;
+		if (n_bytes > 0)
+			apply_volume(this, dst, src, n_bytes);
+		else {
+			n_bytes = this->bpf;
+			apply_volume_frame(this, &dd[0], doffset, &sd[0], soffset);
+		}
 
 		sindex += n_bytes;
 		dindex += n_bytes;
@@ -826,15 +1233,22 @@ static int impl_node_process_input(struct spa_node *node)
 		return -EINVAL;
 	}
 
-	if ((dbuf = find_free_buffer(this, out_port)) == NULL) {
+	sbuf = in_port->buffers[input->buffer_id].outbuf;
+
+	if (this->in_place) {
+		/* we keep the buffer until it is recycled on the output */
+		dbuf = sbuf;
+		input->buffer_id = SPA_ID_INVALID;
+	}
+	else if ((dbuf = find_free_buffer(this, out_port)) == NULL) {
                 spa_log_error(this->log, NAME " %p: out of buffers", this);
 		return -EPIPE;
 	}
 
-	sbuf = in_port->buffers[input->buffer_id].outbuf;
-
 	input->status = SPA_STATUS_OK;
 
+	apply_volume_update(this);
+
 	spa_log_trace(this->log, NAME " %p: do volume %d -> %d", this, sbuf->id, dbuf->id);
 	do_volume(this, dbuf, sbuf);
 
@@ -861,16 +1275,19 @@ static int impl_node_process_output(struct spa_node *node)
 	if (output->status == SPA_STATUS_HAVE_BUFFER)
 		return SPA_STATUS_HAVE_BUFFER;
 
-	/* recycle */
-	if (output->buffer_id < out_port->n_buffers) {
-		recycle_buffer(this, output->buffer_id);
-		output->buffer_id = SPA_ID_INVALID;
-	}
-
 	in_port = GET_IN_PORT(this, 0);
 	input = in_port->io;
 	spa_return_val_if_fail(input != NULL, -EIO);
 
+	/* recycle, in-place buffers go back to the input */
+	if (output->buffer_id < out_port->n_buffers) {
+		if (this->in_place)
+			input->buffer_id = output->buffer_id;
+		else
+			recycle_buffer(this, output->buffer_id);
+		output->buffer_id = SPA_ID_INVALID;
+	}
+
 	if (in_port->range && out_port->range)
 		*in_port->range = *out_port->range;
 	input->status = SPA_STATUS_NEED_BUFFER;
@@ -955,6 +1372,13 @@ impl_init(const struct spa_handle_factory *factory,
 
 	this->node = impl_node;
 	reset_props(&this->props);
+	get_targets(&this->props, this->pending.target);
+	memcpy(this->target, this->pending.target, sizeof(this->target));
+	memcpy(this->gain, this->target, sizeof(this->gain));
+	this->ramp_frames = 0;
+	this->pending_seq = this->applied_seq = 0;
+
+	spa_audiomixer_get_ops(&this->ops);
 
 	this->in_ports[0].info.flags = SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS |
 	    SPA_PORT_INFO_FLAG_IN_PLACE;
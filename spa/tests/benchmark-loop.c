@@ -0,0 +1,352 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* compare the loop implementations of the support plugin. A thread wakes
+ * up the loop with an event, like a driver waking up the data loop, and
+ * measures the time until the callback runs. Each wakeup also signals a
+ * number of events from the loop thread and rearms a timer, like the nodes
+ * of a graph would do. The wakeup is done when the loop also saw a byte
+ * that it wrote to a pipe, this checks that an fd source keeps firing when
+ * it becomes readable again.
+ *
+ * usage: benchmark-loop [iterations] [load-events] [factory...] */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+
+#include <spa/support/loop.h>
+#include <spa/support/log-impl.h>
+#include <spa/support/type-map-impl.h>
+#include <spa/support/plugin.h>
+
+#define MAX_LOAD	64
+#define MAX_WAIT	(1 * SPA_NSEC_PER_SEC)
+
+static SPA_TYPE_MAP_IMPL(default_map, 4096);
+static SPA_LOG_IMPL(default_log);
+
+struct data {
+	struct spa_loop_control *control;
+	struct spa_loop_utils *utils;
+
+	struct spa_source *wakeup;
+	struct spa_source *load[MAX_LOAD];
+	uint32_t n_load;
+	struct spa_source *timer;
+	int pipe[2];
+	struct spa_source *pipe_source;
+
+	pthread_t thread;
+	bool running;
+
+	uint32_t iterations;
+	uint64_t signal_time;
+	int done;
+
+	int counter;
+	uint32_t n_wakeups;
+
+	uint64_t min, max, total;
+	uint64_t n_loops;
+	uint64_t n_load_events;
+	uint64_t n_pipe_events;
+};
+
+static inline uint64_t get_time_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_TIME(&now);
+}
+
+static void on_load(void *data, uint64_t count)
+{
+	struct data *d = data;
+	d->n_load_events += count;
+}
+
+static void on_timer(void *data, uint64_t expirations)
+{
+}
+
+static void on_pipe(void *data, int fd, enum spa_io mask)
+{
+	struct data *d = data;
+	uint8_t buffer[64];
+
+	if (read(fd, buffer, sizeof(buffer)) > 0)
+		d->n_pipe_events++;
+	__atomic_store_n(&d->done, 1, __ATOMIC_RELEASE);
+}
+
+static void on_wakeup(void *data, uint64_t count)
+{
+	struct data *d = data;
+	uint64_t lat = get_time_ns() - __atomic_load_n(&d->signal_time, __ATOMIC_ACQUIRE);
+	struct timespec value = { 1, 0 };
+	uint32_t i;
+
+	if (d->n_wakeups++ > 0) {
+		d->min = SPA_MIN(d->min, lat);
+		d->max = SPA_MAX(d->max, lat);
+		d->total += lat;
+	}
+
+	for (i = 0; i < d->n_load; i++)
+		spa_loop_utils_signal_event(d->utils, d->load[i]);
+	spa_loop_utils_update_timer(d->utils, d->timer, &value, NULL, false);
+
+	/* start counting after the first wakeup, the loop is running now */
+	if (d->n_wakeups == 1) {
+		d->n_loops = 0;
+		if (d->counter >= 0) {
+			ioctl(d->counter, PERF_EVENT_IOC_RESET, 0);
+			ioctl(d->counter, PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+	if (write(d->pipe[1], "x", 1) != 1)
+		__atomic_store_n(&d->done, 1, __ATOMIC_RELEASE);
+}
+
+static void on_stop(void *data, uint64_t count)
+{
+	struct data *d = data;
+	d->running = false;
+}
+
+/* count the syscalls of the calling thread, this needs access to the
+ * raw_syscalls tracepoint */
+static int open_syscall_counter(void)
+{
+	const char *paths[] = {
+		"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+		"/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+	};
+	struct perf_event_attr attr;
+	unsigned int i, id = 0;
+	FILE *f;
+
+	for (i = 0; i < SPA_N_ELEMENTS(paths) && id == 0; i++) {
+		if ((f = fopen(paths[i], "r")) == NULL)
+			continue;
+		if (fscanf(f, "%u", &id) != 1)
+			id = 0;
+		fclose(f);
+	}
+	if (id == 0)
+		return -1;
+
+	spa_zero(attr);
+	attr.type = PERF_TYPE_TRACEPOINT;
+	attr.size = sizeof(attr);
+	attr.config = id;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void *loop_start(void *arg)
+{
+	struct data *d = arg;
+
+	d->counter = open_syscall_counter();
+
+	spa_loop_control_enter(d->control);
+	while (d->running) {
+		spa_loop_control_iterate(d->control, -1);
+		d->n_loops++;
+	}
+	spa_loop_control_leave(d->control);
+
+	return NULL;
+}
+
+static int make_loop(struct data *d, void *hnd, const char *name)
+{
+	struct spa_support support[2];
+	struct spa_handle *handle;
+	spa_handle_factory_enum_func_t enum_func;
+	void *iface;
+	uint32_t i;
+	int res;
+
+	if ((enum_func = dlsym(hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL) {
+		printf("can't find enum function\n");
+		return -errno;
+	}
+
+	support[0] = SPA_SUPPORT_INIT(SPA_TYPE__TypeMap, &default_map.map);
+	support[1] = SPA_SUPPORT_INIT(SPA_TYPE__Log, &default_log.log);
+
+	for (i = 0;;) {
+		const struct spa_handle_factory *factory;
+
+		if ((res = enum_func(&factory, &i)) <= 0) {
+			if (res != 0)
+				printf("can't enumerate factories: %d\n", res);
+			break;
+		}
+		if (strcmp(factory->name, name))
+			continue;
+
+		handle = calloc(1, factory->size);
+		if ((res = spa_handle_factory_init(factory, handle, NULL, support, 2)) < 0) {
+			printf("can't make factory instance: %d\n", res);
+			free(handle);
+			return res;
+		}
+		if ((res = spa_handle_get_interface(handle,
+				spa_type_map_get_id(&default_map.map, SPA_TYPE__LoopControl),
+				&iface)) < 0)
+			return res;
+		d->control = iface;
+
+		if ((res = spa_handle_get_interface(handle,
+				spa_type_map_get_id(&default_map.map, SPA_TYPE__LoopUtils),
+				&iface)) < 0)
+			return res;
+		d->utils = iface;
+		return 0;
+	}
+	return -ENOENT;
+}
+
+static int run(void *hnd, const char *name, uint32_t iterations, uint32_t n_load)
+{
+	struct data d = { NULL };
+	struct spa_source *stop;
+	uint64_t n_syscalls = 0;
+	int res;
+	uint32_t i, n_done;
+
+	if ((res = make_loop(&d, hnd, name)) < 0) {
+		printf("%s: can't create loop: %d\n", name, res);
+		return res;
+	}
+	d.iterations = iterations;
+	d.n_load = n_load;
+	d.min = UINT64_MAX;
+
+	d.wakeup = spa_loop_utils_add_event(d.utils, on_wakeup, &d);
+	for (i = 0; i < d.n_load; i++)
+		d.load[i] = spa_loop_utils_add_event(d.utils, on_load, &d);
+	d.timer = spa_loop_utils_add_timer(d.utils, on_timer, &d);
+	stop = spa_loop_utils_add_event(d.utils, on_stop, &d);
+
+	if (pipe2(d.pipe, O_CLOEXEC | O_NONBLOCK) < 0)
+		return -errno;
+	d.pipe_source = spa_loop_utils_add_io(d.utils, d.pipe[0], SPA_IO_IN, false, on_pipe, &d);
+
+	d.running = true;
+	pthread_create(&d.thread, NULL, loop_start, &d);
+
+	/* let the loop thread start before measuring */
+	usleep(10000);
+
+	for (i = 0; i < iterations; i++) {
+		uint64_t start = get_time_ns();
+
+		__atomic_store_n(&d.done, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&d.signal_time, start, __ATOMIC_RELEASE);
+		spa_loop_utils_signal_event(d.utils, d.wakeup);
+
+		while ((n_done = __atomic_load_n(&d.done, __ATOMIC_ACQUIRE)) == 0 &&
+		       get_time_ns() - start < MAX_WAIT)
+			sched_yield();
+		if (n_done == 0)
+			break;
+	}
+	spa_loop_utils_signal_event(d.utils, stop);
+	pthread_join(d.thread, NULL);
+
+	spa_loop_utils_destroy_source(d.utils, d.pipe_source);
+	close(d.pipe[0]);
+	close(d.pipe[1]);
+
+	if (i < iterations) {
+		printf("%s: the pipe source stopped firing after %" PRIu64 " events\n",
+				name, d.n_pipe_events);
+		return -EIO;
+	}
+
+	if (d.counter < 0)
+		printf("%s: no syscall tracepoint, use 'strace -c -f' for syscall counts\n", name);
+
+	if (d.counter >= 0) {
+		if (read(d.counter, &n_syscalls, sizeof(n_syscalls)) != sizeof(n_syscalls))
+			n_syscalls = 0;
+		close(d.counter);
+	}
+
+	printf("%-12s latency min %6.2f avg %6.2f max %8.2f us, loops/wakeup %.2f",
+			name, d.min / 1000.0, d.total / 1000.0 / (iterations - 1),
+			d.max / 1000.0, (double)d.n_loops / (iterations - 1));
+	if (d.counter >= 0)
+		printf(", syscalls/wakeup %.2f", (double)n_syscalls / (iterations - 1));
+	printf("\n");
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *default_names[] = { "loop", "loop-uring" };
+	const char **names = default_names;
+	uint32_t i, iterations, n_load, n_names = SPA_N_ELEMENTS(default_names);
+	void *hnd;
+	int res = 0;
+
+	default_log.log.level = SPA_LOG_LEVEL_WARN;
+
+	iterations = argc > 1 ? atoi(argv[1]) : 100000;
+	n_load = argc > 2 ? atoi(argv[2]) : 8;
+	if (argc > 3) {
+		names = (const char **) &argv[3];
+		n_names = argc - 3;
+	}
+	iterations = SPA_MAX(iterations, 2u);
+	n_load = SPA_MIN(n_load, MAX_LOAD);
+
+	if ((hnd = dlopen("build/spa/plugins/support/libspa-support.so", RTLD_NOW)) == NULL) {
+		printf("can't load support plugin: %s\n", dlerror());
+		return -1;
+	}
+
+	printf("iterations %d, load events %d\n", iterations, n_load);
+
+	for (i = 0; i < n_names; i++) {
+		if (run(hnd, names[i], iterations, n_load) == -EIO)
+			res = -1;
+	}
+
+	return res;
+}
@@ -0,0 +1,487 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* run the same synthetic graphs through all graph schedulers and measure
+ * the time and cache misses per cycle. A cycle pulls all the sinks of the
+ * graph, a scheduler fails a graph when a sink did not get exactly one
+ * buffer per cycle. Every run is done in a child process so that a
+ * scheduler that crashes or hangs on a graph does not stop the others.
+ *
+ * Next to the schedulers of graph-schedulers.h, the ones that can't be
+ * selected because they fail here are measured too.
+ *
+ * usage: benchmark-scheduler [cycles] [size] [scheduler...] */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+
+#include <spa/node/node.h>
+#include <spa/node/io.h>
+
+#include <spa/graph/graph.h>
+#include <spa/graph/graph-schedulers.h>
+#include <spa/graph/graph-scheduler1.h>
+#include <spa/graph/graph-scheduler3.h>
+#include <spa/graph/graph-scheduler4.h>
+#include <spa/graph/graph-scheduler5.h>
+
+#define N_SAMPLES	64
+#define WARMUP		100
+#define TIMEOUT		10
+
+struct link {
+	struct spa_io_buffers io;
+	float data[N_SAMPLES];
+};
+
+struct node {
+	struct spa_node node;
+	struct spa_graph_node gnode;
+
+	uint32_t n_in;
+	uint32_t n_out;
+	struct spa_graph_port *in;
+	struct spa_graph_port *out;
+	struct link **inputs;
+	struct link **outputs;
+
+	uint64_t count;
+};
+
+struct graph {
+	struct spa_graph graph;
+	const struct spa_graph_scheduler *scheduler;
+	void *scheduler_data;
+
+	uint32_t n_nodes;
+	struct node *nodes;
+	uint32_t n_links;
+	struct link *links;
+};
+
+struct topology {
+	const char *name;
+	uint32_t (*n_nodes) (uint32_t size);
+	void (*build) (struct graph *g, uint32_t size);
+};
+
+static inline uint64_t get_time_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_TIME(&now);
+}
+
+static int node_process_output(struct spa_node *node)
+{
+	struct node *n = SPA_CONTAINER_OF(node, struct node, node);
+	uint32_t i, j, have = 0;
+
+	for (i = 0; i < n->n_out; i++)
+		if (n->outputs[i]->io.status == SPA_STATUS_HAVE_BUFFER)
+			have++;
+	if (have == n->n_out)
+		return SPA_STATUS_HAVE_BUFFER;
+
+	if (n->n_in > 0) {
+		for (i = 0; i < n->n_in; i++)
+			if (n->inputs[i]->io.status != SPA_STATUS_HAVE_BUFFER)
+				n->inputs[i]->io.status = SPA_STATUS_NEED_BUFFER;
+		return SPA_STATUS_NEED_BUFFER;
+	}
+
+	/* a source, fill all outputs */
+	for (i = 0; i < n->n_out; i++) {
+		struct link *l = n->outputs[i];
+		for (j = 0; j < N_SAMPLES; j++)
+			l->data[j] = (float) j;
+		l->io.buffer_id = 0;
+		l->io.status = SPA_STATUS_HAVE_BUFFER;
+	}
+	n->count++;
+	return SPA_STATUS_HAVE_BUFFER;
+}
+
+static int node_process_input(struct spa_node *node)
+{
+	struct node *n = SPA_CONTAINER_OF(node, struct node, node);
+	float sum[N_SAMPLES] = { 0.0f, };
+	uint32_t i, j;
+
+	for (i = 0; i < n->n_in; i++)
+		if (n->inputs[i]->io.status != SPA_STATUS_HAVE_BUFFER)
+			return SPA_STATUS_NEED_BUFFER;
+	for (i = 0; i < n->n_out; i++)
+		if (n->outputs[i]->io.status == SPA_STATUS_HAVE_BUFFER)
+			return SPA_STATUS_HAVE_BUFFER;
+
+	for (i = 0; i < n->n_in; i++) {
+		struct link *l = n->inputs[i];
+		for (j = 0; j < N_SAMPLES; j++)
+			sum[j] += l->data[j];
+		l->io.status = SPA_STATUS_NEED_BUFFER;
+	}
+	for (i = 0; i < n->n_out; i++) {
+		struct link *l = n->outputs[i];
+		memcpy(l->data, sum, sizeof(sum));
+		l->io.buffer_id = 0;
+		l->io.status = SPA_STATUS_HAVE_BUFFER;
+	}
+	n->count++;
+
+	return n->n_out > 0 ? SPA_STATUS_HAVE_BUFFER : SPA_STATUS_OK;
+}
+
+static const struct spa_node node_impl = {
+	SPA_VERSION_NODE,
+	.process_input = node_process_input,
+	.process_output = node_process_output,
+};
+
+static struct node *add_node(struct graph *g, uint32_t n_in, uint32_t n_out)
+{
+	struct node *n = &g->nodes[g->n_nodes++];
+
+	n->node = node_impl;
+	n->n_in = n_in;
+	n->n_out = n_out;
+	n->in = calloc(n_in + 1, sizeof(struct spa_graph_port));
+	n->out = calloc(n_out + 1, sizeof(struct spa_graph_port));
+	n->inputs = calloc(n_in + 1, sizeof(struct link *));
+	n->outputs = calloc(n_out + 1, sizeof(struct link *));
+
+	spa_graph_node_init(&n->gnode);
+	spa_graph_node_set_implementation(&n->gnode, &n->node);
+	spa_graph_node_add(&g->graph, &n->gnode);
+
+	return n;
+}
+
+static void link_nodes(struct graph *g, struct node *out, uint32_t out_port,
+		       struct node *in, uint32_t in_port)
+{
+	struct link *l = &g->links[g->n_links++];
+
+	l->io.status = SPA_STATUS_NEED_BUFFER;
+	l->io.buffer_id = SPA_ID_INVALID;
+	out->outputs[out_port] = l;
+	in->inputs[in_port] = l;
+
+	spa_graph_port_init(&out->out[out_port], SPA_DIRECTION_OUTPUT, out_port, 0, &l->io);
+	spa_graph_port_add(&out->gnode, &out->out[out_port]);
+	spa_graph_port_init(&in->in[in_port], SPA_DIRECTION_INPUT, in_port, 0, &l->io);
+	spa_graph_port_add(&in->gnode, &in->in[in_port]);
+	spa_graph_port_link(&out->out[out_port], &in->in[in_port]);
+}
+
+/* source -> size filters -> sink */
+static uint32_t chain_n_nodes(uint32_t size)
+{
+	return size + 2;
+}
+
+static void chain_build(struct graph *g, uint32_t size)
+{
+	struct node *prev, *n;
+	uint32_t i;
+
+	prev = add_node(g, 0, 1);
+	for (i = 0; i < size; i++) {
+		n = add_node(g, 1, 1);
+		link_nodes(g, prev, 0, n, 0);
+		prev = n;
+	}
+	n = add_node(g, 1, 0);
+	link_nodes(g, prev, 0, n, 0);
+}
+
+/* size sources -> mixer -> sink */
+static uint32_t fan_in_n_nodes(uint32_t size)
+{
+	return size + 2;
+}
+
+static void fan_in_build(struct graph *g, uint32_t size)
+{
+	struct node *mixer, *src, *sink;
+	uint32_t i;
+
+	mixer = add_node(g, size, 1);
+	for (i = 0; i < size; i++) {
+		src = add_node(g, 0, 1);
+		link_nodes(g, src, 0, mixer, i);
+	}
+	sink = add_node(g, 1, 0);
+	link_nodes(g, mixer, 0, sink, 0);
+}
+
+/* source -> size sinks */
+static uint32_t fan_out_n_nodes(uint32_t size)
+{
+	return size + 1;
+}
+
+static void fan_out_build(struct graph *g, uint32_t size)
+{
+	struct node *src, *sink;
+	uint32_t i;
+
+	src = add_node(g, 0, size);
+	for (i = 0; i < size; i++) {
+		sink = add_node(g, 1, 0);
+		link_nodes(g, src, i, sink, 0);
+	}
+}
+
+/* source -> size filters -> mixer -> sink */
+static uint32_t diamond_n_nodes(uint32_t size)
+{
+	return size + 3;
+}
+
+static void diamond_build(struct graph *g, uint32_t size)
+{
+	struct node *src, *mixer, *filter, *sink;
+	uint32_t i;
+
+	src = add_node(g, 0, size);
+	mixer = add_node(g, size, 1);
+	for (i = 0; i < size; i++) {
+		filter = add_node(g, 1, 1);
+		link_nodes(g, src, i, filter, 0);
+		link_nodes(g, filter, 0, mixer, i);
+	}
+	sink = add_node(g, 1, 0);
+	link_nodes(g, mixer, 0, sink, 0);
+}
+
+static const struct topology topologies[] = {
+	{ "chain", chain_n_nodes, chain_build },
+	{ "fan-in", fan_in_n_nodes, fan_in_build },
+	{ "fan-out", fan_out_n_nodes, fan_out_build },
+	{ "diamond", diamond_n_nodes, diamond_build },
+};
+
+static int make_graph(struct graph *g, const struct topology *t, uint32_t size,
+		      const struct spa_graph_scheduler *scheduler)
+{
+	uint32_t n_nodes = t->n_nodes(size);
+
+	memset(g, 0, sizeof(*g));
+	g->nodes = calloc(n_nodes, sizeof(struct node));
+	/* every node has at most 2 links */
+	g->links = calloc(n_nodes * 2, sizeof(struct link));
+	g->scheduler = scheduler;
+	g->scheduler_data = calloc(1, SPA_MAX(scheduler->size, sizeof(void *)));
+	if (g->nodes == NULL || g->links == NULL || g->scheduler_data == NULL)
+		return -ENOMEM;
+
+	spa_graph_init(&g->graph);
+	spa_graph_set_scheduler(&g->graph, scheduler, g->scheduler_data);
+
+	t->build(g, size);
+	spa_graph_update(&g->graph);
+
+	return 0;
+}
+
+static void free_graph(struct graph *g)
+{
+	uint32_t i;
+
+	spa_graph_scheduler_clear(g->scheduler, g->scheduler_data);
+	free(g->scheduler_data);
+	for (i = 0; i < g->n_nodes; i++) {
+		free(g->nodes[i].in);
+		free(g->nodes[i].out);
+		free(g->nodes[i].inputs);
+		free(g->nodes[i].outputs);
+	}
+	free(g->nodes);
+	free(g->links);
+}
+
+static void run_cycle(struct graph *g)
+{
+	uint32_t i;
+
+	for (i = 0; i < g->n_nodes; i++) {
+		struct node *n = &g->nodes[i];
+		if (n->n_out == 0)
+			spa_graph_need_input(&g->graph, &n->gnode);
+	}
+}
+
+static int open_cache_miss_counter(void)
+{
+	struct perf_event_attr attr;
+
+	spa_zero(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void run(const struct topology *t, uint32_t size, uint32_t cycles,
+		const struct spa_graph_scheduler *scheduler, int counter)
+{
+	struct graph g;
+	uint64_t start, elapsed, misses = 0;
+	uint32_t i, failures = 0;
+
+	if (make_graph(&g, t, size, scheduler) < 0) {
+		printf("%-8s %5d %-12s can't make graph\n", t->name, size, scheduler->name);
+		free_graph(&g);
+		return;
+	}
+
+	for (i = 0; i < WARMUP; i++)
+		run_cycle(&g);
+
+	if (counter >= 0) {
+		ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+		ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	start = get_time_ns();
+	for (i = 0; i < cycles; i++)
+		run_cycle(&g);
+	elapsed = get_time_ns() - start;
+	if (counter >= 0) {
+		ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(counter, &misses, sizeof(misses)) != sizeof(misses))
+			misses = 0;
+	}
+
+	for (i = 0; i < g.n_nodes; i++) {
+		struct node *n = &g.nodes[i];
+		if (n->n_out == 0 && n->count != WARMUP + cycles)
+			failures++;
+	}
+
+	printf("%-8s %5d %-12s %10.1f", t->name, size, scheduler->name,
+			(double) elapsed / cycles);
+	if (counter >= 0)
+		printf(" %12.2f", (double) misses / cycles);
+	else
+		printf(" %12s", "-");
+	printf("   %s\n", failures ? "FAIL" : "ok");
+
+	free_graph(&g);
+}
+
+static void run_child(const struct topology *t, uint32_t size, uint32_t cycles,
+		      const struct spa_graph_scheduler *scheduler, int counter)
+{
+	pid_t pid;
+	int status;
+
+	fflush(stdout);
+	if ((pid = fork()) < 0) {
+		printf("fork failed: %s\n", strerror(errno));
+		return;
+	}
+	if (pid == 0) {
+		alarm(TIMEOUT);
+		run(t, size, cycles, scheduler, counter);
+		fflush(stdout);
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0)
+		return;
+
+	if (WIFSIGNALED(status))
+		printf("%-8s %5d %-12s %10s %12s   %s\n", t->name, size, scheduler->name,
+				"-", "-", WTERMSIG(status) == SIGALRM ? "HANG" : "CRASH");
+}
+
+static const struct spa_graph_scheduler * const all_schedulers[] = {
+	&spa_graph_scheduler1,
+	&spa_graph_scheduler3,
+	&spa_graph_scheduler4,
+	&spa_graph_scheduler5,
+	&spa_graph_scheduler6,
+	&spa_graph_scheduler_plan,
+};
+
+static const struct spa_graph_scheduler *find_scheduler(const char *name)
+{
+	uint32_t i;
+
+	for (i = 0; i < SPA_N_ELEMENTS(all_schedulers); i++) {
+		if (strcmp(all_schedulers[i]->name, name) == 0)
+			return all_schedulers[i];
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	const struct spa_graph_scheduler *schedulers[SPA_N_ELEMENTS(all_schedulers)];
+	uint32_t i, j, cycles, size, n_schedulers = 0;
+	int counter;
+
+	cycles = argc > 1 ? atoi(argv[1]) : 10000;
+	size = argc > 2 ? atoi(argv[2]) : 8;
+	cycles = SPA_MAX(cycles, 1u);
+	size = SPA_MAX(size, 1u);
+
+	if (argc > 3) {
+		for (i = 3; i < (uint32_t) argc && n_schedulers < SPA_N_ELEMENTS(schedulers); i++) {
+			if ((schedulers[n_schedulers] = find_scheduler(argv[i])) == NULL) {
+				printf("unknown scheduler %s\n", argv[i]);
+				return -1;
+			}
+			n_schedulers++;
+		}
+	} else {
+		for (i = 0; i < SPA_N_ELEMENTS(all_schedulers); i++)
+			schedulers[n_schedulers++] = all_schedulers[i];
+	}
+
+	if ((counter = open_cache_miss_counter()) < 0)
+		printf("no cache miss counter: %s\n", strerror(errno));
+
+	printf("cycles %d, size %d\n", cycles, size);
+	printf("%-8s %5s %-12s %10s %12s   %s\n", "graph", "size", "scheduler",
+			"ns/cycle", "misses/cycle", "result");
+
+	for (i = 0; i < SPA_N_ELEMENTS(topologies); i++)
+		for (j = 0; j < n_schedulers; j++)
+			run_child(&topologies[i], size, cycles, schedulers[j], counter);
+
+	if (counter >= 0)
+		close(counter);
+
+	return 0;
+}
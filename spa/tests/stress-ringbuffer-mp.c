@@ -0,0 +1,270 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* multi-producer variant of stress-ringbuffer: several threads invoke into
+ * the loop at the same time, the loop thread checks that the items of each
+ * producer arrive complete and in order and blocking invokes get their own
+ * result back. */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include <spa/support/loop.h>
+#include <spa/support/log-impl.h>
+#include <spa/support/type-map-impl.h>
+#include <spa/support/plugin.h>
+
+#define MAX_PRODUCERS	16
+#define ARRAY_SIZE	64
+#define BLOCK_EVERY	16
+
+static SPA_TYPE_MAP_IMPL(default_map, 4096);
+static SPA_LOG_IMPL(default_log);
+
+struct item {
+	uint32_t producer;
+	uint32_t count;
+	int array[ARRAY_SIZE];
+};
+
+struct producer {
+	struct data *data;
+	pthread_t thread;
+	uint32_t id;
+	uint32_t sent;
+	uint32_t received;
+	unsigned long failures;
+	unsigned long retries;
+};
+
+struct data {
+	struct spa_loop *loop;
+	struct spa_loop_control *control;
+	pthread_t thread;
+	bool running;
+
+	uint32_t iterations;
+	uint32_t n_producers;
+	struct producer producers[MAX_PRODUCERS];
+};
+
+static int do_item(struct spa_loop *loop, bool async, uint32_t seq,
+		   const void *data, size_t size, void *user_data)
+{
+	struct data *d = user_data;
+	const struct item *item = data;
+	struct producer *p;
+	int i;
+
+	if (size != sizeof(struct item) || item->producer >= d->n_producers) {
+		printf("invalid item of size %zd\n", size);
+		return -EINVAL;
+	}
+	p = &d->producers[item->producer];
+
+	if (item->count != p->received) {
+		printf("producer %d: expected item %d, got %d\n",
+				p->id, p->received, item->count);
+		p->failures++;
+	}
+	for (i = 0; i < ARRAY_SIZE; i++) {
+		if (item->array[i] != (int)(item->count + i)) {
+			printf("producer %d: item %d corrupted at offset %d\n",
+					p->id, item->count, i);
+			p->failures++;
+			break;
+		}
+	}
+	p->received = item->count + 1;
+
+	return item->count;
+}
+
+static void *producer_start(void *arg)
+{
+	struct producer *p = arg;
+	struct data *d = p->data;
+	struct item item;
+	int i, res;
+
+	printf("producer %d started on cpu: %d\n", p->id, sched_getcpu());
+
+	item.producer = p->id;
+
+	while (p->sent < d->iterations) {
+		bool block = (p->sent % BLOCK_EVERY) == 0;
+
+		item.count = p->sent;
+		for (i = 0; i < ARRAY_SIZE; i++)
+			item.array[i] = item.count + i;
+
+		res = spa_loop_invoke(d->loop, do_item, item.count, &item, sizeof(item),
+				      block, d);
+		if (res == -EPIPE) {
+			/* queue full, let the loop catch up */
+			p->retries++;
+			sched_yield();
+			continue;
+		}
+		if (block && res != (int)item.count) {
+			printf("producer %d: blocking invoke %d returned %d\n",
+					p->id, item.count, res);
+			p->failures++;
+		}
+		p->sent++;
+	}
+	return NULL;
+}
+
+static void *loop_start(void *arg)
+{
+	struct data *d = arg;
+
+	printf("loop started on cpu: %d\n", sched_getcpu());
+
+	spa_loop_control_enter(d->control);
+	while (d->running)
+		spa_loop_control_iterate(d->control, -1);
+	spa_loop_control_leave(d->control);
+
+	return NULL;
+}
+
+static int do_stop(struct spa_loop *loop, bool async, uint32_t seq,
+		   const void *data, size_t size, void *user_data)
+{
+	struct data *d = user_data;
+	d->running = false;
+	return 0;
+}
+
+static int make_loop(struct data *d, const char *lib)
+{
+	struct spa_support support[2];
+	struct spa_handle *handle;
+	spa_handle_factory_enum_func_t enum_func;
+	void *hnd, *iface;
+	uint32_t i;
+	int res;
+
+	if ((hnd = dlopen(lib, RTLD_NOW)) == NULL) {
+		printf("can't load %s: %s\n", lib, dlerror());
+		return -errno;
+	}
+	if ((enum_func = dlsym(hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL) {
+		printf("can't find enum function\n");
+		return -errno;
+	}
+
+	support[0] = SPA_SUPPORT_INIT(SPA_TYPE__TypeMap, &default_map.map);
+	support[1] = SPA_SUPPORT_INIT(SPA_TYPE__Log, &default_log.log);
+
+	for (i = 0;;) {
+		const struct spa_handle_factory *factory;
+
+		if ((res = enum_func(&factory, &i)) <= 0) {
+			if (res != 0)
+				printf("can't enumerate factories: %d\n", res);
+			break;
+		}
+		if (strcmp(factory->name, "loop"))
+			continue;
+
+		handle = calloc(1, factory->size);
+		if ((res = spa_handle_factory_init(factory, handle, NULL, support, 2)) < 0) {
+			printf("can't make factory instance: %d\n", res);
+			return res;
+		}
+		if ((res = spa_handle_get_interface(handle,
+				spa_type_map_get_id(&default_map.map, SPA_TYPE__Loop),
+				&iface)) < 0)
+			return res;
+		d->loop = iface;
+
+		if ((res = spa_handle_get_interface(handle,
+				spa_type_map_get_id(&default_map.map, SPA_TYPE__LoopControl),
+				&iface)) < 0)
+			return res;
+		d->control = iface;
+		return 0;
+	}
+	return -ENOENT;
+}
+
+int main(int argc, char *argv[])
+{
+	struct data data = { NULL };
+	unsigned long failures = 0, retries = 0;
+	uint32_t i;
+	int res;
+
+	printf("starting multi-producer ringbuffer stress test\n");
+
+	/* a full queue is expected and retried, don't warn about it */
+	default_log.log.level = SPA_LOG_LEVEL_ERROR;
+
+	data.n_producers = argc > 1 ? atoi(argv[1]) : 4;
+	data.iterations = argc > 2 ? atoi(argv[2]) : 100000;
+	data.n_producers = SPA_CLAMP(data.n_producers, 1, MAX_PRODUCERS);
+
+	printf("producers: %d\n", data.n_producers);
+	printf("items per producer: %d\n", data.iterations);
+	printf("item size (bytes): %zd\n", sizeof(struct item));
+
+	if ((res = make_loop(&data, "build/spa/plugins/support/libspa-support.so")) < 0) {
+		printf("can't create loop: %d\n", res);
+		return -1;
+	}
+
+	data.running = true;
+	pthread_create(&data.thread, NULL, loop_start, &data);
+
+	for (i = 0; i < data.n_producers; i++) {
+		struct producer *p = &data.producers[i];
+		p->data = &data;
+		p->id = i;
+		pthread_create(&p->thread, NULL, producer_start, p);
+	}
+	for (i = 0; i < data.n_producers; i++)
+		pthread_join(data.producers[i].thread, NULL);
+
+	spa_loop_invoke(data.loop, do_stop, SPA_ID_INVALID, NULL, 0, true, &data);
+	pthread_join(data.thread, NULL);
+
+	for (i = 0; i < data.n_producers; i++) {
+		struct producer *p = &data.producers[i];
+
+		if (p->received != p->sent) {
+			printf("producer %d: sent %d, received %d\n", i, p->sent, p->received);
+			p->failures++;
+		}
+		failures += p->failures;
+		retries += p->retries;
+	}
+	printf("failures: %lu, queue full retries: %lu\n", failures, retries);
+
+	return failures > 0 ? -1 : 0;
+}
@@ -42,7 +42,7 @@ static SPA_LOG_IMPL(default_log);
 #define spa_debug(f,...) spa_log_trace(&default_log.log, f, __VA_ARGS__)
 
 #include <spa/graph/graph.h>
-#include <spa/graph/graph-scheduler6.h>
+#include <spa/graph/graph-schedulers.h>
 
 #include <lib/debug.h>
 
@@ -107,7 +107,8 @@ struct data {
 	uint32_t n_support;
 
 	struct spa_graph graph;
-	struct spa_graph_data graph_data;
+	const struct spa_graph_scheduler *scheduler;
+	void *graph_data;
 	struct spa_graph_node source_node;
 	struct spa_graph_port source_out;
 	struct spa_graph_port volume_in;
@@ -555,8 +556,14 @@ int main(int argc, char *argv[])
 	const char *str;
 
 	spa_graph_init(&data.graph);
-	spa_graph_data_init(&data.graph_data, &data.graph);
-	spa_graph_set_callbacks(&data.graph, &spa_graph_impl_default, &data.graph_data);
+	if ((str = getenv("SPA_GRAPH_SCHEDULER")) == NULL)
+		str = "scheduler6";
+	if ((data.scheduler = spa_graph_scheduler_find(str)) == NULL) {
+		printf("unknown graph scheduler %s\n", str);
+		return -1;
+	}
+	data.graph_data = calloc(1, SPA_MAX(data.scheduler->size, sizeof(void *)));
+	spa_graph_set_scheduler(&data.graph, data.scheduler, data.graph_data);
 
 	data.map = &default_map.map;
 	data.log = &default_log.log;
@@ -0,0 +1,303 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include <math.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <spa/utils/defs.h>
+
+#include <plugins/audiomixer/mix-ops.h>
+
+/* odd size so that the tail code of the vector functions is tested too */
+#define N_SAMPLES	1031
+#define F32_TOLERANCE	1e-6f
+
+static int16_t s16_src[N_SAMPLES];
+static int16_t s16_ref[N_SAMPLES];
+static int16_t s16_dst[N_SAMPLES];
+static float f32_src[N_SAMPLES];
+static float f32_ref[N_SAMPLES];
+static float f32_dst[N_SAMPLES];
+static int32_t s32_src[N_SAMPLES];
+static int32_t s32_ref[N_SAMPLES];
+static int32_t s32_dst[N_SAMPLES];
+static double f64_src[N_SAMPLES];
+static double f64_ref[N_SAMPLES];
+static double f64_dst[N_SAMPLES];
+
+static int n_failures;
+
+static void fill_data(void)
+{
+	int i;
+
+	for (i = 0; i < N_SAMPLES; i++) {
+		s16_src[i] = (rand() % 65536) - 32768;
+		s16_ref[i] = s16_dst[i] = (rand() % 65536) - 32768;
+		f32_src[i] = (rand() / (float) RAND_MAX) * 2.0f - 1.0f;
+		f32_ref[i] = f32_dst[i] = (rand() / (float) RAND_MAX) * 2.0f - 1.0f;
+		s32_src[i] = ((uint32_t) rand() << 1) ^ rand();
+		s32_ref[i] = s32_dst[i] = ((uint32_t) rand() << 1) ^ rand();
+		f64_src[i] = (rand() / (double) RAND_MAX) * 2.0 - 1.0;
+		f64_ref[i] = f64_dst[i] = (rand() / (double) RAND_MAX) * 2.0 - 1.0;
+	}
+}
+
+static void compare_s16(const char *name, uint32_t cpu_flags)
+{
+	int i;
+
+	for (i = 0; i < N_SAMPLES; i++) {
+		if (s16_ref[i] != s16_dst[i]) {
+			printf("%s cpu %08x: sample %d: %d != %d\n", name, cpu_flags,
+			       i, s16_ref[i], s16_dst[i]);
+			n_failures++;
+			return;
+		}
+	}
+}
+
+static void compare_f32(const char *name, uint32_t cpu_flags)
+{
+	int i;
+
+	for (i = 0; i < N_SAMPLES; i++) {
+		if (fabsf(f32_ref[i] - f32_dst[i]) > F32_TOLERANCE) {
+			printf("%s cpu %08x: sample %d: %f != %f\n", name, cpu_flags,
+			       i, f32_ref[i], f32_dst[i]);
+			n_failures++;
+			return;
+		}
+	}
+}
+
+static void compare_s32(const char *name, uint32_t cpu_flags)
+{
+	int i;
+
+	for (i = 0; i < N_SAMPLES; i++) {
+		if (s32_ref[i] != s32_dst[i]) {
+			printf("%s cpu %08x: sample %d: %d != %d\n", name, cpu_flags,
+			       i, s32_ref[i], s32_dst[i]);
+			n_failures++;
+			return;
+		}
+	}
+}
+
+static void compare_f64(const char *name, uint32_t cpu_flags)
+{
+	int i;
+
+	for (i = 0; i < N_SAMPLES; i++) {
+		if (f64_ref[i] != f64_dst[i]) {
+			printf("%s cpu %08x: sample %d: %f != %f\n", name, cpu_flags,
+			       i, f64_ref[i], f64_dst[i]);
+			n_failures++;
+			return;
+		}
+	}
+}
+
+static void test_ops(struct spa_audiomixer_ops *ref, struct spa_audiomixer_ops *ops,
+		     uint32_t cpu_flags)
+{
+	static const double scales[] = { 0.0, 0.25, 0.5, 0.999, 1.5, 10.0, 20.0 };
+	int offset, i;
+
+	/* also test unaligned start and odd sizes */
+	for (offset = 0; offset < 3; offset++) {
+		int n_samples = N_SAMPLES - offset;
+
+		fill_data();
+		ref->add[FMT_S16](s16_ref + offset, s16_src, n_samples * sizeof(int16_t));
+		ops->add[FMT_S16](s16_dst + offset, s16_src, n_samples * sizeof(int16_t));
+		compare_s16("add_s16", cpu_flags);
+
+		ref->add[FMT_F32](f32_ref + offset, f32_src, n_samples * sizeof(float));
+		ops->add[FMT_F32](f32_dst + offset, f32_src, n_samples * sizeof(float));
+		compare_f32("add_f32", cpu_flags);
+
+		for (i = 1; i <= 8; i++) {
+			static const float volumes[] = { 0.1f, 0.5f, 1.0f, 1.5f, 0.0f, 3.0f, 20.0f, 0.33f };
+			int n_frames = n_samples / i;
+
+			fill_data();
+			ref->copy_volume[FMT_S16](s16_ref + offset, s16_src, volumes, i,
+						  n_frames * i * sizeof(int16_t));
+			ops->copy_volume[FMT_S16](s16_dst + offset, s16_src, volumes, i,
+						  n_frames * i * sizeof(int16_t));
+			compare_s16("copy_volume_s16", cpu_flags);
+
+			ref->copy_volume[FMT_F32](f32_ref + offset, f32_src, volumes, i,
+						  n_frames * i * sizeof(float));
+			ops->copy_volume[FMT_F32](f32_dst + offset, f32_src, volumes, i,
+						  n_frames * i * sizeof(float));
+			compare_f32("copy_volume_f32", cpu_flags);
+
+			ref->copy_volume[FMT_S32](s32_ref + offset, s32_src, volumes, i,
+						  n_frames * i * sizeof(int32_t));
+			ops->copy_volume[FMT_S32](s32_dst + offset, s32_src, volumes, i,
+						  n_frames * i * sizeof(int32_t));
+			compare_s32("copy_volume_s32", cpu_flags);
+
+			ref->copy_volume[FMT_F64](f64_ref + offset, f64_src, volumes, i,
+						  n_frames * i * sizeof(double));
+			ops->copy_volume[FMT_F64](f64_dst + offset, f64_src, volumes, i,
+						  n_frames * i * sizeof(double));
+			compare_f64("copy_volume_f64", cpu_flags);
+		}
+
+		for (i = 0; i < SPA_N_ELEMENTS(scales); i++) {
+			fill_data();
+			ref->copy_scale[FMT_S16](s16_ref + offset, s16_src, scales[i],
+						 n_samples * sizeof(int16_t));
+			ops->copy_scale[FMT_S16](s16_dst + offset, s16_src, scales[i],
+						 n_samples * sizeof(int16_t));
+			compare_s16("copy_scale_s16", cpu_flags);
+
+			ref->add_scale[FMT_S16](s16_ref + offset, s16_src, scales[i],
+						n_samples * sizeof(int16_t));
+			ops->add_scale[FMT_S16](s16_dst + offset, s16_src, scales[i],
+						n_samples * sizeof(int16_t));
+			compare_s16("add_scale_s16", cpu_flags);
+
+			ref->copy_scale[FMT_F32](f32_ref + offset, f32_src, scales[i],
+						 n_samples * sizeof(float));
+			ops->copy_scale[FMT_F32](f32_dst + offset, f32_src, scales[i],
+						 n_samples * sizeof(float));
+			compare_f32("copy_scale_f32", cpu_flags);
+
+			ref->add_scale[FMT_F32](f32_ref + offset, f32_src, scales[i],
+						n_samples * sizeof(float));
+			ops->add_scale[FMT_F32](f32_dst + offset, f32_src, scales[i],
+						n_samples * sizeof(float));
+			compare_f32("add_scale_f32", cpu_flags);
+
+			ref->copy_scale[FMT_S32](s32_ref + offset, s32_src, scales[i],
+						 n_samples * sizeof(int32_t));
+			ops->copy_scale[FMT_S32](s32_dst + offset, s32_src, scales[i],
+						 n_samples * sizeof(int32_t));
+			compare_s32("copy_scale_s32", cpu_flags);
+
+			ref->copy_scale[FMT_F64](f64_ref + offset, f64_src, scales[i],
+						 n_samples * sizeof(double));
+			ops->copy_scale[FMT_F64](f64_dst + offset, f64_src, scales[i],
+						 n_samples * sizeof(double));
+			compare_f64("copy_scale_f64", cpu_flags);
+		}
+	}
+}
+
+#define N_SOURCES	5
+/* more than one tile plus a remainder so that the tiled loop of mix_n crosses
+ * tile boundaries and handles a partial last tile */
+#define N_MIX_SAMPLES	(2 * MIX_TILE_BYTES / sizeof(int16_t) + 37)
+
+static int16_t s16_mix_srcs[N_SOURCES][N_MIX_SAMPLES];
+static int16_t s16_mix_ref[N_MIX_SAMPLES];
+static int16_t s16_mix_dst[N_MIX_SAMPLES];
+static float f32_mix_srcs[N_SOURCES][N_MIX_SAMPLES];
+static float f32_mix_ref[N_MIX_SAMPLES];
+static float f32_mix_dst[N_MIX_SAMPLES];
+
+/* mixing N sources in one pass should give the same result as mixing them
+ * one after the other */
+static void test_mix_n(struct spa_audiomixer_ops *ops, uint32_t cpu_flags)
+{
+	static const double volume[N_SOURCES] = { 1.0, 0.5, 1.0, 0.25, 2.0 };
+	const void *src[N_SOURCES];
+	int i, j;
+
+	for (i = 0; i < N_SOURCES; i++) {
+		for (j = 0; j < N_MIX_SAMPLES; j++) {
+			s16_mix_srcs[i][j] = (rand() % 65536) - 32768;
+			f32_mix_srcs[i][j] = (rand() / (float) RAND_MAX) * 2.0f - 1.0f;
+		}
+	}
+
+	for (i = 0; i < N_SOURCES; i++) {
+		if (i == 0)
+			ops->copy_scale[FMT_S16](s16_mix_ref, s16_mix_srcs[i], volume[i],
+						 sizeof(s16_mix_ref));
+		else
+			ops->add_scale[FMT_S16](s16_mix_ref, s16_mix_srcs[i], volume[i],
+						sizeof(s16_mix_ref));
+		src[i] = s16_mix_srcs[i];
+	}
+	spa_audiomixer_mix_n(ops, FMT_S16, s16_mix_dst, src, volume, N_SOURCES,
+			     sizeof(s16_mix_dst));
+	for (j = 0; j < N_MIX_SAMPLES; j++) {
+		if (s16_mix_ref[j] != s16_mix_dst[j]) {
+			printf("mix_n_s16 cpu %08x: sample %d: %d != %d\n", cpu_flags,
+			       j, s16_mix_ref[j], s16_mix_dst[j]);
+			n_failures++;
+			break;
+		}
+	}
+
+	for (i = 0; i < N_SOURCES; i++) {
+		if (i == 0)
+			ops->copy_scale[FMT_F32](f32_mix_ref, f32_mix_srcs[i], volume[i],
+						 sizeof(f32_mix_ref));
+		else
+			ops->add_scale[FMT_F32](f32_mix_ref, f32_mix_srcs[i], volume[i],
+						sizeof(f32_mix_ref));
+		src[i] = f32_mix_srcs[i];
+	}
+	spa_audiomixer_mix_n(ops, FMT_F32, f32_mix_dst, src, volume, N_SOURCES,
+			     sizeof(f32_mix_dst));
+	for (j = 0; j < N_MIX_SAMPLES; j++) {
+		if (fabsf(f32_mix_ref[j] - f32_mix_dst[j]) > F32_TOLERANCE) {
+			printf("mix_n_f32 cpu %08x: sample %d: %f != %f\n", cpu_flags,
+			       j, f32_mix_ref[j], f32_mix_dst[j]);
+			n_failures++;
+			break;
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct spa_audiomixer_ops ref, ops;
+	uint32_t cpu_flags = spa_audiomixer_get_cpu_flags();
+	uint32_t flag;
+
+	printf("cpu flags: %08x\n", cpu_flags);
+
+	spa_audiomixer_get_ops_for_cpu(&ref, 0);
+
+	/* test each supported instruction set on its own */
+	for (flag = 1; flag <= MIX_CPU_FLAG_NEON; flag <<= 1) {
+		if ((cpu_flags & flag) == 0)
+			continue;
+		spa_audiomixer_get_ops_for_cpu(&ops, flag);
+		test_ops(&ref, &ops, flag);
+		test_mix_n(&ops, flag);
+	}
+	spa_audiomixer_get_ops(&ops);
+	test_ops(&ref, &ops, cpu_flags);
+
+	printf("%s\n", n_failures ? "FAILED" : "OK");
+
+	return n_failures ? -1 : 0;
+}
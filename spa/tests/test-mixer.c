@@ -50,6 +50,7 @@ static SPA_LOG_IMPL(default_log);
 #define spa_debug(...)	spa_log_trace(&default_log.log,__VA_ARGS__)
 
 #include <spa/graph/graph.h>
+#include <spa/graph/graph-schedulers.h>
 #include <spa/graph/graph-scheduler1.h>
 
 struct type {
@@ -115,7 +116,8 @@ struct data {
 	uint32_t n_support;
 
 	struct spa_graph graph;
-	struct spa_graph_data graph_data;
+	const struct spa_graph_scheduler *scheduler;
+	void *graph_data;
 	struct spa_graph_node source1_node;
 	struct spa_graph_port source1_out;
 	struct spa_graph_node source2_node;
@@ -714,8 +716,14 @@ int main(int argc, char *argv[])
 	data.data_loop.invoke = do_invoke;
 
 	spa_graph_init(&data.graph);
-	spa_graph_data_init(&data.graph_data, &data.graph);
-	spa_graph_set_callbacks(&data.graph, &spa_graph_impl_default, &data.graph_data);
+	if ((str = getenv("SPA_GRAPH_SCHEDULER")) == NULL)
+		data.scheduler = &spa_graph_scheduler1;
+	else if ((data.scheduler = spa_graph_scheduler_find(str)) == NULL) {
+		printf("unknown graph scheduler %s\n", str);
+		return -1;
+	}
+	data.graph_data = calloc(1, SPA_MAX(data.scheduler->size, sizeof(void *)));
+	spa_graph_set_scheduler(&data.graph, data.scheduler, data.graph_data);
 
 	if ((str = getenv("SPA_DEBUG")))
 		data.log->level = atoi(str);
@@ -36,6 +36,7 @@
 #include <spa/param/audio/format-utils.h>
 #include <spa/param/format-utils.h>
 #include <spa/graph/graph.h>
+#include <spa/graph/graph-schedulers.h>
 #include <spa/graph/graph-scheduler1.h>
 
 #define MODE_SYNC_PUSH          (1<<0)
@@ -109,7 +110,8 @@ struct data {
 	int iterations;
 
 	struct spa_graph graph;
-	struct spa_graph_data graph_data;
+	const struct spa_graph_scheduler *scheduler;
+	void *graph_data;
 	struct spa_graph_node source_node;
 	struct spa_graph_port source_out;
 	struct spa_graph_port sink_in;
@@ -545,8 +547,14 @@ int main(int argc, char *argv[])
 	const char *str;
 
 	spa_graph_init(&data.graph);
-	spa_graph_data_init(&data.graph_data, &data.graph);
-	spa_graph_set_callbacks(&data.graph, &spa_graph_impl_default, &data.graph_data);
+	if ((str = getenv("SPA_GRAPH_SCHEDULER")) == NULL)
+		data.scheduler = &spa_graph_scheduler1;
+	else if ((data.scheduler = spa_graph_scheduler_find(str)) == NULL) {
+		printf("unknown graph scheduler %s\n", str);
+		return -1;
+	}
+	data.graph_data = calloc(1, SPA_MAX(data.scheduler->size, sizeof(void *)));
+	spa_graph_set_scheduler(&data.graph, data.scheduler, data.graph_data);
 
 	data.map = &default_map.map;
 	data.log = &default_log.log;
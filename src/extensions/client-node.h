@@ -46,6 +46,18 @@ struct pw_client_node_area {
 	uint32_t n_output_ports;	/**< number of output ports of the node */
 };
 
+#define PW_CLIENT_NODE_CACHE_LINE	64
+
+/** Single producer, single consumer message queue in the transport area.
+ * The writer and the reader each update their own cache line so that they
+ * don't steal the line from each other on every message. \memberof pw_client_node */
+struct pw_client_node_queue {
+	uint32_t writeindex SPA_ALIGNED(PW_CLIENT_NODE_CACHE_LINE);	/**< updated by the writer */
+	uint32_t readindex SPA_ALIGNED(PW_CLIENT_NODE_CACHE_LINE);	/**< updated by the reader */
+	uint32_t running;	/**< the reader is handling messages and will see new
+				  *  messages without a wakeup */
+};
+
 /** \class pw_client_node_transport
  *
  * \brief Transport object
@@ -58,10 +70,10 @@ struct pw_client_node_transport {
 	struct pw_client_node_area *area;	/**< the transport area */
 	struct spa_io_buffers *inputs;		/**< array of buffer input io */
 	struct spa_io_buffers *outputs;		/**< array of buffer output io */
-	void *input_data;			/**< input memory for ringbuffer */
-	struct spa_ringbuffer *input_buffer;	/**< ringbuffer for input memory */
-	void *output_data;			/**< output memory for ringbuffer */
-	struct spa_ringbuffer *output_buffer;	/**< ringbuffer for output memory */
+	void *input_data;			/**< input memory for the queue */
+	struct pw_client_node_queue *input_queue;	/**< queue for input messages */
+	void *output_data;			/**< output memory for the queue */
+	struct pw_client_node_queue *output_queue;	/**< queue for output messages */
 
 	/** Destroy a transport
 	 * \param trans a transport to destroy
@@ -100,12 +112,23 @@ struct pw_client_node_transport {
 	 * Use this function after \ref next_message().
 	 */
 	int (*parse_message) (struct pw_client_node_transport *trans, void *message);
+
+	/** Check if the peer needs a wakeup
+	 * \param trans the transport
+	 * \return true when the peer is not handling messages and must be
+	 *	woken up to see the messages that were added
+	 *
+	 * Use this function after \ref add_message() to avoid writing the
+	 * eventfd when the peer is already running.
+	 */
+	bool (*need_wakeup) (struct pw_client_node_transport *trans);
 };
 
 #define pw_client_node_transport_destroy(t)		((t)->destroy((t)))
 #define pw_client_node_transport_add_message(t,m)	((t)->add_message((t), (m)))
 #define pw_client_node_transport_next_message(t,m)	((t)->next_message((t), (m)))
 #define pw_client_node_transport_parse_message(t,m)	((t)->parse_message((t), (m)))
+#define pw_client_node_transport_need_wakeup(t)		((t)->need_wakeup((t)))
 
 enum pw_client_node_message_type {
 	PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT,		/*< signal that the node has output */
@@ -299,7 +322,8 @@ pw_client_node_proxy_destroy(struct pw_client_node_proxy *p)
 #define PW_CLIENT_NODE_PROXY_EVENT_PORT_USE_BUFFERS	8
 #define PW_CLIENT_NODE_PROXY_EVENT_PORT_COMMAND		9
 #define PW_CLIENT_NODE_PROXY_EVENT_PORT_SET_IO		10
-#define PW_CLIENT_NODE_PROXY_EVENT_NUM			11
+#define PW_CLIENT_NODE_PROXY_EVENT_PORT_SET_PEER	11
+#define PW_CLIENT_NODE_PROXY_EVENT_NUM			12
 
 /** \ref pw_client_node events */
 struct pw_client_node_proxy_events {
@@ -446,6 +470,27 @@ struct pw_client_node_proxy_events {
 			     uint32_t mem_id,
 			     uint32_t offset,
 			     uint32_t size);
+
+	/**
+	 * Exchange buffers of \a port_id directly with a port of another client
+	 *
+	 * The output side writes the io of the peer input port and wakes up
+	 * the peer, the input side answers over the same transport. The
+	 * server does not see the buffers of the port while the peer is set.
+	 *
+	 * \param direction the direction of the port
+	 * \param port_id the port id
+	 * \param readfd fd for signal data can be read, -1 to remove the peer
+	 * \param writefd fd for signal data can be written
+	 * \param transport the transport shared with the peer, NULL to remove
+	 *	the peer and use the server again
+	 */
+	void (*port_set_peer) (void *object,
+			       enum spa_direction direction,
+			       uint32_t port_id,
+			       int readfd,
+			       int writefd,
+			       struct pw_client_node_transport *transport);
 };
 
 static inline void
@@ -479,6 +524,8 @@ pw_client_node_proxy_add_listener(struct pw_client_node_proxy *p,
 	pw_resource_notify(r,struct pw_client_node_proxy_events,port_command,__VA_ARGS__)
 #define pw_client_node_resource_port_set_io(r,...)	\
 	pw_resource_notify(r,struct pw_client_node_proxy_events,port_set_io,__VA_ARGS__)
+#define pw_client_node_resource_port_set_peer(r,...)	\
+	pw_resource_notify(r,struct pw_client_node_proxy_events,port_set_peer,__VA_ARGS__)
 
 #ifdef __cplusplus
 }  /* extern "C" */
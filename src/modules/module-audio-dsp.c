@@ -27,6 +27,7 @@
 #include <spa/node/node.h>
 #include <spa/utils/hook.h>
 #include <spa/param/audio/format-utils.h>
+#include <spa/param/props.h>
 
 #include <spa/lib/pod.h>
 #include <spa/lib/debug.h>
@@ -43,12 +44,16 @@
 #define MAX_PORTS	256
 #define MAX_BUFFERS	8
 
+#define DEFAULT_QUANTUM	(1024 / sizeof(float))
+#define MAX_QUANTUM	8192
+
 struct type {
 	struct spa_type_media_type media_type;
         struct spa_type_media_subtype media_subtype;
         struct spa_type_format_audio format_audio;
         struct spa_type_audio_format audio_format;
         struct spa_type_media_subtype_audio media_subtype_audio;
+	uint32_t prop_min_latency;
 };
 
 static inline void init_type(struct type *type, struct spa_type_map *map)
@@ -58,6 +63,7 @@ static inline void init_type(struct type *type, struct spa_type_map *map)
         spa_type_format_audio_map(map, &type->format_audio);
         spa_type_audio_format_map(map, &type->audio_format);
         spa_type_media_subtype_audio_map(map, &type->media_subtype_audio);
+	type->prop_min_latency = spa_type_map_get_id(map, SPA_TYPE_PROPS__minLatency);
 }
 
 struct impl {
@@ -119,7 +125,7 @@ struct node {
 
 	int channels;
 	int sample_rate;
-	int buffer_size;
+	int buffer_size;	/**< samples per cycle, changed with the minLatency prop */
 
 	struct spa_node node_impl;
 
@@ -142,11 +148,47 @@ static int node_enum_params(struct spa_node *node,
 	return -ENOTSUP;
 }
 
+static int do_set_buffer_size(struct spa_loop *loop,
+			      bool async,
+			      uint32_t seq,
+			      const void *data,
+			      size_t size,
+			      void *user_data)
+{
+	struct node *n = user_data;
+	n->buffer_size = *(const int *) data;
+	return 0;
+}
+
+/* the buffers are negotiated for MAX_QUANTUM samples, the number of samples
+ * that is processed in a cycle can change without renegotiation */
 static int node_set_param(struct spa_node *node,
 			  uint32_t id, uint32_t flags,
 			  const struct spa_pod *param)
 {
-	return -ENOTSUP;
+	struct node *n = SPA_CONTAINER_OF(node, struct node, node_impl);
+	struct pw_type *t = n->impl->t;
+	int buffer_size = n->buffer_size;
+
+	if (id != t->param.idProps)
+		return -ENOENT;
+
+	if (param == NULL)
+		buffer_size = DEFAULT_QUANTUM;
+	else
+		spa_pod_object_parse(param,
+			":", n->impl->type.prop_min_latency, "?i", &buffer_size, NULL);
+
+	buffer_size = SPA_CLAMP(buffer_size, 1, MAX_QUANTUM);
+	if (buffer_size == n->buffer_size)
+		return 0;
+
+	pw_log_debug(NAME " %p: buffer size %d -> %d", n, n->buffer_size, buffer_size);
+
+	pw_loop_invoke(n->node->data_loop, do_set_buffer_size, SPA_ID_INVALID,
+		       &buffer_size, sizeof(buffer_size), true, n);
+
+	return 0;
 }
 
 static int node_send_command(struct spa_node *node,
@@ -465,7 +507,7 @@ static int port_enum_params(struct spa_node *node,
 
 		param = spa_pod_builder_object(&b,
 			id, t->param_buffers.Buffers,
-			":", t->param_buffers.size,    "i", n->buffer_size * sizeof(float),
+			":", t->param_buffers.size,    "i", MAX_QUANTUM * sizeof(float),
 			":", t->param_buffers.stride,  "i", 0,
 			":", t->param_buffers.buffers, "ir", 2,
 				SPA_POD_PROP_MIN_MAX(1, MAX_BUFFERS),
@@ -579,7 +621,7 @@ static int port_alloc_buffers(struct spa_node *node, enum spa_direction directio
                 b = &p->buffers[i];
 		b->outbuf = buffers[i];
 		d[0].type = t->data.MemPtr;
-		d[0].maxsize = n->buffer_size;
+		d[0].maxsize = MAX_QUANTUM * sizeof(float);
 		b->ptr = d[0].data = p->buffer;
                 spa_list_append(&p->queue, &b->link);
 	}
@@ -766,7 +808,7 @@ static struct pw_node *make_node(struct impl *impl, const struct pw_properties *
 	n->node_impl = node_impl;
 	n->channels = 2;
 	n->sample_rate = 44100;
-	n->buffer_size = 1024 / sizeof(float);
+	n->buffer_size = DEFAULT_QUANTUM;
 	pw_node_set_implementation(node, &n->node_impl);
 
 	p = make_port(n, direction, 0, 0, NULL);
@@ -83,6 +83,9 @@ struct port {
 
 	uint32_t n_buffers;
 	struct buffer buffers[MAX_BUFFERS];
+
+	struct pw_port *port;
+	struct spa_hook port_listener;
 };
 
 struct proxy {
@@ -120,6 +123,7 @@ struct impl {
 	struct pw_client_node this;
 
 	bool client_reuse;
+	bool direct;
 
 	struct pw_core *core;
 	struct pw_type *t;
@@ -136,6 +140,24 @@ struct impl {
 
 	uint32_t input_ready;
 	bool out_pending;
+
+	struct spa_list peers;
+};
+
+/* a link from one of our output ports to the input port of another
+ * client-node. When both clients can do it, they exchange buffers directly
+ * over their own transport and we only take care of the control. */
+struct peer {
+	struct spa_list link;
+
+	struct impl *impl;
+	struct impl *peer;
+	struct pw_link *pw_link;
+	struct spa_hook link_listener;
+
+	struct pw_client_node_transport *transport;
+	int fds[2];
+	bool active;
 };
 
 /** \endcond */
@@ -201,6 +223,10 @@ static int spa_proxy_node_set_param(struct spa_node *node, uint32_t id, uint32_t
 static inline void do_flush(struct proxy *this)
 {
 	uint64_t cmd = 1;
+
+	if (!pw_client_node_transport_need_wakeup(this->impl->transport))
+		return;
+
 	if (write(this->writefd, &cmd, 8) != 8)
 		spa_log_warn(this->log, "proxy %p: error flushing : %s", this, strerror(errno));
 
@@ -895,7 +921,8 @@ static void setup_transport(struct impl *impl)
 
 	spa_node_get_n_ports(&impl->proxy.node, &n_inputs, &max_inputs, &n_outputs, &max_outputs);
 
-	impl->transport = pw_client_node_transport_new(max_inputs, max_outputs);
+	impl->transport = pw_client_node_transport_new(max_inputs, max_outputs,
+						       impl->core->mem_flags);
 	impl->transport->area->n_input_ports = n_inputs;
 	impl->transport->area->n_output_ports = n_outputs;
 }
@@ -1146,13 +1173,225 @@ static void node_initialized(void *data)
 					  impl->transport);
 }
 
+static uint32_t count_links(struct pw_port *port)
+{
+	struct pw_link *l;
+	uint32_t n_links = 0;
+
+	if (port->direction == PW_DIRECTION_OUTPUT)
+		spa_list_for_each(l, &port->links, output_link)
+			n_links++;
+	else
+		spa_list_for_each(l, &port->links, input_link)
+			n_links++;
+	return n_links;
+}
+
+static struct impl *get_client_node(struct pw_node *node)
+{
+	if (node->node == NULL || node->node->process_input != spa_proxy_node_process_input)
+		return NULL;
+	return (SPA_CONTAINER_OF(node->node, struct proxy, node))->impl;
+}
+
+/* the client of \a impl may exchange data with the node of \a peer */
+static bool peer_allowed(struct impl *impl, struct impl *peer)
+{
+	struct pw_global *global = peer->this.node->global;
+	uint32_t perms;
+
+	if (global == NULL)
+		return false;
+	perms = pw_global_get_permissions(global, impl->this.resource->client);
+	return PW_PERM_IS_R(perms) && PW_PERM_IS_X(perms);
+}
+
+static bool peer_can_activate(struct peer *p)
+{
+	struct impl *impl = p->impl, *peer = p->peer;
+
+	return impl->direct && peer->direct &&
+	    impl->this.resource && peer->this.resource &&
+	    peer_allowed(impl, peer) && peer_allowed(peer, impl) &&
+	    impl->proxy.n_inputs == 0 && impl->proxy.n_outputs == 1 &&
+	    peer->proxy.n_inputs == 1 && peer->proxy.n_outputs == 0 &&
+	    count_links(p->pw_link->output) == 1 && count_links(p->pw_link->input) == 1;
+}
+
+static void peer_activate(struct peer *p)
+{
+	struct impl *impl = p->impl, *peer = p->peer;
+	struct pw_link *link = p->pw_link;
+
+	p->transport = pw_client_node_transport_new(1, 1, impl->core->mem_flags);
+	if (p->transport == NULL)
+		return;
+	p->transport->area->n_input_ports = 1;
+	p->transport->area->n_output_ports = 1;
+
+	p->fds[0] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	p->fds[1] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (p->fds[0] == -1 || p->fds[1] == -1) {
+		pw_log_error("client-node %p: can't create peer eventfd: %m", impl);
+		goto error;
+	}
+
+	pw_log_debug("client-node %p: direct link %p to client-node %p", impl, link, peer);
+
+	/* fds[0] wakes up the input side, fds[1] the output side */
+	pw_client_node_resource_port_set_peer(impl->this.resource,
+					      SPA_DIRECTION_OUTPUT,
+					      link->output->port_id,
+					      p->fds[1], p->fds[0],
+					      p->transport);
+	pw_client_node_resource_port_set_peer(peer->this.resource,
+					      SPA_DIRECTION_INPUT,
+					      link->input->port_id,
+					      p->fds[0], p->fds[1],
+					      p->transport);
+	p->active = true;
+	return;
+
+      error:
+	if (p->fds[0] != -1)
+		close(p->fds[0]);
+	if (p->fds[1] != -1)
+		close(p->fds[1]);
+	p->fds[0] = p->fds[1] = -1;
+	pw_client_node_transport_destroy(p->transport);
+	p->transport = NULL;
+}
+
+static void peer_deactivate(struct peer *p)
+{
+	struct impl *impl = p->impl, *peer = p->peer;
+	struct pw_link *link = p->pw_link;
+
+	if (!p->active)
+		return;
+
+	pw_log_debug("client-node %p: remove direct link %p", impl, link);
+
+	if (impl->this.resource)
+		pw_client_node_resource_port_set_peer(impl->this.resource,
+						      SPA_DIRECTION_OUTPUT,
+						      link->output->port_id,
+						      -1, -1, NULL);
+	if (peer->this.resource)
+		pw_client_node_resource_port_set_peer(peer->this.resource,
+						      SPA_DIRECTION_INPUT,
+						      link->input->port_id,
+						      -1, -1, NULL);
+
+	close(p->fds[0]);
+	close(p->fds[1]);
+	p->fds[0] = p->fds[1] = -1;
+	pw_client_node_transport_destroy(p->transport);
+	p->transport = NULL;
+	p->active = false;
+}
+
+static void peer_free(struct peer *p)
+{
+	peer_deactivate(p);
+	spa_hook_remove(&p->link_listener);
+	spa_list_remove(&p->link);
+	free(p);
+}
+
+static void peer_link_state_changed(void *data, enum pw_link_state old,
+				    enum pw_link_state state, const char *error)
+{
+	struct peer *p = data;
+
+	if (state >= PW_LINK_STATE_PAUSED) {
+		if (!p->active && peer_can_activate(p))
+			peer_activate(p);
+	}
+	else
+		peer_deactivate(p);
+}
+
+static void peer_link_destroy(void *data)
+{
+	peer_free(data);
+}
+
+static const struct pw_link_events peer_link_events = {
+	PW_VERSION_LINK_EVENTS,
+	.destroy = peer_link_destroy,
+	.state_changed = peer_link_state_changed,
+};
+
+static void port_link_added(void *data, struct pw_link *link)
+{
+	struct impl *impl = data;
+	struct impl *peer;
+	struct peer *p;
+
+	if (link->output->node != impl->this.node)
+		return;
+	if ((peer = get_client_node(link->input->node)) == NULL)
+		return;
+
+	if ((p = calloc(1, sizeof(struct peer))) == NULL)
+		return;
+
+	p->impl = impl;
+	p->peer = peer;
+	p->pw_link = link;
+	p->fds[0] = p->fds[1] = -1;
+	spa_list_append(&impl->peers, &p->link);
+	pw_link_add_listener(link, &p->link_listener, &peer_link_events, p);
+}
+
+static const struct pw_port_events port_events = {
+	PW_VERSION_PORT_EVENTS,
+	.link_added = port_link_added,
+};
+
+static void node_port_added(void *data, struct pw_port *port)
+{
+	struct impl *impl = data;
+	struct proxy *this = &impl->proxy;
+	struct port *p;
+
+	if (port->direction != PW_DIRECTION_OUTPUT || port->port_id >= MAX_OUTPUTS)
+		return;
+
+	p = GET_OUT_PORT(this, port->port_id);
+	p->port = port;
+	pw_port_add_listener(port, &p->port_listener, &port_events, impl);
+}
+
+static void node_port_removed(void *data, struct pw_port *port)
+{
+	struct impl *impl = data;
+	struct proxy *this = &impl->proxy;
+	struct port *p;
+
+	if (port->direction != PW_DIRECTION_OUTPUT || port->port_id >= MAX_OUTPUTS)
+		return;
+
+	p = GET_OUT_PORT(this, port->port_id);
+	if (p->port == port) {
+		spa_hook_remove(&p->port_listener);
+		p->port = NULL;
+	}
+}
+
 static void node_free(void *data)
 {
 	struct impl *impl = data;
 
+	struct peer *p, *t;
+
 	pw_log_debug("client-node %p: free", &impl->this);
 	proxy_clear(&impl->proxy);
 
+	spa_list_for_each_safe(p, t, &impl->peers, link)
+		peer_free(p);
+
 	if (impl->transport)
 		pw_client_node_transport_destroy(impl->transport);
 
@@ -1169,6 +1408,8 @@ static const struct pw_node_events node_events = {
 	PW_VERSION_NODE_EVENTS,
 	.free = node_free,
 	.initialized = node_initialized,
+	.port_added = node_port_added,
+	.port_removed = node_port_removed,
 };
 
 static const struct pw_resource_events resource_events = {
@@ -1208,6 +1449,7 @@ struct pw_client_node *pw_client_node_new(struct pw_resource *resource,
 	impl->core = core;
 	impl->t = pw_core_get_type(core);
 	impl->fds[0] = impl->fds[1] = -1;
+	spa_list_init(&impl->peers);
 	pw_log_debug("client-node %p: new", impl);
 
 	support = pw_core_get_support(impl->core, &n_support);
@@ -1233,6 +1475,9 @@ struct pw_client_node *pw_client_node_new(struct pw_resource *resource,
 	str = pw_properties_get(properties, "pipewire.client.reuse");
 	impl->client_reuse = str && pw_properties_parse_bool(str);
 
+	str = pw_properties_get(properties, "pipewire.client.direct");
+	impl->direct = str && pw_properties_parse_bool(str);
+
 	pw_resource_add_listener(this->resource,
 				 &impl->resource_listener,
 				 &resource_events,
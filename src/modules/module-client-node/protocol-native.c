@@ -439,6 +439,46 @@ static int client_node_demarshal_port_set_io(void *object, void *data, size_t si
 	return 0;
 }
 
+static int client_node_demarshal_port_set_peer(void *object, void *data, size_t size)
+{
+	struct pw_proxy *proxy = object;
+	struct spa_pod_parser prs;
+	uint32_t direction, port_id;
+	int32_t ridx, widx, memfd_idx;
+	int readfd = -1, writefd = -1;
+	struct pw_client_node_transport_info info;
+	struct pw_client_node_transport *transport = NULL;
+
+	spa_pod_parser_init(&prs, data, size, 0);
+	if (spa_pod_parser_get(&prs,
+			"["
+			"i", &direction,
+			"i", &port_id,
+			"i", &ridx,
+			"i", &widx,
+			"i", &memfd_idx,
+			"i", &info.offset,
+			"i", &info.size, NULL) < 0)
+		return -EINVAL;
+
+	if (memfd_idx != -1) {
+		readfd = pw_protocol_native_get_proxy_fd(proxy, ridx);
+		writefd = pw_protocol_native_get_proxy_fd(proxy, widx);
+		info.memfd = pw_protocol_native_get_proxy_fd(proxy, memfd_idx);
+
+		if (readfd == -1 || writefd == -1 || info.memfd == -1)
+			return -EINVAL;
+
+		if ((transport = pw_client_node_transport_new_peer(&info, direction)) == NULL)
+			return -errno;
+	}
+
+	pw_proxy_notify(proxy, struct pw_client_node_proxy_events, port_set_peer,
+							direction, port_id,
+							readfd, writefd, transport);
+	return 0;
+}
+
 static void
 client_node_marshal_add_mem(void *object,
 			    uint32_t mem_id,
@@ -681,6 +721,40 @@ client_node_marshal_port_set_io(void *object,
 	pw_protocol_native_end_resource(resource, b);
 }
 
+static void
+client_node_marshal_port_set_peer(void *object,
+				  enum spa_direction direction,
+				  uint32_t port_id,
+				  int readfd,
+				  int writefd,
+				  struct pw_client_node_transport *transport)
+{
+	struct pw_resource *resource = object;
+	struct spa_pod_builder *b;
+	struct pw_client_node_transport_info info = { -1, 0, 0 };
+	int32_t ridx = -1, widx = -1, memfd_idx = -1;
+
+	b = pw_protocol_native_begin_resource(resource, PW_CLIENT_NODE_PROXY_EVENT_PORT_SET_PEER);
+
+	if (transport) {
+		pw_client_node_transport_get_info(transport, &info);
+		ridx = pw_protocol_native_add_resource_fd(resource, readfd);
+		widx = pw_protocol_native_add_resource_fd(resource, writefd);
+		memfd_idx = pw_protocol_native_add_resource_fd(resource, info.memfd);
+	}
+
+	spa_pod_builder_struct(b,
+			       "i", direction,
+			       "i", port_id,
+			       "i", ridx,
+			       "i", widx,
+			       "i", memfd_idx,
+			       "i", info.offset,
+			       "i", info.size);
+
+	pw_protocol_native_end_resource(resource, b);
+}
+
 
 static int client_node_demarshal_done(void *object, void *data, size_t size)
 {
@@ -867,6 +941,7 @@ static const struct pw_client_node_proxy_events pw_protocol_native_client_node_e
 	&client_node_marshal_port_use_buffers,
 	&client_node_marshal_port_command,
 	&client_node_marshal_port_set_io,
+	&client_node_marshal_port_set_peer,
 };
 
 static const struct pw_protocol_native_demarshal pw_protocol_native_client_node_event_demarshal[] = {
@@ -881,6 +956,7 @@ static const struct pw_protocol_native_demarshal pw_protocol_native_client_node_
 	{ &client_node_demarshal_port_use_buffers, PW_PROTOCOL_NATIVE_REMAP },
 	{ &client_node_demarshal_port_command, PW_PROTOCOL_NATIVE_REMAP },
 	{ &client_node_demarshal_port_set_io, PW_PROTOCOL_NATIVE_REMAP },
+	{ &client_node_demarshal_port_set_peer, 0 },
 };
 
 static const struct pw_protocol_marshal pw_protocol_native_client_node_marshal = {
@@ -21,7 +21,6 @@
 #include <errno.h>
 #include <sys/mman.h>
 
-#include <spa/utils/ringbuffer.h>
 #include <spa/node/io.h>
 #include <pipewire/log.h>
 #include <extensions/client-node.h>
@@ -50,9 +49,10 @@ static size_t area_get_size(struct pw_client_node_area *area)
 	size = sizeof(struct pw_client_node_area);
 	size += area->max_input_ports * sizeof(struct spa_io_buffers);
 	size += area->max_output_ports * sizeof(struct spa_io_buffers);
-	size += sizeof(struct spa_ringbuffer);
+	size = SPA_ROUND_UP_N(size, PW_CLIENT_NODE_CACHE_LINE);
+	size += sizeof(struct pw_client_node_queue);
 	size += INPUT_BUFFER_SIZE;
-	size += sizeof(struct spa_ringbuffer);
+	size += sizeof(struct pw_client_node_queue);
 	size += OUTPUT_BUFFER_SIZE;
 	return size;
 }
@@ -70,14 +70,17 @@ static void transport_setup_area(void *p, struct pw_client_node_transport *trans
 	trans->outputs = p;
 	p = SPA_MEMBER(p, a->max_output_ports * sizeof(struct spa_io_buffers), void);
 
-	trans->input_buffer = p;
-	p = SPA_MEMBER(p, sizeof(struct spa_ringbuffer), void);
+	/* the queues start on a cache line */
+	p = SPA_MEMBER(a, SPA_ROUND_UP_N(SPA_PTRDIFF(p, a), PW_CLIENT_NODE_CACHE_LINE), void);
+
+	trans->input_queue = p;
+	p = SPA_MEMBER(p, sizeof(struct pw_client_node_queue), void);
 
 	trans->input_data = p;
 	p = SPA_MEMBER(p, INPUT_BUFFER_SIZE, void);
 
-	trans->output_buffer = p;
-	p = SPA_MEMBER(p, sizeof(struct spa_ringbuffer), void);
+	trans->output_queue = p;
+	p = SPA_MEMBER(p, sizeof(struct pw_client_node_queue), void);
 
 	trans->output_data = p;
 	p = SPA_MEMBER(p, OUTPUT_BUFFER_SIZE, void);
@@ -96,8 +99,26 @@ static void transport_reset_area(struct pw_client_node_transport *trans)
 		trans->outputs[i].status = SPA_STATUS_OK;
 		trans->outputs[i].buffer_id = SPA_ID_INVALID;
 	}
-	spa_ringbuffer_init(trans->input_buffer);
-	spa_ringbuffer_init(trans->output_buffer);
+	memset(trans->input_queue, 0, sizeof(struct pw_client_node_queue));
+	memset(trans->output_queue, 0, sizeof(struct pw_client_node_queue));
+}
+
+static void queue_read_data(const void *buffer, uint32_t size, uint32_t offset,
+			    void *data, uint32_t len)
+{
+	uint32_t l0 = SPA_MIN(len, size - offset), l1 = len - l0;
+	memcpy(data, SPA_MEMBER(buffer, offset, void), l0);
+	if (SPA_UNLIKELY(l1 > 0))
+		memcpy(SPA_MEMBER(data, l0, void), buffer, l1);
+}
+
+static void queue_write_data(void *buffer, uint32_t size, uint32_t offset,
+			     const void *data, uint32_t len)
+{
+	uint32_t l0 = SPA_MIN(len, size - offset), l1 = len - l0;
+	memcpy(SPA_MEMBER(buffer, offset, void), data, l0);
+	if (SPA_UNLIKELY(l1 > 0))
+		memcpy(buffer, SPA_MEMBER(data, l0, void), l1);
 }
 
 static void destroy(struct pw_client_node_transport *trans)
@@ -119,20 +140,33 @@ static int add_message(struct pw_client_node_transport *trans, struct pw_client_
 	if (impl == NULL || message == NULL)
 		return -EINVAL;
 
-	filled = spa_ringbuffer_get_write_index(trans->output_buffer, &index);
+	index = trans->output_queue->writeindex;
+	filled = index - __atomic_load_n(&trans->output_queue->readindex, __ATOMIC_ACQUIRE);
 	avail = OUTPUT_BUFFER_SIZE - filled;
 	size = SPA_POD_SIZE(message);
 	if (avail < size)
 		return -ENOSPC;
 
-	spa_ringbuffer_write_data(trans->output_buffer,
-				  trans->output_data, OUTPUT_BUFFER_SIZE,
-				  index & (OUTPUT_BUFFER_SIZE - 1), message, size);
-	spa_ringbuffer_write_update(trans->output_buffer, index + size);
+	queue_write_data(trans->output_data, OUTPUT_BUFFER_SIZE,
+			 index & (OUTPUT_BUFFER_SIZE - 1), message, size);
+	__atomic_store_n(&trans->output_queue->writeindex, index + size, __ATOMIC_RELEASE);
 
 	return 0;
 }
 
+static bool need_wakeup(struct pw_client_node_transport *trans)
+{
+	/* order the write of the index before the read of the running flag,
+	 * pairs with the fence in next_message */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return !__atomic_load_n(&trans->output_queue->running, __ATOMIC_RELAXED);
+}
+
+static inline int32_t queue_avail(struct pw_client_node_queue *queue, uint32_t index)
+{
+	return __atomic_load_n(&queue->writeindex, __ATOMIC_ACQUIRE) - index;
+}
+
 static int next_message(struct pw_client_node_transport *trans, struct pw_client_node_message *message)
 {
 	struct transport *impl = (struct transport *) trans;
@@ -141,14 +175,29 @@ static int next_message(struct pw_client_node_transport *trans, struct pw_client
 	if (impl == NULL || message == NULL)
 		return -EINVAL;
 
-	avail = spa_ringbuffer_get_read_index(trans->input_buffer, &impl->current_index);
+	impl->current_index = trans->input_queue->readindex;
+
+	/* the writer does not wake us up while we are running */
+	if (!trans->input_queue->running)
+		__atomic_store_n(&trans->input_queue->running, 1, __ATOMIC_RELAXED);
+
+	avail = queue_avail(trans->input_queue, impl->current_index);
+	if (avail == 0) {
+		/* stop running and check again for a message that was added
+		 * before the writer could see that we stopped */
+		__atomic_store_n(&trans->input_queue->running, 0, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		avail = queue_avail(trans->input_queue, impl->current_index);
+		if (avail == 0)
+			return 0;
+		__atomic_store_n(&trans->input_queue->running, 1, __ATOMIC_RELAXED);
+	}
 	if (avail < sizeof(struct pw_client_node_message))
 		return 0;
 
-	spa_ringbuffer_read_data(trans->input_buffer,
-				 trans->input_data, INPUT_BUFFER_SIZE,
-				 impl->current_index & (INPUT_BUFFER_SIZE - 1),
-				 &impl->current, sizeof(struct pw_client_node_message));
+	queue_read_data(trans->input_data, INPUT_BUFFER_SIZE,
+			impl->current_index & (INPUT_BUFFER_SIZE - 1),
+			&impl->current, sizeof(struct pw_client_node_message));
 
 	if (avail < SPA_POD_SIZE(&impl->current))
 		return 0;
@@ -168,10 +217,10 @@ static int parse_message(struct pw_client_node_transport *trans, void *message)
 
 	size = SPA_POD_SIZE(&impl->current);
 
-	spa_ringbuffer_read_data(trans->input_buffer,
-				 trans->input_data, INPUT_BUFFER_SIZE,
-				 impl->current_index & (INPUT_BUFFER_SIZE - 1), message, size);
-	spa_ringbuffer_read_update(trans->input_buffer, impl->current_index + size);
+	queue_read_data(trans->input_data, INPUT_BUFFER_SIZE,
+			impl->current_index & (INPUT_BUFFER_SIZE - 1), message, size);
+	__atomic_store_n(&trans->input_queue->readindex, impl->current_index + size,
+			 __ATOMIC_RELEASE);
 
 	return 0;
 }
@@ -179,11 +228,13 @@ static int parse_message(struct pw_client_node_transport *trans, void *message)
 /** Create a new transport
  * \param max_input_ports maximum number of input_ports
  * \param max_output_ports maximum number of output_ports
+ * \param flags extra memblock flags for the transport area
  * \return a newly allocated \ref pw_client_node_transport
  * \memberof pw_client_node_transport
  */
 struct pw_client_node_transport *
-pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports)
+pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports,
+			     enum pw_memblock_flags flags)
 {
 	struct transport *impl;
 	struct pw_client_node_transport *trans;
@@ -205,10 +256,12 @@ pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports
 
 	if (pw_memblock_alloc(PW_MEMBLOCK_FLAG_WITH_FD |
 			  PW_MEMBLOCK_FLAG_MAP_READWRITE |
-			  PW_MEMBLOCK_FLAG_SEAL,
+			  PW_MEMBLOCK_FLAG_SEAL | flags,
 			  area_get_size(&area),
-			  &impl->mem) < 0)
+			  &impl->mem) < 0) {
+		free(impl);
 		return NULL;
+	}
 
 	memcpy(impl->mem->ptr, &area, sizeof(struct pw_client_node_area));
 	transport_setup_area(impl->mem->ptr, trans);
@@ -218,12 +271,13 @@ pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports
 	trans->add_message = add_message;
 	trans->next_message = next_message;
 	trans->parse_message = parse_message;
+	trans->need_wakeup = need_wakeup;
 
 	return trans;
 }
 
-struct pw_client_node_transport *
-pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *info)
+static struct pw_client_node_transport *
+transport_new_from_info(struct pw_client_node_transport_info *info, bool swap)
 {
 	struct transport *impl;
 	struct pw_client_node_transport *trans;
@@ -251,18 +305,21 @@ pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *inf
 
 	transport_setup_area(impl->mem->ptr, trans);
 
-	tmp = trans->output_buffer;
-	trans->output_buffer = trans->input_buffer;
-	trans->input_buffer = tmp;
+	if (swap) {
+		tmp = trans->output_queue;
+		trans->output_queue = trans->input_queue;
+		trans->input_queue = tmp;
 
-	tmp = trans->output_data;
-	trans->output_data = trans->input_data;
-	trans->input_data = tmp;
+		tmp = trans->output_data;
+		trans->output_data = trans->input_data;
+		trans->input_data = tmp;
+	}
 
 	trans->destroy = destroy;
 	trans->add_message = add_message;
 	trans->next_message = next_message;
 	trans->parse_message = parse_message;
+	trans->need_wakeup = need_wakeup;
 
 	return trans;
 
@@ -272,6 +329,36 @@ pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *inf
 	return NULL;
 }
 
+/** Create a transport from info
+ * \param info transport info from the server
+ * \return a new transport with the queues of the client side
+ * \memberof pw_client_node_transport
+ */
+struct pw_client_node_transport *
+pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *info)
+{
+	return transport_new_from_info(info, true);
+}
+
+/** Create a transport to a peer node from info
+ * \param info transport info from the server
+ * \param direction direction of the port that uses the transport
+ * \return a new transport
+ *
+ * A peer transport connects an output port of one client directly with
+ * an input port of another client. The output side writes the inputs
+ * of the peer and sends the messages that the server would send, the
+ * input side uses it like the transport with the server.
+ *
+ * \memberof pw_client_node_transport
+ */
+struct pw_client_node_transport *
+pw_client_node_transport_new_peer(struct pw_client_node_transport_info *info,
+				  enum spa_direction direction)
+{
+	return transport_new_from_info(info, direction == SPA_DIRECTION_INPUT);
+}
+
 /** Get transport info
  * \param trans the transport to get info of
  * \param[out] info transport info
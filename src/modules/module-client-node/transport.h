@@ -38,11 +38,16 @@ struct pw_client_node_transport_info {
 };
 
 struct pw_client_node_transport *
-pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports);
+pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports,
+			     enum pw_memblock_flags flags);
 
 struct pw_client_node_transport *
 pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *info);
 
+struct pw_client_node_transport *
+pw_client_node_transport_new_peer(struct pw_client_node_transport_info *info,
+				  enum spa_direction direction);
+
 int
 pw_client_node_transport_get_info(struct pw_client_node_transport *trans,
 				  struct pw_client_node_transport_info *info);
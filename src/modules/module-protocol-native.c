@@ -21,6 +21,8 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
+#include <inttypes.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/stat.h>
@@ -49,6 +51,7 @@
 #include "extensions/protocol-native.h"
 #include "modules/module-protocol-native/connection.h"
 #include "modules/module-protocol-native/defs.h"
+#include "modules/module-protocol-native/remap.h"
 
 #ifndef UNIX_PATH_MAX
 #define UNIX_PATH_MAX   108
@@ -59,6 +62,20 @@ static bool debug_messages = 0;
 #define LOCK_SUFFIX     ".lock"
 #define LOCK_SUFFIXLEN  5
 
+/* interval for updating the client statistics properties */
+#define STATS_INTERVAL	1
+
+/* max number of messages handled for a client before the other clients
+ * get their turn */
+#define MAX_DISPATCH	64
+
+/* stop reading messages from a client when this much output is queued for
+ * it and resume when it drops below the low water mark. A client that lets
+ * the output grow beyond the max is disconnected. */
+#define OUTPUT_HIGH_WATER	(256 * 1024)
+#define OUTPUT_LOW_WATER	(64 * 1024)
+#define OUTPUT_MAX		(16 * 1024 * 1024)
+
 void pw_protocol_native_init(struct pw_protocol *protocol);
 
 struct protocol_data {
@@ -91,104 +108,66 @@ struct server {
 
 	struct pw_loop *loop;
 	struct spa_source *source;
+	struct spa_source *stats_timer;
 	struct spa_hook hook;
+
+	struct spa_list pending_list;	/* clients with unhandled messages */
+	struct spa_source *resume;
 };
 
 struct client_data {
+	struct server *server;
 	struct pw_client *client;
 	struct spa_hook client_listener;
 	struct spa_source *source;
 	struct pw_protocol_native_connection *connection;
+	enum spa_io mask;
 	bool busy;
-};
-
-static bool pod_remap_data(uint32_t type, void *body, uint32_t size, struct pw_map *types)
-{
-	void *t;
+	bool paused;		/* too much output queued */
 
-	switch (type) {
-	case SPA_POD_TYPE_ID:
-		if ((t = pw_map_lookup(types, *(int32_t *) body)) == NULL)
-			return false;
-		*(int32_t *) body = PW_MAP_PTR_TO_ID(t);
-		break;
+	bool pending;
+	struct spa_list pending_link;
 
-	case SPA_POD_TYPE_PROP:
-	{
-		struct spa_pod_prop_body *b = body;
-
-		if ((t = pw_map_lookup(types, b->key)) == NULL)
-			return false;
-		b->key = PW_MAP_PTR_TO_ID(t);
-
-		if (b->value.type == SPA_POD_TYPE_ID) {
-			void *alt;
-			if (!pod_remap_data
-			    (b->value.type, SPA_POD_BODY(&b->value), b->value.size, types))
-				return false;
+	uint64_t stats_in;	/* messages in and out at the last stats update */
+	uint64_t stats_out;
+};
 
-			SPA_POD_PROP_ALTERNATIVE_FOREACH(b, size, alt)
-				if (!pod_remap_data(b->value.type, alt, b->value.size, types))
-					return false;
-		}
-		break;
-	}
-	case SPA_POD_TYPE_OBJECT:
-	{
-		struct spa_pod_object_body *b = body;
-		struct spa_pod *p;
-
-		if ((t = pw_map_lookup(types, b->id)) != NULL)
-			b->id = PW_MAP_PTR_TO_ID(t);
-		else
-			b->id = SPA_ID_INVALID;
-
-		if ((t = pw_map_lookup(types, b->type)) == NULL)
-			return false;
-		b->type = PW_MAP_PTR_TO_ID(t);
-
-		SPA_POD_OBJECT_BODY_FOREACH(b, size, p)
-			if (!pod_remap_data(p->type, SPA_POD_BODY(p), p->size, types))
-				return false;
-		break;
-	}
-	case SPA_POD_TYPE_STRUCT:
-	{
-		struct spa_pod *b = body, *p;
-
-		SPA_POD_FOREACH(b, size, p)
-			if (!pod_remap_data(p->type, SPA_POD_BODY(p), p->size, types))
-				return false;
-		break;
-	}
-	default:
-		break;
-	}
-	return true;
+static inline uint64_t get_time_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_TIME(&now);
 }
 
-static void
+/* returns true when the budget ran out and there can be more messages */
+static bool
 process_messages(struct client_data *data)
 {
 	struct pw_protocol_native_connection *conn = data->connection;
 	struct pw_client *client = data->client;
 	struct pw_core *core = client->core;
 	uint8_t opcode;
-	uint32_t id, size;
+	uint32_t id, size, budget = MAX_DISPATCH;
+	uint64_t start;
 	void *message;
 
 	core->current_client = client;
+	start = get_time_ns();
 
 	/* when the client is busy processing an async action, stop processing messages
-	 * for the client until it finishes the action */
-	while (!data->busy) {
+	 * for the client until it finishes the action. Also stop when the client does
+	 * not read its output. */
+	while (!data->busy && !data->paused) {
 		struct pw_resource *resource;
 		const struct pw_protocol_native_demarshal *demarshal;
 	        const struct pw_protocol_marshal *marshal;
 		uint32_t permissions;
 
+		if (budget == 0)
+			break;
 		if (!pw_protocol_native_connection_get_next(conn, &opcode, &id, &message, &size))
 			break;
+		budget--;
 
 		pw_log_trace("protocol-native %p: got message %d from %u", client->protocol,
 			     opcode, id);
@@ -199,6 +178,10 @@ process_messages(struct client_data *data)
 				     client->protocol, id);
 			continue;
 		}
+		if (!pw_protocol_native_opcode_stats_count(conn->stats.opcodes_in,
+							   resource->type, opcode))
+			conn->stats.other_in++;
+
 		permissions = pw_resource_get_permissions(resource);
 		if ((permissions & PW_PERM_X) == 0) {
 			pw_log_error("protocol-native %p: execute not allowed on resource %u",
@@ -222,7 +205,7 @@ process_messages(struct client_data *data)
 		}
 
 		if (demarshal[opcode].flags & PW_PROTOCOL_NATIVE_REMAP)
-			if (!pod_remap_data(SPA_POD_TYPE_STRUCT, message, size, &client->types))
+			if (!pod_remap_message(message, size, &client->types))
 				goto invalid_message;
 
 		if (debug_messages) {
@@ -232,9 +215,13 @@ process_messages(struct client_data *data)
 		if (demarshal[opcode].func(resource, message, size) < 0)
 			goto invalid_message;
 	}
+	conn->stats.busy_time += get_time_ns() - start;
+	core->current_client = NULL;
+	return budget == 0;
+
       done:
 	core->current_client = NULL;
-	return;
+	return false;
 
       invalid_method:
 	pw_log_error("protocol-native %p: invalid method %u on resource %u",
@@ -248,24 +235,109 @@ process_messages(struct client_data *data)
 	goto done;
 }
 
+static void update_mask(struct client_data *c)
+{
+	enum spa_io mask = SPA_IO_ERR | SPA_IO_HUP;
+
+	if (!c->busy && !c->paused)
+		mask |= SPA_IO_IN;
+	if (pw_protocol_native_connection_get_queued(c->connection) > 0)
+		mask |= SPA_IO_OUT;
+
+	if (mask != c->mask) {
+		c->mask = mask;
+		pw_loop_update_io(c->client->core->main_loop, c->source, mask);
+	}
+}
+
+static void add_pending(struct client_data *c)
+{
+	struct server *s = c->server;
+
+	if (c->pending)
+		return;
+	c->pending = true;
+	spa_list_append(&s->pending_list, &c->pending_link);
+	pw_loop_signal_event(s->loop, s->resume);
+}
+
+static void remove_pending(struct client_data *c)
+{
+	if (!c->pending)
+		return;
+	c->pending = false;
+	spa_list_remove(&c->pending_link);
+}
+
+/* handle messages of one client, when it has more messages than the budget
+ * it is queued after the other pending clients */
+static void dispatch_client(struct client_data *c)
+{
+	remove_pending(c);
+	if (process_messages(c))
+		add_pending(c);
+}
+
+/* give every pending client one turn */
+static void on_resume(void *data, uint64_t count)
+{
+	struct server *s = data;
+	struct client_data *c;
+	struct spa_list list;
+
+	spa_list_init(&list);
+	spa_list_insert_list(&list, &s->pending_list);
+	spa_list_init(&s->pending_list);
+
+	while (!spa_list_is_empty(&list)) {
+		c = spa_list_first(&list, struct client_data, pending_link);
+		spa_list_remove(&c->pending_link);
+		c->pending = false;
+		if (process_messages(c))
+			add_pending(c);
+	}
+}
+
+/* check the output queue of a client, returns false when the client was
+ * destroyed */
+static bool check_output(struct client_data *c)
+{
+	struct pw_client *client = c->client;
+	size_t queued = pw_protocol_native_connection_get_queued(c->connection);
+
+	if (queued > OUTPUT_MAX) {
+		pw_log_error("protocol-native %p: client %p does not read its messages, "
+			     "%zd bytes queued", client->protocol, client, queued);
+		pw_client_destroy(client);
+		return false;
+	}
+	if (!c->paused && queued > OUTPUT_HIGH_WATER) {
+		pw_log_debug("protocol-native %p: client %p paused, %zd bytes queued",
+			     client->protocol, client, queued);
+		c->paused = true;
+	}
+	else if (c->paused && queued < OUTPUT_LOW_WATER) {
+		pw_log_debug("protocol-native %p: client %p resumed", client->protocol, client);
+		c->paused = false;
+		add_pending(c);
+	}
+	update_mask(c);
+	return true;
+}
+
 static void
 client_busy_changed(void *data, bool busy)
 {
 	struct client_data *c = data;
 	struct pw_client *client = c->client;
-	enum spa_io mask = SPA_IO_ERR | SPA_IO_HUP;
 
 	c->busy = busy;
 
-	if (!busy)
-		mask |= SPA_IO_IN;
-
 	pw_log_debug("protocol-native %p: busy changed %d", client->protocol, busy);
-	pw_loop_update_io(client->core->main_loop, c->source, mask);
+	update_mask(c);
 
 	if (!busy)
-		process_messages(c);
-
+		dispatch_client(c);
 }
 
 static void
@@ -280,8 +352,16 @@ connection_data(void *data, int fd, enum spa_io mask)
 		return;
 	}
 
+	if (mask & SPA_IO_OUT) {
+		if (!pw_protocol_native_connection_flush(this->connection)) {
+			pw_client_destroy(client);
+			return;
+		}
+		if (!check_output(this))
+			return;
+	}
 	if (mask & SPA_IO_IN)
-		process_messages(this);
+		dispatch_client(this);
 }
 
 static void client_free(void *data)
@@ -291,6 +371,7 @@ static void client_free(void *data)
 
 	pw_loop_destroy_source(client->protocol->core->main_loop, this->source);
 	spa_list_remove(&client->protocol_link);
+	remove_pending(this);
 
 	pw_protocol_native_connection_destroy(this->connection);
 }
@@ -332,9 +413,11 @@ static struct pw_client *client_new(struct server *s, int fd)
 		goto no_client;
 
 	this = pw_client_get_user_data(client);
+	this->server = s;
 	this->client = client;
+	this->mask = SPA_IO_ERR | SPA_IO_HUP;
 	this->source = pw_loop_add_io(pw_core_get_main_loop(core),
-				      fd, SPA_IO_ERR | SPA_IO_HUP, true, connection_data, this);
+				      fd, this->mask, true, connection_data, this);
 	if (this->source == NULL)
 		goto no_source;
 
@@ -448,8 +531,7 @@ socket_data(void *data, int fd, enum spa_io mask)
 	}
 	c = client->user_data;
 
-	pw_loop_update_io(client->protocol->core->main_loop,
-			  c->source, SPA_IO_IN | SPA_IO_ERR | SPA_IO_HUP);
+	update_mask(c);
 }
 
 static bool add_socket(struct pw_protocol *protocol, struct server *s)
@@ -552,7 +634,7 @@ on_remote_data(void *data, int fd, enum spa_io mask)
 			}
 
 			if (demarshal[opcode].flags & PW_PROTOCOL_NATIVE_REMAP) {
-				if (!pod_remap_data(SPA_POD_TYPE_STRUCT, message, size, &this->types)) {
+				if (!pod_remap_message(message, size, &this->types)) {
                                         pw_log_error
                                             ("protocol-native %p: invalid message received %u for %u", this,
                                              opcode, id);
@@ -610,6 +692,12 @@ static int impl_connect_fd(struct pw_protocol_client *client, int fd)
 						   &conn_events,
 						   impl);
 
+	/* the offer goes out before the hello so that the daemon can use the
+	 * ring for its first replies */
+	if (getenv("PIPEWIRE_NO_RING") == NULL &&
+	    pw_protocol_native_connection_offer_ring(impl->connection) < 0)
+		pw_log_warn("protocol-native %p: can't offer ring, using socket", impl);
+
         impl->source = pw_loop_add_io(remote->core->main_loop,
                                       fd,
                                       SPA_IO_IN | SPA_IO_HUP | SPA_IO_ERR,
@@ -702,12 +790,17 @@ static void destroy_server(struct pw_protocol_server *server)
 	struct pw_client *client, *tmp;
 
 	spa_list_remove(&server->link);
+	spa_hook_remove(&s->hook);
 
 	spa_list_for_each_safe(client, tmp, &server->client_list, protocol_link)
 		pw_client_destroy(client);
 
 	if (s->source)
 		pw_loop_destroy_source(s->loop, s->source);
+	if (s->stats_timer)
+		pw_loop_destroy_source(s->loop, s->stats_timer);
+	if (s->resume)
+		pw_loop_destroy_source(s->loop, s->resume);
 	if (s->addr.sun_path[0])
 		unlink(s->addr.sun_path);
 	if (s->lock_addr[0])
@@ -717,6 +810,79 @@ static void destroy_server(struct pw_protocol_server *server)
 	free(s);
 }
 
+static void print_opcodes(struct pw_core *core, char *str, size_t size,
+			 const struct pw_protocol_native_opcode_stats *opcodes, uint64_t other)
+{
+	uint32_t i;
+	int len = 0;
+
+	str[0] = '\0';
+	for (i = 0; i < PW_PROTOCOL_NATIVE_STATS_OPCODES && len < (int) size; i++) {
+		const char *type, *name;
+
+		if (opcodes[i].count == 0)
+			continue;
+
+		type = spa_type_map_get_type(core->type.map, opcodes[i].type);
+		name = type ? strrchr(type, ':') : NULL;
+		name = name ? name + 1 : "unknown";
+
+		len += snprintf(str + len, size - len, "%s%s.%u:%" PRIu64,
+				len > 0 ? " " : "", name, opcodes[i].opcode, opcodes[i].count);
+	}
+	if (other > 0 && len < (int) size)
+		snprintf(str + len, size - len, "%sother:%" PRIu64, len > 0 ? " " : "", other);
+}
+
+static void update_client_stats(struct client_data *data)
+{
+	struct pw_client *client = data->client;
+	struct pw_core *core = client->core;
+	const struct pw_protocol_native_connection_stats *stats = &data->connection->stats;
+	struct spa_dict_item items[9];
+	char values[7][32], opcodes_in[1024], opcodes_out[1024];
+	int i;
+
+	if (stats->messages_in == data->stats_in && stats->messages_out == data->stats_out)
+		return;
+
+	snprintf(values[0], sizeof(values[0]), "%" PRIu64, stats->messages_in);
+	snprintf(values[1], sizeof(values[1]), "%" PRIu64, stats->messages_out);
+	snprintf(values[2], sizeof(values[2]), "%" PRIu64, stats->bytes_in);
+	snprintf(values[3], sizeof(values[3]), "%" PRIu64, stats->bytes_out);
+	snprintf(values[4], sizeof(values[4]), "%" PRIu64, stats->fds_in);
+	snprintf(values[5], sizeof(values[5]), "%" PRIu64, stats->fds_out);
+	snprintf(values[6], sizeof(values[6]), "%" PRIu64, (uint64_t) (stats->busy_time / SPA_NSEC_PER_USEC));
+	print_opcodes(core, opcodes_in, sizeof(opcodes_in), stats->opcodes_in, stats->other_in);
+	print_opcodes(core, opcodes_out, sizeof(opcodes_out), stats->opcodes_out, stats->other_out);
+
+	i = 0;
+	items[i++] = SPA_DICT_ITEM_INIT(PW_CLIENT_PROP_MESSAGES_IN, values[0]);
+	items[i++] = SPA_DICT_ITEM_INIT(PW_CLIENT_PROP_MESSAGES_OUT, values[1]);
+	items[i++] = SPA_DICT_ITEM_INIT(PW_CLIENT_PROP_BYTES_IN, values[2]);
+	items[i++] = SPA_DICT_ITEM_INIT(PW_CLIENT_PROP_BYTES_OUT, values[3]);
+	items[i++] = SPA_DICT_ITEM_INIT(PW_CLIENT_PROP_FDS_IN, values[4]);
+	items[i++] = SPA_DICT_ITEM_INIT(PW_CLIENT_PROP_FDS_OUT, values[5]);
+	items[i++] = SPA_DICT_ITEM_INIT(PW_CLIENT_PROP_BUSY_TIME, values[6]);
+	items[i++] = SPA_DICT_ITEM_INIT(PW_CLIENT_PROP_OPCODES_IN, opcodes_in);
+	items[i++] = SPA_DICT_ITEM_INIT(PW_CLIENT_PROP_OPCODES_OUT, opcodes_out);
+
+	pw_client_update_properties(client, &SPA_DICT_INIT(items, i));
+
+	/* the info events of this update are not a reason for the next one */
+	data->stats_in = stats->messages_in;
+	data->stats_out = stats->messages_out;
+}
+
+static void on_stats_timeout(void *_data, uint64_t expirations)
+{
+	struct server *server = _data;
+	struct pw_client *client, *tmp;
+
+	spa_list_for_each_safe(client, tmp, &server->this.client_list, protocol_link)
+		update_client_stats(client->user_data);
+}
+
 static void on_before_hook(void *_data)
 {
 	struct server *server = _data;
@@ -726,7 +892,11 @@ static void on_before_hook(void *_data)
 
 	spa_list_for_each_safe(client, tmp, &this->client_list, protocol_link) {
 		data = client->user_data;
-		pw_protocol_native_connection_flush(data->connection);
+		if (!pw_protocol_native_connection_flush(data->connection)) {
+			pw_client_destroy(client);
+			continue;
+		}
+		check_output(data);
 	}
 }
 
@@ -756,6 +926,7 @@ impl_add_server(struct pw_protocol *protocol,
 {
 	struct pw_protocol_server *this;
 	struct server *s;
+	struct timespec interval;
 	const char *name;
 
 	if ((s = calloc(1, sizeof(struct server))) == NULL)
@@ -767,8 +938,10 @@ impl_add_server(struct pw_protocol *protocol,
 	this->protocol = protocol;
 	spa_list_init(&this->client_list);
 	this->destroy = destroy_server;
+	spa_list_init(&s->pending_list);
 
 	spa_list_append(&protocol->server_list, &this->link);
+	pw_loop_add_hook(pw_core_get_main_loop(core), &s->hook, &impl_hooks, s);
 
 	name = get_name(pw_core_get_properties(core));
 
@@ -781,7 +954,15 @@ impl_add_server(struct pw_protocol *protocol,
 	if (!add_socket(protocol, s))
 		goto error;
 
-	pw_loop_add_hook(pw_core_get_main_loop(core), &s->hook, &impl_hooks, s);
+	s->stats_timer = pw_loop_add_timer(s->loop, on_stats_timeout, s);
+	if (s->stats_timer == NULL)
+		goto error;
+	s->resume = pw_loop_add_event(s->loop, on_resume, s);
+	if (s->resume == NULL)
+		goto error;
+	interval.tv_sec = STATS_INTERVAL;
+	interval.tv_nsec = 0;
+	pw_loop_update_timer(s->loop, s->stats_timer, &interval, &interval, false);
 
 	pw_log_info("protocol-native %p: Added server %p %s", protocol, this, name);
 
@@ -24,8 +24,12 @@
 #include <errno.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 #include <spa/lib/debug.h>
+#include <spa/utils/ringbuffer.h>
 
 #include <pipewire/pipewire.h>
 #include <pipewire/private.h>
@@ -34,9 +38,87 @@
 
 #define MAX_BUFFER_SIZE (1024 * 32)
 #define MAX_FDS 28
+#define MAX_CHUNKS 64
+
+/* pods of at least this size are not copied into the message, they are
+ * queued as a chunk of their own and sent before the builder returns */
+#define EXT_POD_THRESHOLD MAX_BUFFER_SIZE
+#define MAX_EXT_PODS 8
+
+/* the size of a message is in the lower 24 bits of the second header word */
+#define MESSAGE_SIZE_MASK	0xffffff
+
+#ifndef F_GET_SEALS
+#define F_GET_SEALS (1024 + 10)
+#define F_SEAL_SHRINK 0x0002
+#endif
+
+/* messages to this id are handled by the connection itself */
+#define CONTROL_ID		SPA_ID_INVALID
+
+#define CONTROL_NOP		0	/* wakeup, the reader should check the ring */
+#define CONTROL_RING_OFFER	1	/* fd index and size of the ring memory */
+#define CONTROL_SWITCH_RING	2	/* next messages are in the ring */
+#define CONTROL_SWITCH_SOCKET	3	/* next messages are on the socket */
+
+/* size of the ring in each direction, must be a power of 2 */
+#define RING_SIZE		(128 * 1024)
+
+/* one direction of the shared memory channel */
+struct ring {
+	struct spa_ringbuffer rb;
+	uint32_t idle;		/**< reader found the ring empty and waits for a wakeup */
+	uint32_t padding[13];
+	uint8_t data[RING_SIZE];
+};
+
+/* the shared memory channel, allocated by the client. Messages go through
+ * the ring in order, the socket carries wakeups and the messages with fds
+ * or that don't fit. The writer switches to the socket with a message in
+ * the ring and back to the ring with a message on the socket. 8 bytes are
+ * kept free in the ring for the switch. */
+struct ring_area {
+	struct ring rings[2];	/**< client to server, server to client */
+};
+
+enum channel {
+	CHANNEL_SOCKET,
+	CHANNEL_RING,
+};
 
 static bool debug_messages = 0;
 
+/* a block of queued messages */
+struct chunk {
+	uint8_t *data;
+	size_t size;
+	size_t maxsize;
+	bool external;		/**< data is a pod of the caller, not owned */
+};
+
+/* a large pod of the message that is being written */
+struct ext_pod {
+	const void *data;
+	uint32_t ref;		/**< offset of the pod in the payload */
+	uint32_t offset;	/**< offset in the payload without the earlier pods */
+	uint32_t size;
+};
+
+/* queued output, messages are written in chunks that are sent with one
+ * sendmsg so that the queue never needs to be copied to grow */
+struct out_buffer {
+	struct chunk chunks[MAX_CHUNKS];
+	uint32_t n_chunks;
+	uint32_t first;		/**< first chunk with unsent data */
+	size_t sent;		/**< bytes of the first chunk that are sent */
+	size_t reserved;	/**< bytes reserved for the current message */
+	int fds[MAX_FDS];
+	uint32_t n_fds;
+	bool fds_queued;	/**< a queued message uses the fds */
+	uint32_t fds_chunk;	/**< chunk of the first message that uses the fds */
+	size_t fds_offset;	/**< offset of that message in the chunk */
+};
+
 struct buffer {
 	uint8_t *buffer_data;
 	size_t buffer_size;
@@ -54,10 +136,25 @@ struct buffer {
 struct impl {
 	struct pw_protocol_native_connection this;
 
-	struct buffer in, out;
+	struct buffer in;
+	struct out_buffer out;
+
+	struct pw_memblock *ring_mem;	/**< ring memory when we offered the ring */
+	struct ring_area *ring_map;	/**< ring memory mapped from the peer */
+	struct ring *in_ring;
+	struct ring *out_ring;		/**< set when the peer accepted the ring */
+	enum channel in_channel;
+	enum channel out_channel;
+	bool ring_kick;			/**< wrote to the ring since the last flush */
+	uint8_t *ring_msg;		/**< message read from the ring */
 
 	uint32_t dest_id;
 	uint8_t opcode;
+	uint32_t type;
+	bool msg_fds;			/**< current message uses fds */
+	struct ext_pod ext[MAX_EXT_PODS];	/**< large pods of the current message */
+	uint32_t n_ext;
+	uint32_t ext_size;		/**< total size of the large pods */
 	struct spa_pod_builder builder;
 };
 
@@ -94,6 +191,8 @@ uint32_t pw_protocol_native_connection_add_fd(struct pw_protocol_native_connecti
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
 	uint32_t index, i;
 
+	impl->msg_fds = true;
+
 	for (i = 0; i < impl->out.n_fds; i++) {
 		if (impl->out.fds[i] == fd)
 			return i;
@@ -156,6 +255,7 @@ static bool refill_buffer(struct pw_protocol_native_connection *conn, struct buf
 	}
 
 	buf->buffer_size += len;
+	conn->stats.bytes_in += len;
 
 	/* handle control messages */
 	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
@@ -165,6 +265,7 @@ static bool refill_buffer(struct pw_protocol_native_connection *conn, struct buf
 		buf->n_fds =
 		    (cmsg->cmsg_len - ((char *) CMSG_DATA(cmsg) - (char *) cmsg)) / sizeof(int);
 		memcpy(buf->fds, CMSG_DATA(cmsg), buf->n_fds * sizeof(int));
+		conn->stats.fds_in += buf->n_fds;
 	}
 	pw_log_trace("connection %p: %d read %zd bytes and %d fds", conn, conn->fd, len,
 		     buf->n_fds);
@@ -177,6 +278,8 @@ static bool refill_buffer(struct pw_protocol_native_connection *conn, struct buf
 	return false;
 }
 
+/* the fds of a batch arrive with the first message that uses them and are
+ * dropped when all data is consumed, a new batch of fds replaces them */
 static void clear_buffer(struct buffer *buf)
 {
 	buf->n_fds = 0;
@@ -185,6 +288,24 @@ static void clear_buffer(struct buffer *buf)
 	buf->buffer_size = 0;
 }
 
+static void clear_out_buffer(struct out_buffer *buf)
+{
+	uint32_t i;
+
+	buf->n_fds = 0;
+	buf->fds_queued = false;
+
+	/* keep the first chunk around */
+	for (i = 1; i < buf->n_chunks; i++) {
+		if (!buf->chunks[i].external)
+			free(buf->chunks[i].data);
+	}
+	buf->chunks[0].size = 0;
+	buf->n_chunks = 1;
+	buf->first = 0;
+	buf->sent = 0;
+}
+
 /** Make a new connection object for the given socket
  *
  * \param fd the socket
@@ -210,19 +331,20 @@ struct pw_protocol_native_connection *pw_protocol_native_connection_new(int fd)
 	this->fd = fd;
 	spa_hook_list_init(&this->listener_list);
 
-	impl->out.buffer_data = malloc(MAX_BUFFER_SIZE);
-	impl->out.buffer_maxsize = MAX_BUFFER_SIZE;
+	impl->out.chunks[0].data = malloc(MAX_BUFFER_SIZE);
+	impl->out.chunks[0].maxsize = MAX_BUFFER_SIZE;
+	impl->out.n_chunks = 1;
 	impl->in.buffer_data = malloc(MAX_BUFFER_SIZE);
 	impl->in.buffer_maxsize = MAX_BUFFER_SIZE;
 	impl->in.update = true;
 
-	if (impl->out.buffer_data == NULL || impl->in.buffer_data == NULL)
+	if (impl->out.chunks[0].data == NULL || impl->in.buffer_data == NULL)
 		goto no_mem;
 
 	return this;
 
       no_mem:
-	free(impl->out.buffer_data);
+	free(impl->out.chunks[0].data);
 	free(impl->in.buffer_data);
 	free(impl);
 	return NULL;
@@ -242,31 +364,86 @@ void pw_protocol_native_connection_destroy(struct pw_protocol_native_connection
 
 	spa_hook_list_call(&conn->listener_list, struct pw_protocol_native_connection_events, destroy);
 
-	free(impl->out.buffer_data);
+	clear_out_buffer(&impl->out);
+	free(impl->out.chunks[0].data);
 	free(impl->in.buffer_data);
+	if (impl->ring_mem)
+		pw_memblock_free(impl->ring_mem);
+	if (impl->ring_map)
+		munmap(impl->ring_map, sizeof(struct ring_area));
+	free(impl->ring_msg);
 	free(impl);
 }
 
-/** Move to the next packet in the connection
- *
- * \param conn the connection
- * \param opcode addres of result opcode
- * \param dest_id addres of result destination id
- * \param dt pointer to packet data
- * \param sz size of packet data
- * \return true on success
- *
- * Get the next packet in \a conn and store the opcode and destination
- * id as well as the packet data and size.
- *
- * \memberof pw_protocol_native_connection
- */
-bool
-pw_protocol_native_connection_get_next(struct pw_protocol_native_connection *conn,
-		       uint8_t *opcode,
-		       uint32_t *dest_id,
-		       void **dt,
-		       uint32_t *sz)
+static bool resize_chunk(struct pw_protocol_native_connection *conn, struct chunk *c, size_t size)
+{
+	uint8_t *data;
+
+	size = SPA_ROUND_UP_N(size, MAX_BUFFER_SIZE);
+	if ((data = realloc(c->data, size)) == NULL) {
+		spa_hook_list_call(&conn->listener_list, struct pw_protocol_native_connection_events, error, -ENOMEM);
+		return false;
+	}
+	c->data = data;
+	c->maxsize = size;
+	return true;
+}
+
+/* reserve space for a message with \a size bytes of payload. When the
+ * message does not fit in the last chunk, the message that is being written
+ * is moved to a new chunk. */
+static inline void *begin_write(struct pw_protocol_native_connection *conn, uint32_t size)
+{
+	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+	struct out_buffer *buf = &impl->out;
+	struct chunk *c = &buf->chunks[buf->n_chunks - 1];
+	/* 4 for dest_id, 1 for opcode, 3 for size and size for payload */
+	size_t need = 8 + size;
+
+	if (c->size + need > c->maxsize) {
+		if (c->size == 0 || buf->n_chunks == MAX_CHUNKS) {
+			if (!resize_chunk(conn, c, c->size + need))
+				return NULL;
+		} else {
+			struct chunk *n = &buf->chunks[buf->n_chunks];
+
+			n->data = NULL;
+			n->size = 0;
+			if (!resize_chunk(conn, n, need))
+				return NULL;
+			memcpy(n->data, c->data + c->size, buf->reserved);
+			buf->n_chunks++;
+			c = n;
+		}
+	}
+	buf->reserved = need;
+
+	return c->data + c->size + 8;
+}
+
+/* queue the reserved message of \a size bytes of payload on the socket. The
+ * first message after fds were added is where the fds are sent, the data
+ * before it goes out in an earlier sendmsg. */
+static void commit_write(struct out_buffer *buf, uint32_t size)
+{
+	struct chunk *c = &buf->chunks[buf->n_chunks - 1];
+
+	if (buf->n_fds > 0 && !buf->fds_queued) {
+		buf->fds_queued = true;
+		buf->fds_chunk = buf->n_chunks - 1;
+		buf->fds_offset = c->size;
+	}
+	c->size += 8 + size;
+	buf->reserved = 0;
+}
+
+/* read the next message from the socket, returns 1 for a message, 0 when
+ * there is no complete message and -EBUSY when the next message is not a
+ * control message and \a control_only is set. That message is then not
+ * consumed. */
+static int read_socket(struct pw_protocol_native_connection *conn,
+		       uint8_t *opcode, uint32_t *dest_id, void **dt, uint32_t *sz,
+		       bool control_only)
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
 	size_t len, size;
@@ -278,11 +455,12 @@ pw_protocol_native_connection_get_next(struct pw_protocol_native_connection *con
 
 	/* move to next packet */
 	buf->offset += buf->size;
+	buf->size = 0;
 
       again:
 	if (buf->update) {
 		if (!refill_buffer(conn, buf))
-			return false;
+			return 0;
 		buf->update = false;
 	}
 
@@ -293,7 +471,7 @@ pw_protocol_native_connection_get_next(struct pw_protocol_native_connection *con
 	if (buf->offset >= size) {
 		clear_buffer(buf);
 		buf->update = true;
-		return false;
+		return 0;
 	}
 
 	data += buf->offset;
@@ -301,7 +479,7 @@ pw_protocol_native_connection_get_next(struct pw_protocol_native_connection *con
 
 	if (size < 8) {
 		if (connection_ensure_size(conn, buf, 8) == NULL)
-			return false;
+			return 0;
 		buf->update = true;
 		goto again;
 	}
@@ -309,13 +487,16 @@ pw_protocol_native_connection_get_next(struct pw_protocol_native_connection *con
 	data += 8;
 	size -= 8;
 
+	if (control_only && p[0] != CONTROL_ID)
+		return -EBUSY;
+
 	*dest_id = p[0];
 	*opcode = p[1] >> 24;
-	len = p[1] & 0xffffff;
+	len = p[1] & MESSAGE_SIZE_MASK;
 
 	if (len > size) {
 		if (connection_ensure_size(conn, buf, len) == NULL)
-			return false;
+			return 0;
 		buf->update = true;
 		goto again;
 	}
@@ -326,35 +507,468 @@ pw_protocol_native_connection_get_next(struct pw_protocol_native_connection *con
 	*dt = buf->data;
 	*sz = buf->size;
 
-	return true;
+	return 1;
 }
 
-static inline void *begin_write(struct pw_protocol_native_connection *conn, uint32_t size)
+static inline uint32_t ring_avail(struct ring *r, uint32_t *index)
+{
+	return spa_ringbuffer_get_read_index(&r->rb, index);
+}
+
+/* read the next message from the ring into ring_msg, returns 1 for a
+ * message, 0 when the ring is empty and < 0 when the ring is corrupted. The
+ * message is copied because the peer can change the ring at any time. */
+static int read_ring(struct pw_protocol_native_connection *conn,
+		     uint8_t *opcode, uint32_t *dest_id, void **dt, uint32_t *sz)
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+	struct ring *r = impl->in_ring;
+	uint32_t index, hdr[2], len;
+	int32_t avail;
+
+	avail = spa_ringbuffer_get_read_index(&r->rb, &index);
+	if (avail == 0)
+		return 0;
+	if (avail < 8 || avail > RING_SIZE)
+		goto corrupted;
+
+	spa_ringbuffer_read_data(&r->rb, r->data, RING_SIZE,
+				 index & (RING_SIZE - 1), hdr, 8);
+	len = hdr[1] & MESSAGE_SIZE_MASK;
+	if (len > (uint32_t) avail - 8)
+		goto corrupted;
+
+	spa_ringbuffer_read_data(&r->rb, r->data, RING_SIZE,
+				 (index + 8) & (RING_SIZE - 1), impl->ring_msg, len);
+	spa_ringbuffer_read_update(&r->rb, index + 8 + len);
+
+	*dest_id = hdr[0];
+	*opcode = hdr[1] >> 24;
+	*dt = impl->ring_msg;
+	*sz = len;
+	conn->stats.bytes_in += 8 + len;
+
+	return 1;
+
+      corrupted:
+	pw_log_error("connection %p: corrupted ring", conn);
+	return -EINVAL;
+}
+
+/* check if a message of \a len bytes can go in the ring. 8 bytes are kept
+ * free for switching to the socket. */
+static bool ring_has_space(struct impl *impl, uint32_t len)
+{
+	uint32_t index;
+	int32_t filled;
+
+	if (impl->out_ring == NULL || impl->msg_fds)
+		return false;
+
+	filled = spa_ringbuffer_get_write_index(&impl->out_ring->rb, &index);
+	return filled >= 0 && (uint32_t) filled + len + 8 <= RING_SIZE;
+}
+
+/* write a message to the ring, the caller checked the space */
+static void write_ring(struct impl *impl, const uint32_t *p, uint32_t len)
+{
+	struct ring *r = impl->out_ring;
+	uint32_t index;
+
+	spa_ringbuffer_get_write_index(&r->rb, &index);
+	spa_ringbuffer_write_data(&r->rb, r->data, RING_SIZE,
+				  index & (RING_SIZE - 1), p, len);
+	spa_ringbuffer_write_update(&r->rb, index + len);
+
+	impl->this.stats.bytes_out += len;
+	impl->ring_kick = true;
+}
+
+/* write a message with large pods to the ring, \a p is the header and the
+ * payload without the large pods */
+static void write_ring_ext(struct impl *impl, const uint8_t *p, uint32_t size)
+{
+	struct ring *r = impl->out_ring;
+	uint32_t i, index, start, offset = 0, len = 8 + size - impl->ext_size;
+
+	spa_ringbuffer_get_write_index(&r->rb, &index);
+	start = index;
+
+	for (i = 0; i <= impl->n_ext; i++) {
+		uint32_t end = i < impl->n_ext ? 8 + impl->ext[i].offset : len;
+
+		spa_ringbuffer_write_data(&r->rb, r->data, RING_SIZE,
+					  index & (RING_SIZE - 1), p + offset, end - offset);
+		index += end - offset;
+		offset = end;
+		if (i < impl->n_ext) {
+			spa_ringbuffer_write_data(&r->rb, r->data, RING_SIZE,
+						  index & (RING_SIZE - 1),
+						  impl->ext[i].data, impl->ext[i].size);
+			index += impl->ext[i].size;
+		}
+	}
+	spa_ringbuffer_write_update(&r->rb, index);
+
+	impl->this.stats.bytes_out += index - start;
+	impl->ring_kick = true;
+}
+
+/* queue a message for the connection itself on the socket */
+static void write_control(struct pw_protocol_native_connection *conn, uint8_t opcode,
+			  const uint32_t *data, uint32_t size)
+{
+	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+	struct out_buffer *buf = &impl->out;
 	uint32_t *p;
-	struct buffer *buf = &impl->out;
-	/* 4 for dest_id, 1 for opcode, 3 for size and size for payload */
-	if ((p = connection_ensure_size(conn, buf, 8 + size)) == NULL)
-		return NULL;
 
-	return p + 2;
+	if ((p = begin_write(conn, size)) == NULL)
+		return;
+	p -= 2;
+
+	p[0] = CONTROL_ID;
+	p[1] = (opcode << 24) | size;
+	if (size > 0)
+		memcpy(&p[2], data, size);
+
+	commit_write(buf, size);
 }
 
+static int setup_ring(struct impl *impl)
+{
+	if ((impl->ring_msg = malloc(RING_SIZE)) == NULL)
+		return -ENOMEM;
+	impl->in_channel = CHANNEL_SOCKET;
+	impl->out_channel = CHANNEL_SOCKET;
+	return 0;
+}
+
+/* the server maps the ring of the client and starts using it */
+static void accept_ring(struct pw_protocol_native_connection *conn, const uint32_t *data,
+			uint32_t size)
+{
+	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+	struct stat st;
+	void *ptr;
+	int fd, seals;
+
+	if (size < 8 || impl->ring_mem || impl->ring_map ||
+	    (fd = pw_protocol_native_connection_get_fd(conn, data[0])) < 0) {
+		pw_log_warn("connection %p: invalid ring offer", conn);
+		return;
+	}
+	impl->in.fds[data[0]] = -1;
+
+	if (data[1] != sizeof(struct ring_area) ||
+	    fstat(fd, &st) < 0 || st.st_size < data[1] ||
+	    (seals = fcntl(fd, F_GET_SEALS)) < 0 || !(seals & F_SEAL_SHRINK)) {
+		pw_log_warn("connection %p: ring memory of wrong size or not sealed", conn);
+		close(fd);
+		return;
+	}
+	ptr = mmap(NULL, data[1], PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		pw_log_warn("connection %p: can't map ring: %m", conn);
+		return;
+	}
+	if (setup_ring(impl) < 0) {
+		munmap(ptr, data[1]);
+		return;
+	}
+	impl->ring_map = ptr;
+	impl->in_ring = &impl->ring_map->rings[0];
+	impl->out_ring = &impl->ring_map->rings[1];
+
+	/* the client reads the ring after this */
+	write_control(conn, CONTROL_SWITCH_RING, NULL, 0);
+	impl->out_channel = CHANNEL_RING;
+
+	pw_log_debug("connection %p: using ring", conn);
+}
+
+static void handle_control(struct pw_protocol_native_connection *conn, uint8_t opcode,
+			   const void *data, uint32_t size)
+{
+	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+
+	switch (opcode) {
+	case CONTROL_NOP:
+		break;
+	case CONTROL_RING_OFFER:
+		accept_ring(conn, data, size);
+		break;
+	case CONTROL_SWITCH_RING:
+		if (impl->in_ring == NULL) {
+			pw_log_warn("connection %p: switch to ring without ring", conn);
+			break;
+		}
+		impl->in_channel = CHANNEL_RING;
+		/* the server accepted our ring, we can write to it as well */
+		if (impl->ring_mem && impl->out_ring == NULL)
+			impl->out_ring = &((struct ring_area *) impl->ring_mem->ptr)->rings[0];
+		break;
+	case CONTROL_SWITCH_SOCKET:
+		impl->in_channel = CHANNEL_SOCKET;
+		break;
+	default:
+		pw_log_warn("connection %p: unknown control message %d", conn, opcode);
+		break;
+	}
+}
+
+/** Offer a shared memory ring to the server
+ *
+ * \param conn the connection
+ * \return 0 on success, < 0 on error
+ *
+ * When the server accepts the ring, messages without fds are exchanged
+ * through the ring and the socket is mostly used for wakeups. A server
+ * that does not know about the ring ignores the offer.
+ *
+ * \memberof pw_protocol_native_connection
+ */
+int pw_protocol_native_connection_offer_ring(struct pw_protocol_native_connection *conn)
+{
+	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+	struct ring_area *area;
+	uint32_t data[2];
+	int res;
+
+	if (impl->ring_mem || impl->ring_map)
+		return -EEXIST;
+
+	if ((res = pw_memblock_alloc(PW_MEMBLOCK_FLAG_WITH_FD |
+				     PW_MEMBLOCK_FLAG_MAP_READWRITE |
+				     PW_MEMBLOCK_FLAG_SEAL,
+				     sizeof(struct ring_area), &impl->ring_mem)) < 0)
+		return res;
+
+	if ((res = setup_ring(impl)) < 0) {
+		pw_memblock_free(impl->ring_mem);
+		impl->ring_mem = NULL;
+		return res;
+	}
+
+	area = impl->ring_mem->ptr;
+	memset(area, 0, sizeof(struct ring_area));
+	impl->in_ring = &area->rings[1];
+
+	data[0] = pw_protocol_native_connection_add_fd(conn, impl->ring_mem->fd);
+	data[1] = sizeof(struct ring_area);
+	write_control(conn, CONTROL_RING_OFFER, data, sizeof(data));
+
+	spa_hook_list_call(&conn->listener_list, struct pw_protocol_native_connection_events, need_flush);
+
+	return 0;
+}
+
+/** Move to the next packet in the connection
+ *
+ * \param conn the connection
+ * \param opcode addres of result opcode
+ * \param dest_id addres of result destination id
+ * \param dt pointer to packet data
+ * \param sz size of packet data
+ * \return true on success
+ *
+ * Get the next packet in \a conn and store the opcode and destination
+ * id as well as the packet data and size.
+ *
+ * \memberof pw_protocol_native_connection
+ */
+bool
+pw_protocol_native_connection_get_next(struct pw_protocol_native_connection *conn,
+		       uint8_t *opcode,
+		       uint32_t *dest_id,
+		       void **dt,
+		       uint32_t *sz)
+{
+	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+	uint32_t index;
+	int res;
+
+	while (true) {
+		bool ring = impl->in_channel == CHANNEL_RING;
+
+		if (ring) {
+			if ((res = read_ring(conn, opcode, dest_id, dt, sz)) < 0) {
+				spa_hook_list_call(&conn->listener_list,
+						struct pw_protocol_native_connection_events,
+						error, res);
+				return false;
+			}
+			if (res > 0)
+				goto have_message;
+		}
+
+		/* when reading the ring, only the wakeups are read from the
+		 * socket until the ring tells us to switch */
+		res = read_socket(conn, opcode, dest_id, dt, sz, ring);
+		if (res > 0)
+			goto have_message;
+
+		if (res == -EBUSY) {
+			/* the switch must be in the ring before this message */
+			if (ring_avail(impl->in_ring, &index) == 0) {
+				pw_log_warn("connection %p: message on socket while reading ring",
+						conn);
+				impl->in_channel = CHANNEL_SOCKET;
+			}
+			continue;
+		}
+		if (ring) {
+			/* tell the writer we need a wakeup and check again so that
+			 * we don't miss a message written before it saw the flag */
+			__atomic_store_n(&impl->in_ring->idle, 1, __ATOMIC_RELAXED);
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			if (ring_avail(impl->in_ring, &index) > 0) {
+				__atomic_store_n(&impl->in_ring->idle, 0, __ATOMIC_RELAXED);
+				continue;
+			}
+		}
+		return false;
+
+	      have_message:
+		if (*dest_id == CONTROL_ID) {
+			handle_control(conn, *opcode, *dt, *sz);
+			continue;
+		}
+		conn->stats.messages_in++;
+		return true;
+	}
+}
+
+/* the builder data only has the payload without the large pods, large
+ * pods are remembered and go out from the memory of the caller */
 static uint32_t write_pod(struct spa_pod_builder *b, const void *data, uint32_t size)
 {
 	struct impl *impl = SPA_CONTAINER_OF(b, struct impl, builder);
 	uint32_t ref = b->state.offset;
+	uint32_t offset = ref - impl->ext_size;
+
+	if (size >= EXT_POD_THRESHOLD && impl->n_ext < MAX_EXT_PODS) {
+		impl->ext[impl->n_ext++] = (struct ext_pod) { data, ref, offset, size };
+		impl->ext_size += size;
+		return ref;
+	}
 
-        if (b->size <= ref) {
-                b->size = SPA_ROUND_UP_N(ref + size, 4096);
+        if (b->size < offset + size) {
+                b->size = SPA_ROUND_UP_N(offset + size, 4096);
                 b->data = begin_write(&impl->this, b->size);
         }
-        memcpy(b->data + ref, data, size);
+        memcpy(b->data + offset, data, size);
 
         return ref;
 }
 
+static void *deref_pod(struct spa_pod_builder *b, uint32_t ref)
+{
+	struct impl *impl = SPA_CONTAINER_OF(b, struct impl, builder);
+	uint32_t i, offset = ref;
+
+	for (i = 0; i < impl->n_ext && impl->ext[i].ref <= ref; i++) {
+		/* the large pods are not written by the builder */
+		if (ref < impl->ext[i].ref + impl->ext[i].size)
+			return NULL;
+		offset -= impl->ext[i].size;
+	}
+	if (b->data == NULL || offset + 8 > b->size)
+		return NULL;
+	return SPA_MEMBER(b->data, offset, void);
+}
+
+/* copy the large pods into the message, \a p is the payload with \a size
+ * bytes reserved */
+static void copy_ext_pods(struct impl *impl, uint8_t *p, uint32_t size)
+{
+	uint32_t i, end = size - impl->ext_size;
+
+	/* move from the back so that nothing is overwritten before it moved */
+	for (i = impl->n_ext; i > 0; i--) {
+		struct ext_pod *e = &impl->ext[i - 1];
+
+		memmove(p + e->ref + e->size, p + e->offset, end - e->offset);
+		memcpy(p + e->ref, e->data, e->size);
+		end = e->offset;
+	}
+	impl->n_ext = 0;
+	impl->ext_size = 0;
+}
+
+/* queue the reserved message with large pods as chunks of the pods and
+ * chunks of the payload in between */
+static bool commit_ext(struct pw_protocol_native_connection *conn, uint32_t size)
+{
+	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+	struct out_buffer *buf = &impl->out;
+	struct chunk *c = &buf->chunks[buf->n_chunks - 1];
+	uint8_t *p = c->data + c->size + 8;
+	uint32_t i, end = size - impl->ext_size;
+
+	commit_write(buf, impl->ext[0].offset);
+
+	for (i = 0; i < impl->n_ext; i++) {
+		struct ext_pod *e = &impl->ext[i];
+		uint32_t next = i + 1 < impl->n_ext ? impl->ext[i + 1].offset : end;
+
+		c = &buf->chunks[buf->n_chunks++];
+		c->data = (uint8_t *) e->data;
+		c->size = e->size;
+		c->maxsize = e->size;
+		c->external = true;
+
+		if (next > e->offset) {
+			c = &buf->chunks[buf->n_chunks];
+			c->data = NULL;
+			c->size = 0;
+			c->external = false;
+			if (!resize_chunk(conn, c, next - e->offset)) {
+				clear_out_buffer(buf);
+				return false;
+			}
+			memcpy(c->data, p + e->offset, next - e->offset);
+			c->size = next - e->offset;
+			buf->n_chunks++;
+		}
+	}
+	impl->n_ext = 0;
+	impl->ext_size = 0;
+	return true;
+}
+
+/* copy the large pods that could not be sent yet, the caller owns them */
+static bool detach_ext_chunks(struct pw_protocol_native_connection *conn)
+{
+	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+	struct out_buffer *buf = &impl->out;
+	uint32_t i;
+	bool res = true;
+
+	for (i = buf->first; i < buf->n_chunks; i++) {
+		struct chunk *c = &buf->chunks[i];
+		uint8_t *data;
+
+		if (!c->external)
+			continue;
+
+		if ((data = malloc(c->size)) == NULL) {
+			res = false;
+			break;
+		}
+		memcpy(data, c->data, c->size);
+		c->data = data;
+		c->maxsize = c->size;
+		c->external = false;
+	}
+	if (!res) {
+		/* the queue is broken, drop it */
+		clear_out_buffer(buf);
+		spa_hook_list_call(&conn->listener_list, struct pw_protocol_native_connection_events, error, -ENOMEM);
+	}
+	return res;
+}
+
 struct spa_pod_builder *
 pw_protocol_native_connection_begin_resource(struct pw_protocol_native_connection *conn,
 					     struct pw_resource *resource,
@@ -379,7 +993,11 @@ pw_protocol_native_connection_begin_resource(struct pw_protocol_native_connectio
 
 	impl->dest_id = resource->id;
 	impl->opcode = opcode;
-	impl->builder = (struct spa_pod_builder) { NULL, 0, write_pod };
+	impl->type = resource->type;
+	impl->msg_fds = false;
+	impl->n_ext = 0;
+	impl->ext_size = 0;
+	impl->builder = (struct spa_pod_builder) { NULL, 0, write_pod, deref_pod };
 
 	return &impl->builder;
 }
@@ -408,7 +1026,13 @@ pw_protocol_native_connection_begin_proxy(struct pw_protocol_native_connection *
 
 	impl->dest_id = proxy->id;
 	impl->opcode = opcode;
-	impl->builder = (struct spa_pod_builder) { NULL, 0, write_pod, };
+	/* only the opcodes of resources are counted, the type id of a proxy
+	 * is not known without a lookup */
+	impl->type = SPA_ID_INVALID;
+	impl->msg_fds = false;
+	impl->n_ext = 0;
+	impl->ext_size = 0;
+	impl->builder = (struct spa_pod_builder) { NULL, 0, write_pod, deref_pod };
 
 	return &impl->builder;
 }
@@ -419,23 +1043,98 @@ pw_protocol_native_connection_end(struct pw_protocol_native_connection *conn,
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
 	uint32_t *p, size = builder->state.offset;
-	struct buffer *buf = &impl->out;
+	struct out_buffer *buf = &impl->out;
+
+	if (size > MESSAGE_SIZE_MASK) {
+		/* the size does not fit in the header, drop the message */
+		pw_log_error("connection %p: message of %u bytes is too large", conn, size);
+		buf->reserved = 0;
+		spa_hook_list_call(&conn->listener_list, struct pw_protocol_native_connection_events, error, -EFBIG);
+		return;
+	}
 
-	if ((p = connection_ensure_size(conn, buf, 8 + size)) == NULL)
+	if ((p = begin_write(conn, size - impl->ext_size)) == NULL)
 		return;
 
-	*p++ = impl->dest_id;
-	*p++ = (impl->opcode << 24) | (size & 0xffffff);
+	/* copy the large pods when there are not enough chunks for them or
+	 * when the message is dumped */
+	if (impl->n_ext > 0 &&
+	    (debug_messages || buf->n_chunks + 2 * impl->n_ext > MAX_CHUNKS)) {
+		if ((p = begin_write(conn, size)) == NULL)
+			return;
+		copy_ext_pods(impl, (uint8_t *) p, size);
+	}
+	p -= 2;
 
-	buf->buffer_size += 8 + size;
+	p[0] = impl->dest_id;
+	p[1] = (impl->opcode << 24) | size;
 
 	if (debug_messages) {
 		printf(">>>>>>>>> out: %d %d %d\n", impl->dest_id, impl->opcode, size);
-	        spa_debug_pod((struct spa_pod *)p, 0);
+	        spa_debug_pod((struct spa_pod *)&p[2], 0);
+	}
+
+	if (ring_has_space(impl, 8 + size)) {
+		/* the message is copied to the ring and not kept in the chunk */
+		if (impl->n_ext > 0)
+			write_ring_ext(impl, (const uint8_t *) p, size);
+		else
+			write_ring(impl, p, 8 + size);
+		impl->n_ext = 0;
+		impl->ext_size = 0;
+		buf->reserved = 0;
+		if (impl->out_channel == CHANNEL_SOCKET) {
+			write_control(conn, CONTROL_SWITCH_RING, NULL, 0);
+			impl->out_channel = CHANNEL_RING;
+		}
+	} else {
+		if (impl->out_channel == CHANNEL_RING) {
+			/* there is always space for this */
+			const uint32_t sw[2] = { CONTROL_ID, CONTROL_SWITCH_SOCKET << 24 };
+			write_ring(impl, sw, 8);
+			impl->out_channel = CHANNEL_SOCKET;
+		}
+		if (impl->n_ext == 0)
+			commit_write(buf, size);
+		else if (commit_ext(conn, size)) {
+			/* the large pods are only valid until we return, send
+			 * what we can now and keep a copy of the rest */
+			pw_protocol_native_connection_flush(conn);
+			if (!detach_ext_chunks(conn))
+				return;
+		} else
+			return;
 	}
+
+	conn->stats.messages_out++;
+	if (impl->type != SPA_ID_INVALID &&
+	    !pw_protocol_native_opcode_stats_count(conn->stats.opcodes_out,
+						   impl->type, impl->opcode))
+		conn->stats.other_out++;
+
 	spa_hook_list_call(&conn->listener_list, struct pw_protocol_native_connection_events, need_flush);
 }
 
+/** Get the amount of queued output
+ *
+ * \param conn the connection object
+ * \return the number of bytes that are queued and not sent yet
+ *
+ * \memberof pw_protocol_native_connection
+ */
+size_t pw_protocol_native_connection_get_queued(struct pw_protocol_native_connection *conn)
+{
+	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+	struct out_buffer *buf = &impl->out;
+	size_t size = 0;
+	uint32_t i;
+
+	for (i = buf->first; i < buf->n_chunks; i++)
+		size += buf->chunks[i].size;
+
+	return size - buf->sent;
+}
+
 /** Flush the connection object
  *
  * \param conn the connection object
@@ -450,26 +1149,55 @@ bool pw_protocol_native_connection_flush(struct pw_protocol_native_connection *c
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
 	ssize_t len;
 	struct msghdr msg = { 0 };
-	struct iovec iov[1];
+	struct iovec iov[MAX_CHUNKS];
 	struct cmsghdr *cmsg;
 	char cmsgbuf[CMSG_SPACE(MAX_FDS * sizeof(int))];
 	int *cm;
-	uint32_t i, fds_len;
-	struct buffer *buf;
+	uint32_t i, n_iov, fds_len, end;
+	size_t size;
+	bool with_fds;
+	struct out_buffer *buf;
+
+	if (impl->ring_kick) {
+		/* wake up the reader when it found the ring empty. Pairs with
+		 * the fence in get_next */
+		impl->ring_kick = false;
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_exchange_n(&impl->out_ring->idle, 0, __ATOMIC_SEQ_CST))
+			write_control(conn, CONTROL_NOP, NULL, 0);
+	}
 
 	buf = &impl->out;
 
-	if (buf->buffer_size == 0)
+      again:
+	/* the fds go out with the first message that uses them, send the
+	 * messages before it first */
+	with_fds = buf->fds_queued &&
+		buf->first == buf->fds_chunk && buf->sent == buf->fds_offset;
+	end = buf->fds_queued && !with_fds ? buf->fds_chunk : buf->n_chunks - 1;
+
+	for (i = buf->first, n_iov = 0, size = 0; i <= end; i++) {
+		struct chunk *c = &buf->chunks[i];
+		size_t offset = i == buf->first ? buf->sent : 0;
+		size_t last = i == end && buf->fds_queued && !with_fds ? buf->fds_offset : c->size;
+
+		if (last > offset) {
+			iov[n_iov].iov_base = c->data + offset;
+			iov[n_iov].iov_len = last - offset;
+			size += last - offset;
+			n_iov++;
+		}
+	}
+	if (n_iov == 0) {
+		clear_out_buffer(buf);
 		return true;
+	}
 
-	fds_len = buf->n_fds * sizeof(int);
-
-	iov[0].iov_base = buf->buffer_data;
-	iov[0].iov_len = buf->buffer_size;
 	msg.msg_iov = iov;
-	msg.msg_iovlen = 1;
+	msg.msg_iovlen = n_iov;
 
-	if (buf->n_fds > 0) {
+	if (with_fds) {
+		fds_len = buf->n_fds * sizeof(int);
 		msg.msg_control = cmsgbuf;
 		msg.msg_controllen = CMSG_SPACE(fds_len);
 		cmsg = CMSG_FIRSTHDR(&msg);
@@ -490,16 +1218,45 @@ bool pw_protocol_native_connection_flush(struct pw_protocol_native_connection *c
 		if (len < 0) {
 			if (errno == EINTR)
 				continue;
-			else
-				goto send_error;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return true;
+			goto send_error;
 		}
 		break;
 	}
-	pw_log_trace("connection %p: %d written %zd bytes and %u fds", conn, conn->fd, len,
-		     buf->n_fds);
+	pw_log_trace("connection %p: %d written %zd bytes in %u chunks and %u fds", conn,
+		     conn->fd, len, n_iov, with_fds ? buf->n_fds : 0);
 
-	buf->buffer_size -= len;
-	buf->n_fds = 0;
+	conn->stats.bytes_out += len;
+
+	if (with_fds) {
+		/* the fds went out with the first byte */
+		conn->stats.fds_out += buf->n_fds;
+		buf->n_fds = 0;
+		buf->fds_queued = false;
+	}
+
+	/* skip over what was sent, keep the rest for the next flush */
+	size -= len;
+	while (len > 0 && buf->first < buf->n_chunks) {
+		struct chunk *c = &buf->chunks[buf->first];
+		size_t avail = c->size - buf->sent;
+
+		if ((size_t) len < avail) {
+			buf->sent += len;
+			break;
+		}
+		len -= avail;
+		buf->first++;
+		buf->sent = 0;
+	}
+	if (buf->first == buf->n_chunks) {
+		clear_out_buffer(buf);
+		return true;
+	}
+	/* everything up to the fds was sent, now send the fds */
+	if (size == 0)
+		goto again;
 
 	return true;
 
@@ -522,8 +1279,9 @@ bool pw_protocol_native_connection_clear(struct pw_protocol_native_connection *c
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
 
-	clear_buffer(&impl->out);
+	clear_out_buffer(&impl->out);
 	clear_buffer(&impl->in);
+	impl->in.n_fds = 0;
 	impl->in.update = true;
 
 	return true;
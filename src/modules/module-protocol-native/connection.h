@@ -36,6 +36,52 @@ struct pw_protocol_native_connection_events {
 	void (*need_flush) (void *data);
 };
 
+#define PW_PROTOCOL_NATIVE_STATS_OPCODES	64
+
+/** number of messages for an opcode of an interface */
+struct pw_protocol_native_opcode_stats {
+	uint32_t type;		/**< interface type */
+	uint32_t opcode;	/**< opcode */
+	uint64_t count;		/**< number of messages */
+};
+
+/** Statistics of a connection. They are always updated so keep them
+ * cheap: the opcode counters are a direct mapped table where opcodes
+ * that collide with another opcode are not counted separately. */
+struct pw_protocol_native_connection_stats {
+	uint64_t messages_in;	/**< messages received */
+	uint64_t messages_out;	/**< messages sent */
+	uint64_t bytes_in;	/**< bytes received */
+	uint64_t bytes_out;	/**< bytes sent */
+	uint64_t fds_in;	/**< fds received */
+	uint64_t fds_out;	/**< fds sent */
+	uint64_t busy_time;	/**< time spent handling received messages in nsec */
+	uint64_t other_in;	/**< messages received with a colliding opcode */
+	uint64_t other_out;	/**< messages sent with a colliding opcode */
+	struct pw_protocol_native_opcode_stats opcodes_in[PW_PROTOCOL_NATIVE_STATS_OPCODES];
+	struct pw_protocol_native_opcode_stats opcodes_out[PW_PROTOCOL_NATIVE_STATS_OPCODES];
+};
+
+/** count a message with \a opcode on an interface of \a type, returns false
+ * when the slot is used by another opcode */
+static inline bool
+pw_protocol_native_opcode_stats_count(struct pw_protocol_native_opcode_stats *stats,
+				      uint32_t type, uint32_t opcode)
+{
+	struct pw_protocol_native_opcode_stats *s;
+
+	s = &stats[(type * 31 + opcode) & (PW_PROTOCOL_NATIVE_STATS_OPCODES - 1)];
+	if (SPA_UNLIKELY(s->count == 0)) {
+		s->type = type;
+		s->opcode = opcode;
+	}
+	else if (SPA_UNLIKELY(s->type != type || s->opcode != opcode))
+		return false;
+
+	s->count++;
+	return true;
+}
+
 /** \class pw_protocol_native_connection
  *
  * \brief Manages the connection between client and server
@@ -46,6 +92,8 @@ struct pw_protocol_native_connection_events {
 struct pw_protocol_native_connection {
 	int fd;	/**< the socket */
 
+	struct pw_protocol_native_connection_stats stats;	/**< statistics */
+
 	struct spa_hook_list listener_list;
 };
 
@@ -93,6 +141,12 @@ pw_protocol_native_connection_flush(struct pw_protocol_native_connection *conn);
 bool
 pw_protocol_native_connection_clear(struct pw_protocol_native_connection *conn);
 
+size_t
+pw_protocol_native_connection_get_queued(struct pw_protocol_native_connection *conn);
+
+int
+pw_protocol_native_connection_offer_ring(struct pw_protocol_native_connection *conn);
+
 #ifdef __cplusplus
 }  /* extern "C" */
 #endif
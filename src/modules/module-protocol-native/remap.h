@@ -0,0 +1,107 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __PIPEWIRE_PROTOCOL_NATIVE_REMAP_H__
+#define __PIPEWIRE_PROTOCOL_NATIVE_REMAP_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <spa/pod/iter.h>
+
+#include "pipewire/private.h"
+
+static inline bool pod_remap_data(uint32_t type, void *body, uint32_t size,
+				  const struct pw_type_remap *types)
+{
+	uint32_t t;
+
+	switch (type) {
+	case SPA_POD_TYPE_ID:
+		if ((t = pw_type_remap_lookup(types, *(uint32_t *) body)) == SPA_ID_INVALID)
+			return false;
+		*(uint32_t *) body = t;
+		break;
+
+	case SPA_POD_TYPE_PROP:
+	{
+		struct spa_pod_prop_body *b = body;
+
+		if ((t = pw_type_remap_lookup(types, b->key)) == SPA_ID_INVALID)
+			return false;
+		b->key = t;
+
+		if (b->value.type == SPA_POD_TYPE_ID) {
+			void *alt;
+			if (!pod_remap_data
+			    (b->value.type, SPA_POD_BODY(&b->value), b->value.size, types))
+				return false;
+
+			SPA_POD_PROP_ALTERNATIVE_FOREACH(b, size, alt)
+				if (!pod_remap_data(b->value.type, alt, b->value.size, types))
+					return false;
+		}
+		break;
+	}
+	case SPA_POD_TYPE_OBJECT:
+	{
+		struct spa_pod_object_body *b = body;
+		struct spa_pod *p;
+
+		b->id = pw_type_remap_lookup(types, b->id);
+
+		if ((t = pw_type_remap_lookup(types, b->type)) == SPA_ID_INVALID)
+			return false;
+		b->type = t;
+
+		SPA_POD_OBJECT_BODY_FOREACH(b, size, p)
+			if (!pod_remap_data(p->type, SPA_POD_BODY(p), p->size, types))
+				return false;
+		break;
+	}
+	case SPA_POD_TYPE_STRUCT:
+	{
+		struct spa_pod *b = body, *p;
+
+		SPA_POD_FOREACH(b, size, p)
+			if (!pod_remap_data(p->type, SPA_POD_BODY(p), p->size, types))
+				return false;
+		break;
+	}
+	default:
+		break;
+	}
+	return true;
+}
+
+/** remap the types in a message to our types. When the peer uses the same
+ * type ids as we do, the lookups don't touch the translation array but the
+ * message is still walked to reject unknown ids. */
+static inline bool pod_remap_message(void *message, uint32_t size,
+				     const struct pw_type_remap *types)
+{
+	return pod_remap_data(SPA_POD_TYPE_STRUCT, message, size, types);
+}
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif /* __PIPEWIRE_PROTOCOL_NATIVE_REMAP_H__ */
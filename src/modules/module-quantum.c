@@ -0,0 +1,349 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "config.h"
+
+#include <spa/pod/builder.h>
+#include <spa/pod/parser.h>
+#include <spa/param/props.h>
+
+#include "pipewire/core.h"
+#include "pipewire/log.h"
+#include "pipewire/type.h"
+#include "pipewire/module.h"
+#include "pipewire/stream.h"
+#include "pipewire/private.h"
+
+#define NAME "quantum"
+
+#define QUANTUM_MIN	32
+#define QUANTUM_MAX	8192
+#define QUANTUM_DEFAULT	1024
+/* the rate of the dsp nodes, used to turn the latencies into samples */
+#define QUANTUM_RATE	44100
+
+struct impl {
+	struct pw_core *core;
+	struct pw_type *t;
+	struct pw_properties *properties;
+
+	struct spa_hook module_listener;
+	struct spa_hook core_listener;
+
+	uint32_t prop_min_latency;
+
+	struct spa_list node_list;
+
+	uint32_t quantum;
+};
+
+struct node_info {
+	struct spa_list link;
+	struct impl *impl;
+	struct pw_node *node;
+	struct spa_hook node_listener;
+	/* the node is made by the daemon and gets the quantum pushed */
+	bool driver;
+	/* the requested latency in samples, 0 when not set */
+	uint32_t min;
+	uint32_t max;
+	/* the quantum the node uses, 0 when it can't tell */
+	uint32_t quantum;
+};
+
+static struct node_info *find_node_info(struct impl *impl, struct pw_node *node)
+{
+	struct node_info *info;
+
+	spa_list_for_each(info, &impl->node_list, link) {
+		if (info->node == node)
+			return info;
+	}
+	return NULL;
+}
+
+/* the latency properties are in nanoseconds, round the min up and the
+ * max down to samples */
+static uint32_t get_samples(struct pw_node *node, const char *key, bool round_up)
+{
+	const char *str;
+	uint64_t ns, samples;
+
+	if ((str = pw_properties_get(pw_node_get_properties(node), key)) == NULL)
+		return 0;
+
+	ns = strtoull(str, NULL, 10);
+	if (round_up)
+		samples = (ns * QUANTUM_RATE + SPA_NSEC_PER_SEC - 1) / SPA_NSEC_PER_SEC;
+	else
+		samples = ns * QUANTUM_RATE / SPA_NSEC_PER_SEC;
+
+	return SPA_MIN(samples, (uint64_t) UINT32_MAX);
+}
+
+static void node_info_update(struct node_info *info)
+{
+	info->min = get_samples(info->node, PW_STREAM_PROP_LATENCY_MIN, true);
+	info->max = get_samples(info->node, PW_STREAM_PROP_LATENCY_MAX, false);
+}
+
+static void set_quantum(struct impl *impl, struct node_info *info, uint32_t quantum)
+{
+	struct pw_type *t = impl->t;
+	struct spa_pod_builder b = { 0 };
+	uint8_t buffer[256];
+	struct spa_pod *param;
+	int res;
+
+	spa_pod_builder_init(&b, buffer, sizeof(buffer));
+	param = spa_pod_builder_object(&b,
+		t->param.idProps, t->spa_props,
+		":", impl->prop_min_latency, "i", quantum);
+
+	if ((res = spa_node_set_param(info->node->node, t->param.idProps, 0, param)) < 0 &&
+	    res != -ENOTSUP && res != -ENOENT)
+		pw_log_warn("module %p: node %p can't set quantum: %s", impl, info->node,
+				spa_strerror(res));
+}
+
+/* read back the minLatency the node uses, the alsa nodes limit it to what
+ * the hardware buffer allows */
+static uint32_t get_quantum(struct impl *impl, struct node_info *info)
+{
+	struct pw_type *t = impl->t;
+	struct spa_pod_builder b = { 0 };
+	uint8_t buffer[4096];
+	struct spa_pod *param;
+	uint32_t index = 0;
+	int32_t quantum = 0;
+
+	spa_pod_builder_init(&b, buffer, sizeof(buffer));
+	if (spa_node_enum_params(info->node->node, t->param.idProps,
+				 &index, NULL, &param, &b) <= 0)
+		return 0;
+
+	if (spa_pod_object_parse(param,
+			":", impl->prop_min_latency, "?i", &quantum, NULL) < 0)
+		return 0;
+
+	return SPA_MAX(quantum, 0);
+}
+
+/* the quantum is the smallest max of all nodes, but not smaller than the
+ * largest min. The drivers and dsp nodes change their period without
+ * renegotiating so that the links stay up. When a driver can't run the
+ * quantum, the smaller quantum it uses is given to the other nodes and
+ * published instead. */
+static void update_quantum(struct impl *impl)
+{
+	struct node_info *info;
+	uint32_t min = 0, max = 0, quantum, requested;
+	struct spa_dict_item items[1];
+	char str[16];
+
+	spa_list_for_each(info, &impl->node_list, link) {
+		if (info->min > 0)
+			min = SPA_MAX(min, info->min);
+		if (info->max > 0)
+			max = max == 0 ? info->max : SPA_MIN(max, info->max);
+	}
+
+	requested = max > 0 ? max : QUANTUM_DEFAULT;
+	requested = SPA_MAX(requested, min);
+	requested = SPA_CLAMP(requested, QUANTUM_MIN, QUANTUM_MAX);
+
+	quantum = requested;
+	spa_list_for_each(info, &impl->node_list, link) {
+		if (!info->driver)
+			continue;
+		set_quantum(impl, info, requested);
+		info->quantum = get_quantum(impl, info);
+		if (info->quantum > 0)
+			quantum = SPA_MIN(quantum, info->quantum);
+	}
+	if (quantum != requested) {
+		spa_list_for_each(info, &impl->node_list, link) {
+			if (info->driver && info->quantum == 0)
+				set_quantum(impl, info, quantum);
+		}
+	}
+
+	if (quantum == impl->quantum)
+		return;
+
+	pw_log_debug("module %p: quantum %d -> %d (requested %d)", impl,
+			impl->quantum, quantum, requested);
+	impl->quantum = quantum;
+
+	snprintf(str, sizeof(str), "%u", quantum);
+	items[0] = SPA_DICT_ITEM_INIT(PW_CORE_PROP_QUANTUM, str);
+	pw_core_update_properties(impl->core, &SPA_DICT_INIT(items, 1));
+}
+
+static void node_info_free(struct node_info *info)
+{
+	spa_list_remove(&info->link);
+	spa_hook_remove(&info->node_listener);
+	free(info);
+}
+
+static void
+node_info_changed(void *data, struct pw_node_info *node_info)
+{
+	struct node_info *info = data;
+	uint32_t min = info->min, max = info->max;
+
+	node_info_update(info);
+	if (info->min != min || info->max != max)
+		update_quantum(info->impl);
+}
+
+/* the alsa nodes know their hardware buffer size when they run, check
+ * again if they can use the quantum */
+static void
+node_state_changed(void *data, enum pw_node_state old,
+		   enum pw_node_state state, const char *error)
+{
+	struct node_info *info = data;
+
+	if (info->driver && state == PW_NODE_STATE_RUNNING)
+		update_quantum(info->impl);
+}
+
+static const struct pw_node_events node_events = {
+	PW_VERSION_NODE_EVENTS,
+	.info_changed = node_info_changed,
+	.state_changed = node_state_changed,
+};
+
+static void
+core_global_added(void *data, struct pw_global *global)
+{
+	struct impl *impl = data;
+
+	if (pw_global_get_type(global) == impl->t->node) {
+		struct pw_node *node = pw_global_get_object(global);
+		struct node_info *info;
+
+		info = calloc(1, sizeof(struct node_info));
+		if (info == NULL)
+			return;
+
+		info->impl = impl;
+		info->node = node;
+		info->driver = pw_global_get_owner(global) == NULL;
+		node_info_update(info);
+		spa_list_append(&impl->node_list, &info->link);
+
+		pw_node_add_listener(node, &info->node_listener, &node_events, info);
+
+		pw_log_debug("module %p: node %p added, quantum %d-%d", impl, node,
+				info->min, info->max);
+
+		update_quantum(impl);
+	}
+}
+
+static void
+core_global_removed(void *data, struct pw_global *global)
+{
+	struct impl *impl = data;
+
+	if (pw_global_get_type(global) == impl->t->node) {
+		struct pw_node *node = pw_global_get_object(global);
+		struct node_info *info;
+
+		if ((info = find_node_info(impl, node))) {
+			node_info_free(info);
+			update_quantum(impl);
+		}
+
+		pw_log_debug("module %p: node %p removed", impl, node);
+	}
+}
+
+static int on_global(void *data, struct pw_global *global)
+{
+	core_global_added(data, global);
+	return 0;
+}
+
+static void module_destroy(void *data)
+{
+	struct impl *impl = data;
+	struct node_info *info, *t;
+
+	spa_list_for_each_safe(info, t, &impl->node_list, link)
+		node_info_free(info);
+
+	spa_hook_remove(&impl->core_listener);
+	spa_hook_remove(&impl->module_listener);
+
+	if (impl->properties)
+		pw_properties_free(impl->properties);
+
+	free(impl);
+}
+
+static const struct pw_module_events module_events = {
+	PW_VERSION_MODULE_EVENTS,
+	.destroy = module_destroy,
+};
+
+static const struct pw_core_events core_events = {
+	PW_VERSION_CORE_EVENTS,
+	.global_added = core_global_added,
+	.global_removed = core_global_removed,
+};
+
+static int module_init(struct pw_module *module, struct pw_properties *properties)
+{
+	struct impl *impl;
+
+	impl = calloc(1, sizeof(struct impl));
+	if (impl == NULL)
+		return -ENOMEM;
+
+	pw_log_debug("module %p: new", impl);
+
+	impl->core = pw_module_get_core(module);
+	impl->t = pw_core_get_type(impl->core);
+	impl->properties = properties;
+	impl->prop_min_latency = spa_type_map_get_id(impl->t->map, SPA_TYPE_PROPS__minLatency);
+
+	spa_list_init(&impl->node_list);
+
+	pw_core_for_each_global(impl->core, on_global, impl);
+	update_quantum(impl);
+
+	pw_module_add_listener(module, &impl->module_listener, &module_events, impl);
+	pw_core_add_listener(impl->core, &impl->core_listener, &core_events, impl);
+
+	return 0;
+}
+
+int pipewire__module_init(struct pw_module *module, const char *args)
+{
+	return module_init(module, NULL);
+}
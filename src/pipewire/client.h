@@ -120,6 +120,18 @@ struct pw_client_events {
 #define PW_CLIENT_PROP_UCRED_UID	"pipewire.ucred.uid"	/**< Client uid, set by protocol*/
 #define PW_CLIENT_PROP_UCRED_GID	"pipewire.ucred.gid"	/**< client gid, set by protocol*/
 
+/** Statistics of the client connection, updated periodically by the protocol */
+#define PW_CLIENT_PROP_MESSAGES_IN	"pipewire.protocol.messages-in"		/**< received messages */
+#define PW_CLIENT_PROP_MESSAGES_OUT	"pipewire.protocol.messages-out"	/**< sent messages */
+#define PW_CLIENT_PROP_BYTES_IN		"pipewire.protocol.bytes-in"		/**< received bytes */
+#define PW_CLIENT_PROP_BYTES_OUT	"pipewire.protocol.bytes-out"		/**< sent bytes */
+#define PW_CLIENT_PROP_FDS_IN		"pipewire.protocol.fds-in"		/**< received fds */
+#define PW_CLIENT_PROP_FDS_OUT		"pipewire.protocol.fds-out"		/**< sent fds */
+#define PW_CLIENT_PROP_BUSY_TIME	"pipewire.protocol.busy-time"		/**< time handling messages in usec */
+/** messages per opcode as a list of "Interface.opcode:count" */
+#define PW_CLIENT_PROP_OPCODES_IN	"pipewire.protocol.opcodes-in"
+#define PW_CLIENT_PROP_OPCODES_OUT	"pipewire.protocol.opcodes-out"
+
 /** Create a new client. This is mainly used by protocols. */
 struct pw_client *
 pw_client_new(struct pw_core *core,		/**< the core object */
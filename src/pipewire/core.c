@@ -33,7 +33,9 @@
 #include <pipewire/core.h>
 #include <pipewire/data-loop.h>
 
-#include <spa/graph/graph-scheduler6.h>
+#include <spa/graph/graph-schedulers.h>
+
+#define PW_CORE_MEMPOOL_SIZE_DEFAULT	(32 * 1024 * 1024)
 
 /** \cond */
 struct resource_data {
@@ -108,6 +110,7 @@ static void core_hello(void *object)
 	pw_log_debug("core %p: hello from source %p", this, resource);
 	resource->client->n_types = 0;
 
+	pw_core_update_mem_info(this);
 	this->info.change_mask = PW_CORE_CHANGE_MASK_ALL;
 	pw_core_resource_info(resource, &this->info);
 }
@@ -272,7 +275,7 @@ static void core_update_types(void *object, uint32_t first_id, const char **type
 
 	for (i = 0; i < n_types; i++, first_id++) {
 		uint32_t this_id = spa_type_map_get_id(this->type.map, types[i]);
-		if (!pw_map_insert_at(&client->types, first_id, PW_MAP_ID_TO_PTR(this_id)))
+		if (pw_type_remap_set(&client->types, first_id, this_id) < 0)
 			pw_log_error("can't add type %d->%d for client", first_id, this_id);
 	}
 }
@@ -386,8 +389,30 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
 	pw_type_init(&this->type);
 	pw_map_init(&this->globals, 128, 32);
 
+	if ((name = pw_properties_get(properties, PW_CORE_PROP_MEMPOOL_SIZE)) != NULL)
+		this->pool = pw_mempool_new(strtoul(name, NULL, 0));
+	else
+		this->pool = pw_mempool_new(PW_CORE_MEMPOOL_SIZE_DEFAULT);
+
+	this->mem_flags = pw_memblock_flags_parse(pw_properties_get(properties,
+								   PW_CORE_PROP_MEM_FLAGS));
+	pw_properties_setf(properties, PW_CORE_PROP_MEM_LOCKED, "%zu",
+			   this->mem_locked = pw_memblock_get_locked_size());
+
+	if ((name = pw_properties_get(properties, PW_CORE_PROP_GRAPH_SCHEDULER)) == NULL)
+		name = getenv("PIPEWIRE_GRAPH_SCHEDULER");
+	if ((this->rt.scheduler = spa_graph_scheduler_find(name)) == NULL) {
+		pw_log_warn("core %p: unknown graph scheduler %s", this, name);
+		this->rt.scheduler = spa_graph_scheduler_find(NULL);
+	}
+	pw_log_info("core %p: using graph scheduler %s", this, this->rt.scheduler->name);
+
+	this->rt.scheduler_data = calloc(1, SPA_MAX(this->rt.scheduler->size, sizeof(void *)));
+	if (this->rt.scheduler_data == NULL)
+		goto no_scheduler;
+
 	spa_graph_init(&this->rt.graph);
-	spa_graph_set_callbacks(&this->rt.graph, &spa_graph_impl_default, NULL);
+	spa_graph_set_scheduler(&this->rt.graph, this->rt.scheduler, this->rt.scheduler_data);
 
 	spa_debug_set_type_map(this->type.map);
 
@@ -446,7 +471,7 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
 					     NULL),
 				     this);
 	if (this->global == NULL)
-		goto no_mem;
+		goto no_global;
 
 	pw_global_add_listener(this->global, &this->global_listener, &global_events, this);
 	pw_global_register(this->global, NULL, NULL);
@@ -454,6 +479,11 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
 
 	return this;
 
+      no_global:
+	spa_graph_scheduler_clear(this->rt.scheduler, this->rt.scheduler_data);
+	free(this->rt.scheduler_data);
+      no_scheduler:
+	pw_data_loop_destroy(this->data_loop_impl);
       no_mem:
       no_data_loop:
 	free(this);
@@ -493,11 +523,16 @@ void pw_core_destroy(struct pw_core *core)
 	spa_hook_list_call(&core->listener_list, struct pw_core_events, free);
 
 	pw_data_loop_destroy(core->data_loop_impl);
+	spa_graph_scheduler_clear(core->rt.scheduler, core->rt.scheduler_data);
+	free(core->rt.scheduler_data);
 
 	pw_properties_free(core->properties);
 
 	pw_map_clear(&core->globals);
 
+	if (core->pool)
+		pw_mempool_destroy(core->pool);
+
 	pw_log_debug("core %p: free", core);
 	free(core);
 }
@@ -572,6 +607,21 @@ int pw_core_update_properties(struct pw_core *core, const struct spa_dict *dict)
 	return 0;
 }
 
+void pw_core_update_mem_info(struct pw_core *core)
+{
+	struct spa_dict_item items[1];
+	size_t locked = pw_memblock_get_locked_size();
+	char val[32];
+
+	if (locked == core->mem_locked)
+		return;
+
+	core->mem_locked = locked;
+	snprintf(val, sizeof(val), "%zu", locked);
+	items[0] = SPA_DICT_ITEM_INIT(PW_CORE_PROP_MEM_LOCKED, val);
+	pw_core_update_properties(core, &SPA_DICT_INIT(items, 1));
+}
+
 int pw_core_for_each_global(struct pw_core *core,
 			    int (*callback) (void *data, struct pw_global *global),
 			    void *data)
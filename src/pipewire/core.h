@@ -110,6 +110,21 @@ struct pw_core_events {
 #define PW_CORE_PROP_VERSION	"pipewire.core.version"
 /** If the core should listen for connections, boolean default false */
 #define PW_CORE_PROP_DAEMON	"pipewire.daemon"
+/** The graph scheduler to use, scheduler6 or plan. The default is taken
+ * from the PIPEWIRE_GRAPH_SCHEDULER environment variable or else
+ * scheduler6. */
+#define PW_CORE_PROP_GRAPH_SCHEDULER	"pipewire.core.graph-scheduler"
+/** Max number of bytes of link buffer memory the core pools, in use and
+ * free, default 32MB, 0 disables the pool */
+#define PW_CORE_PROP_MEMPOOL_SIZE	"pipewire.core.mempool-size"
+/** Extra memblock flags for link buffers and client-node transports, a list
+ * of populate, lock, hugepage and hugetlb. Default none */
+#define PW_CORE_PROP_MEM_FLAGS	"pipewire.core.mem-flags"
+/** Number of bytes of memblock memory locked in memory, read-only */
+#define PW_CORE_PROP_MEM_LOCKED	"pipewire.core.mem-locked"
+/** Number of samples the drivers and dsp nodes process in one cycle, set by
+ * the quantum module, read-only */
+#define PW_CORE_PROP_QUANTUM	"pipewire.core.quantum"
 
 /** Make a new core object for a given main_loop. Ownership of the properties is taken */
 struct pw_core * pw_core_new(struct pw_loop *main_loop, struct pw_properties *props);
@@ -370,10 +370,14 @@ static int alloc_buffers(struct pw_link *this,
 	/* pointer to buffer structures */
 	bp = SPA_MEMBER(buffers, n_buffers * sizeof(struct spa_buffer *), struct spa_buffer);
 
-	if ((res = pw_memblock_alloc(PW_MEMBLOCK_FLAG_WITH_FD |
-				     PW_MEMBLOCK_FLAG_MAP_READWRITE |
-				     PW_MEMBLOCK_FLAG_SEAL, n_buffers * data_size, &m)) < 0)
+	if ((res = pw_mempool_alloc(this->core->pool,
+				    PW_MEMBLOCK_FLAG_WITH_FD |
+				    PW_MEMBLOCK_FLAG_MAP_READWRITE |
+				    PW_MEMBLOCK_FLAG_SEAL |
+				    this->core->mem_flags, n_buffers * data_size, &m)) < 0) {
+		free(buffers);
 		return res;
+	}
 
 	for (i = 0; i < n_buffers; i++) {
 		int j;
@@ -480,6 +484,43 @@ param_filter(struct pw_link *this,
 	return num;
 }
 
+/* Check if the node of the output port can modify the buffers of its input
+ * port in-place and forward them on the output port. This is only possible
+ * when the node has one input and one output port and when the buffers on the
+ * input are not shared with another consumer. */
+static struct allocation *find_in_place_allocation(struct pw_port *output)
+{
+	struct pw_node *node = output->node;
+	struct pw_port *input, *peer;
+	struct pw_link *link;
+
+	if (node->info.n_input_ports != 1 || node->info.n_output_ports != 1)
+		return NULL;
+
+	if (!(output->spa_info->flags & SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS))
+		return NULL;
+
+	/* output goes to more than one consumer */
+	if (spa_list_is_empty(&output->links) || output->links.next->next != &output->links)
+		return NULL;
+
+	input = spa_list_first(&node->input_ports, struct pw_port, link);
+	if (!(input->spa_info->flags & SPA_PORT_INFO_FLAG_IN_PLACE) ||
+	    input->state < PW_PORT_STATE_PAUSED ||
+	    spa_list_is_empty(&input->links))
+		return NULL;
+
+	link = spa_list_first(&input->links, struct pw_link, input_link);
+	if ((peer = link->output) == NULL || peer->allocation.n_buffers == 0)
+		return NULL;
+
+	/* buffers are also sent to another consumer */
+	if (peer->links.next->next != &peer->links)
+		return NULL;
+
+	return &peer->allocation;
+}
+
 static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_state)
 {
 	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
@@ -489,7 +530,8 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 	char *error = NULL;
 	struct pw_port *input, *output;
 	struct pw_type *t = &this->core->type;
-	struct allocation allocation;
+	struct allocation allocation, *shared;
+	bool in_place = false;
 
 	if (in_state != PW_PORT_STATE_READY && out_state != PW_PORT_STATE_READY)
 		return 0;
@@ -558,7 +600,20 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 		spa_debug_port_info(oinfo);
 		spa_debug_port_info(iinfo);
 	}
-	if (output->allocation.n_buffers) {
+	if (in_state == PW_PORT_STATE_READY && out_state == PW_PORT_STATE_READY &&
+	    output->allocation.n_buffers == 0 &&
+	    (shared = find_in_place_allocation(output)) != NULL) {
+		out_flags = SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS;
+		in_flags = SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS;
+		in_place = true;
+
+		/* the memory stays owned by the port that allocated it */
+		allocation = *shared;
+		allocation.mem = NULL;
+
+		pw_log_debug("link %p: forwarding %d in-place buffers %p", this,
+				allocation.n_buffers, allocation.buffers);
+	} else if (output->allocation.n_buffers) {
 		out_flags = 0;
 		in_flags = SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS;
 
@@ -644,6 +699,7 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 
 		pw_log_debug("link %p: allocating %d buffers %p %zd %zd", this,
 			     allocation.n_buffers, allocation.buffers, minsize, stride);
+		pw_core_update_mem_info(this->core);
 
 		if (out_flags & SPA_PORT_INFO_FLAG_CAN_ALLOC_BUFFERS) {
 			if ((res = pw_port_alloc_buffers(output,
@@ -689,7 +745,20 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 			pw_work_queue_add(impl->work, output->node, res, complete_paused, output);
 
 		move_allocation(&allocation, &output->allocation);
+		output->in_place = in_place;
 
+		if (in_place) {
+			pw_log_debug("link %p: using %d in-place buffers %p on input port", this,
+				     allocation.n_buffers, allocation.buffers);
+			if ((res = pw_port_use_buffers(input,
+						       allocation.buffers,
+						       allocation.n_buffers)) < 0) {
+				asprintf(&error, "error use input buffers: %d", res);
+				goto error;
+			}
+			if (SPA_RESULT_IS_ASYNC(res))
+				pw_work_queue_add(impl->work, input->node, res, complete_paused, input);
+		}
 	} else if (in_flags & SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS) {
 		pw_log_debug("link %p: using %d buffers %p on input port", this,
 			     allocation.n_buffers, allocation.buffers);
@@ -828,6 +897,43 @@ static int check_states(struct pw_link *this, void *user_data, int res)
 	return res;
 }
 
+static void stop_in_place(struct pw_link *this, struct pw_port *port)
+{
+	struct pw_link *l;
+
+	pw_log_debug("link %p: stop in-place buffers on port %p", this, port);
+	pw_port_clear_in_place(port);
+
+	spa_list_for_each(l, &port->links, output_link) {
+		struct impl *impl = SPA_CONTAINER_OF(l, struct impl, this);
+		if (impl->active)
+			pw_work_queue_add(impl->work, l, -EBUSY,
+					  (pw_work_func_t) check_states, l);
+	}
+}
+
+/* in-place forwarding needs buffers with one consumer, see
+ * find_in_place_allocation. When output is about to get a second link,
+ * stop it on output itself and on the ports that forward the buffers of
+ * output, and allocate new buffers for their links. */
+static void clear_in_place(struct pw_link *this, struct pw_port *output)
+{
+	struct pw_link *l;
+	struct pw_port *p;
+
+	if (output->in_place)
+		stop_in_place(this, output);
+
+	spa_list_for_each(l, &output->links, output_link) {
+		if (l->input == NULL)
+			continue;
+
+		spa_list_for_each(p, &l->input->node->output_ports, link)
+			if (p->in_place)
+				stop_in_place(this, p);
+	}
+}
+
 static void
 input_node_async_complete(void *data, uint32_t seq, int res)
 {
@@ -860,6 +966,7 @@ do_remove_input(struct spa_loop *loop,
 {
 	struct pw_link *this = user_data;
 	spa_graph_port_remove(&this->rt.in_port);
+	spa_graph_update(this->input->rt.graph);
 	return 0;
 }
 
@@ -887,6 +994,7 @@ do_remove_output(struct spa_loop *loop,
 {
 	struct pw_link *this = user_data;
 	spa_graph_port_remove(&this->rt.out_port);
+	spa_graph_update(this->output->rt.graph);
 	return 0;
 }
 
@@ -1060,6 +1168,7 @@ do_add_link(struct spa_loop *loop,
         } else {
                 spa_graph_port_add(&port->rt.mix_node, &this->rt.in_port);
         }
+        spa_graph_update(port->rt.graph);
 
         return 0;
 }
@@ -1113,7 +1222,6 @@ struct pw_link *pw_link_new(struct pw_core *core,
                 this->user_data = SPA_MEMBER(impl, sizeof(struct impl), void);
 
 	impl->work = pw_work_queue_new(core->main_loop);
-
 	this->core = core;
 	this->properties = properties;
 	this->state = PW_LINK_STATE_INIT;
@@ -1151,6 +1259,9 @@ struct pw_link *pw_link_new(struct pw_core *core,
 	pw_log_debug("link %p: output node %p clock %p, live %d",
 			this, output_node, output_node->clock, output_node->live);
 
+	if (!spa_list_is_empty(&output->links))
+		clear_in_place(this, output);
+
 	spa_list_append(&output->links, &this->output_link);
 	spa_list_append(&input->links, &this->input_link);
 
@@ -1269,6 +1380,7 @@ int pw_link_register(struct pw_link *link,
 void pw_link_destroy(struct pw_link *link)
 {
 	struct impl *impl = SPA_CONTAINER_OF(link, struct impl, this);
+	struct pw_core *core = link->core;
 	struct pw_resource *resource, *tmp;
 
 	pw_log_debug("link %p: destroy", impl);
@@ -1305,6 +1417,8 @@ void pw_link_destroy(struct pw_link *link)
 	free_allocation(&link->allocation);
 
 	free(impl);
+
+	pw_core_update_mem_info(core);
 }
 
 void pw_link_add_listener(struct pw_link *link,
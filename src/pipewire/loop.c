@@ -18,6 +18,8 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <spa/support/loop.h>
 #include <spa/support/type-map.h>
@@ -38,6 +40,9 @@ struct impl {
 /** \endcond */
 
 /** Create a new loop
+ * \param properties extra properties, "loop.factory" selects the support
+ *	plugin factory that implements the loop, the PIPEWIRE_LOOP environment
+ *	variable is used when not set. Defaults to "loop".
  * \returns a newly allocated loop
  * \memberof pw_loop
  */
@@ -51,6 +56,7 @@ struct pw_loop *pw_loop_new(struct pw_properties *properties)
 	void *iface;
 	const struct spa_support *support;
 	uint32_t n_support;
+	const char *name = NULL;
 
 	support = pw_get_support(&n_support);
 	if (support == NULL)
@@ -60,10 +66,16 @@ struct pw_loop *pw_loop_new(struct pw_properties *properties)
 	if (map == NULL)
 		return NULL;
 
-	factory = pw_get_support_factory("loop");
+	if (properties)
+		name = pw_properties_get(properties, "loop.factory");
+	if (name == NULL)
+		name = getenv("PIPEWIRE_LOOP");
+	if (name == NULL || (factory = pw_get_support_factory(name)) == NULL)
+		factory = pw_get_support_factory("loop");
 	if (factory == NULL)
 		return NULL;
 
+      again:
 	impl = calloc(1, sizeof(struct impl) + factory->size);
 	if (impl == NULL)
 		return NULL;
@@ -77,6 +89,15 @@ struct pw_loop *pw_loop_new(struct pw_properties *properties)
 					   NULL,
 					   support,
 					   n_support)) < 0) {
+		/* fall back to the default loop, the kernel might not support
+		 * what the selected implementation needs */
+		if (strcmp(factory->name, "loop") != 0 &&
+		    (factory = pw_get_support_factory("loop")) != NULL) {
+			pw_log_warn("loop %p: can't make factory instance: %d, using default",
+					this, res);
+			free(impl);
+			goto again;
+		}
 		fprintf(stderr, "can't make factory instance: %d\n", res);
 		goto failed;
 	}
@@ -32,6 +32,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/syscall.h>
+#include <pthread.h>
 
 #include <spa/utils/list.h>
 
@@ -63,6 +64,13 @@ static inline int memfd_create(const char *name, unsigned int flags)
 #define MFD_ALLOW_SEALING 0x0002U
 #endif
 
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB       0x0004U
+#endif
+
+/* size of the default hugetlbfs pages */
+#define HUGETLB_SIZE	(2 * 1024 * 1024)
+
 /* fcntl() seals-related flags */
 
 #ifndef F_LINUX_SPECIFIC_BASE
@@ -81,13 +89,132 @@ static inline int memfd_create(const char *name, unsigned int flags)
 
 struct memblock {
 	struct pw_memblock mem;
-	struct spa_list link;
+	bool indexed;
+	struct pw_mempool *pool;
+	struct spa_list pool_link;
+	size_t pool_used;	/**< bytes handed out from a pool block */
+	size_t locked;
+};
+
+#define POOL_MIN_SHIFT	12
+#define POOL_CLASSES	20
+
+struct pw_mempool {
+	size_t max_size;	/**< budget for the pool blocks, used and free */
+	size_t size;		/**< size of all pool blocks */
+	size_t cached;		/**< size of the free pool blocks */
+	struct spa_list free[POOL_CLASSES];
+	struct spa_list used;
 };
 
-static struct spa_list _memblocks = SPA_LIST_INIT(&_memblocks);
+/* the mapped memblocks, sorted on address for pw_memblock_find() */
+struct index_entry {
+	const void *start;
+	const void *end;
+	struct memblock *m;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct index_entry *entries;
+	size_t n_entries;
+	size_t max_entries;
+} _index = { PTHREAD_MUTEX_INITIALIZER, };
+
+static size_t _locked;
+
+/* first entry with a start address bigger than ptr */
+static size_t index_upper(const void *ptr)
+{
+	size_t lo = 0, hi = _index.n_entries;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (_index.entries[mid].start <= ptr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int index_add(struct memblock *m)
+{
+	struct pw_memblock *mem = &m->mem;
+	size_t pos, size;
+	int res = 0;
+
+	if (m->indexed || mem->ptr == NULL || mem->size == 0)
+		return 0;
+
+	size = mem->flags & PW_MEMBLOCK_FLAG_MAP_TWICE ? mem->size << 1 : mem->size;
+
+	pthread_mutex_lock(&_index.lock);
+	if (_index.n_entries == _index.max_entries) {
+		size_t max = SPA_MAX(_index.max_entries * 2, 64u);
+		struct index_entry *e = realloc(_index.entries, max * sizeof(struct index_entry));
+		if (e == NULL) {
+			res = -ENOMEM;
+			goto done;
+		}
+		_index.entries = e;
+		_index.max_entries = max;
+	}
+	pos = index_upper(mem->ptr);
+	memmove(&_index.entries[pos + 1], &_index.entries[pos],
+		(_index.n_entries - pos) * sizeof(struct index_entry));
+	_index.entries[pos].start = mem->ptr;
+	_index.entries[pos].end = SPA_MEMBER(mem->ptr, size, void);
+	_index.entries[pos].m = m;
+	_index.n_entries++;
+	m->indexed = true;
+      done:
+	pthread_mutex_unlock(&_index.lock);
+	return res;
+}
+
+static void index_remove(struct memblock *m)
+{
+	size_t pos;
+
+	if (!m->indexed)
+		return;
+
+	pthread_mutex_lock(&_index.lock);
+	pos = index_upper(m->mem.ptr);
+	if (pos > 0 && _index.entries[pos - 1].m == m) {
+		pos--;
+		memmove(&_index.entries[pos], &_index.entries[pos + 1],
+			(_index.n_entries - pos - 1) * sizeof(struct index_entry));
+		_index.n_entries--;
+	}
+	m->indexed = false;
+	pthread_mutex_unlock(&_index.lock);
+}
 
 #define USE_MEMFD
 
+static void map_setup(struct pw_memblock *mem, void *ptr, size_t size)
+{
+	struct memblock *m = (struct memblock *) mem;
+
+#ifdef MADV_HUGEPAGE
+	if (mem->flags & PW_MEMBLOCK_FLAG_HUGEPAGE) {
+		if (madvise(ptr, size, MADV_HUGEPAGE) < 0)
+			pw_log_debug("mem %p: no hugepages: %s", mem, strerror(errno));
+	}
+#endif
+	if (mem->flags & PW_MEMBLOCK_FLAG_MAP_LOCK) {
+		if (mlock(ptr, size) < 0) {
+			pw_log_warn("mem %p: failed to lock %zd bytes: %s", mem, size,
+				    strerror(errno));
+		} else {
+			m->locked = size;
+			_locked += size;
+		}
+	}
+}
+
 /** Map a memblock
  * \param mem a memblock
  * \return 0 on success, < 0 on error
@@ -99,12 +226,14 @@ int pw_memblock_map(struct pw_memblock *mem)
 		return 0;
 
 	if (mem->flags & PW_MEMBLOCK_FLAG_MAP_READWRITE) {
-		int prot = 0;
+		int prot = 0, flags = MAP_SHARED;
 
 		if (mem->flags & PW_MEMBLOCK_FLAG_MAP_READ)
 			prot |= PROT_READ;
 		if (mem->flags & PW_MEMBLOCK_FLAG_MAP_WRITE)
 			prot |= PROT_WRITE;
+		if (mem->flags & PW_MEMBLOCK_FLAG_MAP_POPULATE)
+			flags |= MAP_POPULATE;
 
 		if (mem->flags & PW_MEMBLOCK_FLAG_MAP_TWICE) {
 			void *ptr;
@@ -116,7 +245,7 @@ int pw_memblock_map(struct pw_memblock *mem)
 				return -errno;
 
 			ptr =
-			    mmap(mem->ptr, mem->size, prot, MAP_FIXED | MAP_SHARED, mem->fd,
+			    mmap(mem->ptr, mem->size, prot, MAP_FIXED | flags, mem->fd,
 				 mem->offset);
 			if (ptr != mem->ptr) {
 				munmap(mem->ptr, mem->size << 1);
@@ -124,16 +253,18 @@ int pw_memblock_map(struct pw_memblock *mem)
 			}
 
 			ptr =
-			    mmap(mem->ptr + mem->size, mem->size, prot, MAP_FIXED | MAP_SHARED,
+			    mmap(mem->ptr + mem->size, mem->size, prot, MAP_FIXED | flags,
 				 mem->fd, mem->offset);
 			if (ptr != mem->ptr + mem->size) {
 				munmap(mem->ptr, mem->size << 1);
 				return -ENOMEM;
 			}
+			map_setup(mem, mem->ptr, mem->size << 1);
 		} else {
-			mem->ptr = mmap(NULL, mem->size, prot, MAP_SHARED, mem->fd, 0);
+			mem->ptr = mmap(NULL, mem->size, prot, flags, mem->fd, 0);
 			if (mem->ptr == MAP_FAILED)
 				return -ENOMEM;
+			map_setup(mem, mem->ptr, mem->size);
 		}
 	} else {
 		mem->ptr = NULL;
@@ -142,6 +273,28 @@ int pw_memblock_map(struct pw_memblock *mem)
 	return 0;
 }
 
+#ifdef USE_MEMFD
+static int alloc_hugetlb(struct pw_memblock *m)
+{
+	int res;
+
+	m->fd = memfd_create("pipewire-memfd", MFD_CLOEXEC | MFD_ALLOW_SEALING | MFD_HUGETLB);
+	if (m->fd == -1)
+		return -errno;
+
+	/* mapping fails when there are not enough hugepages reserved */
+	if (ftruncate(m->fd, m->size) < 0)
+		res = -errno;
+	else if ((res = pw_memblock_map(m)) == 0)
+		return 0;
+
+	close(m->fd);
+	m->fd = -1;
+	m->ptr = NULL;
+	return res;
+}
+#endif
+
 /** Create a new memblock
  * \param flags memblock flags
  * \param size size to allocate
@@ -158,6 +311,7 @@ int pw_memblock_alloc(enum pw_memblock_flags flags, size_t size, struct pw_membl
 	if (mem == NULL)
 		return -EINVAL;
 
+	spa_zero(tmp);
 	m = &tmp.mem;
 	m->offset = 0;
 	m->flags = flags;
@@ -168,7 +322,17 @@ int pw_memblock_alloc(enum pw_memblock_flags flags, size_t size, struct pw_membl
 
 	if (use_fd) {
 #ifdef USE_MEMFD
-		m->fd = memfd_create("pipewire-memfd", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+		m->fd = -1;
+		/* hugetlb pages can't be mapped twice at an arbitrary address */
+		if ((flags & PW_MEMBLOCK_FLAG_HUGETLB) &&
+		    !(flags & PW_MEMBLOCK_FLAG_MAP_TWICE)) {
+			int res;
+			m->size = size = SPA_ROUND_UP_N(size, HUGETLB_SIZE);
+			if ((res = alloc_hugetlb(m)) < 0)
+				pw_log_warn("Failed to allocate hugetlb memory: %s", strerror(-res));
+		}
+		if (m->fd == -1)
+			m->fd = memfd_create("pipewire-memfd", MFD_CLOEXEC | MFD_ALLOW_SEALING);
 		if (m->fd == -1) {
 			pw_log_error("Failed to create memfd: %s\n", strerror(errno));
 			return -errno;
@@ -183,7 +347,7 @@ int pw_memblock_alloc(enum pw_memblock_flags flags, size_t size, struct pw_membl
 		unlink(filename);
 #endif
 
-		if (ftruncate(m->fd, size) < 0) {
+		if (m->ptr == NULL && ftruncate(m->fd, size) < 0) {
 			pw_log_warn("Failed to truncate temporary file: %s", strerror(errno));
 			close(m->fd);
 			return -errno;
@@ -213,7 +377,11 @@ int pw_memblock_alloc(enum pw_memblock_flags flags, size_t size, struct pw_membl
 
 	p = calloc(1, sizeof(struct memblock));
 	*p = tmp;
-	spa_list_append(&_memblocks, &p->link);
+	p->pool = NULL;
+	if (index_add(p) < 0) {
+		pw_memblock_free(&p->mem);
+		return -ENOMEM;
+	}
 	*mem = &p->mem;
 	pw_log_debug("mem %p: alloc", *mem);
 
@@ -241,13 +409,18 @@ pw_memblock_import(enum pw_memblock_flags flags,
 
 	pw_log_debug("mem %p: import", *mem);
 
-	return pw_memblock_map(*mem);
+	if ((res = pw_memblock_map(*mem)) < 0)
+		return res;
+
+	return index_add((struct memblock *) *mem);
 }
 
 /** Free a memblock
  * \param mem a memblock
  * \memberof pw_memblock
  */
+static bool pool_release(struct memblock *m);
+
 void pw_memblock_free(struct pw_memblock *mem)
 {
 	struct memblock *m = (struct memblock *)mem;
@@ -255,26 +428,224 @@ void pw_memblock_free(struct pw_memblock *mem)
 	if (mem == NULL)
 		return;
 
+	if (m->pool && pool_release(m))
+		return;
+
 	pw_log_debug("mem %p: free", mem);
+	/* remove first so that a concurrent lookup never sees unmapped memory */
+	index_remove(m);
+	_locked -= m->locked;
 	if (mem->flags & PW_MEMBLOCK_FLAG_WITH_FD) {
 		if (mem->ptr)
-			munmap(mem->ptr, mem->size);
+			munmap(mem->ptr, mem->flags & PW_MEMBLOCK_FLAG_MAP_TWICE ?
+					mem->size << 1 : mem->size);
 		if (mem->fd != -1)
 			close(mem->fd);
 	} else {
 		free(mem->ptr);
 	}
-	spa_list_remove(&m->link);
 	free(mem);
 }
 
+enum pw_memblock_flags pw_memblock_flags_parse(const char *str)
+{
+	static const struct {
+		const char *name;
+		enum pw_memblock_flags flag;
+	} names[] = {
+		{ "populate", PW_MEMBLOCK_FLAG_MAP_POPULATE },
+		{ "lock", PW_MEMBLOCK_FLAG_MAP_LOCK },
+		{ "hugepage", PW_MEMBLOCK_FLAG_HUGEPAGE },
+		{ "hugetlb", PW_MEMBLOCK_FLAG_HUGETLB },
+	};
+	enum pw_memblock_flags flags = 0;
+	size_t len, i;
+
+	while (str && *str) {
+		str += strspn(str, " ,");
+		len = strcspn(str, " ,");
+		for (i = 0; i < SPA_N_ELEMENTS(names); i++) {
+			if (strlen(names[i].name) == len &&
+			    strncmp(names[i].name, str, len) == 0) {
+				flags |= names[i].flag;
+				break;
+			}
+		}
+		if (len > 0 && i == SPA_N_ELEMENTS(names))
+			pw_log_warn("unknown memblock flag %.*s", (int) len, str);
+		str += len;
+	}
+	return flags;
+}
+
+size_t pw_memblock_get_locked_size(void)
+{
+	return _locked;
+}
+
 struct pw_memblock * pw_memblock_find(const void *ptr)
+{
+	struct pw_memblock *mem = NULL;
+	size_t pos;
+
+	pthread_mutex_lock(&_index.lock);
+	pos = index_upper(ptr);
+	if (pos > 0 && ptr < _index.entries[pos - 1].end)
+		mem = &_index.entries[pos - 1].m->mem;
+	pthread_mutex_unlock(&_index.lock);
+
+	return mem;
+}
+
+static int pool_class(size_t size)
+{
+	int c = 0;
+
+	while (c < POOL_CLASSES && ((size_t) 1 << (c + POOL_MIN_SHIFT)) < size)
+		c++;
+	return c;
+}
+
+static bool pool_release(struct memblock *m)
+{
+	struct pw_mempool *pool = m->pool;
+
+	/* the block is already counted in the budget, keep it */
+	index_remove(m);
+	spa_list_remove(&m->pool_link);
+	spa_list_append(&pool->free[pool_class(m->mem.size)], &m->pool_link);
+	pool->cached += m->mem.size;
+
+	pw_log_debug("mem %p: release to pool %p, cached %zd", m, pool, pool->cached);
+	return true;
+}
+
+/* really free cached blocks, largest first, until \a size more bytes fit
+ * in the budget */
+static bool pool_reserve(struct pw_mempool *pool, size_t size)
+{
+	struct memblock *m;
+	int i;
+
+	if (size > pool->max_size)
+		return false;
+
+	for (i = POOL_CLASSES - 1; i >= 0; i--) {
+		while (pool->size + size > pool->max_size && !spa_list_is_empty(&pool->free[i])) {
+			m = spa_list_first(&pool->free[i], struct memblock, pool_link);
+			spa_list_remove(&m->pool_link);
+			pool->cached -= m->mem.size;
+			pool->size -= m->mem.size;
+			m->pool = NULL;
+			pw_log_debug("mempool %p: evict block %p size %zd", pool, m, m->mem.size);
+			pw_memblock_free(&m->mem);
+		}
+	}
+	return pool->size + size <= pool->max_size;
+}
+
+struct pw_mempool * pw_mempool_new(size_t max_size)
+{
+	struct pw_mempool *pool;
+	int i;
+
+	pool = calloc(1, sizeof(struct pw_mempool));
+	if (pool == NULL)
+		return NULL;
+
+	pool->max_size = max_size;
+	for (i = 0; i < POOL_CLASSES; i++)
+		spa_list_init(&pool->free[i]);
+	spa_list_init(&pool->used);
+
+	pw_log_debug("mempool %p: new, max size %zd", pool, max_size);
+	return pool;
+}
+
+void pw_mempool_destroy(struct pw_mempool *pool)
+{
+	struct memblock *m, *t;
+	int i;
+
+	pw_log_debug("mempool %p: destroy", pool);
+
+	spa_list_for_each_safe(m, t, &pool->used, pool_link) {
+		spa_list_remove(&m->pool_link);
+		m->pool = NULL;
+	}
+	for (i = 0; i < POOL_CLASSES; i++) {
+		spa_list_for_each_safe(m, t, &pool->free[i], pool_link) {
+			spa_list_remove(&m->pool_link);
+			m->pool = NULL;
+			pw_memblock_free(&m->mem);
+		}
+	}
+	free(pool);
+}
+
+int pw_mempool_alloc(struct pw_mempool *pool, enum pw_memblock_flags flags,
+		     size_t size, struct pw_memblock **mem)
 {
 	struct memblock *m;
+	size_t class_size, i;
+	int res, c;
+
+	if (mem == NULL)
+		return -EINVAL;
+
+	if (flags & PW_MEMBLOCK_FLAG_HUGETLB)
+		size = SPA_ROUND_UP_N(size, HUGETLB_SIZE);
+	c = pool_class(size);
+
+	if (pool == NULL || pool->max_size == 0 || c == POOL_CLASSES ||
+	    (flags & PW_MEMBLOCK_FLAG_MAP_TWICE) ||
+	    (flags & PW_MEMBLOCK_FLAG_WITH_FD) == 0 ||
+	    (flags & PW_MEMBLOCK_FLAG_MAP_READWRITE) != PW_MEMBLOCK_FLAG_MAP_READWRITE)
+		return pw_memblock_alloc(flags, size, mem);
+
+	flags |= PW_MEMBLOCK_FLAG_SEAL;
+	class_size = (size_t) 1 << (c + POOL_MIN_SHIFT);
+
+	spa_list_for_each(m, &pool->free[c], pool_link) {
+		if (m->mem.flags != flags)
+			continue;
+
+		spa_list_remove(&m->pool_link);
+		pool->cached -= m->mem.size;
+		/* clear what the previous user could have written and what
+		 * the new user gets, the rest of the block is still zero */
+		memset(m->mem.ptr, 0, SPA_MAX(size, m->pool_used));
+		goto found;
+	}
+
+	/* don't round up when the class does not fit in the budget */
+	if (!pool_reserve(pool, class_size))
+		return pw_memblock_alloc(flags, size, mem);
+
+	if ((res = pw_memblock_alloc(flags, class_size, mem)) < 0)
+		return res;
 
-	spa_list_for_each(m, &_memblocks, link) {
-		if (ptr >= m->mem.ptr && ptr < m->mem.ptr + m->mem.size)
-			return &m->mem;
+	m = SPA_CONTAINER_OF(*mem, struct memblock, mem);
+	pool->size += class_size;
+	/* touch the pages that are handed out so that the data thread does
+	 * not fault on them */
+	for (i = 0; i < size; i += 1 << POOL_MIN_SHIFT)
+		((volatile uint8_t *) m->mem.ptr)[i] = 0;
+
+	pw_log_debug("mempool %p: new block %p size %zd for %zd, pool size %zd",
+			pool, m, class_size, size, pool->size);
+
+      found:
+	m->pool_used = size;
+	if ((res = index_add(m)) < 0) {
+		pool->size -= m->mem.size;
+		m->pool = NULL;
+		pw_memblock_free(&m->mem);
+		return res;
 	}
-	return NULL;
+	m->pool = pool;
+	spa_list_append(&pool->used, &m->pool_link);
+	*mem = &m->mem;
+
+	return 0;
 }
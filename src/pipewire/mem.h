@@ -34,6 +34,12 @@ enum pw_memblock_flags {
 	PW_MEMBLOCK_FLAG_MAP_READ = (1 << 2),
 	PW_MEMBLOCK_FLAG_MAP_WRITE = (1 << 3),
 	PW_MEMBLOCK_FLAG_MAP_TWICE = (1 << 4),
+	PW_MEMBLOCK_FLAG_MAP_POPULATE = (1 << 5),	/**< prefault the pages when mapping */
+	PW_MEMBLOCK_FLAG_MAP_LOCK = (1 << 6),		/**< lock the mapped pages in memory */
+	PW_MEMBLOCK_FLAG_HUGEPAGE = (1 << 7),		/**< advise transparent hugepages */
+	PW_MEMBLOCK_FLAG_HUGETLB = (1 << 8),		/**< allocate the memfd from hugetlbfs,
+							  *  rounds the size to the hugepage
+							  *  size */
 };
 
 #define PW_MEMBLOCK_FLAG_MAP_READWRITE (PW_MEMBLOCK_FLAG_MAP_READ | PW_MEMBLOCK_FLAG_MAP_WRITE)
@@ -62,9 +68,49 @@ pw_memblock_map(struct pw_memblock *mem);
 void
 pw_memblock_free(struct pw_memblock *mem);
 
-/** Find memblock for given \a ptr */
+/** Parse a list of memblock flag names separated by spaces or commas:
+ * populate, lock, hugepage and hugetlb */
+enum pw_memblock_flags pw_memblock_flags_parse(const char *str);
+
+/** Get the total number of bytes currently locked by memblocks */
+size_t pw_memblock_get_locked_size(void);
+
+/** Find memblock for given \a ptr, this does a binary search in the mapped
+ * memblocks. The lookup itself is thread safe but the returned memblock is
+ * not pinned, the caller must make sure that it is not freed while in use,
+ * usually by calling this from the thread that frees the memblocks. */
 struct pw_memblock * pw_memblock_find(const void *ptr);
 
+/** \class pw_mempool
+ * A cache of sealed memfd memblocks, grouped in power of two size classes.
+ *
+ * The blocks of the pool, in use and free, never take more than \a max_size
+ * bytes. Freeing a block from the pool with pw_memblock_free() returns it to
+ * the pool, free blocks are only really freed to make room for a new block.
+ * When the size class of a request does not fit in the budget, even after
+ * freeing all free blocks, the request is allocated outside of the pool
+ * with its exact size.
+ *
+ * The pages a request uses are prefaulted when a block is created, a
+ * recycled block is cleared up to the largest size it was used for.
+ * Note that a recycled block can still be mapped by the clients it was
+ * shared with before.
+ *
+ * A pool with \a max_size 0 does not cache, prefault or round up blocks.
+ */
+struct pw_mempool;
+
+/** Make a new memblock pool that holds at most \a max_size bytes */
+struct pw_mempool * pw_mempool_new(size_t max_size);
+
+/** Destroy a pool, blocks still in use are detached from the pool */
+void pw_mempool_destroy(struct pw_mempool *pool);
+
+/** Get a block of at least \a size bytes from \a pool. Flags that
+ * can't be pooled fall back to \ref pw_memblock_alloc() */
+int pw_mempool_alloc(struct pw_mempool *pool, enum pw_memblock_flags flags,
+		     size_t size, struct pw_memblock **mem);
+
 /** parameters to map a memory range */
 struct pw_map_range {
 	uint32_t start;		/** offset in first page with start of data */
@@ -308,6 +308,7 @@ do_node_add(struct spa_loop *loop,
 	struct pw_node *this = user_data;
 
 	spa_graph_node_add(this->rt.graph, &this->rt.node);
+	spa_graph_update(this->rt.graph);
 
 	return 0;
 }
@@ -592,6 +593,7 @@ do_node_remove(struct spa_loop *loop,
 	pause_node(this);
 
 	spa_graph_node_remove(&this->rt.node);
+	spa_graph_update(this->rt.graph);
 
 	return 0;
 }
@@ -293,6 +293,7 @@ static int do_add_port(struct spa_loop *loop,
 	spa_graph_node_add(this->rt.graph, &this->rt.mix_node);
 	spa_graph_port_add(&this->rt.mix_node, &this->rt.mix_port);
 	spa_graph_port_link(&this->rt.port, &this->rt.mix_port);
+	spa_graph_update(this->rt.graph);
 
 	return 0;
 }
@@ -502,6 +503,7 @@ static int do_remove_port(struct spa_loop *loop,
 
 	spa_graph_port_remove(&this->rt.mix_port);
 	spa_graph_node_remove(&this->rt.mix_node);
+	spa_graph_update(this->rt.graph);
 
 	return 0;
 }
@@ -676,11 +678,42 @@ int pw_port_set_param(struct pw_port *port, uint32_t id, uint32_t flags,
 	return res;
 }
 
+void pw_port_clear_in_place(struct pw_port *port)
+{
+	struct pw_link *l;
+
+	if (!port->in_place)
+		return;
+
+	pw_log_debug("port %p: clear in-place buffers", port);
+	port->in_place = false;
+
+	spa_list_for_each(l, &port->links, output_link)
+		if (l->input)
+			pw_port_use_buffers(l->input, NULL, 0);
+	pw_port_use_buffers(port, NULL, 0);
+}
+
+/* the output ports that forward the buffers of the input port can't use
+ * them anymore when the input port buffers change, clear them and the ports
+ * they are linked to. */
+static void clear_in_place_outputs(struct pw_port *port)
+{
+	struct pw_node *node = port->node;
+	struct pw_port *p;
+
+	spa_list_for_each(p, &node->output_ports, link)
+		pw_port_clear_in_place(p);
+}
+
 int pw_port_use_buffers(struct pw_port *port, struct spa_buffer **buffers, uint32_t n_buffers)
 {
 	int res;
 	struct pw_node *node = port->node;
 
+	if (port->direction == PW_DIRECTION_INPUT)
+		clear_in_place_outputs(port);
+
 	if (n_buffers == 0 && port->state <= PW_PORT_STATE_READY)
 		return 0;
 
@@ -691,6 +724,7 @@ int pw_port_use_buffers(struct pw_port *port, struct spa_buffer **buffers, uint3
 	pw_log_debug("port %p: use %d buffers: %d (%s)", port, n_buffers, res, spa_strerror(res));
 
 	port->allocated = false;
+	port->in_place = false;
 
 	free_allocation(&port->allocation);
 
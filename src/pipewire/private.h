@@ -24,6 +24,8 @@
 extern "C" {
 #endif
 
+#include <errno.h>
+#include <stdlib.h>
 #include <sys/socket.h>
 #include <sys/types.h> /* for pthread_t */
 
@@ -74,6 +76,62 @@ struct pw_protocol {
 typedef uint32_t (*pw_permission_func_t) (struct pw_global *global,
 					  struct pw_client *client, void *data);
 
+/** translation of the type ids of the peer to our type ids */
+struct pw_type_remap {
+	uint32_t *ids;		/**< our id for each peer id */
+	uint32_t n_ids;		/**< number of peer ids */
+	uint32_t max_ids;	/**< allocated size of ids */
+	bool identity;		/**< all peer ids are the same as our ids */
+};
+
+static inline void pw_type_remap_init(struct pw_type_remap *remap)
+{
+	remap->ids = NULL;
+	remap->n_ids = 0;
+	remap->max_ids = 0;
+	remap->identity = true;
+}
+
+static inline void pw_type_remap_clear(struct pw_type_remap *remap)
+{
+	free(remap->ids);
+	pw_type_remap_init(remap);
+}
+
+/** map peer type \a peer_id to our type \a id, done when the peer updates its types.
+ * The peer ids are added in order, \a peer_id can be an existing id or the next one. */
+static inline int pw_type_remap_set(struct pw_type_remap *remap, uint32_t peer_id, uint32_t id)
+{
+	if (peer_id > remap->n_ids || id == SPA_ID_INVALID)
+		return -EINVAL;
+
+	if (peer_id == remap->n_ids) {
+		if (remap->n_ids == remap->max_ids) {
+			uint32_t *ids, max_ids = remap->max_ids + 64;
+
+			if (max_ids > UINT32_MAX / sizeof(uint32_t) ||
+			    (ids = realloc(remap->ids, max_ids * sizeof(uint32_t))) == NULL)
+				return -ENOMEM;
+			remap->ids = ids;
+			remap->max_ids = max_ids;
+		}
+		remap->n_ids++;
+	}
+	remap->ids[peer_id] = id;
+	if (peer_id != id)
+		remap->identity = false;
+
+	return 0;
+}
+
+/** get our type for peer type \a peer_id, SPA_ID_INVALID when unknown */
+static inline uint32_t pw_type_remap_lookup(const struct pw_type_remap *remap, uint32_t peer_id)
+{
+	if (peer_id >= remap->n_ids)
+		return SPA_ID_INVALID;
+	return remap->identity ? peer_id : remap->ids[peer_id];
+}
+
 struct pw_client {
 	struct pw_core *core;		/**< core object */
 	struct spa_list link;		/**< link in core object client list */
@@ -94,7 +152,7 @@ struct pw_client {
 
 	struct pw_map objects;		/**< list of resource objects */
 	uint32_t n_types;		/**< number of client types */
-	struct pw_map types;		/**< map of client types */
+	struct pw_type_remap types;	/**< client types */
 
 	struct spa_list resource_list;	/**< The list of resources of this client */
 
@@ -164,8 +222,14 @@ struct pw_core {
 
 	long sc_pagesize;
 
+	struct pw_mempool *pool;	/**< pool of link buffer memory */
+	enum pw_memblock_flags mem_flags;	/**< extra flags for buffer memory */
+	size_t mem_locked;		/**< last reported locked memory */
+
 	struct {
 		struct spa_graph graph;
+		const struct spa_graph_scheduler *scheduler;
+		void *scheduler_data;
 	} rt;
 };
 
@@ -324,6 +388,8 @@ struct pw_port {
 	struct spa_io_buffers io;	/**< io area of the port */
 
 	bool allocated;			/**< if buffers are allocated */
+	bool in_place;			/**< output port forwards the buffers of the
+					  *  input port of the node */
 	struct allocation allocation;
 
 	struct spa_list links;		/**< list of \ref pw_link */
@@ -393,7 +459,7 @@ struct pw_remote {
         struct pw_core_info *info;		/**< info about the remote core */
 
 	uint32_t n_types;			/**< number of client types */
-	struct pw_map types;			/**< client types */
+	struct pw_type_remap types;		/**< client types */
 
 	struct spa_list proxy_list;		/**< list of \ref pw_proxy objects */
 	struct spa_list stream_list;		/**< list of \ref pw_stream objects */
@@ -470,6 +536,9 @@ struct pw_control {
 };
 
 
+/** Update the locked memory in the core info when it changed */
+void pw_core_update_mem_info(struct pw_core *core);
+
 /** Find a good format between 2 ports */
 int pw_core_find_format(struct pw_core *core,
 			struct pw_port *output,
@@ -544,6 +613,10 @@ int pw_port_set_param(struct pw_port *port, uint32_t id, uint32_t flags,
 /** Use buffers on a port \memberof pw_port */
 int pw_port_use_buffers(struct pw_port *port, struct spa_buffer **buffers, uint32_t n_buffers);
 
+/** Stop forwarding the input buffers on an output port, the port and the
+ * ports it is linked to have no buffers afterwards \memberof pw_port */
+void pw_port_clear_in_place(struct pw_port *port);
+
 /** Allocate memory for buffers on a port \memberof pw_port */
 int pw_port_alloc_buffers(struct pw_port *port,
 			  struct spa_pod **params, uint32_t n_params,
@@ -198,7 +198,7 @@ core_event_update_types(void *data, uint32_t first_id, const char **types, uint3
 
 	for (i = 0; i < n_types; i++, first_id++) {
 		uint32_t this_id = spa_type_map_get_id(this->core->type.map, types[i]);
-		if (!pw_map_insert_at(&this->types, first_id, PW_MAP_ID_TO_PTR(this_id)))
+		if (pw_type_remap_set(&this->types, first_id, this_id) < 0)
 			pw_log_error("can't add type for client");
 	}
 }
@@ -245,7 +245,7 @@ struct pw_remote *pw_remote_new(struct pw_core *core,
 	this->state = PW_REMOTE_STATE_UNCONNECTED;
 
 	pw_map_init(&this->objects, 64, 32);
-	pw_map_init(&this->types, 64, 32);
+	pw_type_remap_init(&this->types);
 
 	spa_list_init(&this->proxy_list);
 	spa_list_init(&this->stream_list);
@@ -451,7 +451,7 @@ int pw_remote_disconnect(struct pw_remote *remote)
 	remote->core_proxy = NULL;
 
 	pw_map_clear(&remote->objects);
-	pw_map_clear(&remote->types);
+	pw_type_remap_clear(&remote->types);
 	remote->n_types = 0;
 
 	if (remote->info) {
@@ -633,6 +633,7 @@ static void clean_transport(struct pw_proxy *proxy)
 		spa_graph_port_remove(&data->out_ports[port->port_id].output);
 		spa_graph_port_remove(&data->out_ports[port->port_id].input);
 	}
+	spa_graph_update(data->node->rt.graph);
 
 	pw_array_for_each(mid, &data->mem_ids)
 		clear_memid(data, mid);
@@ -758,6 +759,7 @@ static void client_node_transport(void *object, uint32_t node_id,
 		spa_graph_port_add(&port->rt.mix_node, &data->out_ports[port->port_id].output);
 		data->out_ports[port->port_id].port = port;
 	}
+	spa_graph_update(data->node->rt.graph);
 
         data->rtwritefd = writefd;
         data->rtsocket_source = pw_loop_add_io(proxy->remote->core->data_loop,
@@ -846,7 +848,8 @@ static void node_need_input(void *data)
         uint64_t cmd = 1;
 	pw_client_node_transport_add_message(d->trans,
 				&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_NEED_INPUT));
-        write(d->rtwritefd, &cmd, 8);
+	if (pw_client_node_transport_need_wakeup(d->trans))
+	        write(d->rtwritefd, &cmd, 8);
 }
 
 static void node_have_output(void *data)
@@ -855,7 +858,8 @@ static void node_have_output(void *data)
         uint64_t cmd = 1;
         pw_client_node_transport_add_message(d->trans,
                                &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT));
-        write(d->rtwritefd, &cmd, 8);
+	if (pw_client_node_transport_need_wakeup(d->trans))
+	        write(d->rtwritefd, &cmd, 8);
 }
 
 static void client_node_command(void *object, uint32_t seq, const struct spa_command *command)
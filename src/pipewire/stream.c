@@ -21,12 +21,18 @@
 #include <sys/socket.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include <spa/utils/ringbuffer.h>
 
 #include "spa/lib/debug.h"
 
 #include "pipewire/pipewire.h"
+#include "pipewire/data-loop.h"
 #include "pipewire/private.h"
 #include "pipewire/interfaces.h"
 #include "pipewire/array.h"
@@ -41,27 +47,50 @@
 #define MAX_FDS         32
 #define MAX_INPUTS      64
 #define MAX_OUTPUTS     64
+#define MAX_BUFFERS     64
+#define MASK_BUFFERS    (MAX_BUFFERS-1)
+
+/* a mapping of a memfd, shared by all users of the same file. Every fd
+ * received for a file is a new fd so the file is identified by its inode. */
+struct mem_map {
+	struct spa_list link;
+	uint32_t ref;
+	bool shared;		/**< mapping of the complete file */
+	dev_t dev;
+	ino_t ino;
+	int prot;
+	off_t offset;
+	size_t size;
+	void *ptr;
+};
 
 struct mem_id {
 	uint32_t id;
 	int fd;
 	uint32_t flags;
 	uint32_t ref;
-	struct pw_map_range map;
+	struct mem_map *map;
 	void *ptr;
 };
 
 struct buffer_id {
 	struct spa_list link;
+	struct pw_buffer this;
 	uint32_t id;
 	bool used;
 	struct spa_buffer *buf;
+	struct mem_map *map;
 	void *ptr;
-	struct pw_map_range map;
 	uint32_t n_mem;
 	struct mem_id **mem;
 };
 
+/* a single producer, single consumer queue of buffer indexes */
+struct queue {
+	uint32_t ids[MAX_BUFFERS];
+	struct spa_ringbuffer ring;
+};
+
 struct stream {
 	struct pw_stream this;
 
@@ -82,6 +111,11 @@ struct stream {
 
 	enum pw_stream_flags flags;
 
+	/* the loop for the data messages, the data loop of the core or our
+	 * own realtime thread with PW_STREAM_FLAG_RT_PROCESS */
+	struct pw_loop *data_loop;
+	struct pw_data_loop *rt_loop;
+
 	int rtwritefd;
 	struct spa_source *rtsocket_source;
 
@@ -92,16 +126,26 @@ struct stream {
 
 	struct pw_client_node_transport *trans;
 
+	/* transport shared with the peer port when buffers are exchanged
+	 * directly with another client */
+	struct pw_client_node_transport *peer_trans;
+	int peer_writefd;
+	struct spa_source *peer_source;
+	bool peer_pending;
+
 	struct spa_source *timeout_source;
 
 	struct pw_array mem_ids;
+	struct spa_list mem_maps;
 	struct pw_array buffer_ids;
 	bool in_order;
 	struct spa_io_buffers *io;
 
 	bool client_reuse;
+	bool direct;
 
 	struct spa_list free;
+	struct queue queue;	/**< buffers to dequeue with PW_STREAM_FLAG_QUEUE */
 	bool in_need_buffer;
 	bool in_new_buffer;
 
@@ -111,6 +155,32 @@ struct stream {
 };
 /** \endcond */
 
+static inline int queue_push(struct queue *queue, uint32_t id)
+{
+	uint32_t index;
+
+	if (spa_ringbuffer_get_write_index(&queue->ring, &index) >= MAX_BUFFERS)
+		return -ENOSPC;
+
+	queue->ids[index & MASK_BUFFERS] = id;
+	spa_ringbuffer_write_update(&queue->ring, index + 1);
+
+	return 0;
+}
+
+static inline int queue_pop(struct queue *queue, uint32_t *id)
+{
+	uint32_t index;
+
+	if (spa_ringbuffer_get_read_index(&queue->ring, &index) < 1)
+		return -EPIPE;
+
+	*id = queue->ids[index & MASK_BUFFERS];
+	spa_ringbuffer_read_update(&queue->ring, index + 1);
+
+	return 0;
+}
+
 static struct mem_id *find_mem(struct pw_stream *stream, uint32_t id)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
@@ -123,30 +193,71 @@ static struct mem_id *find_mem(struct pw_stream *stream, uint32_t id)
 	return NULL;
 }
 
-static void *mem_map(struct pw_stream *stream, struct mem_id *m, uint32_t offset, uint32_t size)
+/* get a pointer to \a size bytes at \a offset in \a fd. The complete file
+ * is mapped once and shared with all other users of the file. When the size
+ * of the file can't be found, only the range is mapped. */
+static void *mem_map(struct stream *impl, int fd, int prot, uint32_t offset, uint32_t size,
+		     struct mem_map **map)
 {
-	if (m->ptr == NULL) {
-		pw_map_range_init(&m->map, offset, size, stream->remote->core->sc_pagesize);
+	struct pw_stream *stream = &impl->this;
+	struct mem_map *m;
+	struct stat st;
+	bool shared;
+
+	*map = NULL;
+	shared = fstat(fd, &st) == 0 && st.st_size >= (off_t) offset + size;
+
+	if (shared) {
+		spa_list_for_each(m, &impl->mem_maps, link) {
+			if (m->shared && m->dev == st.st_dev && m->ino == st.st_ino &&
+			    m->prot == prot)
+				goto found;
+		}
+	}
 
-		m->ptr = mmap(NULL, m->map.size, PROT_READ|PROT_WRITE,
-				MAP_SHARED, m->fd, m->map.offset);
+	m = calloc(1, sizeof(struct mem_map));
+	if (m == NULL)
+		return NULL;
 
-		if (m->ptr == MAP_FAILED) {
-			pw_log_error("stream %p: Failed to mmap memory %d %p: %m", stream, size, m);
-			m->ptr = NULL;
-			return NULL;
-		}
+	m->shared = shared;
+	m->prot = prot;
+	if (shared) {
+		m->dev = st.st_dev;
+		m->ino = st.st_ino;
+		m->offset = 0;
+		m->size = st.st_size;
+	} else {
+		struct pw_map_range range;
+		pw_map_range_init(&range, offset, size, stream->remote->core->sc_pagesize);
+		m->offset = range.offset;
+		m->size = range.size;
 	}
-	return SPA_MEMBER(m->ptr, m->map.start, void);
+
+	m->ptr = mmap(NULL, m->size, prot, MAP_SHARED, fd, m->offset);
+	if (m->ptr == MAP_FAILED) {
+		pw_log_error("stream %p: Failed to mmap memory %zd: %m", stream, m->size);
+		free(m);
+		return NULL;
+	}
+	spa_list_append(&impl->mem_maps, &m->link);
+	pw_log_debug("stream %p: map %p fd %d size %zd shared %d", stream, m, fd, m->size, shared);
+
+      found:
+	m->ref++;
+	*map = m;
+	return SPA_MEMBER(m->ptr, offset - m->offset, void);
 }
 
-static void mem_unmap(struct stream *impl, struct mem_id *m)
+static void mem_unmap(struct stream *impl, struct mem_map *m)
 {
-	if (m->ptr != NULL) {
-		if (munmap(m->ptr, m->map.size) < 0)
-			pw_log_warn("stream %p: failed to unmap: %m", impl);
-		m->ptr = NULL;
-	}
+	if (m == NULL || --m->ref > 0)
+		return;
+
+	pw_log_debug("stream %p: unmap %p", impl, m);
+	if (munmap(m->ptr, m->size) < 0)
+		pw_log_warn("stream %p: failed to unmap: %m", impl);
+	spa_list_remove(&m->link);
+	free(m);
 }
 
 static void clear_memid(struct stream *impl, struct mem_id *mid)
@@ -165,11 +276,12 @@ static void clear_memid(struct stream *impl, struct mem_id *mid)
 				break;
 			}
 		}
-		if (!has_ref) {
-			mem_unmap(impl, mid);
+		if (!has_ref)
 			close(fd);
-		}
 	}
+	mem_unmap(impl, mid->map);
+	mid->map = NULL;
+	mid->ptr = NULL;
 }
 
 static void clear_mems(struct pw_stream *stream)
@@ -191,9 +303,8 @@ static void clear_buffers(struct pw_stream *stream)
 
 	pw_array_for_each(bid, &impl->buffer_ids) {
 		spa_hook_list_call(&stream->listener_list, struct pw_stream_events, remove_buffer, bid->id);
-		if (bid->ptr != NULL)
-			if (munmap(bid->ptr, bid->map.size) < 0)
-				pw_log_warn("failed to unmap buffer: %m");
+		mem_unmap(impl, bid->map);
+		bid->map = NULL;
 		bid->ptr = NULL;
 		free(bid->buf);
 		bid->buf = NULL;
@@ -202,6 +313,7 @@ static void clear_buffers(struct pw_stream *stream)
 	impl->buffer_ids.size = 0;
 	impl->in_order = true;
 	spa_list_init(&impl->free);
+	spa_ringbuffer_init(&impl->queue.ring);
 }
 
 static bool stream_set_state(struct pw_stream *stream, enum pw_stream_state state, char *error)
@@ -272,7 +384,9 @@ struct pw_stream *pw_stream_new(struct pw_remote *remote,
 	this->remote = remote;
 	this->name = strdup(name);
 	impl->type_client_node = spa_type_map_get_id(remote->core->type.map, PW_TYPE_INTERFACE__ClientNode);
+	impl->data_loop = remote->core->data_loop;
 	impl->rtwritefd = -1;
+	impl->peer_writefd = -1;
 
 	str = pw_properties_get(props, "pipewire.client.reuse");
 	impl->client_reuse = str && pw_properties_parse_bool(str);
@@ -282,11 +396,13 @@ struct pw_stream *pw_stream_new(struct pw_remote *remote,
 	this->state = PW_STREAM_STATE_UNCONNECTED;
 
 	pw_array_init(&impl->mem_ids, 64);
+	spa_list_init(&impl->mem_maps);
 	pw_array_ensure_size(&impl->mem_ids, sizeof(struct mem_id) * 64);
 	pw_array_init(&impl->buffer_ids, 32);
 	pw_array_ensure_size(&impl->buffer_ids, sizeof(struct buffer_id) * 64);
 	impl->pending_seq = SPA_ID_INVALID;
 	spa_list_init(&impl->free);
+	spa_ringbuffer_init(&impl->queue.ring);
 
 	spa_list_append(&remote->stream_list, &this->link);
 
@@ -322,6 +438,23 @@ void pw_stream_add_listener(struct pw_stream *stream,
 	spa_hook_list_append(&stream->listener_list, listener, events, data);
 }
 
+static void clear_peer(struct stream *impl)
+{
+	if (impl->peer_source) {
+		pw_loop_destroy_source(impl->data_loop, impl->peer_source);
+		impl->peer_source = NULL;
+	}
+	if (impl->peer_writefd != -1) {
+		close(impl->peer_writefd);
+		impl->peer_writefd = -1;
+	}
+	if (impl->peer_trans) {
+		pw_client_node_transport_destroy(impl->peer_trans);
+		impl->peer_trans = NULL;
+	}
+	impl->peer_pending = false;
+}
+
 static int
 do_remove_sources(struct spa_loop *loop,
                   bool async, uint32_t seq, const void *data, size_t size, void *user_data)
@@ -330,17 +463,18 @@ do_remove_sources(struct spa_loop *loop,
 	struct pw_stream *stream = &impl->this;
 
 	if (impl->rtsocket_source) {
-		pw_loop_destroy_source(stream->remote->core->data_loop, impl->rtsocket_source);
+		pw_loop_destroy_source(impl->data_loop, impl->rtsocket_source);
 		impl->rtsocket_source = NULL;
 	}
 	if (impl->timeout_source) {
-		pw_loop_destroy_source(stream->remote->core->data_loop, impl->timeout_source);
+		pw_loop_destroy_source(stream->remote->core->main_loop, impl->timeout_source);
 		impl->timeout_source = NULL;
 	}
 	if (impl->rtwritefd != -1) {
 		close(impl->rtwritefd);
 		impl->rtwritefd = -1;
 	}
+	clear_peer(impl);
 	return 0;
 }
 
@@ -348,7 +482,7 @@ static void unhandle_socket(struct pw_stream *stream)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 
-        pw_loop_invoke(stream->remote->core->data_loop,
+        pw_loop_invoke(impl->data_loop,
                        do_remove_sources, 1, NULL, 0, true, impl);
 }
 
@@ -406,6 +540,9 @@ void pw_stream_destroy(struct pw_stream *stream)
 
 	pw_stream_disconnect(stream);
 
+	if (impl->rt_loop)
+		pw_data_loop_destroy(impl->rt_loop);
+
 	spa_list_remove(&stream->link);
 
 	set_init_params(stream, 0, NULL);
@@ -477,14 +614,30 @@ static void add_port_update(struct pw_stream *stream, uint32_t change_mask)
 					 &impl->port_info);
 }
 
+/* the transport with the input buffers, this is the transport of the peer
+ * when the input port receives the buffers directly from another client */
+static inline struct pw_client_node_transport *input_transport(struct stream *impl, int *writefd)
+{
+	if (impl->peer_trans) {
+		*writefd = impl->peer_writefd;
+		return impl->peer_trans;
+	}
+	*writefd = impl->rtwritefd;
+	return impl->trans;
+}
+
 static inline void send_need_input(struct pw_stream *stream)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct pw_client_node_transport *trans;
 	uint64_t cmd = 1;
+	int writefd;
 
-	pw_client_node_transport_add_message(impl->trans,
+	trans = input_transport(impl, &writefd);
+	pw_client_node_transport_add_message(trans,
 			       &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_NEED_INPUT));
-	write(impl->rtwritefd, &cmd, 8);
+	if (pw_client_node_transport_need_wakeup(trans))
+		write(writefd, &cmd, 8);
 }
 
 static inline void send_have_output(struct pw_stream *stream)
@@ -494,17 +647,33 @@ static inline void send_have_output(struct pw_stream *stream)
 
 	pw_client_node_transport_add_message(impl->trans,
 			       &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT));
-	write(impl->rtwritefd, &cmd, 8);
+	if (pw_client_node_transport_need_wakeup(impl->trans))
+		write(impl->rtwritefd, &cmd, 8);
 }
 
 static inline void send_reuse_buffer(struct pw_stream *stream, uint32_t id)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct pw_client_node_transport *trans;
 	uint64_t cmd = 1;
+	int writefd;
 
-	pw_client_node_transport_add_message(impl->trans, (struct pw_client_node_message*)
+	trans = input_transport(impl, &writefd);
+	pw_client_node_transport_add_message(trans, (struct pw_client_node_message*)
 			       &PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFER_INIT(impl->port_id, id));
-	write(impl->rtwritefd, &cmd, 8);
+	if (pw_client_node_transport_need_wakeup(trans))
+		write(writefd, &cmd, 8);
+}
+
+static inline void send_process_input(struct pw_stream *stream)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	uint64_t cmd = 1;
+
+	pw_client_node_transport_add_message(impl->peer_trans,
+			       &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT));
+	if (pw_client_node_transport_need_wakeup(impl->peer_trans))
+		write(impl->peer_writefd, &cmd, 8);
 }
 
 static void add_request_clock_update(struct pw_stream *stream)
@@ -566,6 +735,34 @@ static struct buffer_id *find_buffer(struct pw_stream *stream, uint32_t id)
 	return NULL;
 }
 
+static inline void push_buffer(struct stream *impl, struct buffer_id *bid)
+{
+	uint32_t index = bid - (struct buffer_id *) impl->buffer_ids.data;
+
+	if (queue_push(&impl->queue, index) < 0)
+		pw_log_warn("stream %p: queue full, dropping buffer %u", impl, bid->id);
+}
+
+static inline void call_need_buffer(struct pw_stream *stream)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+
+	impl->in_need_buffer = true;
+	if (impl->flags & PW_STREAM_FLAG_QUEUE)
+		spa_hook_list_call(&stream->listener_list, struct pw_stream_events, process);
+	else
+		spa_hook_list_call(&stream->listener_list, struct pw_stream_events, need_buffer);
+	impl->in_need_buffer = false;
+}
+
+static int
+do_call_need_buffer(struct spa_loop *loop,
+		    bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	call_need_buffer(user_data);
+	return 0;
+}
+
 static inline void reuse_buffer(struct pw_stream *stream, uint32_t id)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
@@ -574,6 +771,10 @@ static inline void reuse_buffer(struct pw_stream *stream, uint32_t id)
 	if ((bid = find_buffer(stream, id)) && bid->used) {
 		pw_log_trace("stream %p: reuse buffer %u", stream, id);
 		bid->used = false;
+		if (impl->flags & PW_STREAM_FLAG_QUEUE) {
+			push_buffer(impl, bid);
+			return;
+		}
 		spa_list_append(&impl->free, &bid->link);
 		impl->in_new_buffer = true;
 		spa_hook_list_call(&stream->listener_list, struct pw_stream_events, new_buffer, id);
@@ -581,7 +782,8 @@ static inline void reuse_buffer(struct pw_stream *stream, uint32_t id)
 	}
 }
 
-static void handle_rtnode_message(struct pw_stream *stream, struct pw_client_node_message *message)
+static void handle_rtnode_message(struct pw_stream *stream, struct pw_client_node_transport *trans,
+				  struct pw_client_node_message *message)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 
@@ -590,8 +792,12 @@ static void handle_rtnode_message(struct pw_stream *stream, struct pw_client_nod
 	{
 		int i;
 
-		for (i = 0; i < impl->trans->area->n_input_ports; i++) {
-			struct spa_io_buffers *input = &impl->trans->inputs[i];
+		/* with a peer, the buffers only come from the peer */
+		if (impl->peer_trans && trans != impl->peer_trans)
+			break;
+
+		for (i = 0; i < trans->area->n_input_ports; i++) {
+			struct spa_io_buffers *input = &trans->inputs[i];
 			struct buffer_id *bid;
 			uint32_t buffer_id;
 
@@ -608,14 +814,24 @@ static void handle_rtnode_message(struct pw_stream *stream, struct pw_client_nod
 
 			if (input->status == SPA_STATUS_HAVE_BUFFER) {
 				bid->used = true;
-				impl->in_new_buffer = true;
-				spa_hook_list_call(&stream->listener_list, struct pw_stream_events,
-					 new_buffer, buffer_id);
-				impl->in_new_buffer = false;
+				if (impl->flags & PW_STREAM_FLAG_QUEUE) {
+					push_buffer(impl, bid);
+				} else {
+					impl->in_new_buffer = true;
+					spa_hook_list_call(&stream->listener_list,
+							   struct pw_stream_events,
+							   new_buffer, buffer_id);
+					impl->in_new_buffer = false;
+				}
 			}
 
 			input->status = SPA_STATUS_NEED_BUFFER;
 		}
+		if (impl->flags & PW_STREAM_FLAG_QUEUE) {
+			impl->in_new_buffer = true;
+			spa_hook_list_call(&stream->listener_list, struct pw_stream_events, process);
+			impl->in_new_buffer = false;
+		}
 		send_need_input(stream);
 		break;
 	}
@@ -623,6 +839,10 @@ static void handle_rtnode_message(struct pw_stream *stream, struct pw_client_nod
 	{
 		int i;
 
+		/* with a peer, the peer asks for the next buffer */
+		if (impl->peer_trans)
+			break;
+
 		for (i = 0; i < impl->trans->area->n_output_ports; i++) {
 			struct spa_io_buffers *output = &impl->trans->outputs[i];
 
@@ -633,9 +853,25 @@ static void handle_rtnode_message(struct pw_stream *stream, struct pw_client_nod
 			output->buffer_id = SPA_ID_INVALID;
 		}
 		pw_log_trace("stream %p: process output", stream);
-		impl->in_need_buffer = true;
-		spa_hook_list_call(&stream->listener_list, struct pw_stream_events, need_buffer);
-		impl->in_need_buffer = false;
+		call_need_buffer(stream);
+		break;
+	}
+	case PW_CLIENT_NODE_MESSAGE_NEED_INPUT:
+	{
+		struct spa_io_buffers *input;
+
+		/* the peer input port consumed our buffer and wants the next one */
+		if (trans != impl->peer_trans || impl->direction != SPA_DIRECTION_OUTPUT)
+			break;
+
+		input = &trans->inputs[0];
+		impl->peer_pending = false;
+		if (input->buffer_id != SPA_ID_INVALID) {
+			reuse_buffer(stream, input->buffer_id);
+			input->buffer_id = SPA_ID_INVALID;
+		}
+		pw_log_trace("stream %p: peer need input", stream);
+		call_need_buffer(stream);
 		break;
 	}
 	case PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFER:
@@ -657,6 +893,22 @@ static void handle_rtnode_message(struct pw_stream *stream, struct pw_client_nod
 	}
 }
 
+static void process_messages(struct pw_stream *stream, struct pw_client_node_transport *trans, int fd)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct pw_client_node_message message;
+	uint64_t cmd;
+
+	if (read(fd, &cmd, sizeof(uint64_t)) != sizeof(uint64_t))
+		pw_log_warn("stream %p: read failed %m", impl);
+
+	while (pw_client_node_transport_next_message(trans, &message) == 1) {
+		struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
+		pw_client_node_transport_parse_message(trans, msg);
+		handle_rtnode_message(stream, trans, msg);
+	}
+}
+
 static void
 on_rtsocket_condition(void *data, int fd, enum spa_io mask)
 {
@@ -669,19 +921,24 @@ on_rtsocket_condition(void *data, int fd, enum spa_io mask)
 		return;
 	}
 
-	if (mask & SPA_IO_IN) {
-		struct pw_client_node_message message;
-		uint64_t cmd;
+	if (mask & SPA_IO_IN)
+		process_messages(stream, impl->trans, fd);
+}
 
-		if (read(fd, &cmd, sizeof(uint64_t)) != sizeof(uint64_t))
-			pw_log_warn("stream %p: read failed %m", impl);
+static void
+on_peer_condition(void *data, int fd, enum spa_io mask)
+{
+	struct pw_stream *stream = data;
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 
-		while (pw_client_node_transport_next_message(impl->trans, &message) == 1) {
-			struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
-			pw_client_node_transport_parse_message(impl->trans, msg);
-			handle_rtnode_message(stream, msg);
-		}
+	if (mask & (SPA_IO_ERR | SPA_IO_HUP)) {
+		pw_log_warn("stream %p: peer error", stream);
+		pw_loop_update_io(impl->data_loop, impl->peer_source, 0);
+		return;
 	}
+
+	if (mask & SPA_IO_IN)
+		process_messages(stream, impl->peer_trans, fd);
 }
 
 static void handle_socket(struct pw_stream *stream, int rtreadfd, int rtwritefd)
@@ -690,7 +947,7 @@ static void handle_socket(struct pw_stream *stream, int rtreadfd, int rtwritefd)
 	struct timespec interval;
 
 	impl->rtwritefd = rtwritefd;
-	impl->rtsocket_source = pw_loop_add_io(stream->remote->core->data_loop,
+	impl->rtsocket_source = pw_loop_add_io(impl->data_loop,
 					       rtreadfd,
 					       SPA_IO_ERR | SPA_IO_HUP,
 					       true, on_rtsocket_condition, stream);
@@ -728,7 +985,7 @@ static void client_node_command(void *data, uint32_t seq, const struct spa_comma
 		if (stream->state == PW_STREAM_STATE_STREAMING) {
 			pw_log_debug("stream %p: pause %d", stream, seq);
 
-			pw_loop_update_io(stream->remote->core->data_loop,
+			pw_loop_update_io(impl->data_loop,
 					  impl->rtsocket_source, SPA_IO_ERR | SPA_IO_HUP);
 
 			stream_set_state(stream, PW_STREAM_STATE_PAUSED, NULL);
@@ -741,7 +998,7 @@ static void client_node_command(void *data, uint32_t seq, const struct spa_comma
 
 			pw_log_debug("stream %p: start %d %d", stream, seq, impl->direction);
 
-			pw_loop_update_io(stream->remote->core->data_loop,
+			pw_loop_update_io(impl->data_loop,
 					  impl->rtsocket_source,
 					  SPA_IO_IN | SPA_IO_ERR | SPA_IO_HUP);
 
@@ -751,10 +1008,10 @@ static void client_node_command(void *data, uint32_t seq, const struct spa_comma
 				send_need_input(stream);
 			}
 			else {
-				impl->in_need_buffer = true;
-				spa_hook_list_call(&stream->listener_list, struct pw_stream_events,
-						    need_buffer);
-				impl->in_need_buffer = false;
+				/* the first buffer is asked for from the data thread,
+				 * like all the following ones */
+				pw_loop_invoke(impl->data_loop, do_call_need_buffer,
+					       SPA_ID_INVALID, NULL, 0, false, stream);
 			}
 			stream_set_state(stream, PW_STREAM_STATE_STREAMING, NULL);
 		}
@@ -849,7 +1106,7 @@ client_node_add_mem(void *data,
 	m->id = mem_id;
 	m->fd = memfd;
 	m->flags = flags;
-	m->map = PW_MAP_RANGE_INIT;
+	m->map = NULL;
 	m->ptr = NULL;
 }
 
@@ -886,19 +1143,20 @@ client_node_port_use_buffers(void *data,
 		bid = pw_array_add(&impl->buffer_ids, sizeof(struct buffer_id));
 		if (impl->direction == SPA_DIRECTION_OUTPUT) {
 			bid->used = false;
-			spa_list_append(&impl->free, &bid->link);
+			if (impl->flags & PW_STREAM_FLAG_QUEUE)
+				queue_push(&impl->queue, len);
+			else
+				spa_list_append(&impl->free, &bid->link);
 		} else {
 			bid->used = true;
 		}
 
 		b = buffers[i].buffer;
 
-		pw_map_range_init(&bid->map, buffers[i].offset, buffers[i].size, core->sc_pagesize);
-
-		bid->ptr = mmap(NULL, bid->map.size, prot, MAP_SHARED, mid->fd, bid->map.offset);
-		if (bid->ptr == MAP_FAILED) {
-			bid->ptr = NULL;
-			pw_log_warn("Failed to mmap memory %d %p: %s", bid->map.size, mid,
+		bid->ptr = mem_map(impl, mid->fd, prot, buffers[i].offset, buffers[i].size,
+				   &bid->map);
+		if (bid->ptr == NULL) {
+			pw_log_warn("Failed to mmap memory %d %p: %s", buffers[i].size, mid,
 				    strerror(errno));
 			continue;
 		}
@@ -935,9 +1193,9 @@ client_node_port_use_buffers(void *data,
 			impl->in_order = false;
 		}
 		pw_log_debug("add buffer %d %d %u %u", mid->id,
-				bid->id, bid->map.offset, bid->map.size);
+				bid->id, buffers[i].offset, buffers[i].size);
 
-		offset = bid->map.start;
+		offset = 0;
 		for (j = 0; j < b->n_metas; j++) {
 			struct spa_meta *m = &b->metas[j];
 			memcpy(m, &buffers[i].buffer->metas[j], sizeof(struct spa_meta));
@@ -961,14 +1219,16 @@ client_node_port_use_buffers(void *data,
 				bid->mem[bid->n_mem++] = bmid;
 				pw_log_debug(" data %d %u -> fd %d", j, bmid->id, bmid->fd);
 			} else if (d->type == t->data.MemPtr) {
-				d->data = SPA_MEMBER(bid->ptr,
-						bid->map.start + SPA_PTR_TO_INT(d->data), void);
+				d->data = SPA_MEMBER(bid->ptr, SPA_PTR_TO_INT(d->data), void);
 				d->fd = -1;
 				pw_log_debug(" data %d %u -> mem %p", j, bid->id, d->data);
 			} else {
 				pw_log_warn("unknown buffer data type %d", d->type);
 			}
 		}
+		bid->this.buffer = bid->buf;
+		bid->this.user_data = NULL;
+
 		spa_hook_list_call(&stream->listener_list, struct pw_stream_events, add_buffer, bid->id);
 	}
 
@@ -1039,7 +1299,9 @@ static void client_node_port_set_io(void *data,
 			res = -EINVAL;
 			goto exit;
 		}
-		if ((ptr = mem_map(stream, m, offset, size)) == NULL) {
+		if (m->ptr == NULL)
+			m->ptr = mem_map(impl, m->fd, PROT_READ | PROT_WRITE, offset, size, &m->map);
+		if ((ptr = m->ptr) == NULL) {
 			res = -errno;
 			goto exit;
 		}
@@ -1056,6 +1318,66 @@ static void client_node_port_set_io(void *data,
 	add_async_complete(stream, seq, res);
 }
 
+struct peer_info {
+	struct pw_client_node_transport *transport;
+	int readfd;
+	int writefd;
+};
+
+static int
+do_set_peer(struct spa_loop *loop,
+	    bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct stream *impl = user_data;
+	struct pw_stream *stream = &impl->this;
+	const struct peer_info *info = data;
+
+	clear_peer(impl);
+
+	if (info->transport == NULL)
+		return 0;
+
+	impl->peer_trans = info->transport;
+	impl->peer_writefd = info->writefd;
+	impl->peer_source = pw_loop_add_io(impl->data_loop,
+					   info->readfd,
+					   SPA_IO_IN | SPA_IO_ERR | SPA_IO_HUP,
+					   true, on_peer_condition, stream);
+
+	/* ask the peer for the first buffer, like the server would do */
+	if (impl->direction == SPA_DIRECTION_INPUT)
+		send_need_input(stream);
+	return 0;
+}
+
+static void client_node_port_set_peer(void *data,
+				      enum spa_direction direction,
+				      uint32_t port_id,
+				      int readfd,
+				      int writefd,
+				      struct pw_client_node_transport *transport)
+{
+	struct stream *impl = data;
+	struct pw_stream *stream = &impl->this;
+	struct peer_info info = { transport, readfd, writefd };
+
+	if (direction != impl->direction || port_id != impl->port_id) {
+		pw_log_warn("stream %p: peer for unknown port %d:%d", stream, direction, port_id);
+		if (transport) {
+			pw_client_node_transport_destroy(transport);
+			close(readfd);
+			close(writefd);
+		}
+		return;
+	}
+
+	pw_log_info("stream %p: %s peer transport %p with fds %d %d", stream,
+			transport ? "set" : "remove", transport, readfd, writefd);
+
+	pw_loop_invoke(impl->data_loop,
+		       do_set_peer, 1, &info, sizeof(info), true, impl);
+}
+
 static const struct pw_client_node_proxy_events client_node_events = {
 	PW_VERSION_CLIENT_NODE_PROXY_EVENTS,
 	.add_mem = client_node_add_mem,
@@ -1069,6 +1391,7 @@ static const struct pw_client_node_proxy_events client_node_events = {
 	.port_use_buffers = client_node_port_use_buffers,
 	.port_command = client_node_port_command,
 	.port_set_io = client_node_port_set_io,
+	.port_set_peer = client_node_port_set_peer,
 };
 
 static void on_node_proxy_destroy(void *data)
@@ -1088,6 +1411,98 @@ static const struct pw_proxy_events proxy_events = {
 	.destroy = on_node_proxy_destroy,
 };
 
+/* parse a cpu list like "0,2-3" */
+static int parse_affinity(const char *str, cpu_set_t *set)
+{
+	char *end;
+	long first, last;
+
+	CPU_ZERO(set);
+	while (*str) {
+		first = last = strtol(str, &end, 10);
+		if (end == str || first < 0)
+			return -EINVAL;
+		if (*end == '-') {
+			str = end + 1;
+			last = strtol(str, &end, 10);
+			if (end == str || last < first)
+				return -EINVAL;
+		}
+		for (; first <= last && first < CPU_SETSIZE; first++)
+			CPU_SET(first, set);
+
+		str = end;
+		if (*str == ',')
+			str++;
+		else if (*str != '\0')
+			return -EINVAL;
+	}
+	return CPU_COUNT(set) > 0 ? 0 : -EINVAL;
+}
+
+static int
+do_setup_rt_thread(struct spa_loop *loop,
+		   bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct stream *impl = user_data;
+	struct pw_stream *stream = &impl->this;
+	struct sched_param sp;
+	const char *str;
+	cpu_set_t set;
+	int res, priority = PW_STREAM_RT_PRIORITY_DEFAULT;
+
+	if ((str = pw_properties_get(stream->properties, PW_STREAM_PROP_RT_PRIORITY)))
+		priority = atoi(str);
+
+	if (priority > 0) {
+		spa_zero(sp);
+		sp.sched_priority = SPA_CLAMP(priority,
+					      sched_get_priority_min(SCHED_FIFO),
+					      sched_get_priority_max(SCHED_FIFO));
+		if ((res = pthread_setschedparam(pthread_self(),
+						 SCHED_FIFO | SCHED_RESET_ON_FORK, &sp)) != 0) {
+			pw_log_warn("stream %p: can't make thread realtime with priority %d: %s",
+				    stream, sp.sched_priority, strerror(res));
+		} else {
+			pw_log_debug("stream %p: thread realtime with priority %d",
+				     stream, sp.sched_priority);
+		}
+	}
+
+	if ((str = pw_properties_get(stream->properties, PW_STREAM_PROP_RT_AFFINITY))) {
+		if (parse_affinity(str, &set) < 0) {
+			pw_log_warn("stream %p: invalid affinity '%s'", stream, str);
+		} else if ((res = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0) {
+			pw_log_warn("stream %p: can't set affinity '%s': %s",
+				    stream, str, strerror(res));
+		}
+	}
+	return 0;
+}
+
+static int setup_rt_thread(struct pw_stream *stream)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	int res;
+
+	if (impl->rt_loop)
+		return 0;
+
+	if ((impl->rt_loop = pw_data_loop_new(NULL)) == NULL)
+		return -errno;
+
+	if ((res = pw_data_loop_start(impl->rt_loop)) < 0) {
+		pw_data_loop_destroy(impl->rt_loop);
+		impl->rt_loop = NULL;
+		return res;
+	}
+	impl->data_loop = pw_data_loop_get_loop(impl->rt_loop);
+
+	pw_loop_invoke(impl->data_loop, do_setup_rt_thread, 1, NULL, 0, true, impl);
+
+	return 0;
+}
+
 int
 pw_stream_connect(struct pw_stream *stream,
 		  enum pw_direction direction,
@@ -1097,12 +1512,20 @@ pw_stream_connect(struct pw_stream *stream,
 		  uint32_t n_params)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	const char *str;
 
 	impl->direction =
 	    direction == PW_DIRECTION_INPUT ? SPA_DIRECTION_INPUT : SPA_DIRECTION_OUTPUT;
 	impl->port_id = 0;
 	impl->flags = flags;
 
+	if (flags & PW_STREAM_FLAG_RT_PROCESS) {
+		int res;
+		if ((res = setup_rt_thread(stream)) < 0)
+			pw_log_warn("stream %p: can't start realtime thread: %s, using the data loop",
+				    stream, spa_strerror(res));
+	}
+
 	set_init_params(stream, n_params, params);
 
 	stream_set_state(stream, PW_STREAM_STATE_CONNECTING, NULL);
@@ -1113,6 +1536,8 @@ pw_stream_connect(struct pw_stream *stream,
 		pw_properties_set(stream->properties, PW_NODE_PROP_TARGET_NODE, port_path);
 	if (flags & PW_STREAM_FLAG_AUTOCONNECT)
 		pw_properties_set(stream->properties, PW_NODE_PROP_AUTOCONNECT, "1");
+	str = pw_properties_get(stream->properties, PW_STREAM_PROP_DIRECT);
+	impl->direct = str && pw_properties_parse_bool(str);
 
 	impl->node_proxy = pw_core_proxy_create_object(stream->remote->core_proxy,
 			       "client-node",
@@ -1203,44 +1628,87 @@ int pw_stream_get_time(struct pw_stream *stream, struct pw_time *time)
 	return 0;
 }
 
-uint32_t pw_stream_get_empty_buffer(struct pw_stream *stream)
+static int
+do_get_empty_buffer(struct spa_loop *loop,
+		    bool async, uint32_t seq, const void *data, size_t size, void *user_data)
 {
-	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct stream *impl = user_data;
+	uint32_t *id = *(uint32_t * const *) data;
 	struct buffer_id *bid;
 
-	if (spa_list_is_empty(&impl->free))
-		return SPA_ID_INVALID;
-
-	bid = spa_list_first(&impl->free, struct buffer_id, link);
+	if (spa_list_is_empty(&impl->free)) {
+		*id = SPA_ID_INVALID;
+	} else {
+		bid = spa_list_first(&impl->free, struct buffer_id, link);
+		*id = bid->id;
+	}
 
-	return bid->id;
+	return 0;
 }
 
-int pw_stream_recycle_buffer(struct pw_stream *stream, uint32_t id)
+uint32_t pw_stream_get_empty_buffer(struct pw_stream *stream)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
-	struct buffer_id *bid;
+	uint32_t id, *idp = &id;
 
-	if ((bid = find_buffer(stream, id)) == NULL || !bid->used)
-		return -EINVAL;
+	if (impl->direct)
+		pw_loop_invoke(impl->data_loop, do_get_empty_buffer,
+			       SPA_ID_INVALID, &idp, sizeof(idp), true, impl);
+	else
+		do_get_empty_buffer(NULL, false, SPA_ID_INVALID, &idp, sizeof(idp), impl);
+
+	return id;
+}
+
+static void recycle_buffer(struct pw_stream *stream, struct buffer_id *bid)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 
 	bid->used = false;
-	spa_list_append(&impl->free, &bid->link);
+	if (!(impl->flags & PW_STREAM_FLAG_QUEUE))
+		spa_list_append(&impl->free, &bid->link);
 
 	if (impl->in_new_buffer) {
-		int i;
+		struct pw_client_node_transport *trans;
+		int i, writefd;
 
-		for (i = 0; i < impl->trans->area->n_input_ports; i++) {
-			struct spa_io_buffers *input = &impl->trans->inputs[i];
-			input->buffer_id = id;
+		trans = input_transport(impl, &writefd);
+		for (i = 0; i < trans->area->n_input_ports; i++) {
+			struct spa_io_buffers *input = &trans->inputs[i];
+			input->buffer_id = bid->id;
 		}
 	} else {
-		send_reuse_buffer(stream, id);
+		send_reuse_buffer(stream, bid->id);
 	}
+}
+
+static int
+do_recycle_buffer(struct spa_loop *loop,
+		  bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct stream *impl = user_data;
+	struct buffer_id *bid;
+
+	if ((bid = find_buffer(&impl->this, *(const uint32_t *) data)) == NULL || !bid->used)
+		return -EINVAL;
+
+	recycle_buffer(&impl->this, bid);
 
 	return 0;
 }
 
+int pw_stream_recycle_buffer(struct pw_stream *stream, uint32_t id)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+
+	/* the peer transport and the free list are used in the data thread */
+	if (impl->direct)
+		return pw_loop_invoke(impl->data_loop, do_recycle_buffer,
+				      SPA_ID_INVALID, &id, sizeof(id), true, impl);
+
+	return do_recycle_buffer(NULL, false, SPA_ID_INVALID, &id, sizeof(id), impl);
+}
+
 struct spa_buffer *pw_stream_peek_buffer(struct pw_stream *stream, uint32_t id)
 {
 	struct buffer_id *bid;
@@ -1251,28 +1719,139 @@ struct spa_buffer *pw_stream_peek_buffer(struct pw_stream *stream, uint32_t id)
 	return NULL;
 }
 
-int pw_stream_send_buffer(struct pw_stream *stream, uint32_t id)
+/* check if the previous buffer was consumed */
+static bool output_pending(struct stream *impl)
+{
+	if (impl->peer_trans) {
+		if (impl->peer_pending) {
+			pw_log_debug("stream %p: peer did not consume buffer %u", impl,
+				     impl->peer_trans->inputs[0].buffer_id);
+			return true;
+		}
+	}
+	else if (impl->trans->outputs[0].buffer_id != SPA_ID_INVALID) {
+		pw_log_debug("stream %p: pending buffer %u", impl,
+			     impl->trans->outputs[0].buffer_id);
+		return true;
+	}
+	return false;
+}
+
+static void output_buffer(struct pw_stream *stream, struct buffer_id *bid)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+
+	if (impl->peer_trans) {
+		struct spa_io_buffers *input = &impl->peer_trans->inputs[0];
+
+		input->buffer_id = bid->id;
+		input->status = SPA_STATUS_HAVE_BUFFER;
+		impl->peer_pending = true;
+		pw_log_trace("stream %p: send buffer %d to peer", stream, bid->id);
+		send_process_input(stream);
+		return;
+	}
+	impl->trans->outputs[0].buffer_id = bid->id;
+	impl->trans->outputs[0].status = SPA_STATUS_HAVE_BUFFER;
+	pw_log_trace("stream %p: send buffer %d", stream, bid->id);
+	if (!impl->in_need_buffer)
+		send_have_output(stream);
+}
+
+static int
+do_send_buffer(struct spa_loop *loop,
+	       bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct stream *impl = user_data;
+	struct pw_stream *stream = &impl->this;
+	uint32_t id = *(const uint32_t *) data;
 	struct buffer_id *bid;
 
-	if (impl->trans->outputs[0].buffer_id != SPA_ID_INVALID) {
-		pw_log_debug("can't send %u, pending buffer %u", id,
-			     impl->trans->outputs[0].buffer_id);
+	if (output_pending(impl)) {
+		pw_log_debug("can't send %u", id);
 		return -EIO;
 	}
 
 	if ((bid = find_buffer(stream, id)) && !bid->used) {
 		bid->used = true;
 		spa_list_remove(&bid->link);
-		impl->trans->outputs[0].buffer_id = id;
-		impl->trans->outputs[0].status = SPA_STATUS_HAVE_BUFFER;
-		pw_log_trace("stream %p: send buffer %d", stream, id);
-		if (!impl->in_need_buffer)
-			send_have_output(stream);
+		output_buffer(stream, bid);
 	} else {
 		pw_log_debug("stream %p: output %u was used", stream, id);
 	}
 
 	return 0;
 }
+
+int pw_stream_send_buffer(struct pw_stream *stream, uint32_t id)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+
+	if (impl->direct)
+		return pw_loop_invoke(impl->data_loop, do_send_buffer,
+				      SPA_ID_INVALID, &id, sizeof(id), true, impl);
+
+	return do_send_buffer(NULL, false, SPA_ID_INVALID, &id, sizeof(id), impl);
+}
+
+struct pw_buffer *pw_stream_dequeue_buffer(struct pw_stream *stream)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct buffer_id *bid;
+	uint32_t index;
+
+	if (queue_pop(&impl->queue, &index) < 0)
+		return NULL;
+
+	bid = pw_array_get_unchecked(&impl->buffer_ids, index, struct buffer_id);
+	bid->used = true;
+
+	pw_log_trace("stream %p: dequeue buffer %d", stream, bid->id);
+
+	return &bid->this;
+}
+
+static int
+do_queue_buffer(struct spa_loop *loop,
+		bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct stream *impl = user_data;
+	struct pw_stream *stream = &impl->this;
+	struct pw_buffer *buffer = *(struct pw_buffer * const *) data;
+	struct buffer_id *bid = SPA_CONTAINER_OF(buffer, struct buffer_id, this);
+	uintptr_t offset = (uintptr_t) bid - (uintptr_t) impl->buffer_ids.data;
+
+	/* only take back the dequeued buffers of this stream */
+	if (offset >= impl->buffer_ids.size ||
+	    offset % sizeof(struct buffer_id) != 0 || !bid->used) {
+		pw_log_warn("stream %p: queue of unknown buffer %p", stream, buffer);
+		return -EINVAL;
+	}
+
+	pw_log_trace("stream %p: queue buffer %d", stream, bid->id);
+
+	if (impl->direction == SPA_DIRECTION_INPUT) {
+		recycle_buffer(stream, bid);
+		return 0;
+	}
+
+	if (output_pending(impl)) {
+		/* the buffer can be dequeued again */
+		bid->used = false;
+		push_buffer(impl, bid);
+		return -EIO;
+	}
+
+	output_buffer(stream, bid);
+
+	return 0;
+}
+
+int pw_stream_queue_buffer(struct pw_stream *stream, struct pw_buffer *buffer)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+
+	/* the transport is only written from the data thread */
+	return pw_loop_invoke(impl->data_loop, do_queue_buffer,
+			      SPA_ID_INVALID, &buffer, sizeof(buffer), true, impl);
+}
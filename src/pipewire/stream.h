@@ -147,6 +147,14 @@ extern "C" {
  * The new_buffer event is emited when PipeWire no longer uses the buffer
  * and it can be safely reused.
  *
+ * \subsection ssec_queue Dequeue and queue buffers
+ *
+ * A stream connected with \ref PW_STREAM_FLAG_QUEUE emits the process event
+ * instead of the new_buffer and need_buffer events. From the process event,
+ * \ref pw_stream_dequeue_buffer() gives the next buffer to fill or consume
+ * and \ref pw_stream_queue_buffer() sends or recycles it again, without
+ * buffer ids.
+ *
  * \section sec_stream_disconnect Disconnect
  *
  * Use \ref pw_stream_disconnect() to disconnect a stream after use.
@@ -202,6 +210,11 @@ struct pw_stream_events {
         void (*new_buffer) (void *data, uint32_t id);
         /** when a buffer is needed (for playback streams) */
         void (*need_buffer) (void *data);
+	/** when buffers can be dequeued with pw_stream_dequeue_buffer(), only
+	 *  with \ref PW_STREAM_FLAG_QUEUE. This is called from the processing
+	 *  thread, a playback stream should dequeue, fill and queue a buffer, a
+	 *  capture stream should dequeue and queue back the new buffers. */
+	void (*process) (void *data);
 };
 
 /** Convert a stream state to a readable string \memberof pw_stream */
@@ -215,8 +228,33 @@ enum pw_stream_flags {
 	PW_STREAM_FLAG_CLOCK_UPDATE	= (1 << 1),	/**< request periodic clock updates for
 							  *  this stream */
 	PW_STREAM_FLAG_INACTIVE		= (1 << 2),	/**< start the stream inactive */
+	PW_STREAM_FLAG_RT_PROCESS	= (1 << 3),	/**< process the data in a dedicated
+							  *  realtime thread of the stream */
+	PW_STREAM_FLAG_QUEUE		= (1 << 4),	/**< exchange buffers with
+							  *  pw_stream_dequeue_buffer() and
+							  *  pw_stream_queue_buffer() from the
+							  *  process event */
+};
+
+/** A buffer of a stream, see \ref pw_stream_dequeue_buffer() \memberof pw_stream */
+struct pw_buffer {
+	struct spa_buffer *buffer;	/**< the spa buffer */
+	void *user_data;		/**< user data attached to the buffer */
 };
 
+/** Realtime SCHED_FIFO priority of the thread of a stream with
+ * \ref PW_STREAM_FLAG_RT_PROCESS, 0 keeps the default scheduling */
+#define PW_STREAM_PROP_RT_PRIORITY	"pipewire.stream.rt.priority"
+#define PW_STREAM_RT_PRIORITY_DEFAULT	20
+/** CPUs the thread of a stream with \ref PW_STREAM_FLAG_RT_PROCESS can run on,
+ * a list of cpu numbers and ranges like "0,2-3" */
+#define PW_STREAM_PROP_RT_AFFINITY	"pipewire.stream.rt.affinity"
+/** Exchange buffers directly with a linked stream that also sets this,
+ * boolean default false. pw_stream_get_empty_buffer(), pw_stream_send_buffer()
+ * and pw_stream_recycle_buffer() then run in the data thread, calls from
+ * other threads wait for it. */
+#define PW_STREAM_PROP_DIRECT		"pipewire.client.direct"
+
 /** A time structure \memberof pw_stream */
 struct pw_time {
 	int64_t now;		/**< the monotonic time */
@@ -245,9 +283,9 @@ const char *pw_stream_get_name(struct pw_stream *stream);
 
 /** Indicates that the stream is live, boolean default false */
 #define PW_STREAM_PROP_IS_LIVE		"pipewire.latency.is-live"
-/** The minimum latency of the stream, int, default 0 */
+/** The minimum latency of the stream in nanoseconds, int, default 0 */
 #define PW_STREAM_PROP_LATENCY_MIN	"pipewire.latency.min"
-/** The maximum latency of the stream, int default MAXINT */
+/** The maximum latency of the stream in nanoseconds, int default MAXINT */
 #define PW_STREAM_PROP_LATENCY_MAX	"pipewire.latency.max"
 
 const struct pw_properties *pw_stream_get_properties(struct pw_stream *stream);
@@ -321,6 +359,21 @@ pw_stream_peek_buffer(struct pw_stream *stream, uint32_t id);
  * there is a new buffer available. */
 int pw_stream_send_buffer(struct pw_stream *stream, uint32_t id);
 
+/** Get a buffer from a stream with \ref PW_STREAM_FLAG_QUEUE \memberof pw_stream
+ * \return an empty buffer to fill for a playback stream, a buffer with new
+ * data for a capture stream or NULL when there is no buffer */
+struct pw_buffer *pw_stream_dequeue_buffer(struct pw_stream *stream);
+
+/** Give a dequeued buffer back to \a stream \memberof pw_stream
+ *
+ * A playback stream sends the buffer, a capture stream recycles it. The
+ * buffer is handled in the processing thread, a call from another thread
+ * waits for it.
+ * \return 0 on success, -EINVAL when \a buffer is not a dequeued buffer of
+ * \a stream, -EIO when the previous buffer was not consumed yet. The buffer
+ * then goes back to the stream and can be dequeued again. */
+int pw_stream_queue_buffer(struct pw_stream *stream, struct pw_buffer *buffer);
+
 #ifdef __cplusplus
 }
 #endif
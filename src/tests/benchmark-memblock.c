@@ -0,0 +1,128 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* allocate a number of memblocks and measure pw_memblock_find() for random
+ * pointers inside them, compared to a linear scan over the same blocks.
+ *
+ * usage: benchmark-memblock [blocks] [lookups] [block-size] */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <pipewire/pipewire.h>
+#include <pipewire/mem.h>
+
+static inline uint64_t get_time_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_TIME(&now);
+}
+
+static struct pw_memblock *linear_find(struct pw_memblock **blocks, uint32_t n_blocks,
+				       const void *ptr)
+{
+	uint32_t i;
+
+	for (i = 0; i < n_blocks; i++) {
+		struct pw_memblock *m = blocks[i];
+		if (ptr >= m->ptr && ptr < SPA_MEMBER(m->ptr, m->size, void))
+			return m;
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	struct pw_memblock **blocks;
+	const void **ptrs;
+	uint32_t *expect;
+	uint32_t i, n_blocks, n_lookups, n_linear, size, errors = 0;
+	uint64_t start, t_alloc, t_find, t_linear, t_free;
+
+	n_blocks = argc > 1 ? atoi(argv[1]) : 10000;
+	n_lookups = argc > 2 ? atoi(argv[2]) : 1000000;
+	size = argc > 3 ? atoi(argv[3]) : 256;
+	n_blocks = SPA_MAX(n_blocks, 1u);
+	n_lookups = SPA_MAX(n_lookups, 1u);
+	size = SPA_MAX(size, 1u);
+
+	pw_init(&argc, &argv);
+
+	blocks = calloc(n_blocks, sizeof(struct pw_memblock *));
+	ptrs = calloc(n_lookups, sizeof(void *));
+	expect = calloc(n_lookups, sizeof(uint32_t));
+	if (blocks == NULL || ptrs == NULL || expect == NULL)
+		return -1;
+
+	/* memory without fd so that the number of blocks is not limited
+	 * by the number of open files */
+	start = get_time_ns();
+	for (i = 0; i < n_blocks; i++) {
+		if (pw_memblock_alloc(PW_MEMBLOCK_FLAG_NONE, size, &blocks[i]) < 0) {
+			printf("can't allocate block %d\n", i);
+			return -1;
+		}
+	}
+	t_alloc = get_time_ns() - start;
+
+	srand(0);
+	for (i = 0; i < n_lookups; i++) {
+		expect[i] = rand() % n_blocks;
+		ptrs[i] = SPA_MEMBER(blocks[expect[i]]->ptr, rand() % size, void);
+	}
+
+	start = get_time_ns();
+	for (i = 0; i < n_lookups; i++) {
+		if (pw_memblock_find(ptrs[i]) != blocks[expect[i]])
+			errors++;
+	}
+	t_find = get_time_ns() - start;
+
+	/* the linear scan is slow, limit the lookups */
+	n_linear = SPA_MIN(n_lookups, 10000u);
+	start = get_time_ns();
+	for (i = 0; i < n_linear; i++) {
+		if (linear_find(blocks, n_blocks, ptrs[i]) != blocks[expect[i]])
+			errors++;
+	}
+	t_linear = get_time_ns() - start;
+
+	start = get_time_ns();
+	for (i = 0; i < n_blocks; i++)
+		pw_memblock_free(blocks[i]);
+	t_free = get_time_ns() - start;
+
+	if (pw_memblock_find(ptrs[0]) != NULL)
+		errors++;
+
+	printf("blocks %d, block size %d\n", n_blocks, size);
+	printf("alloc:  %10.1f ns/block\n", (double) t_alloc / n_blocks);
+	printf("find:   %10.1f ns/lookup\n", (double) t_find / n_lookups);
+	printf("linear: %10.1f ns/lookup\n", (double) t_linear / n_linear);
+	printf("free:   %10.1f ns/block\n", (double) t_free / n_blocks);
+	printf("errors: %d\n", errors);
+
+	free(blocks);
+	free(ptrs);
+	free(expect);
+
+	return errors > 0 ? -1 : 0;
+}
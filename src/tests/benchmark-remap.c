@@ -0,0 +1,264 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* demarshal a node param message, like the native protocol does, and measure
+ * the throughput without remapping, with the identity fast path, with the
+ * translation array and with the pw_map lookups that were used before.
+ *
+ * usage: benchmark-remap [messages] */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <spa/pod/builder.h>
+#include <spa/pod/parser.h>
+
+#include <pipewire/map.h>
+
+#include "modules/module-protocol-native/remap.h"
+
+#define N_TYPES		256
+
+enum mode {
+	MODE_NONE,
+	MODE_IDENTITY,
+	MODE_ARRAY,
+	MODE_MAP,
+};
+
+static const char *mode_names[] = {
+	"none",
+	"identity",
+	"array",
+	"map",
+};
+
+static inline uint64_t get_time_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_TIME(&now);
+}
+
+/* the remapping with a pw_map, as done before the translation array */
+static bool map_remap_data(uint32_t type, void *body, uint32_t size, struct pw_map *types)
+{
+	void *t;
+
+	switch (type) {
+	case SPA_POD_TYPE_ID:
+		if ((t = pw_map_lookup(types, *(int32_t *) body)) == NULL)
+			return false;
+		*(int32_t *) body = PW_MAP_PTR_TO_ID(t);
+		break;
+
+	case SPA_POD_TYPE_PROP:
+	{
+		struct spa_pod_prop_body *b = body;
+
+		if ((t = pw_map_lookup(types, b->key)) == NULL)
+			return false;
+		b->key = PW_MAP_PTR_TO_ID(t);
+
+		if (b->value.type == SPA_POD_TYPE_ID) {
+			void *alt;
+			if (!map_remap_data
+			    (b->value.type, SPA_POD_BODY(&b->value), b->value.size, types))
+				return false;
+
+			SPA_POD_PROP_ALTERNATIVE_FOREACH(b, size, alt)
+				if (!map_remap_data(b->value.type, alt, b->value.size, types))
+					return false;
+		}
+		break;
+	}
+	case SPA_POD_TYPE_OBJECT:
+	{
+		struct spa_pod_object_body *b = body;
+		struct spa_pod *p;
+
+		if ((t = pw_map_lookup(types, b->id)) != NULL)
+			b->id = PW_MAP_PTR_TO_ID(t);
+		else
+			b->id = SPA_ID_INVALID;
+
+		if ((t = pw_map_lookup(types, b->type)) == NULL)
+			return false;
+		b->type = PW_MAP_PTR_TO_ID(t);
+
+		SPA_POD_OBJECT_BODY_FOREACH(b, size, p)
+			if (!map_remap_data(p->type, SPA_POD_BODY(p), p->size, types))
+				return false;
+		break;
+	}
+	case SPA_POD_TYPE_STRUCT:
+	{
+		struct spa_pod *b = body, *p;
+
+		SPA_POD_FOREACH(b, size, p)
+			if (!map_remap_data(p->type, SPA_POD_BODY(p), p->size, types))
+				return false;
+		break;
+	}
+	default:
+		break;
+	}
+	return true;
+}
+
+/* make a node param message with an enum format, the ids are translated
+ * with ids[] */
+static uint32_t make_message(uint8_t *buffer, size_t size, const uint32_t *ids)
+{
+	struct spa_pod_builder b = { 0 };
+	struct spa_pod *msg;
+
+	spa_pod_builder_init(&b, buffer, size);
+	spa_pod_builder_push_struct(&b);
+	spa_pod_builder_id(&b, ids[1]);
+	spa_pod_builder_int(&b, 0);
+	spa_pod_builder_int(&b, 1);
+	spa_pod_builder_object(&b,
+		ids[2], ids[3],
+		"I", ids[4],
+		"I", ids[5],
+		":", ids[6], "I", ids[10],
+		":", ids[7], "ieu", 0,
+						2, 0, 1,
+		":", ids[8], "iru", 44100,
+						2, 1, INT32_MAX,
+		":", ids[9], "iru", 2,
+						2, 1, INT32_MAX,
+		":", ids[13], "Ieu", ids[10],
+						3, ids[10], ids[11], ids[12]);
+	msg = spa_pod_builder_pop(&b);
+
+	return SPA_POD_SIZE(msg);
+}
+
+static int demarshal(void *data, uint32_t size, uint32_t key, uint32_t *id, uint32_t *format)
+{
+	struct spa_pod_parser prs;
+	uint32_t index, next, media_type, media_subtype;
+	struct spa_pod *param;
+
+	spa_pod_parser_init(&prs, data, size, 0);
+	if (spa_pod_parser_get(&prs,
+				"[ I", id,
+				"i", &index,
+				"i", &next,
+				"P", &param, NULL) < 0)
+		return -EINVAL;
+
+	spa_pod_parser_pod(&prs, param);
+	if (spa_pod_parser_get(&prs,
+			"<",
+			"I", &media_type,
+			"I", &media_subtype,
+			":", key, "I", format, ">", NULL) < 0)
+		return -EINVAL;
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	uint8_t template[4096], message[4096];
+	uint32_t i, j, n_messages, size, errors = 0;
+	uint32_t our_ids[N_TYPES], peer_ids[N_TYPES], *ids;
+	struct pw_type_remap identity, remap;
+	struct pw_map map;
+	enum mode mode;
+
+	n_messages = argc > 1 ? atoi(argv[1]) : 1000000;
+	n_messages = SPA_MAX(n_messages, 1u);
+
+	/* the peer uses the same ids for the identity mode and a shuffled
+	 * set of ids for the others */
+	srand(0);
+	for (i = 0; i < N_TYPES; i++)
+		our_ids[i] = peer_ids[i] = i;
+	for (i = N_TYPES - 1; i > 1; i--) {
+		uint32_t t;
+		j = 1 + rand() % i;
+		t = peer_ids[i];
+		peer_ids[i] = peer_ids[j];
+		peer_ids[j] = t;
+	}
+
+	pw_type_remap_init(&identity);
+	pw_type_remap_init(&remap);
+	pw_map_init(&map, N_TYPES, 32);
+	/* the peer ids are added in order, like the peer announces them */
+	for (i = 0; i < N_TYPES; i++) {
+		for (j = 0; peer_ids[j] != i; j++);
+		pw_type_remap_set(&identity, i, i);
+		pw_type_remap_set(&remap, i, our_ids[j]);
+		pw_map_insert_at(&map, i, PW_MAP_ID_TO_PTR(our_ids[j]));
+	}
+
+	printf("messages %d\n", n_messages);
+
+	for (mode = MODE_NONE; mode <= MODE_MAP; mode++) {
+		uint64_t start, elapsed;
+		uint32_t id, format;
+
+		ids = (mode == MODE_NONE || mode == MODE_IDENTITY) ? our_ids : peer_ids;
+		size = make_message(template, sizeof(template), ids);
+
+		start = get_time_ns();
+		for (i = 0; i < n_messages; i++) {
+			bool res = true;
+
+			/* the connection hands out a fresh copy of every message */
+			memcpy(message, template, size);
+
+			switch (mode) {
+			case MODE_NONE:
+				break;
+			case MODE_IDENTITY:
+				res = pod_remap_message(message, size, &identity);
+				break;
+			case MODE_ARRAY:
+				res = pod_remap_message(message, size, &remap);
+				break;
+			case MODE_MAP:
+				res = map_remap_data(SPA_POD_TYPE_STRUCT, message, size, &map);
+				break;
+			}
+			if (!res || demarshal(message, size, our_ids[6], &id, &format) < 0 ||
+			    id != our_ids[1] || format != our_ids[10])
+				errors++;
+		}
+		elapsed = get_time_ns() - start;
+
+		printf("%-9s %8.1f ns/message, %6.2f Mmessages/s\n", mode_names[mode],
+				(double) elapsed / n_messages,
+				n_messages * 1000.0 / elapsed);
+	}
+	printf("errors: %d\n", errors);
+
+	pw_map_clear(&map);
+	pw_type_remap_clear(&remap);
+	pw_type_remap_clear(&identity);
+
+	return errors > 0 ? -1 : 0;
+}
@@ -0,0 +1,245 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* measure the round trip latency over a client-node transport. The main
+ * thread plays the daemon side proxy and sends process_input, the client
+ * thread plays a pw_stream and answers with reuse_buffer and need_input,
+ * like a stream does for every buffer. This is done once with a wakeup for
+ * every message and once with the wakeups that the peer does not need
+ * suppressed. With a depth > 1, the daemon side keeps more process_input
+ * messages in flight and the peer is often still running when a message
+ * is added.
+ *
+ * usage: benchmark-transport [round-trips] [depth] */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include <pipewire/pipewire.h>
+#include <extensions/client-node.h>
+
+#include "modules/module-client-node/transport.h"
+
+#define STOP_ID		SPA_ID_INVALID
+#define MAX_DEPTH	64
+
+enum mode {
+	MODE_ALWAYS,
+	MODE_SUPPRESS,
+};
+
+static const char *mode_names[] = {
+	"always",
+	"suppress",
+};
+
+struct side {
+	struct pw_client_node_transport *trans;
+	int readfd;
+	int writefd;
+	enum mode mode;
+	uint64_t wakeups;
+	uint64_t suppressed;
+
+	uint32_t completed;
+	uint64_t start[MAX_DEPTH];
+	uint64_t *latency;
+	uint64_t total;
+};
+
+static inline uint64_t get_time_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_TIME(&now);
+}
+
+static void send_message(struct side *s, struct pw_client_node_message *message)
+{
+	uint64_t cmd = 1;
+
+	if (pw_client_node_transport_add_message(s->trans, message) < 0) {
+		fprintf(stderr, "transport full\n");
+		exit(-1);
+	}
+	if (s->mode == MODE_SUPPRESS && !pw_client_node_transport_need_wakeup(s->trans)) {
+		s->suppressed++;
+		return;
+	}
+	if (write(s->writefd, &cmd, 8) != 8)
+		perror("write");
+	s->wakeups++;
+}
+
+/* wait for a wakeup and handle all messages, returns false when the stop
+ * message was received */
+static bool wait_messages(struct side *s, bool (*handle) (struct side *s, uint32_t type,
+							  void *message))
+{
+	struct pw_client_node_message message;
+	uint64_t cmd;
+	bool res = true;
+
+	if (read(s->readfd, &cmd, 8) != 8)
+		perror("read");
+
+	while (pw_client_node_transport_next_message(s->trans, &message) == 1) {
+		struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
+		pw_client_node_transport_parse_message(s->trans, msg);
+		if (!handle(s, PW_CLIENT_NODE_MESSAGE_TYPE(msg), msg))
+			res = false;
+	}
+	return res;
+}
+
+static bool handle_client(struct side *s, uint32_t type, void *message)
+{
+	switch (type) {
+	case PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT:
+		send_message(s, (struct pw_client_node_message *)
+			&PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFER_INIT(0, 0));
+		send_message(s,
+			&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_NEED_INPUT));
+		break;
+	case PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFER:
+	{
+		struct pw_client_node_message_port_reuse_buffer *m = message;
+		if (m->body.buffer_id.value == STOP_ID)
+			return false;
+		break;
+	}
+	default:
+		break;
+	}
+	return true;
+}
+
+static bool handle_daemon(struct side *s, uint32_t type, void *message)
+{
+	if (type == PW_CLIENT_NODE_MESSAGE_NEED_INPUT) {
+		uint64_t now = get_time_ns();
+		s->latency[s->completed] = now - s->start[s->completed % MAX_DEPTH];
+		s->total += s->latency[s->completed];
+		s->completed++;
+	}
+	return true;
+}
+
+static void *client_thread(void *data)
+{
+	struct side *s = data;
+
+	while (wait_messages(s, handle_client));
+
+	return NULL;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+	return x < y ? -1 : x > y;
+}
+
+static int run(enum mode mode, uint32_t n_round_trips, uint32_t depth)
+{
+	struct side daemon = { 0 }, client = { 0 };
+	struct pw_client_node_transport_info info;
+	int to_client, to_daemon;
+	pthread_t thread;
+	uint32_t sent = 0;
+
+	to_client = eventfd(0, EFD_CLOEXEC);
+	to_daemon = eventfd(0, EFD_CLOEXEC);
+	daemon.latency = calloc(n_round_trips, sizeof(uint64_t));
+
+	daemon.trans = pw_client_node_transport_new(1, 1, 0);
+	pw_client_node_transport_get_info(daemon.trans, &info);
+	/* the client side owns its own copy of the fd, like after sending it */
+	info.memfd = dup(info.memfd);
+	client.trans = pw_client_node_transport_new_from_info(&info);
+	if (daemon.trans == NULL || client.trans == NULL || daemon.latency == NULL)
+		return -1;
+
+	daemon.readfd = to_daemon;
+	daemon.writefd = to_client;
+	daemon.mode = mode;
+	client.readfd = to_client;
+	client.writefd = to_daemon;
+	client.mode = mode;
+
+	pthread_create(&thread, NULL, client_thread, &client);
+
+	while (daemon.completed < n_round_trips) {
+		while (sent < n_round_trips && sent - daemon.completed < depth) {
+			daemon.start[sent % MAX_DEPTH] = get_time_ns();
+			send_message(&daemon,
+				&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT));
+			sent++;
+		}
+		wait_messages(&daemon, handle_daemon);
+	}
+
+	send_message(&daemon, (struct pw_client_node_message *)
+		&PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFER_INIT(0, STOP_ID));
+	pthread_join(thread, NULL);
+
+	qsort(daemon.latency, n_round_trips, sizeof(uint64_t), compare_u64);
+
+	printf("%-9s avg %8.0f ns, median %8" PRIu64 " ns, 99%% %8" PRIu64 " ns, "
+	       "wakeups/round trip %4.2f, suppressed %" PRIu64 "\n",
+			mode_names[mode],
+			(double) daemon.total / n_round_trips,
+			daemon.latency[n_round_trips / 2],
+			daemon.latency[(uint64_t) n_round_trips * 99 / 100],
+			(double) (daemon.wakeups + client.wakeups) / n_round_trips,
+			daemon.suppressed + client.suppressed);
+
+	pw_client_node_transport_destroy(client.trans);
+	pw_client_node_transport_destroy(daemon.trans);
+	close(to_client);
+	close(to_daemon);
+	free(daemon.latency);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t n_round_trips, depth;
+
+	pw_init(&argc, &argv);
+
+	n_round_trips = argc > 1 ? atoi(argv[1]) : 100000;
+	depth = argc > 2 ? atoi(argv[2]) : 1;
+	n_round_trips = SPA_MAX(n_round_trips, 1u);
+	depth = SPA_CLAMP(depth, 1u, MAX_DEPTH);
+
+	printf("round trips %d, depth %d\n", n_round_trips, depth);
+
+	if (run(MODE_ALWAYS, n_round_trips, depth) < 0 ||
+	    run(MODE_SUPPRESS, n_round_trips, depth) < 0)
+		return -1;
+
+	return 0;
+}
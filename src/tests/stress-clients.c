@@ -0,0 +1,305 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* connect a number of well behaved clients that do sync round trips to a
+ * running daemon together with a number of fake clients that flood the
+ * daemon with sync requests and never read the replies. The well behaved
+ * clients should keep making progress and the daemon should pause or
+ * disconnect the flooders instead of queueing their replies without limit.
+ *
+ * usage: stress-clients [clients] [flooders] [seconds] */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+
+#include <spa/pod/builder.h>
+
+#include <pipewire/pipewire.h>
+#include <pipewire/interfaces.h>
+
+#define MAX_CLIENTS	256
+#define MAX_LATENCY	(500 * SPA_NSEC_PER_MSEC)
+#define FLOOD_INTERVAL	(10 * SPA_NSEC_PER_MSEC)
+
+struct client {
+	struct data *data;
+	struct pw_remote *remote;
+	struct spa_hook remote_listener;
+	struct pw_core_proxy *core_proxy;
+	struct spa_hook core_listener;
+
+	uint32_t seq;
+	uint64_t sent;
+	uint64_t round_trips;
+	uint64_t max_latency;
+	bool failed;
+};
+
+struct flooder {
+	int fd;
+	uint32_t seq;
+	uint64_t bytes;
+	bool blocked;
+	bool disconnected;
+};
+
+struct data {
+	struct pw_main_loop *loop;
+	struct pw_core *core;
+	struct spa_source *timer;
+	struct spa_source *flood_timer;
+
+	uint32_t n_clients;
+	struct client clients[MAX_CLIENTS];
+	uint32_t n_flooders;
+	struct flooder flooders[MAX_CLIENTS];
+};
+
+static inline uint64_t get_time_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_TIME(&now);
+}
+
+static void send_sync(struct client *c)
+{
+	c->sent = get_time_ns();
+	pw_core_proxy_sync(c->core_proxy, ++c->seq);
+}
+
+static void on_core_done(void *data, uint32_t seq)
+{
+	struct client *c = data;
+	uint64_t latency;
+
+	if (seq != c->seq)
+		return;
+
+	latency = get_time_ns() - c->sent;
+	c->max_latency = SPA_MAX(c->max_latency, latency);
+	c->round_trips++;
+	send_sync(c);
+}
+
+static const struct pw_core_proxy_events core_events = {
+	PW_VERSION_CORE_PROXY_EVENTS,
+	.done = on_core_done,
+};
+
+static void on_state_changed(void *data, enum pw_remote_state old,
+			     enum pw_remote_state state, const char *error)
+{
+	struct client *c = data;
+
+	switch (state) {
+	case PW_REMOTE_STATE_ERROR:
+	case PW_REMOTE_STATE_UNCONNECTED:
+		printf("client %p: disconnected: %s\n", c, error ? error : "");
+		c->failed = true;
+		break;
+	case PW_REMOTE_STATE_CONNECTED:
+		c->core_proxy = pw_remote_get_core_proxy(c->remote);
+		pw_core_proxy_add_listener(c->core_proxy, &c->core_listener, &core_events, c);
+		send_sync(c);
+		break;
+	default:
+		break;
+	}
+}
+
+static const struct pw_remote_events remote_events = {
+	PW_VERSION_REMOTE_EVENTS,
+	.state_changed = on_state_changed,
+};
+
+static int connect_socket(void)
+{
+	struct sockaddr_un addr;
+	const char *runtime_dir, *name;
+	socklen_t size;
+	int fd;
+
+	if ((runtime_dir = getenv("XDG_RUNTIME_DIR")) == NULL)
+		return -ENOENT;
+	if ((name = getenv("PIPEWIRE_REMOTE")) == NULL)
+		name = "pipewire-0";
+
+	if ((fd = socket(PF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0)
+		return -errno;
+
+	spa_zero(addr);
+	addr.sun_family = AF_LOCAL;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s", runtime_dir, name);
+	size = offsetof(struct sockaddr_un, sun_path) + strlen(addr.sun_path);
+
+	if (connect(fd, (struct sockaddr *) &addr, size) < 0) {
+		int res = -errno;
+		close(fd);
+		return res;
+	}
+	return fd;
+}
+
+/* write a sync message for the core in the native protocol format */
+static int write_sync(struct flooder *f)
+{
+	uint8_t buffer[64];
+	struct spa_pod_builder b = { 0 };
+	uint32_t *p = (uint32_t *) buffer, size;
+	ssize_t len;
+
+	spa_pod_builder_init(&b, buffer + 8, sizeof(buffer) - 8);
+	spa_pod_builder_struct(&b, "i", ++f->seq);
+	size = b.state.offset;
+
+	p[0] = 0;
+	p[1] = (PW_CORE_PROXY_METHOD_SYNC << 24) | size;
+
+	len = send(f->fd, buffer, size + 8, MSG_NOSIGNAL | MSG_DONTWAIT);
+	if (len < 0)
+		return -errno;
+
+	f->bytes += len;
+	return len;
+}
+
+/* send as many requests as the daemon accepts without reading anything */
+static void on_flood(void *data, uint64_t expirations)
+{
+	struct data *d = data;
+	uint32_t i;
+	int res;
+
+	for (i = 0; i < d->n_flooders; i++) {
+		struct flooder *f = &d->flooders[i];
+
+		if (f->disconnected)
+			continue;
+
+		while ((res = write_sync(f)) > 0);
+
+		if (res == -EAGAIN || res == -EWOULDBLOCK)
+			f->blocked = true;
+		else {
+			f->disconnected = true;
+			close(f->fd);
+		}
+	}
+}
+
+static void on_timeout(void *data, uint64_t expirations)
+{
+	struct data *d = data;
+	pw_main_loop_quit(d->loop);
+}
+
+int main(int argc, char *argv[])
+{
+	struct data data = { 0 };
+	struct pw_loop *l;
+	struct timespec value, interval;
+	uint32_t i, seconds, errors = 0;
+
+	pw_init(&argc, &argv);
+
+	data.n_clients = argc > 1 ? atoi(argv[1]) : 16;
+	data.n_flooders = argc > 2 ? atoi(argv[2]) : 4;
+	seconds = argc > 3 ? atoi(argv[3]) : 5;
+	data.n_clients = SPA_CLAMP(data.n_clients, 1u, MAX_CLIENTS);
+	data.n_flooders = SPA_MIN(data.n_flooders, MAX_CLIENTS);
+	seconds = SPA_MAX(seconds, 1u);
+
+	data.loop = pw_main_loop_new(NULL);
+	l = pw_main_loop_get_loop(data.loop);
+	data.core = pw_core_new(l, NULL);
+
+	for (i = 0; i < data.n_clients; i++) {
+		struct client *c = &data.clients[i];
+
+		c->data = &data;
+		c->remote = pw_remote_new(data.core, NULL, 0);
+		pw_remote_add_listener(c->remote, &c->remote_listener, &remote_events, c);
+		if (pw_remote_connect(c->remote) < 0) {
+			printf("can't connect client %d\n", i);
+			return -1;
+		}
+	}
+	for (i = 0; i < data.n_flooders; i++) {
+		struct flooder *f = &data.flooders[i];
+
+		if ((f->fd = connect_socket()) < 0) {
+			printf("can't connect flooder %d: %s\n", i, strerror(-f->fd));
+			return -1;
+		}
+	}
+
+	data.flood_timer = pw_loop_add_timer(l, on_flood, &data);
+	value.tv_sec = 0;
+	value.tv_nsec = FLOOD_INTERVAL;
+	interval = value;
+	pw_loop_update_timer(l, data.flood_timer, &value, &interval, false);
+
+	data.timer = pw_loop_add_timer(l, on_timeout, &data);
+	value.tv_sec = seconds;
+	value.tv_nsec = 0;
+	pw_loop_update_timer(l, data.timer, &value, NULL, false);
+
+	pw_main_loop_run(data.loop);
+
+	printf("clients %d, flooders %d, seconds %d\n", data.n_clients, data.n_flooders, seconds);
+	for (i = 0; i < data.n_clients; i++) {
+		struct client *c = &data.clients[i];
+		bool ok = !c->failed && c->round_trips > 0 && c->max_latency < MAX_LATENCY;
+
+		printf("client %3d: %8.1f round trips/s, max latency %8.3f ms %s\n", i,
+				(double) c->round_trips / seconds,
+				c->max_latency / (double) SPA_NSEC_PER_MSEC,
+				ok ? "ok" : "FAIL");
+		if (!ok)
+			errors++;
+	}
+	for (i = 0; i < data.n_flooders; i++) {
+		struct flooder *f = &data.flooders[i];
+
+		printf("flooder %2d: %10" PRIu64 " bytes sent, %s\n", i, f->bytes,
+				f->disconnected ? "disconnected" :
+				f->blocked ? "blocked" : "not blocked");
+		if (!f->disconnected)
+			close(f->fd);
+	}
+	printf("errors: %d\n", errors);
+
+	for (i = 0; i < data.n_clients; i++)
+		pw_remote_destroy(data.clients[i].remote);
+	pw_loop_destroy_source(l, data.flood_timer);
+	pw_loop_destroy_source(l, data.timer);
+	pw_core_destroy(data.core);
+	pw_main_loop_destroy(data.loop);
+
+	return errors > 0 ? -1 : 0;
+}
@@ -0,0 +1,80 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+/* link a playback stream to a capture stream, with the streams exchanging
+ * buffers directly or through the daemon. The playback stream sends the
+ * buffers from a timer in the main thread, the capture stream recycles
+ * them in the data thread. See test-stream.h.
+ *
+ * usage: test-stream-direct [seconds] [direct] */
+
+#include "test-stream.h"
+
+static void send_buffer(struct data *d)
+{
+	uint32_t id;
+
+	if ((id = pw_stream_get_empty_buffer(d->source)) == SPA_ID_INVALID) {
+		d->busy++;
+		return;
+	}
+	if (stamp_buffer(d, pw_stream_peek_buffer(d->source, id)) < 0)
+		return;
+
+	/* the peer did not take the previous buffer yet */
+	if (pw_stream_send_buffer(d->source, id) < 0) {
+		d->busy++;
+		return;
+	}
+	buffer_sent(d);
+}
+
+static void sink_new_buffer(struct data *d, uint32_t id)
+{
+	check_buffer(d, pw_stream_peek_buffer(d->sink, id));
+	pw_stream_recycle_buffer(d->sink, id);
+}
+
+int main(int argc, char *argv[])
+{
+	struct data data = { 0 };
+	uint32_t seconds;
+	bool direct;
+
+	pw_init(&argc, &argv);
+
+	seconds = argc > 1 ? atoi(argv[1]) : 3;
+	seconds = SPA_MAX(seconds, 1u);
+	direct = argc > 2 ? atoi(argv[2]) : 1;
+
+	data.props = pw_properties_new(PW_STREAM_PROP_DIRECT, direct ? "1" : "0", NULL);
+	data.send = send_buffer;
+	data.sink_new_buffer = sink_new_buffer;
+
+	data.name = direct ? "direct" : "daemon";
+	run_test(&data, seconds);
+
+	/* the last buffer can still be in flight */
+	if (data.sent - data.received > 1) {
+		printf("lost %u buffers\n", data.sent - data.received);
+		data.errors++;
+	}
+	return data.errors > 0 ? -1 : 0;
+}
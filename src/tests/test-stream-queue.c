@@ -0,0 +1,135 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+/* link a playback stream to a capture stream, both with
+ * PW_STREAM_FLAG_QUEUE. The playback stream dequeues and queues buffers
+ * from a timer in the main thread, two at a time so that the second one
+ * usually finds the first one still pending. A buffer that could not be
+ * sent must come back from pw_stream_dequeue_buffer() and buffers that were
+ * not dequeued from the stream must be refused. The capture stream dequeues
+ * and queues the buffers from the process event. See test-stream.h.
+ *
+ * usage: test-stream-queue [seconds] */
+
+#include "test-stream.h"
+
+struct queue_data {
+	struct data data;
+	struct pw_buffer *retry;	/**< buffer that got -EIO */
+	uint32_t retried;
+	uint32_t dequeued_again;
+};
+
+static int queue_buffer(struct queue_data *qd)
+{
+	struct data *d = &qd->data;
+	struct pw_buffer *b, fake = { 0 };
+	int res;
+
+	if ((b = pw_stream_dequeue_buffer(d->source)) == NULL) {
+		/* all buffers are with the capture stream */
+		d->busy++;
+		return -EPIPE;
+	}
+	if (b == qd->retry) {
+		qd->dequeued_again++;
+		qd->retry = NULL;
+	}
+
+	/* a buffer that was not dequeued from the stream is refused */
+	if (pw_stream_queue_buffer(d->source, &fake) != -EINVAL) {
+		printf("foreign buffer was accepted\n");
+		d->errors++;
+	}
+
+	if ((res = stamp_buffer(d, b->buffer)) < 0)
+		return res;
+
+	if ((res = pw_stream_queue_buffer(d->source, b)) == -EIO) {
+		/* the buffer went back to the stream and can't be queued twice */
+		qd->retried++;
+		qd->retry = b;
+		if (pw_stream_queue_buffer(d->source, b) != -EINVAL) {
+			printf("buffer was queued twice\n");
+			d->errors++;
+		}
+		return res;
+	}
+	if (res < 0) {
+		printf("queue failed: %s\n", spa_strerror(res));
+		d->errors++;
+		return res;
+	}
+	buffer_sent(d);
+	return 0;
+}
+
+static void send_buffers(struct data *d)
+{
+	struct queue_data *qd = SPA_CONTAINER_OF(d, struct queue_data, data);
+
+	if (queue_buffer(qd) == 0)
+		queue_buffer(qd);
+}
+
+static void sink_process(struct data *d)
+{
+	struct pw_buffer *b;
+
+	while ((b = pw_stream_dequeue_buffer(d->sink)) != NULL) {
+		check_buffer(d, b->buffer);
+		if (pw_stream_queue_buffer(d->sink, b) < 0) {
+			printf("capture queue failed\n");
+			d->errors++;
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct queue_data qd;
+	struct data *d = &qd.data;
+	uint32_t seconds;
+
+	spa_zero(qd);
+	pw_init(&argc, &argv);
+
+	seconds = argc > 1 ? atoi(argv[1]) : 3;
+	seconds = SPA_MAX(seconds, 1u);
+
+	d->name = "queue";
+	d->flags = PW_STREAM_FLAG_QUEUE;
+	d->send = send_buffers;
+	d->sink_process = sink_process;
+
+	run_test(d, seconds);
+
+	printf("retried %u, dequeued again %u\n", qd.retried, qd.dequeued_again);
+	if (qd.retried == 0 || (qd.retried > 1 && qd.dequeued_again == 0)) {
+		printf("the -EIO path was not taken or lost its buffer\n");
+		d->errors++;
+	}
+	/* the last buffer can still be in flight */
+	if (d->sent - d->received > 1) {
+		printf("lost %u buffers\n", d->sent - d->received);
+		d->errors++;
+	}
+	return d->errors > 0 ? -1 : 0;
+}
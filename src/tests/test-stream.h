@@ -0,0 +1,438 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* shared by the stream tests: link a playback stream to a capture stream,
+ * let the test send buffers with a sequence number and a timestamp from a
+ * timer in the main thread and check in the capture stream that no buffer
+ * is lost or repeated. The time between sending and receiving a buffer is
+ * reported as the latency.
+ *
+ * The streams connect to the daemon in PIPEWIRE_REMOTE when it is set.
+ * Otherwise a server core with the native protocol, client-node and
+ * autolink modules is run in a thread of the test, so that no daemon is
+ * needed. The modules are loaded from PIPEWIRE_MODULE_DIR. */
+
+#ifndef __PIPEWIRE_TEST_STREAM_H__
+#define __PIPEWIRE_TEST_STREAM_H__
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include <spa/param/video/format-utils.h>
+#include <spa/param/format-utils.h>
+
+#include <pipewire/pipewire.h>
+#include <pipewire/module.h>
+#include <pipewire/stream.h>
+#include <pipewire/thread-loop.h>
+
+#define WIDTH		64
+#define HEIGHT		48
+#define BPP		3
+#define INTERVAL	(2 * SPA_NSEC_PER_MSEC)
+
+struct type {
+	struct spa_type_media_type media_type;
+	struct spa_type_media_subtype media_subtype;
+	struct spa_type_format_video format_video;
+	struct spa_type_video_format video_format;
+};
+
+struct data {
+	struct type type;
+	struct pw_type *t;
+
+	struct pw_main_loop *loop;
+	struct pw_core *core;
+	struct pw_remote *remote;
+	struct spa_hook remote_listener;
+	struct spa_source *timer;
+	struct spa_source *timeout;
+
+	struct pw_loop *server_loop;
+	struct pw_thread_loop *server_thread;
+	struct pw_core *server;
+
+	/* filled in by the test */
+	const char *name;			/**< printed with the results */
+	struct pw_properties *props;		/**< extra properties of the streams */
+	enum pw_stream_flags flags;		/**< extra flags of the streams */
+	void (*send) (struct data *d);		/**< called from the timer */
+	void (*sink_new_buffer) (struct data *d, uint32_t id);
+	void (*sink_process) (struct data *d);
+
+	struct pw_stream *sink;
+	struct spa_hook sink_listener;
+	struct pw_stream *source;
+	struct spa_hook source_listener;
+
+	uint32_t seq;
+	uint32_t sent;
+	uint32_t busy;
+
+	uint32_t next_seq;
+	uint32_t received;
+	uint64_t latency_sum;
+	uint64_t latency_max;
+	uint32_t errors;
+};
+
+static inline uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * SPA_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* give the buffer the next sequence number and the current time */
+static inline int stamp_buffer(struct data *d, struct spa_buffer *buf)
+{
+	struct spa_meta_header *h;
+
+	if ((h = spa_buffer_find_meta(buf, d->t->meta.Header)) == NULL) {
+		printf("buffer without header\n");
+		d->errors++;
+		return -EINVAL;
+	}
+	h->seq = d->seq;
+	h->pts = get_time_ns();
+	return 0;
+}
+
+/* the buffer was sent, the next one gets the next sequence number */
+static inline void buffer_sent(struct data *d)
+{
+	d->seq++;
+	d->sent++;
+}
+
+static inline void check_buffer(struct data *d, struct spa_buffer *buf)
+{
+	struct spa_meta_header *h;
+	uint64_t latency;
+
+	if ((h = spa_buffer_find_meta(buf, d->t->meta.Header)) == NULL)
+		return;
+
+	if (h->seq != d->next_seq) {
+		printf("expected buffer %u, got %u\n", d->next_seq, (uint32_t) h->seq);
+		d->errors++;
+	}
+	d->next_seq = h->seq + 1;
+	d->received++;
+
+	latency = get_time_ns() - h->pts;
+	d->latency_sum += latency;
+	d->latency_max = SPA_MAX(d->latency_max, latency);
+}
+
+static struct spa_pod *build_format(struct data *d, struct spa_pod_builder *b)
+{
+	return spa_pod_builder_object(b,
+		d->t->param.idEnumFormat, d->t->spa_format,
+		"I", d->type.media_type.video,
+		"I", d->type.media_subtype.raw,
+		":", d->type.format_video.format,    "I", d->type.video_format.RGB,
+		":", d->type.format_video.size,      "R", &SPA_RECTANGLE(WIDTH, HEIGHT),
+		":", d->type.format_video.framerate, "F", &SPA_FRACTION(25, 1));
+}
+
+static struct pw_properties *stream_props(struct data *d)
+{
+	return d->props ? pw_properties_copy(d->props) : NULL;
+}
+
+static void on_send(void *data, uint64_t expirations)
+{
+	struct data *d = data;
+	d->send(d);
+}
+
+static void on_format_changed(struct data *d, struct pw_stream *stream, struct spa_pod *format)
+{
+	uint8_t buffer[1024];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	struct spa_pod *params[2];
+	struct pw_type *t = d->t;
+
+	if (format == NULL) {
+		pw_stream_finish_format(stream, 0, NULL, 0);
+		return;
+	}
+	params[0] = spa_pod_builder_object(&b,
+		t->param.idBuffers, t->param_buffers.Buffers,
+		":", t->param_buffers.size,    "i", WIDTH * HEIGHT * BPP,
+		":", t->param_buffers.stride,  "i", WIDTH * BPP,
+		":", t->param_buffers.buffers, "iru", 4,
+			SPA_POD_PROP_MIN_MAX(2, 8),
+		":", t->param_buffers.align,   "i", 16);
+	params[1] = spa_pod_builder_object(&b,
+		t->param.idMeta, t->param_meta.Meta,
+		":", t->param_meta.type, "I", t->meta.Header,
+		":", t->param_meta.size, "i", sizeof(struct spa_meta_header));
+
+	pw_stream_finish_format(stream, 0, params, 2);
+}
+
+static void on_sink_format_changed(void *data, struct spa_pod *format)
+{
+	struct data *d = data;
+	on_format_changed(d, d->sink, format);
+}
+
+static void on_source_format_changed(void *data, struct spa_pod *format)
+{
+	struct data *d = data;
+	on_format_changed(d, d->source, format);
+}
+
+static void on_source_state_changed(void *data, enum pw_stream_state old,
+				    enum pw_stream_state state, const char *error)
+{
+	struct data *d = data;
+	struct timespec value, interval;
+
+	if (state == PW_STREAM_STATE_ERROR) {
+		printf("source error: %s\n", error);
+		d->errors++;
+		pw_main_loop_quit(d->loop);
+		return;
+	}
+	if (state != PW_STREAM_STATE_STREAMING)
+		return;
+
+	value.tv_sec = 0;
+	value.tv_nsec = INTERVAL;
+	interval = value;
+	pw_loop_update_timer(pw_main_loop_get_loop(d->loop), d->timer, &value, &interval, false);
+}
+
+static const struct pw_stream_events source_events = {
+	PW_VERSION_STREAM_EVENTS,
+	.state_changed = on_source_state_changed,
+	.format_changed = on_source_format_changed,
+};
+
+static void connect_source(struct data *d)
+{
+	uint8_t buffer[1024];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	const struct spa_pod *params[1];
+	char target[16];
+
+	d->source = pw_stream_new(d->remote, "test-source", stream_props(d));
+	pw_stream_add_listener(d->source, &d->source_listener, &source_events, d);
+
+	snprintf(target, sizeof(target), "%d", pw_stream_get_node_id(d->sink));
+	params[0] = build_format(d, &b);
+	pw_stream_connect(d->source, PW_DIRECTION_OUTPUT, target,
+			  PW_STREAM_FLAG_AUTOCONNECT | d->flags, params, 1);
+}
+
+static void on_sink_state_changed(void *data, enum pw_stream_state old,
+				  enum pw_stream_state state, const char *error)
+{
+	struct data *d = data;
+
+	if (state == PW_STREAM_STATE_ERROR) {
+		printf("sink error: %s\n", error);
+		d->errors++;
+		pw_main_loop_quit(d->loop);
+		return;
+	}
+	/* the sink node exists now, link the source to it */
+	if (state == PW_STREAM_STATE_CONFIGURE && d->source == NULL)
+		connect_source(d);
+}
+
+static void on_sink_new_buffer(void *data, uint32_t id)
+{
+	struct data *d = data;
+	if (d->sink_new_buffer)
+		d->sink_new_buffer(d, id);
+}
+
+static void on_sink_process(void *data)
+{
+	struct data *d = data;
+	if (d->sink_process)
+		d->sink_process(d);
+}
+
+static const struct pw_stream_events sink_events = {
+	PW_VERSION_STREAM_EVENTS,
+	.state_changed = on_sink_state_changed,
+	.format_changed = on_sink_format_changed,
+	.new_buffer = on_sink_new_buffer,
+	.process = on_sink_process,
+};
+
+static void on_state_changed(void *data, enum pw_remote_state old,
+			     enum pw_remote_state state, const char *error)
+{
+	struct data *d = data;
+	uint8_t buffer[1024];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	const struct spa_pod *params[1];
+
+	switch (state) {
+	case PW_REMOTE_STATE_ERROR:
+		printf("remote error: %s\n", error);
+		d->errors++;
+		pw_main_loop_quit(d->loop);
+		break;
+	case PW_REMOTE_STATE_CONNECTED:
+		d->sink = pw_stream_new(d->remote, "test-sink", stream_props(d));
+		pw_stream_add_listener(d->sink, &d->sink_listener, &sink_events, d);
+
+		params[0] = build_format(d, &b);
+		pw_stream_connect(d->sink, PW_DIRECTION_INPUT, NULL,
+				  d->flags, params, 1);
+		break;
+	default:
+		break;
+	}
+}
+
+static const struct pw_remote_events remote_events = {
+	PW_VERSION_REMOTE_EVENTS,
+	.state_changed = on_state_changed,
+};
+
+static void on_timeout(void *data, uint64_t expirations)
+{
+	struct data *d = data;
+	pw_main_loop_quit(d->loop);
+}
+
+/* run a server core in a thread with the modules that are needed to link
+ * two streams, the remote connects to it by name */
+static int start_server(struct data *d, char *name, size_t size)
+{
+	static const char * const modules[] = {
+		"libpipewire-module-protocol-native",
+		"libpipewire-module-client-node",
+		"libpipewire-module-autolink",
+	};
+	uint32_t i;
+
+	snprintf(name, size, "pipewire-test-%d", (int) getpid());
+
+	d->server_loop = pw_loop_new(NULL);
+	d->server_thread = pw_thread_loop_new(d->server_loop, "test-server");
+	d->server = pw_core_new(d->server_loop,
+			pw_properties_new(PW_CORE_PROP_NAME, name,
+					  PW_CORE_PROP_DAEMON, "1", NULL));
+
+	for (i = 0; i < SPA_N_ELEMENTS(modules); i++) {
+		if (pw_module_load(d->server, modules[i], NULL, NULL, NULL, NULL) == NULL) {
+			printf("can't load %s\n", modules[i]);
+			return -ENOENT;
+		}
+	}
+	return pw_thread_loop_start(d->server_thread);
+}
+
+static void stop_server(struct data *d)
+{
+	if (d->server_thread)
+		pw_thread_loop_stop(d->server_thread);
+	if (d->server)
+		pw_core_destroy(d->server);
+	if (d->server_thread)
+		pw_thread_loop_destroy(d->server_thread);
+	if (d->server_loop)
+		pw_loop_destroy(d->server_loop);
+}
+
+/* link the streams and send buffers for \a seconds, returns the number of
+ * errors */
+static uint32_t run_test(struct data *d, uint32_t seconds)
+{
+	struct pw_loop *l;
+	struct pw_properties *props = NULL;
+	struct timespec value;
+	char name[64];
+
+	if (getenv("PIPEWIRE_REMOTE") == NULL) {
+		if (start_server(d, name, sizeof(name)) < 0) {
+			stop_server(d);
+			return 1;
+		}
+		props = pw_properties_new(PW_REMOTE_PROP_REMOTE_NAME, name, NULL);
+	}
+
+	d->loop = pw_main_loop_new(NULL);
+	l = pw_main_loop_get_loop(d->loop);
+	d->core = pw_core_new(l, NULL);
+	d->t = pw_core_get_type(d->core);
+	d->remote = pw_remote_new(d->core, props, 0);
+
+	spa_type_media_type_map(d->t->map, &d->type.media_type);
+	spa_type_media_subtype_map(d->t->map, &d->type.media_subtype);
+	spa_type_format_video_map(d->t->map, &d->type.format_video);
+	spa_type_video_format_map(d->t->map, &d->type.video_format);
+
+	d->timer = pw_loop_add_timer(l, on_send, d);
+	d->timeout = pw_loop_add_timer(l, on_timeout, d);
+	value.tv_sec = seconds;
+	value.tv_nsec = 0;
+	pw_loop_update_timer(l, d->timeout, &value, NULL, false);
+
+	pw_remote_add_listener(d->remote, &d->remote_listener, &remote_events, d);
+	if (pw_remote_connect(d->remote) < 0) {
+		printf("can't connect\n");
+		d->errors++;
+	}
+	else
+		pw_main_loop_run(d->loop);
+
+	printf("%s: sent %u, busy %u, received %u, latency avg %" PRIu64 " us max %" PRIu64
+	       " us, errors %u\n", d->name, d->sent, d->busy, d->received,
+	       d->received ? d->latency_sum / d->received / 1000 : 0,
+	       d->latency_max / 1000, d->errors);
+
+	if (d->received == 0) {
+		printf("no buffers received\n");
+		d->errors++;
+	}
+
+	if (d->source)
+		pw_stream_destroy(d->source);
+	if (d->sink)
+		pw_stream_destroy(d->sink);
+	pw_loop_destroy_source(l, d->timer);
+	pw_loop_destroy_source(l, d->timeout);
+	pw_core_destroy(d->core);
+	pw_main_loop_destroy(d->loop);
+	if (d->props)
+		pw_properties_free(d->props);
+
+	stop_server(d);
+
+	return d->errors;
+}
+
+#endif /* __PIPEWIRE_TEST_STREAM_H__ */
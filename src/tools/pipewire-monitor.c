@@ -18,7 +18,9 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <signal.h>
+#include <time.h>
 
 #include <spa/lib/debug.h>
 
@@ -64,6 +66,12 @@ struct proxy_data {
 	print_func_t print_func;
 	uint32_t n_params;
 	struct spa_pod **params;
+
+	/* previous client stats for the rates */
+	uint64_t stats_time;
+	uint64_t stats_messages;
+	uint64_t stats_bytes;
+	uint64_t stats_busy;
 };
 
 static void add_pending(struct proxy_data *pd)
@@ -361,6 +369,42 @@ static const struct pw_factory_proxy_events factory_events = {
         .info = factory_event_info
 };
 
+static uint64_t get_prop_u64(const struct spa_dict *props, const char *key)
+{
+	const char *str = spa_dict_lookup(props, key);
+	return str ? strtoull(str, NULL, 10) : 0;
+}
+
+static void print_client_stats(struct proxy_data *data, const struct spa_dict *props)
+{
+	struct timespec now;
+	uint64_t time, messages, bytes, busy;
+	double elapsed;
+
+	if (props == NULL || spa_dict_lookup(props, PW_CLIENT_PROP_MESSAGES_IN) == NULL)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	time = SPA_TIMESPEC_TO_TIME(&now);
+	messages = get_prop_u64(props, PW_CLIENT_PROP_MESSAGES_IN) +
+		   get_prop_u64(props, PW_CLIENT_PROP_MESSAGES_OUT);
+	bytes = get_prop_u64(props, PW_CLIENT_PROP_BYTES_IN) +
+		get_prop_u64(props, PW_CLIENT_PROP_BYTES_OUT);
+	busy = get_prop_u64(props, PW_CLIENT_PROP_BUSY_TIME);
+
+	if (data->stats_time != 0 && time > data->stats_time && messages >= data->stats_messages) {
+		elapsed = (time - data->stats_time) / (double) SPA_NSEC_PER_SEC;
+		printf("\tprotocol: %.1f messages/s, %.1f KB/s, busy %.2f%%\n",
+				(messages - data->stats_messages) / elapsed,
+				(bytes - data->stats_bytes) / elapsed / 1024.0,
+				(busy - data->stats_busy) / (elapsed * 10000.0));
+	}
+	data->stats_time = time;
+	data->stats_messages = messages;
+	data->stats_bytes = bytes;
+	data->stats_busy = busy;
+}
+
 static void client_event_info(void *object, struct pw_client_info *info)
 {
         struct proxy_data *data = object;
@@ -387,6 +431,7 @@ static void client_event_info(void *object, struct pw_client_info *info)
 	if (print_all) {
 		print_properties(info->props, MARK_CHANGE(0));
 	}
+	print_client_stats(data, info->props);
 }
 
 static const struct pw_client_proxy_events client_events = {